@@ -15,12 +15,6 @@ layout(set = 0, binding = 0) uniform GlobalUbo
 	vec4 lightColor;
 } ubo;
 
-layout(push_constant) uniform Push
-{
-	mat4 modelMatrix;
-	mat4 normalMatrix;
-} push;
-
 
 void main()
 {
@@ -18,21 +18,35 @@ layout(set = 0, binding = 0) uniform GlobalUbo
 	vec4 lightColor;
 } ubo;
 
-layout(push_constant) uniform Push
+struct ObjectData
 {
 	mat4 modelMatrix;
 	mat4 normalMatrix;
-} push;
+	vec4 boundsMin;
+	vec4 boundsMax;
+	uint indexCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint padding;
+};
+
+// Written by the host every frame, and indexed by the firstInstance the culling pass gave each draw
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+};
 
 
 void main()
 {
+	ObjectData object = objects[gl_InstanceIndex];
+
 	// Calculate vertex position in world space
-	vec4 positionWorld = push.modelMatrix * vec4(position, 1.0f);
-	gl_Position = ubo.projection * ubo.view * push.modelMatrix * vec4(position, 1.0);
+	vec4 positionWorld = object.modelMatrix * vec4(position, 1.0f);
+	gl_Position = ubo.projection * ubo.view * positionWorld;
 
 	// Only work when scaling is applied uniformly.
-	fragNormalWorld = normalize(mat3(push.normalMatrix) * normal);
+	fragNormalWorld = normalize(mat3(object.normalMatrix) * normal);
 	fragPosWorld = positionWorld.xyz;
 	fragColor = color;
 }
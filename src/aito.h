@@ -28,6 +28,12 @@ static_assert(sizeof(Float) == sizeof(FloatBits),
 #define Infinity std::numeric_limits<Float>::infinity()
 #define MachineEpsilon (std::numeric_limits<Float>::epsilon() * 0.5)
 
+#ifdef AITO_FLOAT_AS_DOUBLE
+static constexpr Float OneMinusEpsilon = 0x1.fffffffffffffp-1;
+#else
+static constexpr Float OneMinusEpsilon = 0x1.fffffep-1;
+#endif
+
 static constexpr Float ShadowEpsilon = 0.0001f;
 static constexpr Float Pi = 3.14159265358979323846;
 static constexpr Float InvPi = 0.31830988618379067154;
@@ -40,7 +46,7 @@ static constexpr Float Sqrt2 = 1.41421356237309504880;
 template<typename T>
 [[nodiscard]] constexpr T lerp(Float t, T v1, T v2) { return (1 - t) * v1 + t * v2; };
 
-inline Float gamma(int n)
+constexpr Float gamma(int n)
 {
     return (n * MachineEpsilon) / (1 - n * MachineEpsilon);
 }
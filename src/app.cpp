@@ -14,6 +14,8 @@
 #include <stdexcept>
 #include <array>
 #include <iostream>
+#include <string>
+#include <unordered_map>
 
 
 namespace aito
@@ -31,8 +33,13 @@ namespace aito
 		: imgui_context_(ImGui::CreateContext()), io_(ImGui::GetIO())
 	{
 		globalPool_ = DescriptorPool::Builder(device_)
-			.setMaxSets(Swapchain::MAX_FRAMES_IN_FLIGHT + 1)
-			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, Swapchain::MAX_FRAMES_IN_FLIGHT)
+			.setMaxSets(1 + 2)
+			// The film texture gives its descriptor back when it is destroyed
+			.setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)
+			// The global uniform buffer of every frame, picked by its dynamic offset
+			.addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1)
+			// ImGui's font and the progressive film
+			.addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2)
 			.build();
 
 		// Initialize ImGui
@@ -88,10 +95,17 @@ namespace aito
 
 		// Load objects
 		loadObjects();
+
+		filmTexture_ = std::make_unique<FilmTexture>(device_, Point2i(FILM_WIDTH, FILM_HEIGHT));
 	}
 
 	Application::~Application()
 	{
+		// Stop the render threads before anything they use goes away
+		progressiveRenderer_.reset();
+		// The film texture gives its descriptor back to the ImGui backend, which has to outlive it
+		filmTexture_.reset();
+
 		ImGui_ImplVulkan_Shutdown();
 		ImGui_ImplGlfw_Shutdown();
 		ImGui::DestroyContext(imgui_context_);
@@ -99,32 +113,21 @@ namespace aito
 
 	void Application::run()
 	{
-		std::vector<std::unique_ptr<Buffer>> uniformBuffers(Swapchain::MAX_FRAMES_IN_FLIGHT);
-		for (auto& bufferPtr : uniformBuffers)
-		{
-			bufferPtr = std::make_unique<Buffer>(device_,
-												 sizeof(GlobalUbo),
-												 Swapchain::MAX_FRAMES_IN_FLIGHT,
-												 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-												 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-												 device_.properties.limits.minUniformBufferOffsetAlignment);
-			bufferPtr->map();
-		}
+		FrameAllocator& frameAllocator = renderer_.getFrameAllocator();
 
 		auto globalSetLayout = DescriptorSetLayout::Builder(device_)
-			.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+			.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
 			.build();
 
-		std::vector<VkDescriptorSet> globalDescriptorSets(Swapchain::MAX_FRAMES_IN_FLIGHT);
-		for (size_t i = 0; i < globalDescriptorSets.size(); i++)
-		{
-			auto bufferInfo = uniformBuffers[i]->descriptorInfo();
-			DescriptorWriter(*globalSetLayout, *globalPool_)
-				.writeBuffer(0, &bufferInfo)
-				.build(globalDescriptorSets[i]);
-		}
+		// One set for all the frames, since the uniform buffers of the frames are slices of the frame allocator
+		VkDescriptorSet globalDescriptorSet;
+		auto globalBufferInfo = frameAllocator.descriptorInfo(sizeof(GlobalUbo));
+		DescriptorWriter(*globalSetLayout, *globalPool_)
+			.writeBuffer(0, &globalBufferInfo)
+			.build(globalDescriptorSet);
+		uint32_t globalGeneration = frameAllocator.getGeneration();
 
-		SimpleRenderSystem simpleRenderSystem{ device_, renderer_.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout() };
+		SimpleRenderSystem simpleRenderSystem{ device_, renderer_.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout(), geometryPool_ };
 		PointLightSystem pointLightSystem{ device_, renderer_.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout() };
 		BoundingBoxRenderSystem boundingBoxSystem{ device_, renderer_.getSwapChainRenderPass(), globalSetLayout->getDescriptorSetLayout() };
 
@@ -181,6 +184,8 @@ namespace aito
 		
 		// !!!!!!!!!!!!!!!!!!!! ^^^^ !!!!!!!!!!!!!!!!!!!!!!!!!!
 
+		Camera filmCamera{};
+
 		while (!window_.shouldClose())
 		{
 			glfwPollEvents();
@@ -192,39 +197,75 @@ namespace aito
 
 			float aspect = renderer_.getAspectRatio();
 			camera.setPerspectiveProjection(glm::radians(50.0f), aspect, 0.1f, 100.0f);
+
+			// The film has its own aspect ratio, so it gets its own projection
+			if (progressiveRenderer_)
+			{
+				filmCamera.setViewYXZ(viewerObject.transform.translation, viewerObject.transform.rotation);
+				filmCamera.setPerspectiveProjection(glm::radians(50.0f), static_cast<float>(FILM_WIDTH) / FILM_HEIGHT, 0.1f, 100.0f);
+				progressiveRenderer_->set_camera(filmCamera.getView(), filmCamera.getProjection());
+			}
 			
 			// BeginFrame returns a nullptr if the swapchain needs to be recreated. 
 			// This skips the frame draw call, if that's the case.
 			auto commandBuffer = renderer_.beginFrame();
 			if (commandBuffer != nullptr)
 			{
-				const FrameInfo frameInfo{
-					renderer_.getFrameIndex(),
-					time.deltaTime(),
-					commandBuffer,
-					camera,
-					globalDescriptorSets[renderer_.getFrameIndex()]
-				};
-
-
+				// The frame allocator recreates its buffer when it grows, which happens while no frame uses the set
+				if (frameAllocator.getGeneration() != globalGeneration)
+				{
+					globalBufferInfo = frameAllocator.descriptorInfo(sizeof(GlobalUbo));
+					DescriptorWriter(*globalSetLayout, *globalPool_)
+						.writeBuffer(0, &globalBufferInfo)
+						.overwrite(globalDescriptorSet);
+					globalGeneration = frameAllocator.getGeneration();
+				}
 
 				// Update
-				currRot += glm::two_pi<float>() / 3.0f * time.deltaTime();
+				// The light stands still while the progressive render runs, so the viewport shows the same lighting
+				if (!progressiveRenderer_)
+					currRot += glm::two_pi<float>() / 3.0f * time.deltaTime();
 
 				GlobalUbo ubo{};
 				ubo.projection = camera.getProjection();
 				ubo.view = camera.getView();
 				ubo.lightPosition = { cos(currRot) * 1.3f, -1.0f, sin(currRot) * 1.3f };
-				uniformBuffers[frameInfo.frameIndex]->writeToBuffer(&ubo);
-				uniformBuffers[frameInfo.frameIndex]->flush();
+				// The first allocation of the frame, so it is always in the buffer the descriptor set points at
+				const FrameAllocator::Slice uboSlice = frameAllocator.pushUniform(ubo);
+				assert(uboSlice.buffer == frameAllocator.getBuffer() && "The global uniform buffer overflowed the frame allocator");
+
+				const FrameInfo frameInfo{
+					renderer_.getFrameIndex(),
+					time.deltaTime(),
+					commandBuffer,
+					camera,
+					globalDescriptorSet,
+					uboSlice.dynamicOffset(),
+					frameAllocator
+				};
 
-				
+				// The viewport shades with light color * intensity * cos / distance^2, which is what a white diffuse
+				// surface (albedo / pi) reflects from a point light with pi times the intensity
+				viewportLight_.position = ubo.lightPosition;
+				viewportLight_.intensity = Pi * Vec3f(ubo.lightColor) * ubo.lightColor.w;
+				ambientLight_.radiance = Vec3f(ubo.ambientLightColor) * ubo.ambientLightColor.w;
+
+				// Upload the parts of the film that changed since the last frame. This has to happen outside the render pass.
+				if (progressiveRenderer_)
+				{
+					dirtyRegions_.clear();
+					progressiveRenderer_->collect_dirty_regions(dirtyRegions_);
+					filmTexture_->update(commandBuffer, frameInfo.frameIndex, progressiveRenderer_->film(), dirtyRegions_);
+				}
 
+				// The culling pass writes the draw commands of the scene, which also has to happen outside the render pass
+				simpleRenderSystem.cullObjects(frameInfo, objects_);
+				visibleObjects_ = simpleRenderSystem.getVisibleObjectCount();
 
 				// Render
 				renderer_.beginSwapChainRenderPass(commandBuffer);
 				// Render scene
-				simpleRenderSystem.renderObjects(frameInfo, objects_);
+				simpleRenderSystem.renderObjects(frameInfo);
 				pointLightSystem.renderObjects(frameInfo);
 				boundingBoxSystem.renderObjects(frameInfo, boundingBoxes);
 
@@ -261,51 +302,145 @@ namespace aito
 
 		ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
 		ImGui::Text("Frame Time: %.2f ms", 1000.0f / ImGui::GetIO().Framerate);
-		ImGui::SliderFloat2("Smooth Vase X and Y", &objects_[0].transform.translation.x, -5.0f, 5.0f);
+		ImGui::Text("Visible objects: %u / %zu", visibleObjects_, objects_.size());
+
+		const MemoryAllocator::Stats memoryStats = device_.allocator().getStats();
+		ImGui::Text("Device memory: %.1f / %.1f MiB", memoryStats.usedBytes / (1024.0 * 1024.0), memoryStats.blockBytes / (1024.0 * 1024.0));
+		ImGui::Text("%u allocations in %u blocks (%u dedicated)", memoryStats.allocationCount, memoryStats.blockCount, memoryStats.dedicatedBlockCount);
+		ImGui::Text("Free ranges: %u, fragmentation: %.0f%%", memoryStats.freeRangeCount, 100.0f * memoryStats.fragmentation());
+		FrameAllocator& frameAllocator = renderer_.getFrameAllocator();
+		ImGui::Text("Frame data: %.1f / %.1f KiB (%llu overflows)", frameAllocator.getUsedBytes() / 1024.0, frameAllocator.getFrameSize() / 1024.0,
+					static_cast<unsigned long long>(frameAllocator.getOverflowCount()));
+		if (ImGui::SliderFloat2("Smooth Vase X and Y", &objects_[0].transform.translation.x, -5.0f, 5.0f))
+			updateSceneTransforms();
 
 		ImGui::End();
 
-		
-		
+		ImGui::Begin("Render");
+
+		bool progressive = progressiveEnabled_;
+		if (ImGui::Checkbox("Progressive", &progressive))
+			setProgressiveEnabled(progressive);
+		if (ImGui::SliderInt("Samples per pass", &samplesPerPass_, 1, 16) && progressiveRenderer_)
+			progressiveRenderer_->set_samples_per_pass(samplesPerPass_);
+		if (ImGui::Checkbox("Wavefront", &wavefrontEnabled_) && progressiveRenderer_)
+			progressiveRenderer_->set_wavefront(wavefrontEnabled_);
+		if (ImGui::Checkbox("Sort rays", &raySortingEnabled_) && wavefrontIntegrator_)
+			wavefrontIntegrator_->set_ray_sorting(raySortingEnabled_);
+
+		constexpr const char* samplerNames[] = { "Sobol", "Halton", "PMJ02" };
+		int samplerIndex = static_cast<int>(samplerType_);
+		if (ImGui::Combo("Sampler", &samplerIndex, samplerNames, IM_ARRAYSIZE(samplerNames)))
+		{
+			samplerType_ = static_cast<Sampler::Type>(samplerIndex);
+			if (progressiveRenderer_)
+				progressiveRenderer_->set_sampler(samplerType_);
+		}
+
+		if (progressiveRenderer_)
+		{
+			ImGui::Text("Samples per pixel: %d", progressiveRenderer_->samples_per_pixel());
+			ImGui::Text("Last pass: %.1f ms", progressiveRenderer_->last_pass_time());
+			ImGui::ProgressBar(progressiveRenderer_->pass_progress());
+			if (ImGui::Button("Restart"))
+				progressiveRenderer_->restart();
+
+			// Fit the film in the window, keeping its aspect ratio
+			const ImVec2 available = ImGui::GetContentRegionAvail();
+			const float scale = std::max(0.0f, std::min(available.x / FILM_WIDTH, available.y / FILM_HEIGHT));
+			ImGui::Image(filmTexture_->getTextureId(), ImVec2(FILM_WIDTH * scale, FILM_HEIGHT * scale));
+		}
+
+		ImGui::End();
+	}
+
+	void Application::setProgressiveEnabled(bool enabled)
+	{
+		progressiveEnabled_ = enabled;
+		if (!enabled)
+		{
+			progressiveRenderer_.reset();
+			return;
+		}
+
+		// Nothing renders the scene at this point, so its lights can be changed
+		scene_->point_lights = { viewportLight_ };
+		scene_->infinite_light = ambientLight_;
+
+		progressiveRenderer_ = std::make_unique<ProgressiveRenderer>(
+			Point2i(FILM_WIDTH, FILM_HEIGHT),
+			[this](const Ray& ray, Sampler& sampler) { return integrator_->li(ray, sampler); },
+			samplerType_,
+			samplesPerPass_,
+			0,
+			wavefrontIntegrator_.get());
+		progressiveRenderer_->set_wavefront(wavefrontEnabled_);
+	}
+
+
+	void Application::updateSceneTransforms()
+	{
+		// Every object is placed by the scene instance with the same index, so a refit is enough to move them
+		const auto update = [this]()
+			{
+				for (uint32_t i = 0; i < objects_.size(); i++)
+					scene_->set_instance_transform(i, objects_[i].transform.mat4());
+				scene_->update();
+			};
+
+		if (progressiveRenderer_)
+			progressiveRenderer_->edit_scene(update);
+		else
+			update();
 	}
 
 
 	void Application::loadObjects()
 	{
+		// Every model is loaded once and shared by the objects that use it. The offline renderer keeps a triangle mesh
+		// of every model in object space, and places it with the transform of each object (one instance per object).
+		struct LoadedModel
 		{
-			std::shared_ptr<Model> model = Model::createModelFromFile(device_, "models/smooth_vase.obj");
-
-			Object object;
-			object.model = model;
-			object.transform.translation = { -0.8f, 0.0f, 0.0f };
-			object.transform.scale = Vec3f(3);
-			//object.transform.rotation.x = 0.1f * glm::two_pi<float>();
+			std::shared_ptr<Model> model;
+			uint32_t mesh;
+		};
+		std::unordered_map<std::string, LoadedModel> loadedModels;
+		std::vector<MeshInstance> instances;
 
-			objects_.push_back(std::move(object));
-		}
+		const auto addObject = [&](std::string_view filePath, const Vec3f& translation, const Vec3f& scale)
 		{
-			std::shared_ptr<Model> model = Model::createModelFromFile(device_, "models/flat_vase.obj");
+			auto loaded = loadedModels.find(std::string(filePath));
+			if (loaded == loadedModels.end())
+			{
+				Model::Builder builder{};
+				builder.loadModel(filePath);
+
+				meshes_.push_back(builder.createTriangleMesh(Mat4f(1.0f)));
+				const LoadedModel model{ std::make_shared<Model>(geometryPool_, builder), static_cast<uint32_t>(meshes_.size() - 1) };
+				loaded = loadedModels.emplace(std::string(filePath), model).first;
+			}
 
 			Object object;
-			object.model = model;
-			object.transform.translation = { 0.8f, 0.0f, 0.0f };
-			object.transform.scale = Vec3f(3);
+			object.model = loaded->second.model;
+			object.transform.translation = translation;
+			object.transform.scale = scale;
 			//object.transform.rotation.x = 0.1f * glm::two_pi<float>();
 
+			instances.push_back(MeshInstance{ loaded->second.mesh, object.transform.mat4() });
 			objects_.push_back(std::move(object));
-		}
-		{
-			std::shared_ptr<Model> model = Model::createModelFromFile(device_, "models/quad.obj");
+		};
 
-			Object object;
-			object.model = model;
-			object.transform.translation = { 0.0f, 0.0f, 0.0f };
-			object.transform.scale = Vec3f{ 3.0f, 1.0f, 3.0f };
-			//object.transform.rotation.x = 0.1f * glm::two_pi<float>();
+		addObject("models/smooth_vase.obj", { -0.8f, 0.0f, 0.0f }, Vec3f(3));
+		addObject("models/flat_vase.obj", { 0.8f, 0.0f, 0.0f }, Vec3f(3));
+		addObject("models/quad.obj", { 0.0f, 0.0f, 0.0f }, Vec3f{ 3.0f, 1.0f, 3.0f });
 
-			objects_.push_back(std::move(object));
-		}
+		scene_ = std::make_unique<Scene>(meshes_, instances);
+		rgbToSpectrum_ = std::make_unique<RGBToSpectrumTable>(RGBToSpectrumTable::load(RGBToSpectrumTable::default_path()));
+		integrator_ = std::make_unique<PathIntegrator>(*scene_, *rgbToSpectrum_);
+		wavefrontIntegrator_ = std::make_unique<WavefrontIntegrator>(*integrator_);
+		wavefrontIntegrator_->set_ray_sorting(raySortingEnabled_);
 	}
+
 }
 
 
@@ -7,7 +7,13 @@
 #include "window.h"
 #include "renderer.h"
 #include "object.h"
+#include "geometry_pool.h"
 #include "descriptor.h"
+#include "scene.h"
+#include "integrator.h"
+#include "progressive_renderer.h"
+#include "wavefront_integrator.h"
+#include "film_texture.h"
 
 
 #include "imgui_impl_glfw.h"
@@ -22,6 +28,9 @@ namespace aito
 		static constexpr size_t WIDTH = 800;
 		static constexpr size_t HEIGHT = 600;
 
+		static constexpr int FILM_WIDTH = 640;
+		static constexpr int FILM_HEIGHT = 480;
+
 		Application();
 		~Application();
 
@@ -41,9 +50,34 @@ namespace aito
 		ImGuiIO& io_;
 
 		std::unique_ptr<DescriptorPool> globalPool_{};
+		// The geometry of every model, drawn by the SimpleRenderSystem in one indirect draw
+		GeometryPool geometryPool_{ device_ };
 		std::vector<Object> objects_; // TEMP
+		// The objects the GPU culling pass found in the view frustum
+		uint32_t visibleObjects_ = 0;
+
+		// Offline renderer
+		// One mesh per model, in object space. The scene places them with the objects' transforms.
+		std::vector<std::shared_ptr<TriangleMesh>> meshes_;
+		std::unique_ptr<Scene> scene_;
+		std::unique_ptr<RGBToSpectrumTable> rgbToSpectrum_;
+		std::unique_ptr<PathIntegrator> integrator_;
+		std::unique_ptr<WavefrontIntegrator> wavefrontIntegrator_;
+		PointLight viewportLight_;
+		UniformInfiniteLight ambientLight_;
+		std::unique_ptr<FilmTexture> filmTexture_;
+		std::unique_ptr<ProgressiveRenderer> progressiveRenderer_;
+		std::vector<Bounds2i> dirtyRegions_;
+		bool progressiveEnabled_ = false;
+		bool wavefrontEnabled_ = false;
+		bool raySortingEnabled_ = true;
+		int samplesPerPass_ = 1;
+		Sampler::Type samplerType_ = Sampler::Type::Sobol;
 		
 		void loadObjects(); // TEMP
+		void setProgressiveEnabled(bool enabled);
+		// Moves the scene instances to the current transforms of the objects, and restarts the progressive render
+		void updateSceneTransforms();
 	};
 }
 
@@ -0,0 +1,875 @@
+#include "pch.h"
+
+#include "benchmark.h"
+
+#include "bvh.h"
+#include "two_level_bvh.h"
+#include "wide_bvh.h"
+#include "integrator.h"
+#include "memory_arena.h"
+#include "parallel.h"
+#include "ray_sort.h"
+#include "rgb_spectrum.h"
+#include "sampler.h"
+#include "sampling.h"
+#include "shape.h"
+#include "spectrum.h"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+
+namespace aito
+{
+
+namespace
+{
+
+constexpr std::array BENCHMARK_MODELS = {
+	"models/smooth_vase.obj",
+	"models/flat_vase.obj",
+	"models/colored_cube.obj",
+};
+
+/// <summary>
+/// The transforms of copies of the mesh in a grid, enough for at least "triangleCount" triangles.
+/// </summary>
+std::vector<Mat4f> grid_transforms(const Model::Builder& builder, uint32_t triangleCount)
+{
+	const uint32_t meshTriangles = static_cast<uint32_t>((builder.indices.empty() ? builder.vertices.size() : builder.indices.size()) / 3);
+	const uint32_t copies = std::max(1u, (triangleCount + meshTriangles - 1) / meshTriangles);
+	const uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(copies))));
+
+	Bounds3f meshBounds{};
+	for (const auto& vertex : builder.vertices)
+		meshBounds = bounds_union(meshBounds, vertex.position);
+	const Vec3f spacing = 1.25f * meshBounds.diagonal();
+
+	std::vector<Mat4f> transforms;
+	transforms.reserve(copies);
+	for (uint32_t i = 0; i < copies; i++)
+	{
+		const Vec3f offset = spacing * Vec3f(
+			static_cast<Float>(i % gridSize),
+			static_cast<Float>((i / gridSize) % gridSize),
+			static_cast<Float>(i / (gridSize * gridSize)));
+		transforms.push_back(glm::translate(Mat4f(1.0f), offset));
+	}
+	return transforms;
+}
+
+/// <summary>
+/// Creates copies of the mesh in a grid until there are at least "triangleCount" triangles.
+/// </summary>
+std::vector<std::shared_ptr<TriangleMesh>> replicate_mesh(const Model::Builder& builder, uint32_t triangleCount)
+{
+	std::vector<std::shared_ptr<TriangleMesh>> meshes;
+	for (const Mat4f& transform : grid_transforms(builder, triangleCount))
+		meshes.push_back(builder.createTriangleMesh(transform));
+	return meshes;
+}
+
+size_t mesh_memory_usage(const TriangleMesh& mesh)
+{
+	return mesh.p.size() * sizeof(Point3f) + mesh.n.size() * sizeof(Normal3f) + mesh.uv.size() * sizeof(Point2f)
+		+ mesh.color.size() * sizeof(Vec3f) + mesh.indices.size() * sizeof(uint32_t);
+}
+
+std::vector<Triangle> collect_triangles(const std::vector<std::shared_ptr<TriangleMesh>>& meshes)
+{
+	std::vector<Triangle> triangles;
+	for (const auto& mesh : meshes)
+	{
+		for (uint32_t i = 0; i < mesh->triangle_count(); i++)
+			triangles.emplace_back(mesh.get(), i);
+	}
+	return triangles;
+}
+
+/// <summary>
+/// Rays starting at random points inside the bounds, in uniformly random directions. Always the same rays for the same bounds.
+/// </summary>
+std::vector<Ray> random_rays(const Bounds3f& bounds, uint32_t count)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<Float> uniform(0, 1);
+
+	std::vector<Ray> rays;
+	rays.reserve(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const Point3f o = bounds.lerp(Point3f(uniform(rng), uniform(rng), uniform(rng)));
+		const Float z = 1 - 2 * uniform(rng);
+		const Float r = std::sqrt(std::max<Float>(0, 1 - z * z));
+		const Float phi = 2 * Pi * uniform(rng);
+		rays.emplace_back(o, Vec3f(r * std::cos(phi), r * std::sin(phi), z));
+	}
+	return rays;
+}
+
+template<typename Accel>
+void time_traversal(const char* name, const Accel& accel, const std::vector<Ray>& rays, std::vector<Float>& hitDistances)
+{
+	hitDistances.resize(rays.size());
+
+	auto startTime = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rays.size(); i++)
+	{
+		const Ray ray = rays[i];
+		SurfaceInteraction isect{};
+		accel.intersect(ray, &isect);
+		hitDistances[i] = ray.t_max;
+	}
+	const float closestTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+
+	startTime = std::chrono::steady_clock::now();
+	uint32_t anyHits = 0;
+	for (const Ray& ray : rays)
+		anyHits += accel.intersect_p(ray) ? 1 : 0;
+	const float anyTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+
+	AITO_INFO("    {}: closest hit {:.1f} ms ({:.2f} Mrays/s), any hit {:.1f} ms ({:.2f} Mrays/s), {} hits",
+			  name, closestTime, rays.size() / (closestTime * 1000.0f), anyTime, rays.size() / (anyTime * 1000.0f), anyHits);
+}
+
+/// <summary>
+/// Primary rays of a pinhole camera looking at the bounds from outside. The pixels are ordered in blocks of
+/// blockWidth x blockHeight, so every packet of blockWidth * blockHeight consecutive rays covers a small block of the image.
+/// </summary>
+std::vector<Ray> camera_rays(const Bounds3f& bounds, int resolution, int blockWidth, int blockHeight)
+{
+	const Vec3f diagonal = bounds.diagonal();
+	const Point3f target = bounds.lerp(Point3f(0.5f, 0.5f, 0.5f));
+	const Point3f eye(Vec3f(target) + Vec3f(0.4f, 0.6f, 1.2f) * glm::length(diagonal));
+	const Frame frame = Frame::from_z(glm::normalize(Vec3f(target) - Vec3f(eye)));
+	const Float tanHalfFov = 0.4f;
+
+	std::vector<Ray> rays;
+	rays.reserve(static_cast<size_t>(resolution) * resolution);
+	for (int blockY = 0; blockY < resolution; blockY += blockHeight)
+	{
+		for (int blockX = 0; blockX < resolution; blockX += blockWidth)
+		{
+			for (int y = blockY; y < std::min(blockY + blockHeight, resolution); y++)
+			{
+				for (int x = blockX; x < std::min(blockX + blockWidth, resolution); x++)
+				{
+					const Float u = (2 * (x + 0.5f) / resolution - 1) * tanHalfFov;
+					const Float v = (2 * (y + 0.5f) / resolution - 1) * tanHalfFov;
+					rays.emplace_back(eye, glm::normalize(frame.from_local(Vec3f(u, v, 1))));
+				}
+			}
+		}
+	}
+	return rays;
+}
+
+/// <summary>
+/// Rays from a point light to the hits of "rays" (just in front of them), in the same order.
+/// </summary>
+std::vector<Ray> shadow_rays(const std::vector<Ray>& rays, const std::vector<Float>& hitDistances, const Point3f& light)
+{
+	std::vector<Ray> shadowRays;
+	for (size_t i = 0; i < rays.size(); i++)
+	{
+		if (std::isinf(hitDistances[i]))
+			continue;
+		const Point3f p = rays[i](hitDistances[i] * (1 - ShadowEpsilon));
+		shadowRays.emplace_back(light, p - light, 1 - ShadowEpsilon);
+	}
+	return shadowRays;
+}
+
+/// <summary>
+/// Diffuse bounce rays from the hits of "rays", in cosine weighted random directions around the geometric normal.
+/// They stay in the order of "rays", like the next bounce of a wavefront.
+/// </summary>
+template<typename Accel>
+std::vector<Ray> bounce_rays(const Accel& accel, const std::vector<Ray>& rays)
+{
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<Float> uniform(0, 1);
+
+	std::vector<Ray> bounceRays;
+	for (Ray ray : rays)
+	{
+		SurfaceInteraction isect{};
+		if (!accel.intersect(ray, &isect))
+			continue;
+		const Vec3f n = glm::dot(Vec3f(isect.n), ray.d) < 0 ? Vec3f(isect.n) : -Vec3f(isect.n);
+		const Vec3f wi = Frame::from_z(n).from_local(sample_cosine_hemisphere(Point2f(uniform(rng), uniform(rng))));
+		bounceRays.push_back(isect.spawn_ray(wi));
+	}
+	return bounceRays;
+}
+
+/// <summary>
+/// Like time_traversal, but traces packets of K consecutive rays.
+/// </summary>
+template<int K, typename Accel>
+void time_packet_traversal(const char* name, const Accel& accel, const std::vector<Ray>& rays, std::vector<Float>& hitDistances)
+{
+	hitDistances.resize(rays.size());
+
+	const auto makePacket = [&](size_t first)
+	{
+		RayPacket<K> packet;
+		const size_t count = std::min<size_t>(K, rays.size() - first);
+		packet.active = RayPacket<K>::ALL_RAYS >> (K - count);
+		std::copy(rays.begin() + first, rays.begin() + first + count, packet.rays);
+		return packet;
+	};
+
+	auto startTime = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rays.size(); i += K)
+	{
+		const RayPacket<K> packet = makePacket(i);
+		SurfaceInteraction isects[K];
+		accel.intersect(packet, isects);
+		for (size_t j = 0; j < K && i + j < rays.size(); j++)
+			hitDistances[i + j] = packet.rays[j].t_max;
+	}
+	const float closestTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+
+	startTime = std::chrono::steady_clock::now();
+	uint32_t anyHits = 0;
+	for (size_t i = 0; i < rays.size(); i += K)
+		anyHits += std::popcount(accel.intersect_p(makePacket(i)));
+	const float anyTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+
+	AITO_INFO("    {}: closest hit {:.1f} ms ({:.2f} Mrays/s), any hit {:.1f} ms ({:.2f} Mrays/s), {} hits",
+			  name, closestTime, rays.size() / (closestTime * 1000.0f), anyTime, rays.size() / (anyTime * 1000.0f), anyHits);
+}
+
+bool identical_bvh(const BVHAccel& a, const BVHAccel& b)
+{
+	if (a.nodes().size() != b.nodes().size() || a.primitives().size() != b.primitives().size())
+		return false;
+	if (std::memcmp(a.nodes().data(), b.nodes().data(), a.nodes().size() * sizeof(LinearBVHNode)) != 0)
+		return false;
+	for (size_t i = 0; i < a.primitives().size(); i++)
+	{
+		if (a.primitives()[i].mesh() != b.primitives()[i].mesh() || a.primitives()[i].triangle_index() != b.primitives()[i].triangle_index())
+			return false;
+	}
+	return true;
+}
+
+}
+
+void run_benchmarks()
+{
+	benchmark_bvh_build();
+	benchmark_bvh_traversal();
+	benchmark_packet_traversal();
+	benchmark_ray_sorting();
+	benchmark_samplers();
+	benchmark_spectrum();
+	benchmark_memory_arena();
+	benchmark_instancing();
+	benchmark_compressed_bvh();
+	benchmark_bvh_refit();
+}
+
+void benchmark_bvh_build()
+{
+	constexpr std::array<uint32_t, 2> triangleCounts = { 1u << 20, 1u << 22 };
+	constexpr int runs = 3;
+
+	// 1, 2, 4, ... up to all cores
+	std::vector<int> threadCounts;
+	for (int threads = 1; threads < available_cores(); threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(available_cores());
+
+	for (const char* modelPath : BENCHMARK_MODELS)
+	{
+		Model::Builder builder{};
+		builder.loadModel(modelPath);
+
+		for (const uint32_t triangleCount : triangleCounts)
+		{
+			const auto meshes = replicate_mesh(builder, triangleCount);
+			const std::vector<Triangle> triangles = collect_triangles(meshes);
+
+			AITO_INFO("BVH build benchmark: {} replicated {} times ({} triangles)", modelPath, meshes.size(), triangles.size());
+
+			std::unique_ptr<BVHAccel> serialBVH;
+			float serialTime = 0;
+			for (const int threads : threadCounts)
+			{
+				// Keep the fastest of a few runs
+				float bestTime = Infinity;
+				std::unique_ptr<BVHAccel> bvh;
+				for (int run = 0; run < runs; run++)
+				{
+					const auto startTime = std::chrono::steady_clock::now();
+					bvh = std::make_unique<BVHAccel>(triangles, 4, threads);
+					const float time = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+					bestTime = std::min(bestTime, time);
+				}
+
+				if (threads == 1)
+				{
+					serialBVH = std::move(bvh);
+					serialTime = bestTime;
+					AITO_INFO("    1 thread: {:.1f} ms", bestTime);
+				}
+				else
+				{
+					const bool identical = identical_bvh(*serialBVH, *bvh);
+					AITO_INFO("    {} threads: {:.1f} ms, speedup {:.2f}x, {}",
+							  threads, bestTime, serialTime / bestTime, identical ? "identical to the serial build" : "DIFFERS from the serial build");
+					if (!identical)
+						AITO_ERROR("Parallel BVH build with {} threads does not match the serial build", threads);
+				}
+			}
+		}
+	}
+}
+
+void benchmark_bvh_traversal()
+{
+	constexpr uint32_t triangleCount = 1u << 20;
+	constexpr uint32_t rayCount = 1u << 20;
+
+	for (const char* modelPath : BENCHMARK_MODELS)
+	{
+		Model::Builder builder{};
+		builder.loadModel(modelPath);
+
+		const auto meshes = replicate_mesh(builder, triangleCount);
+		const BVHAccel bvh(collect_triangles(meshes));
+		const BVH4 bvh4(bvh);
+		const BVH8 bvh8(bvh);
+
+		const std::vector<Ray> rays = random_rays(bvh.world_bound(), rayCount);
+		AITO_INFO("BVH traversal benchmark: {} replicated {} times, {} rays", modelPath, meshes.size(), rays.size());
+
+		std::vector<Float> binaryHits, hits4, hits8;
+		time_traversal("Binary BVH", bvh, rays, binaryHits);
+		time_traversal("BVH4", bvh4, rays, hits4);
+		time_traversal("BVH8", bvh8, rays, hits8);
+
+		// The hits are compared by distance, since equally close hits may resolve to different triangles
+		const auto differences = [&](const std::vector<Float>& hits)
+		{
+			size_t count = 0;
+			for (size_t i = 0; i < hits.size(); i++)
+				count += hits[i] != binaryHits[i] ? 1 : 0;
+			return count;
+		};
+		AITO_INFO("    Rays with a different closest hit than the binary BVH: BVH4 {}, BVH8 {}", differences(hits4), differences(hits8));
+	}
+}
+
+void benchmark_packet_traversal()
+{
+	constexpr uint32_t triangleCount = 1u << 20;
+	constexpr int resolution = 1024;
+
+	for (const char* modelPath : BENCHMARK_MODELS)
+	{
+		Model::Builder builder{};
+		builder.loadModel(modelPath);
+
+		const auto meshes = replicate_mesh(builder, triangleCount);
+		const BVH8 bvh8(collect_triangles(meshes));
+		const Bounds3f bounds = bvh8.world_bound();
+		const Point3f light = bounds.lerp(Point3f(0.7f, 1.5f, 0.6f));
+
+		// 8 ray packets cover 4x2 pixels, 16 ray packets 4x4 pixels. The single rays trace the 4x4 order.
+		const std::vector<Ray> rays8 = camera_rays(bounds, resolution, 4, 2);
+		const std::vector<Ray> rays16 = camera_rays(bounds, resolution, 4, 4);
+		AITO_INFO("Packet traversal benchmark: {} replicated {} times, {} primary rays", modelPath, meshes.size(), rays16.size());
+
+		std::vector<Float> hits, hits8, hits16;
+		time_traversal("Primary, single rays", bvh8, rays16, hits);
+		time_packet_traversal<8>("Primary, 8 ray packets", bvh8, rays8, hits8);
+		time_packet_traversal<16>("Primary, 16 ray packets", bvh8, rays16, hits16);
+
+		const std::vector<Ray> shadowRays = shadow_rays(rays16, hits, light);
+		std::vector<Float> shadowHits, shadowHits8, shadowHits16;
+		time_traversal("Shadow, single rays", bvh8, shadowRays, shadowHits);
+		time_packet_traversal<8>("Shadow, 8 ray packets", bvh8, shadowRays, shadowHits8);
+		time_packet_traversal<16>("Shadow, 16 ray packets", bvh8, shadowRays, shadowHits16);
+
+		// The 16 ray packets and the shadow ray packets trace the same rays in the same order as the single rays
+		size_t differences = 0;
+		for (size_t i = 0; i < hits16.size(); i++)
+			differences += hits16[i] != hits[i] ? 1 : 0;
+		for (size_t i = 0; i < shadowHits.size(); i++)
+			differences += (shadowHits8[i] != shadowHits[i] ? 1 : 0) + (shadowHits16[i] != shadowHits[i] ? 1 : 0);
+		AITO_INFO("    Rays with a different closest hit than single ray traversal: {}", differences);
+	}
+}
+
+void benchmark_ray_sorting()
+{
+	constexpr std::array vaseModels = {
+		"models/smooth_vase.obj",
+		"models/flat_vase.obj",
+	};
+	constexpr uint32_t triangleCount = 1u << 20;
+	constexpr int resolution = 1024;
+
+	for (const char* modelPath : vaseModels)
+	{
+		Model::Builder builder{};
+		builder.loadModel(modelPath);
+
+		const auto meshes = replicate_mesh(builder, triangleCount);
+		const BVH8 bvh8(collect_triangles(meshes));
+		const Bounds3f bounds = bvh8.world_bound();
+
+		const std::vector<Ray> rays = bounce_rays(bvh8, camera_rays(bounds, resolution, 8, 8));
+		AITO_INFO("Ray sorting benchmark: {} replicated {} times, {} secondary rays", modelPath, meshes.size(), rays.size());
+
+		std::vector<uint32_t> keys(rays.size());
+		std::vector<uint32_t> order(rays.size());
+		RaySorter sorter;
+		const auto startTime = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < rays.size(); i++)
+		{
+			keys[i] = RaySorter::sort_key(rays[i].o, rays[i].d, bounds);
+			order[i] = i;
+		}
+		sorter.sort(keys.data(), order.data(), static_cast<uint32_t>(rays.size()));
+		const float sortTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+
+		std::vector<Ray> sortedRays;
+		sortedRays.reserve(rays.size());
+		for (const uint32_t i : order)
+			sortedRays.push_back(rays[i]);
+
+		std::vector<Float> hits, sortedHits;
+		time_traversal("Unsorted (pixel order)", bvh8, rays, hits);
+		time_traversal("Sorted", bvh8, sortedRays, sortedHits);
+		AITO_INFO("    Computing the keys and sorting: {:.1f} ms", sortTime);
+
+		size_t differences = 0;
+		for (size_t i = 0; i < order.size(); i++)
+			differences += sortedHits[i] != hits[order[i]] ? 1 : 0;
+		AITO_INFO("    Rays with a different closest hit after sorting: {}", differences);
+	}
+}
+
+void benchmark_samplers()
+{
+	constexpr Point2i resolution(1920, 1080);
+	constexpr uint32_t samplesPerPixel = 64;
+	constexpr int dimensions = 16;
+
+	const std::array<std::pair<Sampler::Type, const char*>, 3> samplers = { {
+		{ Sampler::Type::Sobol, "Sobol" },
+		{ Sampler::Type::Halton, "Halton" },
+		{ Sampler::Type::PMJ02, "PMJ02" },
+	} };
+
+	for (const auto& [type, name] : samplers)
+	{
+		Sampler sampler(type, resolution);
+
+		// Pixels are visited in a scattered order, like jumping between pixels in an integrator
+		const uint32_t sampleCount = 1u << 20;
+		Float sum = 0;
+		const auto startTime = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < sampleCount; i++)
+		{
+			const uint32_t pixel = static_cast<uint32_t>(mix_bits(i / samplesPerPixel) % (resolution.x * resolution.y));
+			sampler.start_pixel_sample(Point2i(pixel % resolution.x, pixel / resolution.x), i % samplesPerPixel);
+			const Point2f pFilm = sampler.get_pixel_2d();
+			sum += pFilm.x + pFilm.y;
+			for (int d = 0; d < dimensions; d += 2)
+			{
+				const Point2f u = sampler.get_2d();
+				sum += u.x + u.y;
+			}
+		}
+		const auto endTime = std::chrono::high_resolution_clock::now();
+
+		const double nanoseconds = std::chrono::duration<double, std::nano>(endTime - startTime).count();
+		AITO_INFO("{} sampler: {:.1f} ns per sample of {} dimensions (mean {:.4f})",
+				  name, nanoseconds / sampleCount, dimensions + 2, sum / (static_cast<double>(sampleCount) * (dimensions + 2)));
+	}
+}
+
+void benchmark_spectrum()
+{
+	constexpr uint32_t pathCount = 1u << 20;
+	constexpr int depth = 5;
+
+	// Path throughput and radiance math of a diffuse path: the same steps in RGB and with sampled spectra
+	std::array<Vec3f, 8> albedos;
+	std::array<SampledSpectrum, 8> spectralAlbedos;
+	for (int i = 0; i < 8; i++)
+	{
+		albedos[i] = Vec3f(0.2f + 0.1f * i, 0.8f - 0.05f * i, 0.5f);
+		spectralAlbedos[i] = SampledSpectrum({ 0.2f + 0.1f * i, 0.8f - 0.05f * i, 0.5f, 0.3f });
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	Vec3f rgbSum(0);
+	for (uint32_t i = 0; i < pathCount; i++)
+	{
+		Vec3f beta(1), L(0);
+		for (int d = 0; d < depth; d++)
+		{
+			L += beta * 0.5f;
+			beta *= albedos[(i + d) & 7];
+		}
+		rgbSum += L;
+	}
+	const double rgbTime = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	startTime = std::chrono::high_resolution_clock::now();
+	SampledSpectrum spectralSum(0);
+	for (uint32_t i = 0; i < pathCount; i++)
+	{
+		SampledSpectrum beta(1), L(0);
+		for (int d = 0; d < depth; d++)
+		{
+			L += beta * 0.5f;
+			beta *= spectralAlbedos[(i + d) & 7];
+		}
+		spectralSum += L;
+	}
+	const double spectralTime = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	AITO_INFO("Spectrum benchmark: {} paths of depth {}", pathCount, depth);
+	AITO_INFO("    Path math in RGB: {:.1f} ns per path (mean {:.4f})", rgbTime / pathCount, rgbSum.y / pathCount);
+	AITO_INFO("    Path math with {} wavelengths: {:.1f} ns per path (mean {:.4f})", NSpectrumSamples, spectralTime / pathCount, spectralSum.average() / pathCount);
+
+	// Every spectral path also samples its wavelengths and converts its radiance to RGB.
+	// Dispersive paths terminate their secondary wavelengths along the way.
+	for (const bool dispersive : { false, true })
+	{
+		startTime = std::chrono::high_resolution_clock::now();
+		Vec3f sum(0);
+		for (uint32_t i = 0; i < pathCount; i++)
+		{
+			SampledWavelengths lambda = SampledWavelengths::sample_visible((i + 0.5f) / pathCount);
+			if (dispersive)
+				lambda.terminate_secondary();
+			sum += spectralAlbedos[i & 7].to_rgb(lambda);
+		}
+		const double time = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+		AITO_INFO("    Sampling the wavelengths and converting to RGB{}: {:.1f} ns per path (mean {:.4f})",
+				  dispersive ? ", secondaries terminated" : "", time / pathCount, sum.y / pathCount);
+	}
+
+	// Converting a surface color to a spectral albedo at the path's wavelengths, like every shading point does
+	const RGBToSpectrumTable rgbToSpectrum = RGBToSpectrumTable::load(RGBToSpectrumTable::default_path());
+	const SampledWavelengths lambda = SampledWavelengths::sample_visible(0.5f);
+	startTime = std::chrono::high_resolution_clock::now();
+	SampledSpectrum albedoSum(0);
+	for (uint32_t i = 0; i < pathCount; i++)
+	{
+		const Vec3f color = albedos[i & 7] * (static_cast<Float>(i & 255) / 255);
+		albedoSum += rgbToSpectrum(color).sample(lambda);
+	}
+	const double albedoTime = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+	AITO_INFO("    RGB to spectral albedo: {:.1f} ns per color (mean {:.4f})", albedoTime / pathCount, albedoSum.average() / pathCount);
+}
+
+void benchmark_memory_arena()
+{
+	constexpr uint32_t pathCount = 1u << 20;
+	constexpr int depth = 5;
+
+	// The BSDFs of the hits of a path, created and dropped like in the integrator
+	const Frame frame = Frame::from_z(Vec3f(0, 0, 1));
+	const SampledSpectrum albedo(0.5f);
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	SampledSpectrum heapSum(0);
+	for (uint32_t i = 0; i < pathCount; i++)
+	{
+		std::unique_ptr<DiffuseBSDF> bsdfs[depth];
+		for (int d = 0; d < depth; d++)
+		{
+			bsdfs[d] = std::make_unique<DiffuseBSDF>(frame, albedo * static_cast<Float>(d + 1));
+			heapSum += bsdfs[d]->f(frame.z, frame.z);
+		}
+	}
+	const double heapTime = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	MemoryArena arena;
+	startTime = std::chrono::high_resolution_clock::now();
+	SampledSpectrum arenaSum(0);
+	for (uint32_t i = 0; i < pathCount; i++)
+	{
+		for (int d = 0; d < depth; d++)
+		{
+			const DiffuseBSDF* bsdf = arena.alloc<DiffuseBSDF>(frame, albedo * static_cast<Float>(d + 1));
+			arenaSum += bsdf->f(frame.z, frame.z);
+		}
+		arena.reset();
+	}
+	const double arenaTime = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	AITO_INFO("Memory arena benchmark: {} paths of depth {}", pathCount, depth);
+	AITO_INFO("    BSDFs on the heap: {:.1f} ns per path (mean {:.4f})", heapTime / pathCount, heapSum.average() / pathCount);
+	AITO_INFO("    BSDFs in the arena: {:.1f} ns per path (mean {:.4f}, {} heap allocations)",
+			  arenaTime / pathCount, arenaSum.average() / pathCount, arena.stats().heap_allocations);
+
+	// The path integrator over a grid of vases. The first samples warm the arena up, after that it must not grow anymore.
+	constexpr int resolution = 256;
+	constexpr uint32_t samplesPerPixel = 4;
+
+	Model::Builder builder{};
+	builder.loadModel(BENCHMARK_MODELS[0]);
+	const auto meshes = replicate_mesh(builder, 1u << 16);
+	Scene scene(collect_triangles(meshes));
+	const Bounds3f bounds = scene.world_bound();
+	scene.infinite_light.radiance = Vec3f(0.4f, 0.5f, 0.7f);
+	scene.point_lights.push_back(PointLight{ bounds.lerp(Point3f(0.3f, 1.5f, 0.6f)), Vec3f(0.5f) * glm::dot(bounds.diagonal(), bounds.diagonal()) });
+
+	const RGBToSpectrumTable rgbToSpectrum = RGBToSpectrumTable::load(RGBToSpectrumTable::default_path());
+	const PathIntegrator integrator(scene, rgbToSpectrum);
+	const std::vector<Ray> rays = camera_rays(bounds, resolution, 8, 8);
+	Sampler sampler(Sampler::Type::PMJ02, Point2i(resolution, resolution));
+
+	MemoryArena renderArena;
+	uint64_t warmHeapAllocations = 0;
+	uint64_t warmAllocations = 0;
+	startTime = std::chrono::high_resolution_clock::now();
+	Float sum = 0;
+	for (uint32_t s = 0; s < samplesPerPixel; s++)
+	{
+		for (uint32_t i = 0; i < rays.size(); i++)
+		{
+			sampler.start_pixel_sample(Point2i(i % resolution, i / resolution), s);
+			const SampledWavelengths lambda = SampledWavelengths::sample_visible(sampler.get_1d());
+			sum += integrator.li(RayDifferential(rays[i]), lambda, sampler, renderArena).y(lambda);
+			renderArena.reset();
+		}
+		if (s == 0)
+		{
+			warmHeapAllocations = renderArena.stats().heap_allocations;
+			warmAllocations = renderArena.stats().allocations;
+		}
+	}
+	const double renderTime = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+	const MemoryArena::Stats stats = renderArena.stats();
+	const uint64_t sampleCount = static_cast<uint64_t>(rays.size()) * samplesPerPixel;
+	AITO_INFO("    Path integrator, {} replicated {} times: {:.0f} ns per sample (mean {:.4f})",
+			  BENCHMARK_MODELS[0], meshes.size(), renderTime / sampleCount, sum / sampleCount);
+	AITO_INFO("    {:.2f} arena allocations per sample, peak {} bytes, {} bytes reserved",
+			  static_cast<double>(stats.allocations) / sampleCount, stats.peak_bytes_used, stats.bytes_reserved);
+	AITO_INFO("    Heap allocations: {} while warming up, {} in the remaining {} samples ({} arena allocations)",
+			  warmHeapAllocations, stats.heap_allocations - warmHeapAllocations, sampleCount - rays.size(), stats.allocations - warmAllocations);
+}
+
+void benchmark_instancing()
+{
+	constexpr uint32_t triangleCount = 1u << 22;
+	constexpr uint32_t rayCount = 1u << 20;
+
+	for (const char* modelPath : BENCHMARK_MODELS)
+	{
+		Model::Builder builder{};
+		builder.loadModel(modelPath);
+		const std::vector<Mat4f> transforms = grid_transforms(builder, triangleCount);
+
+		// Every copy as its own world space mesh in one BVH8
+		auto startTime = std::chrono::steady_clock::now();
+		std::vector<std::shared_ptr<TriangleMesh>> meshes;
+		for (const Mat4f& transform : transforms)
+			meshes.push_back(builder.createTriangleMesh(transform));
+		const BVH8 flat(collect_triangles(meshes));
+		const float flatTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+		size_t flatMemory = flat.memory_usage();
+		for (const auto& mesh : meshes)
+			flatMemory += mesh_memory_usage(*mesh);
+
+		// One object space mesh with a BVH8, placed by every instance
+		startTime = std::chrono::steady_clock::now();
+		const std::vector<std::shared_ptr<TriangleMesh>> objectMesh = { builder.createTriangleMesh(Mat4f(1.0f)) };
+		const BVH8 meshBVH(collect_triangles(objectMesh));
+		std::vector<BVHInstance> instances;
+		for (const Mat4f& transform : transforms)
+			instances.emplace_back(&meshBVH, transform);
+		const TwoLevelBVH instanced(std::move(instances));
+		const float instancedTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+		const size_t instancedMemory = mesh_memory_usage(*objectMesh[0]) + meshBVH.memory_usage() + instanced.memory_usage();
+
+		AITO_INFO("Instancing benchmark: {} placed {} times ({} triangles)", modelPath, transforms.size(), flat.primitives().size());
+		AITO_INFO("    Flattened: {:.2f} MB, built in {:.1f} ms", static_cast<double>(flatMemory) / (1024 * 1024), flatTime);
+		AITO_INFO("    Two level: {:.2f} MB, built in {:.1f} ms", static_cast<double>(instancedMemory) / (1024 * 1024), instancedTime);
+
+		const std::vector<Ray> rays = random_rays(flat.world_bound(), rayCount);
+		std::vector<Float> flatHits, instancedHits;
+		time_traversal("Flattened", flat, rays, flatHits);
+		time_traversal("Two level", instanced, rays, instancedHits);
+
+		size_t differences = 0;
+		for (size_t i = 0; i < rays.size(); i++)
+			differences += std::abs(flatHits[i] - instancedHits[i]) > 1e-4f * std::max<Float>(1, flatHits[i]) ? 1 : 0;
+		AITO_INFO("    Rays with a different closest hit: {}", differences);
+	}
+}
+
+void benchmark_compressed_bvh()
+{
+	constexpr uint32_t triangleCount = 1u << 22;
+	constexpr uint32_t rayCount = 1u << 20;
+	constexpr int resolution = 1024;
+
+	const auto megabytes = [](size_t bytes) { return static_cast<double>(bytes) / (1024 * 1024); };
+
+	for (const char* modelPath : BENCHMARK_MODELS)
+	{
+		Model::Builder builder{};
+		builder.loadModel(modelPath);
+
+		const auto meshes = replicate_mesh(builder, triangleCount);
+		const BVHAccel bvh(collect_triangles(meshes));
+		const BVH4 full4(bvh, BVHNodeLayout::Full);
+		const BVH4 compressed4(bvh, BVHNodeLayout::Compressed);
+		const BVH8 full8(bvh, BVHNodeLayout::Full);
+		const BVH8 compressed8(bvh, BVHNodeLayout::Compressed);
+
+		AITO_INFO("Compressed BVH benchmark: {} replicated {} times ({} triangles)", modelPath, meshes.size(), bvh.primitives().size());
+		AITO_INFO("    BVH4 nodes: {:.2f} MB full, {:.2f} MB compressed; total {:.2f} MB full, {:.2f} MB compressed",
+				  megabytes(full4.node_memory_usage()), megabytes(compressed4.node_memory_usage()),
+				  megabytes(full4.memory_usage()), megabytes(compressed4.memory_usage()));
+		AITO_INFO("    BVH8 nodes: {:.2f} MB full, {:.2f} MB compressed; total {:.2f} MB full, {:.2f} MB compressed",
+				  megabytes(full8.node_memory_usage()), megabytes(compressed8.node_memory_usage()),
+				  megabytes(full8.memory_usage()), megabytes(compressed8.memory_usage()));
+
+		// The compressed bounds are larger, so the traversal may visit other nodes, but never finds other hits.
+		// The hits are compared by distance, since equally close hits may resolve to different triangles.
+		size_t differences = 0;
+		const auto countDifferences = [&](const std::vector<Float>& a, const std::vector<Float>& b)
+		{
+			for (size_t i = 0; i < a.size(); i++)
+				differences += a[i] != b[i] ? 1 : 0;
+		};
+
+		const std::vector<Ray> rays = random_rays(bvh.world_bound(), rayCount);
+		std::vector<Float> full4Hits, compressed4Hits, full8Hits, compressed8Hits;
+		time_traversal("Random rays, BVH4 full", full4, rays, full4Hits);
+		time_traversal("Random rays, BVH4 compressed", compressed4, rays, compressed4Hits);
+		time_traversal("Random rays, BVH8 full", full8, rays, full8Hits);
+		time_traversal("Random rays, BVH8 compressed", compressed8, rays, compressed8Hits);
+		countDifferences(full4Hits, compressed4Hits);
+		countDifferences(full8Hits, compressed8Hits);
+
+		const std::vector<Ray> cameraRays = camera_rays(bvh.world_bound(), resolution, 4, 4);
+		std::vector<Float> fullPacketHits, compressedPacketHits;
+		time_packet_traversal<16>("Primary, 16 ray packets, BVH8 full", full8, cameraRays, fullPacketHits);
+		time_packet_traversal<16>("Primary, 16 ray packets, BVH8 compressed", compressed8, cameraRays, compressedPacketHits);
+		countDifferences(fullPacketHits, compressedPacketHits);
+
+		AITO_INFO("    Rays with a different closest hit in the compressed BVHs: {}", differences);
+	}
+}
+
+void benchmark_bvh_refit()
+{
+	constexpr uint32_t instanceTriangles = 1u << 22;
+	constexpr uint32_t meshTriangles = 1u << 20;
+	constexpr uint32_t rayCount = 1u << 20;
+	constexpr int frames = 8;
+
+	const auto milliseconds = [](auto startTime)
+		{
+			return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+		};
+
+	for (const char* modelPath : BENCHMARK_MODELS)
+	{
+		Model::Builder builder{};
+		builder.loadModel(modelPath);
+
+		// Instances that move a bit every frame, then jump far for the last frames, which should trigger a rebuild
+		std::vector<Mat4f> transforms = grid_transforms(builder, instanceTriangles);
+		const std::vector<std::shared_ptr<TriangleMesh>> objectMesh = { builder.createTriangleMesh(Mat4f(1.0f)) };
+		const BVH8 meshBVH(collect_triangles(objectMesh));
+		std::vector<BVHInstance> instances;
+		for (const Mat4f& transform : transforms)
+			instances.emplace_back(&meshBVH, transform);
+		TwoLevelBVH tlas(std::move(instances));
+		const Vec3f sceneSize = tlas.world_bound().diagonal();
+
+		AITO_INFO("BVH refit benchmark: {} placed {} times", modelPath, transforms.size());
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<Float> uniform(-0.5f, 0.5f);
+		for (int frame = 0; frame < frames; frame++)
+		{
+			const Float motion = frame < frames - 2 ? 0.002f : 0.25f;
+			for (uint32_t i = 0; i < transforms.size(); i++)
+			{
+				const Vec3f offset = motion * sceneSize * Vec3f(uniform(rng), uniform(rng), uniform(rng));
+				transforms[i] = glm::translate(Mat4f(1.0f), offset) * transforms[i];
+				tlas.set_transform(i, transforms[i]);
+			}
+
+			auto startTime = std::chrono::steady_clock::now();
+			const bool rebuilt = tlas.update();
+			const float updateTime = milliseconds(startTime);
+
+			std::vector<BVHInstance> moved;
+			for (const Mat4f& transform : transforms)
+				moved.emplace_back(&meshBVH, transform);
+			startTime = std::chrono::steady_clock::now();
+			const TwoLevelBVH reference(std::move(moved));
+			const float buildTime = milliseconds(startTime);
+
+			AITO_INFO("    Frame {}: update {:.2f} ms ({}), full build {:.2f} ms, SAH cost {:.2f} (a new build costs {:.2f})",
+					  frame, updateTime, rebuilt ? "rebuilt" : "refit", buildTime, tlas.sah_cost(), reference.sah_cost());
+			if (frame == frames - 3)
+			{
+				const std::vector<Ray> rays = random_rays(reference.world_bound(), rayCount);
+				std::vector<Float> refitHits, referenceHits;
+				time_traversal("Refit instance BVH", tlas, rays, refitHits);
+				time_traversal("Rebuilt instance BVH", reference, rays, referenceHits);
+				size_t differences = 0;
+				for (size_t i = 0; i < rays.size(); i++)
+					differences += refitHits[i] != referenceHits[i] ? 1 : 0;
+				AITO_INFO("    Rays with a different closest hit: {}", differences);
+			}
+		}
+
+		// A mesh whose vertices move: refit its BVH8 in both node layouts, and compare with building a new one
+		const auto meshes = replicate_mesh(builder, meshTriangles);
+		const std::vector<Triangle> triangles = collect_triangles(meshes);
+		BVH8 full(triangles, 4, 0, BVHNodeLayout::Full);
+		BVH8 compressed(triangles, 4, 0, BVHNodeLayout::Compressed);
+		const Float amplitude = 0.01f * glm::length(full.world_bound().diagonal());
+		for (const auto& mesh : meshes)
+		{
+			for (Point3f& p : mesh->p)
+				p.y += amplitude * std::sin(p.x / amplitude) * std::cos(p.z / amplitude);
+		}
+
+		auto startTime = std::chrono::steady_clock::now();
+		full.refit();
+		const float fullRefitTime = milliseconds(startTime);
+		startTime = std::chrono::steady_clock::now();
+		compressed.refit();
+		const float compressedRefitTime = milliseconds(startTime);
+		startTime = std::chrono::steady_clock::now();
+		const BVH8 rebuilt(triangles);
+		const float rebuildTime = milliseconds(startTime);
+		AITO_INFO("    Deformed {} triangles: refit {:.1f} ms (compressed {:.1f} ms), full build {:.1f} ms",
+				  triangles.size(), fullRefitTime, compressedRefitTime, rebuildTime);
+
+		const std::vector<Ray> rays = random_rays(rebuilt.world_bound(), rayCount);
+		std::vector<Float> fullHits, compressedHits, rebuiltHits;
+		time_traversal("Refit BVH8", full, rays, fullHits);
+		time_traversal("Refit compressed BVH8", compressed, rays, compressedHits);
+		time_traversal("Rebuilt BVH8", rebuilt, rays, rebuiltHits);
+		size_t differences = 0;
+		for (size_t i = 0; i < rays.size(); i++)
+			differences += (fullHits[i] != rebuiltHits[i] ? 1 : 0) + (compressedHits[i] != rebuiltHits[i] ? 1 : 0);
+		AITO_INFO("    Rays with a different closest hit: {}", differences);
+	}
+}
+
+}  // namespace aito
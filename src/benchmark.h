@@ -0,0 +1,78 @@
+#ifndef AITO_BENCHMARK_H
+#define AITO_BENCHMARK_H
+
+
+namespace aito
+{
+
+/// <summary>
+/// Runs all benchmarks and logs the results. Only called in builds configured with -DBENCHMARK=1.
+/// </summary>
+void run_benchmarks();
+
+/// <summary>
+/// Measures the BVH build time over the meshes in models/, replicated in a grid up to millions of triangles,
+/// for 1 to N build threads. Also checks that every parallel build is identical to the serial one.
+/// </summary>
+void benchmark_bvh_build();
+
+/// <summary>
+/// Measures the closest hit and any hit traversal throughput of the binary BVH, BVH4 and BVH8 with random rays,
+/// and checks that all of them find the same hits.
+/// </summary>
+void benchmark_bvh_traversal();
+
+/// <summary>
+/// Compares single ray and packet traversal of the BVH8 for coherent rays: the primary rays of a pinhole camera,
+/// and shadow rays from a point light to their hits. Also checks that the packets find the same hits.
+/// </summary>
+void benchmark_packet_traversal();
+
+/// <summary>
+/// Compares the traversal throughput of diffuse secondary rays from the vase scenes in pixel order
+/// and sorted by RaySorter, and measures the cost of the sort.
+/// </summary>
+void benchmark_ray_sorting();
+
+/// <summary>
+/// Measures the cost of a sample (film position and a few more dimensions) for every sampler.
+/// </summary>
+void benchmark_samplers();
+
+/// <summary>
+/// Compares the cost of the throughput and radiance math of a path in RGB and with sampled spectra,
+/// including sampling the wavelengths and converting the result to RGB, with and without dispersion,
+/// and the cost of converting an RGB albedo to a spectrum.
+/// </summary>
+void benchmark_spectrum();
+
+/// <summary>
+/// Compares allocating the BSDF of every hit on the heap and in a MemoryArena, and renders a vase scene with the
+/// path integrator to check that the sample loop does not allocate from the heap once the arena is warm.
+/// </summary>
+void benchmark_memory_arena();
+
+/// <summary>
+/// Compares a flattened BVH8 over copies of each mesh in models/ with a TwoLevelBVH placing a single copy many times:
+/// memory, build time and traversal throughput, and checks that both find the same hits.
+/// </summary>
+void benchmark_instancing();
+
+/// <summary>
+/// Compares the full and compressed node layouts of the BVH4 and BVH8 over the meshes in models/, replicated to millions
+/// of triangles: the memory of the nodes, and the traversal throughput of random rays and primary ray packets.
+/// Also checks that both layouts find the same hits.
+/// </summary>
+void benchmark_compressed_bvh();
+
+/// <summary>
+/// Moves the instances of a TwoLevelBVH a little every frame and then far, and compares updating it (refit, or a rebuild
+/// once the SAH cost has degraded) with building it from scratch. Then deforms a replicated mesh and compares refitting
+/// its BVH8 in both node layouts with a new build. Also checks that the refit BVHs find the same hits.
+/// </summary>
+void benchmark_bvh_refit();
+
+}  // namespace aito
+
+
+#endif // AITO_BENCHMARK_H
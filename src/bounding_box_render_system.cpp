@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "bounding_box_render_system.h"
+#include "upload_manager.h"
 #include "time.h"
 
 #include "vecmath.h"
@@ -115,8 +116,8 @@ void BoundingBoxRenderSystem::renderObjects(
 		0,
 		1,
 		&frameInfo.globalDescriptorSet,
-		0,
-		nullptr
+		1,
+		&frameInfo.globalOffset
 	);
 
 	for (auto& obj : objects)
@@ -164,19 +165,6 @@ void BoundingBox::createBuffers(const std::array<Vertex, 8>& vertices)
 	{
 		const uint32_t vertexSize = sizeof(vertices[0]);
 
-		// Create staging buffer for transfer to the GPU
-		Buffer stagingBuffer{
-			device_,
-			vertexSize,
-			vertexCount_,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		};
-
-		// Map the memory to the host and copy the data into the mapped region. 
-		stagingBuffer.map();
-		stagingBuffer.writeToBuffer((void*)vertices.data());
-
 		// Create the actual memory buffer on the GPU
 		vertexBuffer_ = std::make_unique<Buffer>(
 			device_,
@@ -186,8 +174,8 @@ void BoundingBox::createBuffers(const std::array<Vertex, 8>& vertices)
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 			);
 
-		// Copy the data from the staging buffer to the vertex buffer.
-		device_.copyBuffer(stagingBuffer.getBuffer(), vertexBuffer_->getBuffer(), stagingBuffer.getBufferSize());
+		// Upload the vertices through the staging ring. The copy is submitted with the next frame.
+		device_.uploads().uploadToBuffer(vertexBuffer_->getBuffer(), 0, vertices.data(), vertexBuffer_->getBufferSize());
 	}
 	// Create the index buffer
 	{
@@ -200,19 +188,6 @@ void BoundingBox::createBuffers(const std::array<Vertex, 8>& vertices)
 			4, 5, 4, 6, 6, 7, 5, 7
 		};
 
-		// Create staging buffer for transfer to the GPU
-		Buffer stagingBuffer{
-			device_,
-			indexSize,
-			indexCount_,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-		};
-
-		// Map the memory to the host and copy the data into the mapped region.
-		stagingBuffer.map();
-		stagingBuffer.writeToBuffer((void*)indices.data());
-
 		// Create the actual memory buffer on the GPU
 		indexBuffer_ = std::make_unique<Buffer>(
 			device_,
@@ -222,8 +197,8 @@ void BoundingBox::createBuffers(const std::array<Vertex, 8>& vertices)
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 			);
 
-		// Copy the data from the staging buffer to the index buffer.
-		device_.copyBuffer(stagingBuffer.getBuffer(), indexBuffer_->getBuffer(), stagingBuffer.getBufferSize());
+		// Upload the indices through the staging ring.
+		device_.uploads().uploadToBuffer(indexBuffer_->getBuffer(), 0, indices.data(), indexBuffer_->getBufferSize());
 	}
 }
 
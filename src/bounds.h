@@ -18,7 +18,7 @@ public:
 public:
 	constexpr Bounds2()
 	{
-		T minNum = std::numeric_limits<T>::min();
+		T minNum = std::numeric_limits<T>::lowest();
 		T maxNum = std::numeric_limits<T>::max();
 		p_min = Point2<T>(maxNum, maxNum);
 		p_max = Point2<T>(minNum, minNum);
@@ -94,30 +94,33 @@ public:
 
 };
 
+// The unions assign the corners directly instead of using the two point constructor,
+// since that would swap the corners of an empty bounds and turn it into an infinite one.
 template<typename T>
 [[nodiscard]] constexpr Bounds2<T> bounds_union(const Bounds2<T>& b, const Point2<T>& p)
 {
-	return Bounds2<T>(
-		min(b.p_min, p),
-		max(b.p_max, p)
-		);
+	Bounds2<T> ret;
+	ret.p_min = min(b.p_min, p);
+	ret.p_max = max(b.p_max, p);
+	return ret;
 }
 template<typename T>
 [[nodiscard]] constexpr Bounds2<T> bounds_union(const Bounds2<T>& b1, const Bounds2<T>& b2)
 {
-	return Bounds2<T>(
-		min(b1.p_min, b2.p_min),
-		max(b1.p_max, b2.p_max)
-		);
+	Bounds2<T> ret;
+	ret.p_min = min(b1.p_min, b2.p_min);
+	ret.p_max = max(b1.p_max, b2.p_max);
+	return ret;
 }
 
 template<typename T>
 [[nodiscard]] constexpr Bounds2<T> bounds_intersect(const Bounds2<T>& b1, const Bounds2<T>& b2)
 {
-	return Bounds2<T>(
-		max(b1.p_min, b2.p_min),
-		min(b1.p_max, b2.p_max)
-		);
+	// Like the unions, this must not swap the corners, or bounds that do not overlap would give a non-empty result.
+	Bounds2<T> ret;
+	ret.p_min = max(b1.p_min, b2.p_min);
+	ret.p_max = min(b1.p_max, b2.p_max);
+	return ret;
 }
 
 template<typename T>
@@ -165,7 +168,9 @@ public:
 public:
 	constexpr Bounds3()
 	{
-		T minNum = std::numeric_limits<T>::min();
+		// lowest() rather than min(): for floating point types min() is the smallest positive value,
+		// which would make the union of an empty bounds with a negative point wrong.
+		T minNum = std::numeric_limits<T>::lowest();
 		T maxNum = std::numeric_limits<T>::max();
 		p_min = Point3<T>(maxNum, maxNum, maxNum);
 		p_max = Point3<T>(minNum, minNum, minNum);
@@ -241,7 +246,7 @@ public:
 			);
 	}
 
-	[[nodiscard]] constexpr glm::vec<3, T, glm::packed_highp> offset(const Point3<T>& p)
+	[[nodiscard]] constexpr glm::vec<3, T, glm::packed_highp> offset(const Point3<T>& p) const
 	{
 		auto o = p - p_min;
 		if (p_max.x > p_min.x) o.x /= p_max.x - p_min.x;
@@ -256,32 +261,72 @@ public:
 		*radius_out = inside_bounds(*center_out, *this) ? distance(*center_out, p_max) : 0;
 	}
 
+	/// <summary>
+	/// Slab test of the ray against the bounds, using the precomputed reciprocal of the ray direction.
+	/// "dirIsNeg" holds 1 for every axis where the ray direction is negative, and 0 otherwise.
+	/// The far slab distances are enlarged by the floating point error bound, so the test is conservative.
+	/// </summary>
+	[[nodiscard]] inline bool intersect_p(const Ray& ray, const Vec3f& invDir, const int dirIsNeg[3]) const
+	{
+		const Bounds3<T>& bounds = *this;
+
+		// Check for ray intersection against the x and y slabs
+		Float tMin = (bounds[dirIsNeg[0]].x - ray.o.x) * invDir.x;
+		Float tMax = (bounds[1 - dirIsNeg[0]].x - ray.o.x) * invDir.x;
+		const Float tyMin = (bounds[dirIsNeg[1]].y - ray.o.y) * invDir.y;
+		Float tyMax = (bounds[1 - dirIsNeg[1]].y - ray.o.y) * invDir.y;
+
+		// Update tMax and tyMax to ensure robust bounds intersection
+		tMax *= 1 + 2 * gamma(3);
+		tyMax *= 1 + 2 * gamma(3);
+
+		if (tMin > tyMax || tyMin > tMax)
+			return false;
+		if (tyMin > tMin) tMin = tyMin;
+		if (tyMax < tMax) tMax = tyMax;
+
+		// Check for ray intersection against the z slab
+		const Float tzMin = (bounds[dirIsNeg[2]].z - ray.o.z) * invDir.z;
+		Float tzMax = (bounds[1 - dirIsNeg[2]].z - ray.o.z) * invDir.z;
+		tzMax *= 1 + 2 * gamma(3);
+
+		if (tMin > tzMax || tzMin > tMax)
+			return false;
+		if (tzMin > tMin) tMin = tzMin;
+		if (tzMax < tMax) tMax = tzMax;
+
+		return (tMin < ray.t_max) && (tMax > 0);
+	}
+
 };
 
+// The unions assign the corners directly instead of using the two point constructor,
+// since that would swap the corners of an empty bounds and turn it into an infinite one.
 template<typename T>
 [[nodiscard]] constexpr Bounds3<T> bounds_union(const Bounds3<T>& b, const Point3<T>& p)
 {
-	return Bounds3<T>(
-		min(b.p_min, p),
-		max(b.p_max, p)
-		);
+	Bounds3<T> ret;
+	ret.p_min = min(b.p_min, p);
+	ret.p_max = max(b.p_max, p);
+	return ret;
 }
 template<typename T>
 [[nodiscard]] constexpr Bounds3<T> bounds_union(const Bounds3<T>& b1, const Bounds3<T>& b2)
 {
-	return Bounds3<T>(
-		min(b1.p_min, b2.p_min),
-		max(b1.p_max, b2.p_max)
-		);
+	Bounds3<T> ret;
+	ret.p_min = min(b1.p_min, b2.p_min);
+	ret.p_max = max(b1.p_max, b2.p_max);
+	return ret;
 }
 
 template<typename T>
 [[nodiscard]] constexpr Bounds3<T> bounds_intersect(const Bounds3<T>& b1, const Bounds3<T>& b2)
 {
-	return Bounds3<T>(
-		max(b1.p_min, b2.p_min),
-		min(b1.p_max, b2.p_max)
-		);
+	// Like the unions, this must not swap the corners, or bounds that do not overlap would give a non-empty result.
+	Bounds3<T> ret;
+	ret.p_min = max(b1.p_min, b2.p_min);
+	ret.p_max = min(b1.p_max, b2.p_max);
+	return ret;
 }
 
 template<typename T>
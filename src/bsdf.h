@@ -0,0 +1,73 @@
+#ifndef AITO_BSDF_H
+#define AITO_BSDF_H
+
+#include "aito.h"
+
+#include "sampling.h"
+#include "spectrum.h"
+#include "vecmath.h"
+
+
+namespace aito
+{
+
+/// <summary>
+/// A direction sampled from a BSDF, with the BSDF's value and the solid angle density it was sampled with.
+/// </summary>
+struct BSDFSample
+{
+	SampledSpectrum f;
+	Vec3f wi{ 0 };
+	Float pdf = 0;
+};
+
+/// <summary>
+/// Lambertian reflection: the same reflected radiance in every direction of the hemisphere the surface is seen from.
+/// Created per hit by PathIntegrator::get_bsdf, in the path's MemoryArena, so it has to stay trivially destructible.
+/// </summary>
+class DiffuseBSDF
+{
+public:
+	/// <summary>
+	/// "frame" is the shading frame, with z on the side of the surface the path arrives from.
+	/// </summary>
+	DiffuseBSDF(const Frame& frame, const SampledSpectrum& albedo)
+		: frame_(frame), albedo_(albedo)
+	{}
+
+	[[nodiscard]] inline const Frame& frame() const { return frame_; }
+
+	[[nodiscard]] inline SampledSpectrum f(const Vec3f& wo, const Vec3f& wi) const
+	{
+		return glm::dot(wi, frame_.z) > 0 ? albedo_ * InvPi : SampledSpectrum(0);
+	}
+
+	[[nodiscard]] inline Float pdf(const Vec3f& wo, const Vec3f& wi) const
+	{
+		return cosine_hemisphere_pdf(std::max<Float>(0, glm::dot(wi, frame_.z)));
+	}
+
+	/// <summary>
+	/// Samples wi proportionally to the cosine, so f * cos / pdf is just the albedo.
+	/// Returns false if the sample has a density of 0.
+	/// </summary>
+	[[nodiscard]] inline bool sample_f(const Vec3f& wo, const Point2f& u, BSDFSample* sample) const
+	{
+		const Vec3f wiLocal = sample_cosine_hemisphere(u);
+		sample->pdf = cosine_hemisphere_pdf(wiLocal.z);
+		if (sample->pdf == 0)
+			return false;
+		sample->wi = frame_.from_local(wiLocal);
+		sample->f = albedo_ * InvPi;
+		return true;
+	}
+
+private:
+	Frame frame_;
+	SampledSpectrum albedo_;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_BSDF_H
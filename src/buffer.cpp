@@ -8,6 +8,7 @@
 
 #include "buffer.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
@@ -48,18 +49,23 @@ namespace aito
 	{
 		unmap();
 		vkDestroyBuffer(device_.device(), buffer_, nullptr);
-		vkFreeMemory(device_.device(), memory_, nullptr);
+		device_.allocator().free(memory_);
 	}
 
 	/// <summary>
 	/// Map a memory range of this buffer. If successful, mapped points to the specified buffer range.
+	/// The memory block the buffer lives in stays mapped by the allocator, so this only computes the pointer.
 	/// </summary>
 	/// <param name="size">(Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete</param>
 	/// <param name="offset">(Optional) Byte offset from beginning</param>
 	VkResult Buffer::map(VkDeviceSize size, VkDeviceSize offset)
 	{
-		assert(buffer_ && memory_ && "Called map on buffer before create");
-		return vkMapMemory(device_.device(), memory_, offset, size, 0, &mapped_);
+		assert(buffer_ && memory_.memory && "Called map on buffer before create");
+		if (!memory_.mapped)
+			return VK_ERROR_MEMORY_MAP_FAILED;
+		mapped_ = static_cast<char*>(memory_.mapped) + offset;
+		mappedOffset_ = offset;
+		return VK_SUCCESS;
 	}
 
 	/// <summary>
@@ -67,11 +73,8 @@ namespace aito
 	/// </summary>
 	void Buffer::unmap()
 	{
-		if (mapped_)
-		{
-			vkUnmapMemory(device_.device(), memory_);
-			mapped_ = nullptr;
-		}
+		mapped_ = nullptr;
+		mappedOffset_ = 0;
 	}
 
 	/// <summary>
@@ -87,12 +90,14 @@ namespace aito
 		if (size == VK_WHOLE_SIZE)
 		{
 			memcpy(mapped_, data, bufferSize_);
+			markDirty(bufferSize_, mappedOffset_);
 		}
 		else
 		{
 			char* memOffset = (char*)mapped_;
 			memOffset += offset;
 			memcpy(memOffset, data, size);
+			markDirty(size, mappedOffset_ + offset);
 		}
 	}
 
@@ -103,11 +108,11 @@ namespace aito
 	/// <param name="offset">(Optional) Byte offset from beginning</param>
 	VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset)
 	{
-		VkMappedMemoryRange mappedRange = {};
-		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = memory_;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
+		if (isCoherent())
+			return VK_SUCCESS;
+
+		VkMappedMemoryRange mappedRange = getMappedRange(size, offset);
+		dropDirtyRanges(mappedRange);
 		return vkFlushMappedMemoryRanges(device_.device(), 1, &mappedRange);
 	}
 
@@ -118,12 +123,118 @@ namespace aito
 	/// <param name="offset">(Optional) Byte offset from beginning</param>
 	VkResult Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset)
 	{
+		if (isCoherent())
+			return VK_SUCCESS;
+
+		// Host writes to the range that were not flushed are undefined after this, so they have nothing left to flush
+		VkMappedMemoryRange mappedRange = getMappedRange(size, offset);
+		dropDirtyRanges(mappedRange);
+		return vkInvalidateMappedMemoryRanges(device_.device(), 1, &mappedRange);
+	}
+
+	/// <summary>
+	/// Record a range of the buffer as written, for the next flushDirtyRanges. A range touching or overlapping the last one
+	/// recorded extends it, so writing the instances of the buffer in order keeps a single range.
+	/// </summary>
+	/// <param name="size">(Optional) Size of the written range. Pass VK_WHOLE_SIZE for the rest of the buffer.</param>
+	/// <param name="offset">(Optional) Byte offset from the beginning of the buffer</param>
+	void Buffer::markDirty(VkDeviceSize size, VkDeviceSize offset)
+	{
+		if (isCoherent() || size == 0)
+			return;
+
+		const VkMappedMemoryRange range = getMappedRange(size, offset);
+		const DirtyRange dirty{ range.offset - memory_.offset, range.offset - memory_.offset + range.size };
+
+		if (!dirtyRanges_.empty() && dirty.begin <= dirtyRanges_.back().end && dirty.end >= dirtyRanges_.back().begin)
+		{
+			dirtyRanges_.back().begin = std::min(dirtyRanges_.back().begin, dirty.begin);
+			dirtyRanges_.back().end = std::max(dirtyRanges_.back().end, dirty.end);
+		}
+		else
+		{
+			dirtyRanges_.push_back(dirty);
+		}
+	}
+
+	/// <summary>
+	/// Flush the ranges written since the last flush of the dirty ranges to make them visible to the device,
+	/// sorted and merged, in one call to vkFlushMappedMemoryRanges.
+	/// </summary>
+	VkResult Buffer::flushDirtyRanges()
+	{
+		if (dirtyRanges_.empty())
+			return VK_SUCCESS;
+
+		std::sort(dirtyRanges_.begin(), dirtyRanges_.end(), [](const DirtyRange& a, const DirtyRange& b)
+			{
+				return a.begin < b.begin;
+			});
+
+		std::vector<VkMappedMemoryRange> mappedRanges;
+		for (const DirtyRange& dirty : dirtyRanges_)
+		{
+			const VkDeviceSize begin = memory_.offset + dirty.begin;
+			const VkDeviceSize end = memory_.offset + dirty.end;
+			if (!mappedRanges.empty() && begin <= mappedRanges.back().offset + mappedRanges.back().size)
+			{
+				mappedRanges.back().size = std::max(mappedRanges.back().offset + mappedRanges.back().size, end) - mappedRanges.back().offset;
+				continue;
+			}
+
+			VkMappedMemoryRange mappedRange = {};
+			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			mappedRange.memory = memory_.memory;
+			mappedRange.offset = begin;
+			mappedRange.size = end - begin;
+			mappedRanges.push_back(mappedRange);
+		}
+		dirtyRanges_.clear();
+
+		return vkFlushMappedMemoryRanges(device_.device(), static_cast<uint32_t>(mappedRanges.size()), mappedRanges.data());
+	}
+
+	/// <summary>
+	/// Remove "range" from the dirty ranges, once it was flushed or invalidated by itself. Ranges it only covers partly are trimmed.
+	/// </summary>
+	void Buffer::dropDirtyRanges(const VkMappedMemoryRange& range)
+	{
+		const VkDeviceSize begin = range.offset - memory_.offset;
+		const VkDeviceSize end = begin + range.size;
+
+		std::vector<DirtyRange> remaining;
+		for (const DirtyRange& dirty : dirtyRanges_)
+		{
+			if (dirty.end <= begin || dirty.begin >= end)
+			{
+				remaining.push_back(dirty);
+				continue;
+			}
+			// The parts before and after the range are still dirty
+			if (dirty.begin < begin)
+				remaining.push_back({ dirty.begin, begin });
+			if (dirty.end > end)
+				remaining.push_back({ end, dirty.end });
+		}
+		dirtyRanges_ = std::move(remaining);
+	}
+
+	VkMappedMemoryRange Buffer::getMappedRange(VkDeviceSize size, VkDeviceSize offset) const
+	{
+		if (size == VK_WHOLE_SIZE)
+			size = bufferSize_ - offset;
+
+		// The allocation starts at a whole atom and is padded to whole atoms, so growing the range stays inside of it
+		const VkDeviceSize atomSize = device_.properties.limits.nonCoherentAtomSize;
+		const VkDeviceSize begin = offset / atomSize * atomSize;
+		const VkDeviceSize end = std::min((offset + size + atomSize - 1) / atomSize * atomSize, memory_.size);
+
 		VkMappedMemoryRange mappedRange = {};
 		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = memory_;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
-		return vkInvalidateMappedMemoryRanges(device_.device(), 1, &mappedRange);
+		mappedRange.memory = memory_.memory;
+		mappedRange.offset = memory_.offset + begin;
+		mappedRange.size = end - begin;
+		return mappedRange;
 	}
 
 	/// <summary>
@@ -3,6 +3,8 @@
 
 #include "device.h"
 
+#include <vector>
+
 namespace aito
 {
 
@@ -25,11 +27,21 @@ namespace aito
 		void unmap();
 
 		void writeToBuffer(void* data, VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
+		// Flushing or invalidating a range also takes it out of the dirty ranges
 		VkResult flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 		VkDescriptorBufferInfo descriptorInfo(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 		VkResult invalidate(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 
 		void writeToIndex(void* data, int index);
+		/// <summary>
+		/// Records a range written through getMappedMemory() for flushDirtyRanges(). The writes of writeToBuffer and writeToIndex are recorded already.
+		/// </summary>
+		void markDirty(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
+		/// <summary>
+		/// Flushes every range written since the last call in a single driver call, with touching and overlapping ranges merged.
+		/// Does nothing for host coherent memory.
+		/// </summary>
+		VkResult flushDirtyRanges();
 		VkResult flushIndex(int index);
 		VkDescriptorBufferInfo descriptorInfoForIndex(int index);
 		VkResult invalidateIndex(int index);
@@ -42,14 +54,31 @@ namespace aito
 		inline VkBufferUsageFlags getUsageFlags() const { return usageFlags_; }
 		inline VkMemoryPropertyFlags getMemoryPropertyFlags() const { return memoryPropertyFlags_; }
 		inline VkDeviceSize getBufferSize() const { return bufferSize_; }
+		// Whether the memory the buffer ended up in needs no flushing or invalidating
+		inline bool isCoherent() const { return (memory_.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0; }
+		inline size_t getDirtyRangeCount() const { return dirtyRanges_.size(); }
 
 	private:
+		// A range of the buffer, in whole non-coherent atoms
+		struct DirtyRange
+		{
+			VkDeviceSize begin;
+			VkDeviceSize end;
+		};
+
 		static VkDeviceSize getAlignment(VkDeviceSize instanceSize, VkDeviceSize minOffsetAlignment);
+		/// <summary>
+		/// The range of the memory covering "size" bytes at "offset" in the buffer, grown to whole non-coherent atoms.
+		/// </summary>
+		VkMappedMemoryRange getMappedRange(VkDeviceSize size, VkDeviceSize offset) const;
+		void dropDirtyRanges(const VkMappedMemoryRange& range);
 
 		Device& device_;
 		void* mapped_ = nullptr;
+		// Where mapped_ points in the buffer
+		VkDeviceSize mappedOffset_ = 0;
 		VkBuffer buffer_ = VK_NULL_HANDLE;
-		VkDeviceMemory memory_ = VK_NULL_HANDLE;
+		MemoryAllocator::Allocation memory_{};
 
 		VkDeviceSize bufferSize_;
 		uint32_t instanceCount_;
@@ -57,6 +86,8 @@ namespace aito
 		VkDeviceSize alignmentSize_;
 		VkBufferUsageFlags usageFlags_;
 		VkMemoryPropertyFlags memoryPropertyFlags_;
+
+		std::vector<DirtyRange> dirtyRanges_;
 	};
 
 }
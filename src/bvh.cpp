@@ -0,0 +1,472 @@
+#include "pch.h"
+
+#include "bvh.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+
+namespace aito
+{
+
+namespace
+{
+
+struct CentroidBoundsResult
+{
+	Bounds3f bounds{};
+	Bounds3f centroidBounds{};
+};
+
+struct BucketInfo
+{
+	uint32_t count = 0;
+	Bounds3f bounds{};
+};
+
+/// <summary>
+/// Stable partition of [first, last) split across threads. Gives exactly the same order as std::stable_partition.
+/// </summary>
+template<typename T, typename Predicate>
+uint32_t parallel_stable_partition(std::vector<T>& data, uint32_t first, uint32_t last, int threadCount, const Predicate& pred)
+{
+	const int chunks = chunk_count(last - first, BVHAccel::PARALLEL_SUBTREE_THRESHOLD, threadCount);
+	std::vector<uint32_t> trueCounts(chunks, 0);
+
+	// Count the elements going to the front in each chunk
+	parallel_for_chunks(first, last, BVHAccel::PARALLEL_SUBTREE_THRESHOLD, threadCount,
+		[&](uint32_t begin, uint32_t end, int chunk)
+		{
+			uint32_t count = 0;
+			for (uint32_t i = begin; i < end; i++)
+				count += pred(data[i]) ? 1 : 0;
+			trueCounts[chunk] = count;
+		});
+
+	uint32_t totalTrue = 0;
+	for (const uint32_t count : trueCounts)
+		totalTrue += count;
+
+	// Scatter every chunk into its place, keeping the relative order within both halves
+	std::vector<T> partitioned(last - first);
+	parallel_for_chunks(first, last, BVHAccel::PARALLEL_SUBTREE_THRESHOLD, threadCount,
+		[&](uint32_t begin, uint32_t end, int chunk)
+		{
+			uint32_t trueOffset = 0;
+			for (int i = 0; i < chunk; i++)
+				trueOffset += trueCounts[i];
+			uint32_t falseOffset = totalTrue + (begin - first) - trueOffset;
+
+			for (uint32_t i = begin; i < end; i++)
+			{
+				if (pred(data[i]))
+					partitioned[trueOffset++] = data[i];
+				else
+					partitioned[falseOffset++] = data[i];
+			}
+		});
+
+	parallel_for_chunks(first, last, BVHAccel::PARALLEL_SUBTREE_THRESHOLD, threadCount,
+		[&](uint32_t begin, uint32_t end, int)
+		{
+			std::copy(partitioned.begin() + (begin - first), partitioned.begin() + (end - first), data.begin() + begin);
+		});
+
+	return first + totalTrue;
+}
+
+}
+
+BVHAccel::BVHAccel(std::vector<Triangle> primitives, int maxPrimsInNode, int buildThreads)
+	: maxPrimsInNode_(std::clamp(maxPrimsInNode, 1, 255)), primitives_(std::move(primitives))
+{
+	if (primitives_.empty())
+		return;
+
+	const auto startTime = std::chrono::steady_clock::now();
+
+	BuildState state{};
+	state.threadCount = buildThreads > 0 ? buildThreads : available_cores();
+	// The calling thread counts as one of the build threads
+	state.freeThreads = state.threadCount - 1;
+
+	const uint32_t primitiveCount = static_cast<uint32_t>(primitives_.size());
+
+	// Initialize the primitive info array
+	std::vector<BVHPrimitiveInfo> primitiveInfo(primitiveCount);
+	parallel_for_chunks(0, primitiveCount, PARALLEL_SUBTREE_THRESHOLD, state.threadCount,
+		[&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const Bounds3f bounds = primitives_[i].world_bound();
+				primitiveInfo[i] = { i, bounds, Point3f(0.5f * bounds.p_min + 0.5f * bounds.p_max) };
+			}
+		});
+
+	// A binary tree over n primitives has at most 2n - 1 nodes
+	nodes_.reserve(2 * static_cast<size_t>(primitiveCount) - 1);
+	recursive_build(state, primitiveInfo, 0, primitiveCount, 0, nodes_);
+	nodes_.shrink_to_fit();
+
+	// Reorder the primitives, so the leaves reference contiguous ranges
+	std::vector<Triangle> orderedPrimitives(primitiveCount, primitives_[0]);
+	parallel_for_chunks(0, primitiveCount, PARALLEL_SUBTREE_THRESHOLD, state.threadCount,
+		[&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t i = begin; i < end; i++)
+				orderedPrimitives[i] = primitives_[primitiveInfo[i].primitive_number];
+		});
+	primitives_.swap(orderedPrimitives);
+
+	const float buildTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+	AITO_INFO("BVH created with {} nodes for {} primitives ({:.2f} MB) in {:.1f} ms using {} threads",
+			  nodes_.size(), primitives_.size(), memory_usage() / (1024.0f * 1024.0f), buildTime, state.threadCount);
+}
+
+uint32_t BVHAccel::append_subtree(std::vector<LinearBVHNode>& nodes, const std::vector<LinearBVHNode>& subtree)
+{
+	const uint32_t base = static_cast<uint32_t>(nodes.size());
+	nodes.insert(nodes.end(), subtree.begin(), subtree.end());
+	for (size_t i = base; i < nodes.size(); i++)
+	{
+		if (nodes[i].n_primitives == 0)
+			nodes[i].second_child_offset += base;
+	}
+	return base;
+}
+
+uint32_t BVHAccel::recursive_build(
+	BuildState& state,
+	std::vector<BVHPrimitiveInfo>& primitiveInfo,
+	uint32_t start,
+	uint32_t end,
+	int depth,
+	std::vector<LinearBVHNode>& nodes) const
+{
+	assert(start < end && "Cannot build a BVH node over zero primitives");
+
+	const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	const uint32_t nPrimitives = end - start;
+
+	// Only split the reductions of the top levels. Deeper down there are already subtrees running in parallel.
+	const int reductionThreads = nPrimitives >= PARALLEL_REDUCTION_THRESHOLD ? std::max(1, state.threadCount >> depth) : 1;
+
+	// Compute the bounds of all primitives in the node, and the bounds of their centroids
+	std::vector<CentroidBoundsResult> boundsResults(chunk_count(nPrimitives, PARALLEL_SUBTREE_THRESHOLD, reductionThreads));
+	parallel_for_chunks(start, end, PARALLEL_SUBTREE_THRESHOLD, reductionThreads,
+		[&](uint32_t begin, uint32_t chunkEnd, int chunk)
+		{
+			CentroidBoundsResult result{};
+			for (uint32_t i = begin; i < chunkEnd; i++)
+			{
+				result.bounds = bounds_union(result.bounds, primitiveInfo[i].bounds);
+				result.centroidBounds = bounds_union(result.centroidBounds, primitiveInfo[i].centroid);
+			}
+			boundsResults[chunk] = result;
+		});
+
+	Bounds3f bounds{};
+	Bounds3f centroidBounds{};
+	for (const auto& result : boundsResults)
+	{
+		bounds = bounds_union(bounds, result.bounds);
+		centroidBounds = bounds_union(centroidBounds, result.centroidBounds);
+	}
+
+	const auto makeLeaf = [&]()
+	{
+		assert(nPrimitives <= static_cast<uint32_t>(maxPrimsInNode_) && "A leaf holds more primitives than allowed");
+		LinearBVHNode& node = nodes[nodeIndex];
+		node.bounds = bounds;
+		node.primitives_offset = start;
+		node.n_primitives = static_cast<uint16_t>(nPrimitives);
+		node.axis = 0;
+		return nodeIndex;
+	};
+
+	// A single primitive always fits, since maxPrimsInNode_ is at least one
+	if (nPrimitives == 1)
+		return makeLeaf();
+
+	const size_t dim = centroidBounds.maximum_extent();
+
+	// Leaves hold at most maxPrimsInNode_ primitives, however many of them are forced into one spot
+	const uint32_t maxPrims = static_cast<uint32_t>(maxPrimsInNode_);
+	uint32_t mid;
+
+	// If all the centroids are in the same position, there is no sensible way to split the primitives.
+	// Too many of them for a leaf are split down the middle of the range, like pbrt does.
+	if (centroidBounds.p_max[dim] == centroidBounds.p_min[dim])
+	{
+		if (nPrimitives <= maxPrims)
+			return makeLeaf();
+		mid = start + nPrimitives / 2;
+	}
+	else
+	{
+		// Bin the primitives by their centroid along the split axis
+		const auto bucketIndex = [&](const BVHPrimitiveInfo& info)
+		{
+			const int b = static_cast<int>(SAH_BUCKET_COUNT * centroidBounds.offset(info.centroid)[dim]);
+			return std::min(b, SAH_BUCKET_COUNT - 1);
+		};
+
+		std::vector<std::array<BucketInfo, SAH_BUCKET_COUNT>> chunkBuckets(chunk_count(nPrimitives, PARALLEL_SUBTREE_THRESHOLD, reductionThreads));
+		parallel_for_chunks(start, end, PARALLEL_SUBTREE_THRESHOLD, reductionThreads,
+			[&](uint32_t begin, uint32_t chunkEnd, int chunk)
+			{
+				std::array<BucketInfo, SAH_BUCKET_COUNT>& chunkBucket = chunkBuckets[chunk];
+				for (uint32_t i = begin; i < chunkEnd; i++)
+				{
+					BucketInfo& bucket = chunkBucket[bucketIndex(primitiveInfo[i])];
+					bucket.count++;
+					bucket.bounds = bounds_union(bucket.bounds, primitiveInfo[i].bounds);
+				}
+			});
+
+		std::array<BucketInfo, SAH_BUCKET_COUNT> buckets{};
+		for (const auto& chunkBucket : chunkBuckets)
+		{
+			for (int i = 0; i < SAH_BUCKET_COUNT; i++)
+			{
+				buckets[i].count += chunkBucket[i].count;
+				buckets[i].bounds = bounds_union(buckets[i].bounds, chunkBucket[i].bounds);
+			}
+		}
+
+		// Sweep from the right to get the area and count of everything above each split
+		std::array<Float, SAH_BUCKET_COUNT - 1> areaAbove{};
+		std::array<uint32_t, SAH_BUCKET_COUNT - 1> countAbove{};
+		{
+			Bounds3f b{};
+			uint32_t count = 0;
+			for (int i = SAH_BUCKET_COUNT - 1; i > 0; i--)
+			{
+				b = bounds_union(b, buckets[i].bounds);
+				count += buckets[i].count;
+				areaAbove[i - 1] = b.surface_area();
+				countAbove[i - 1] = count;
+			}
+		}
+
+		// Sweep from the left, and find the split with the lowest SAH cost
+		int minCostSplitBucket = -1;
+		Float minCost = Infinity;
+		{
+			Bounds3f b{};
+			uint32_t count = 0;
+			for (int i = 0; i < SAH_BUCKET_COUNT - 1; i++)
+			{
+				b = bounds_union(b, buckets[i].bounds);
+				count += buckets[i].count;
+
+				// Splits with an empty side are not splits at all
+				if (count == 0 || countAbove[i] == 0)
+					continue;
+
+				const Float cost = count * b.surface_area() + countAbove[i] * areaAbove[i];
+				if (cost < minCost)
+				{
+					minCost = cost;
+					minCostSplitBucket = i;
+				}
+			}
+		}
+
+		// The cost of a leaf is one intersection test per primitive
+		const Float leafCost = static_cast<Float>(nPrimitives);
+		const Float surfaceArea = bounds.surface_area();
+		minCost = surfaceArea > 0 ? SAH_TRAVERSAL_COST + minCost / surfaceArea : SAH_TRAVERSAL_COST;
+
+		if (minCostSplitBucket < 0 || (nPrimitives <= maxPrims && minCost >= leafCost))
+		{
+			if (nPrimitives <= maxPrims)
+				return makeLeaf();
+
+			// The buckets cannot tell the primitives apart, but they are too many for a leaf: split at the median centroid
+			mid = start + nPrimitives / 2;
+			std::nth_element(primitiveInfo.begin() + start, primitiveInfo.begin() + mid, primitiveInfo.begin() + end,
+				[dim](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) { return a.centroid[dim] < b.centroid[dim]; });
+		}
+		else
+		{
+			// Partition the primitives around the chosen split.
+			// The partition is stable, so the serial and the parallel partition produce the same order.
+			const auto belowSplit = [&](const BVHPrimitiveInfo& info) { return bucketIndex(info) <= minCostSplitBucket; };
+			if (reductionThreads > 1)
+			{
+				mid = parallel_stable_partition(primitiveInfo, start, end, reductionThreads, belowSplit);
+			}
+			else
+			{
+				const auto midIt = std::stable_partition(primitiveInfo.begin() + start, primitiveInfo.begin() + end, belowSplit);
+				mid = static_cast<uint32_t>(midIt - primitiveInfo.begin());
+			}
+		}
+	}
+
+	// Hand the first child to another thread if both children are big enough and a thread is free
+	bool spawnThread = false;
+	if (std::min(mid - start, end - mid) >= PARALLEL_SUBTREE_THRESHOLD)
+	{
+		int freeThreads = state.freeThreads.load();
+		while (freeThreads > 0 && !state.freeThreads.compare_exchange_weak(freeThreads, freeThreads - 1))
+		{}
+		spawnThread = freeThreads > 0;
+	}
+
+	uint32_t secondChild;
+	if (spawnThread)
+	{
+		// Both subtrees are built into their own node arrays, and appended in depth-first order afterwards.
+		std::vector<LinearBVHNode> firstNodes;
+		std::vector<LinearBVHNode> secondNodes;
+		firstNodes.reserve(2 * static_cast<size_t>(mid - start) - 1);
+		secondNodes.reserve(2 * static_cast<size_t>(end - mid) - 1);
+
+		std::thread firstThread([&]()
+			{
+				recursive_build(state, primitiveInfo, start, mid, depth + 1, firstNodes);
+				state.freeThreads++;
+			});
+		recursive_build(state, primitiveInfo, mid, end, depth + 1, secondNodes);
+		firstThread.join();
+
+		append_subtree(nodes, firstNodes);
+		secondChild = append_subtree(nodes, secondNodes);
+	}
+	else
+	{
+		// The first child directly follows its parent, so only the second child offset is stored.
+		recursive_build(state, primitiveInfo, start, mid, depth + 1, nodes);
+		secondChild = recursive_build(state, primitiveInfo, mid, end, depth + 1, nodes);
+	}
+
+	LinearBVHNode& node = nodes[nodeIndex];
+	node.bounds = bounds;
+	node.second_child_offset = secondChild;
+	node.n_primitives = 0;
+	node.axis = static_cast<uint8_t>(dim);
+	return nodeIndex;
+}
+
+Bounds3f BVHAccel::world_bound() const
+{
+	return nodes_.empty() ? Bounds3f() : nodes_[0].bounds;
+}
+
+bool BVHAccel::intersect(const Ray& ray, SurfaceInteraction* isect) const
+{
+	if (nodes_.empty())
+		return false;
+
+	bool hit = false;
+	const Vec3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+	const int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	// Follow the ray through the BVH nodes to find primitive intersections
+	uint32_t toVisitOffset = 0, currentNodeIndex = 0;
+	uint32_t nodesToVisit[64];
+	while (true)
+	{
+		const LinearBVHNode* node = &nodes_[currentNodeIndex];
+		if (node->bounds.intersect_p(ray, invDir, dirIsNeg))
+		{
+			if (node->n_primitives > 0)
+			{
+				// Intersect the ray with the primitives in the leaf
+				for (uint32_t i = 0; i < node->n_primitives; i++)
+				{
+					Float tHit;
+					if (primitives_[node->primitives_offset + i].intersect(ray, &tHit, isect))
+					{
+						hit = true;
+						ray.t_max = tHit;
+					}
+				}
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			else
+			{
+				// Visit the near child first, so the far child is more likely to be culled by the shortened ray
+				if (dirIsNeg[node->axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node->second_child_offset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node->second_child_offset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+		else
+		{
+			if (toVisitOffset == 0) break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+	}
+
+	return hit;
+}
+
+bool BVHAccel::intersect_p(const Ray& ray) const
+{
+	if (nodes_.empty())
+		return false;
+
+	const Vec3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+	const int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	uint32_t toVisitOffset = 0, currentNodeIndex = 0;
+	uint32_t nodesToVisit[64];
+	while (true)
+	{
+		const LinearBVHNode* node = &nodes_[currentNodeIndex];
+		if (node->bounds.intersect_p(ray, invDir, dirIsNeg))
+		{
+			if (node->n_primitives > 0)
+			{
+				for (uint32_t i = 0; i < node->n_primitives; i++)
+				{
+					if (primitives_[node->primitives_offset + i].intersect_p(ray))
+						return true;
+				}
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			else
+			{
+				if (dirIsNeg[node->axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node->second_child_offset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node->second_child_offset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+		else
+		{
+			if (toVisitOffset == 0) break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+	}
+
+	return false;
+}
+
+}  // namespace aito
@@ -0,0 +1,120 @@
+#ifndef AITO_BVH_H
+#define AITO_BVH_H
+
+#include "aito.h"
+
+#include "bounds.h"
+#include "triangle.h"
+#include "interaction.h"
+
+#include <vector>
+#include <atomic>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Node of the flattened BVH. The nodes are stored in depth-first order, so the first child of an interior node
+/// is always the node directly after it, and only the offset of the second child has to be stored.
+/// </summary>
+struct LinearBVHNode
+{
+	Bounds3f bounds;
+	union
+	{
+		uint32_t primitives_offset;		// leaf
+		uint32_t second_child_offset;	// interior
+	};
+	// 0 for interior nodes
+	uint16_t n_primitives;
+	// The axis the primitives were partitioned along (interior nodes only)
+	uint8_t axis;
+	uint8_t pad[1];
+};
+#ifndef AITO_FLOAT_AS_DOUBLE
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes, so two nodes fit in a cache line");
+#endif
+
+/// <summary>
+/// Bounding volume hierarchy over triangles, built using the surface area heuristic with binned splits.
+/// The build is multithreaded: the bounds and bin reductions of the top levels are split across threads,
+/// and large enough subtrees are built on their own threads. The result does not depend on the thread count.
+/// </summary>
+class BVHAccel
+{
+public:
+	static constexpr int SAH_BUCKET_COUNT = 12;
+	static constexpr Float SAH_TRAVERSAL_COST = 0.125f;
+
+	// Nodes with at least this many primitives split their reductions and partitioning across threads.
+	static constexpr uint32_t PARALLEL_REDUCTION_THRESHOLD = 1 << 15;
+	// Both children need at least this many primitives before one of them is handed to another thread.
+	static constexpr uint32_t PARALLEL_SUBTREE_THRESHOLD = 1 << 12;
+
+	/// <summary>
+	/// Builds the BVH. "buildThreads" is the maximum number of threads used for the build, 0 uses all available cores.
+	/// </summary>
+	BVHAccel(std::vector<Triangle> primitives, int maxPrimsInNode = 4, int buildThreads = 0);
+
+	BVHAccel(const BVHAccel&) = delete;
+	BVHAccel& operator=(const BVHAccel&) = delete;
+
+	[[nodiscard]] Bounds3f world_bound() const;
+
+	/// <summary>
+	/// Finds the closest intersection along the ray. On a hit "ray.t_max" is set to the distance of the hit and "isect" is filled in.
+	/// </summary>
+	bool intersect(const Ray& ray, SurfaceInteraction* isect) const;
+	/// <summary>
+	/// Checks if the ray hits anything before "ray.t_max". Terminates at the first hit found (any-hit query).
+	/// </summary>
+	[[nodiscard]] bool intersect_p(const Ray& ray) const;
+
+	[[nodiscard]] inline const std::vector<LinearBVHNode>& nodes() const { return nodes_; }
+	[[nodiscard]] inline const std::vector<Triangle>& primitives() const { return primitives_; }
+	[[nodiscard]] inline size_t memory_usage() const { return nodes_.size() * sizeof(LinearBVHNode) + primitives_.size() * sizeof(Triangle); }
+
+private:
+	struct BVHPrimitiveInfo
+	{
+		uint32_t primitive_number;
+		Bounds3f bounds;
+		Point3f centroid;
+	};
+
+	struct BuildState
+	{
+		int threadCount;
+		// The number of threads that may still be started for subtrees.
+		std::atomic<int> freeThreads;
+	};
+
+	const int maxPrimsInNode_;
+	std::vector<Triangle> primitives_;
+	std::vector<LinearBVHNode> nodes_;
+
+	/// <summary>
+	/// Builds the subtree over primitiveInfo[start, end) and appends its nodes to "nodes" in depth-first order.
+	/// The primitive info is stably partitioned in place, so leaves reference ranges of the final primitive order.
+	/// </summary>
+	/// <returns>The index of the root node of the subtree. </returns>
+	uint32_t recursive_build(
+		BuildState& state,
+		std::vector<BVHPrimitiveInfo>& primitiveInfo,
+		uint32_t start,
+		uint32_t end,
+		int depth,
+		std::vector<LinearBVHNode>& nodes) const;
+
+	/// <summary>
+	/// Appends a subtree that was built into its own node array, and offsets its child indices accordingly.
+	/// </summary>
+	/// <returns>The index of the root of the appended subtree. </returns>
+	static uint32_t append_subtree(std::vector<LinearBVHNode>& nodes, const std::vector<LinearBVHNode>& subtree);
+};
+
+}  // namespace aito
+
+
+#endif // AITO_BVH_H
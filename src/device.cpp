@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "device.h"
+#include "upload_manager.h"
 
 #include <cstring>
 #include <iostream>
@@ -92,15 +93,21 @@ namespace aito
 		pickPhysicalDevice();
 		AITO_INFO("Creating logical device");
 		createLogicalDevice();
+		allocator_ = std::make_unique<MemoryAllocator>(device_, physicalDevice_, properties);
 		AITO_INFO("Creating command pool");
 		createCommandPool();
+		uploads_ = std::make_unique<UploadManager>(*this);
 	}
 
 	Device::~Device()
 	{
 		// Do the cleanup in the right order.
 
+		// Waits for the last uploads, and gives back the staging memory
+		uploads_.reset();
 		vkDestroyCommandPool(device_, commandPool_, nullptr);
+		// Every buffer and image must be destroyed by now
+		allocator_.reset();
 		vkDestroyDevice(device_, nullptr);
 
 		// The DebugMessenger should only be destroyed if it was created in the first place.
@@ -267,6 +274,8 @@ namespace aito
 
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+		if (indices.transferFamily.has_value())
+			uniqueQueueFamilies.insert(indices.transferFamily.value());
 
 		float queuePriority = 1.0f;
 		for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -281,7 +290,14 @@ namespace aito
 		}
 
 		// Declare used device features
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice_, &supportedFeatures);
+
 		VkPhysicalDeviceFeatures deviceFeatures{};
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+		// Without it, every indirect command is drawn by a call of its own
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		enabledFeatures = deviceFeatures;
 
 		// Declare the locial device create info
 		VkDeviceCreateInfo createInfo{};
@@ -321,6 +337,17 @@ namespace aito
 		vkGetDeviceQueue(device_, indices.graphicsFamily.value(), 0, &graphicsQueue_);
 		// Set the presentation queue
 		vkGetDeviceQueue(device_, indices.presentFamily.value(), 0, &presentQueue_);
+		// Set the transfer queue. Software implementations like lavapipe have a single family, and transfer on the graphics queue.
+		if (indices.transferFamily.has_value())
+		{
+			vkGetDeviceQueue(device_, indices.transferFamily.value(), 0, &transferQueue_);
+			AITO_INFO("Using the dedicated transfer queue family {}", indices.transferFamily.value());
+		}
+		else
+		{
+			transferQueue_ = graphicsQueue_;
+			AITO_INFO("No dedicated transfer queue family, transferring on the graphics queue");
+		}
 	}
 
 	/// <summary>
@@ -385,7 +412,9 @@ namespace aito
 		VkPhysicalDeviceFeatures supportedFeatures;
 		vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-		return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+		// The culling pass writes the object index of every draw to its firstInstance
+		return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy
+			&& supportedFeatures.drawIndirectFirstInstance;
 	}
 
 	/// <summary>
@@ -583,7 +612,7 @@ namespace aito
 		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
 		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
-		// Find a queue family that supports "VK_QUEUE_GRAPHICS_BIT"
+		// Find a queue family that supports "VK_QUEUE_GRAPHICS_BIT" and "VK_QUEUE_COMPUTE_BIT", so the culling pass can run in the same command buffer
 		int i = 0;
 		for (const auto& queueFamily : queueFamilies)
 		{
@@ -591,7 +620,7 @@ namespace aito
 			// Get the surface support of the device
 			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
 
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
 			{
 				indices.graphicsFamily = i;
 			}
@@ -607,6 +636,20 @@ namespace aito
 			i++;
 		}
 
+		// Find a family that only transfers, so uploads run on the DMA engines alongside the rendering
+		i = 0;
+		for (const auto& queueFamily : queueFamilies)
+		{
+			const VkQueueFlags flags = queueFamily.queueFlags;
+			if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && queueFamily.queueCount > 0)
+			{
+				indices.transferFamily = i;
+				break;
+			}
+
+			i++;
+		}
+
 		return indices;
 	}
 
@@ -721,13 +764,13 @@ namespace aito
 	/// <param name="usage">: Usage bitmask of the buffer. </param>
 	/// <param name="properties">: The required properties of the memory visible to the physical device. </param>
 	/// <param name="buffer">: The buffer reference that will be written to. </param>
-	/// <param name="bufferMemory">: The buffer device memory that will be written to. </param>
+	/// <param name="bufferMemory">: The allocation the buffer is bound to, which must be freed through allocator() with the buffer. </param>
 	void Device::createBuffer(
 		VkDeviceSize size,
 		VkBufferUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkBuffer& buffer,
-		VkDeviceMemory& bufferMemory)
+		MemoryAllocator::Allocation& bufferMemory)
 	{
 		// Create the bufferinfo struct and populate it.
 		VkBufferCreateInfo bufferInfo{};
@@ -743,25 +786,18 @@ namespace aito
 			throw std::runtime_error("failed to create buffer!");
 		}
 
-		// Allocate memory on the physical device and bind the buffer to the memory 
+		// Sub-allocate memory on the physical device and bind the buffer to the memory 
 		// (The buffer is CPU side, so the memory has to be synced to the GPU visible memory)
 		VkMemoryRequirements memRequirements;
 		vkGetBufferMemoryRequirements(device_, buffer, &memRequirements);
 
-		// Create the allocation info struct.
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+		bufferMemory = allocator_->allocate(memRequirements, properties, true);
 
-		// Attempt to allocate memory on the physical device.
-		if (vkAllocateMemory(device_, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+		// Bind the created buffer to its range of the shared memory block.
+		if (vkBindBufferMemory(device_, buffer, bufferMemory.memory, bufferMemory.offset) != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to allocate buffer memory!");
+			throw std::runtime_error("failed to bind buffer memory!");
 		}
-
-		// Bind the created buffer to the allocated memory without any offset. Memory management for creating offsets will be added later.
-		vkBindBufferMemory(device_, buffer, bufferMemory, 0);
 	}
 
 	/// <summary>
@@ -814,15 +850,17 @@ namespace aito
 	/// <param name="srcBuffer">: The source buffer. </param>
 	/// <param name="dstBuffer">: The destination buffer. </param>
 	/// <param name="size">: The size of the region to be copied. </param>
-	void Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+	/// <param name="srcOffset">: Where the region starts in the source buffer. </param>
+	/// <param name="dstOffset">: Where the region is copied to in the destination buffer. </param>
+	void Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
 	{
 		// Create a single use command to copy the contents
 		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
 		// Create the copy buffer info and populate it.
 		VkBufferCopy copyRegion{};
-		copyRegion.srcOffset = 0;  // Optional
-		copyRegion.dstOffset = 0;  // Optional
+		copyRegion.srcOffset = srcOffset;
+		copyRegion.dstOffset = dstOffset;
 		copyRegion.size = size;
 		// Submit the command to copy the buffer to.
 		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
@@ -879,12 +917,12 @@ namespace aito
 	/// <param name="imageInfo">: The create info of the image. </param>
 	/// <param name="properties">: The property bitmask for the memory used to store the image. </param>
 	/// <param name="image">: The reference the VkImage will be written to. </param>
-	/// <param name="imageMemory">: The reference the image memory will be written to. </param>
+	/// <param name="imageMemory">: The allocation the image is bound to, which must be freed through allocator() with the image. </param>
 	void Device::createImageWithInfo(
 		const VkImageCreateInfo& imageInfo,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory)
+		MemoryAllocator::Allocation& imageMemory)
 	{
 		// First. Attemt to create the image itself. 
 		if (vkCreateImage(device_, &imageInfo, nullptr, &image) != VK_SUCCESS)
@@ -896,20 +934,11 @@ namespace aito
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(device_, image, &memRequirements);
 
-		// Create the memory allocation info and populate it.
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		// Get the index of the memory.
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+		// Sub-allocate the memory. Optimally tiled images must be kept apart from buffers (bufferImageGranularity).
+		imageMemory = allocator_->allocate(memRequirements, properties, imageInfo.tiling == VK_IMAGE_TILING_LINEAR);
 
-		// Attempt to allocate the memory.
-		if (vkAllocateMemory(device_, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to allocate image memory!");
-		}
 		// Attempt to bind the memory to the image.
-		if (vkBindImageMemory(device_, image, imageMemory, 0) != VK_SUCCESS)
+		if (vkBindImageMemory(device_, image, imageMemory.memory, imageMemory.offset) != VK_SUCCESS)
 		{
 			throw std::runtime_error("failed to bind image memory!");
 		}
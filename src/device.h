@@ -5,14 +5,18 @@
 #include <string>
 #include <vector>
 #include <optional>
+#include <memory>
 
 #include "imgui_impl_vulkan.h"
 
 #include "window.h"
+#include "memory_allocator.h"
 
 
 namespace aito
 {
+	class UploadManager;
+
 	/// <summary>
 	/// Struct for storing the support details of a swap chain.
 	/// </summary>
@@ -30,6 +34,8 @@ namespace aito
 	{
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		// A family that can only transfer, backed by the DMA engines of discrete GPUs. Empty if the device has none.
+		std::optional<uint32_t> transferFamily;
 
 		inline bool isComplete() { return graphicsFamily.has_value() && presentFamily.has_value(); }
 	};
@@ -57,6 +63,16 @@ namespace aito
 		VkSurfaceKHR surface() { return surface_; }
 		VkQueue graphicsQueue() { return graphicsQueue_; }
 		VkQueue presentQueue() { return presentQueue_; }
+		// The dedicated transfer queue, or the graphics queue if the device has none
+		VkQueue transferQueue() { return transferQueue_; }
+		uint32_t graphicsQueueFamily() const { return queueFamilyIndices_.graphicsFamily.value(); }
+		uint32_t transferQueueFamily() const { return queueFamilyIndices_.transferFamily.value_or(queueFamilyIndices_.graphicsFamily.value()); }
+		// Whether resources copied on the transfer queue have to change queue family before the graphics queue uses them
+		bool hasDedicatedTransferQueue() const { return queueFamilyIndices_.transferFamily.has_value(); }
+		// Hands out the memory of all buffers and images
+		MemoryAllocator& allocator() { return *allocator_; }
+		// Batches the copies from the host to device local buffers
+		UploadManager& uploads() { return *uploads_; }
 
 		void populateImGui_initInfo(ImGui_ImplVulkan_InitInfo& init_info);
 
@@ -77,10 +93,10 @@ namespace aito
 			VkBufferUsageFlags usage,
 			VkMemoryPropertyFlags properties,
 			VkBuffer& buffer,
-			VkDeviceMemory& bufferMemory);
+			MemoryAllocator::Allocation& bufferMemory);
 		VkCommandBuffer beginSingleTimeCommands();
 		void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-		void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+		void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
 		void copyBufferToImage(
 			VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
 
@@ -88,9 +104,11 @@ namespace aito
 			const VkImageCreateInfo& imageInfo,
 			VkMemoryPropertyFlags properties,
 			VkImage& image,
-			VkDeviceMemory& imageMemory);
+			MemoryAllocator::Allocation& imageMemory);
 
 		VkPhysicalDeviceProperties properties;
+		// The features the logical device was created with
+		VkPhysicalDeviceFeatures enabledFeatures{};
 
 	private:
 		void createInstance();
@@ -121,9 +139,13 @@ namespace aito
 		VkSurfaceKHR surface_;
 		VkQueue graphicsQueue_;
 		VkQueue presentQueue_;
+		VkQueue transferQueue_;
 
 		QueueFamilyIndices queueFamilyIndices_;
 
+		std::unique_ptr<MemoryAllocator> allocator_;
+		std::unique_ptr<UploadManager> uploads_;
+
 		const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
 		const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 	};
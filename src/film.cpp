@@ -0,0 +1,226 @@
+#include "pch.h"
+
+#include "film.h"
+
+#include <algorithm>
+
+
+namespace aito
+{
+
+Float Filter::evaluate(const Point2f& p) const
+{
+	if (std::abs(p.x) > radius.x || std::abs(p.y) > radius.y)
+		return 0;
+
+	switch (type)
+	{
+	case Type::Box:
+		return 1;
+	case Type::Triangle:
+		return std::max<Float>(0, radius.x - std::abs(p.x)) * std::max<Float>(0, radius.y - std::abs(p.y));
+	case Type::Gaussian:
+	{
+		// Subtract the value at the radius, so the filter goes to zero at its edge
+		const auto gaussian = [&](Float d, Float r) { return std::max<Float>(0, std::exp(-alpha * d * d) - std::exp(-alpha * r * r)); };
+		return gaussian(p.x, radius.x) * gaussian(p.y, radius.y);
+	}
+	}
+	return 0;
+}
+
+FilmTile::FilmTile(const Bounds2i& pixelBounds, const Vec2f& filterRadius, const Float* filterTable, int filterTableWidth)
+	: pixelBounds_(pixelBounds),
+	filterRadius_(filterRadius),
+	invFilterRadius_(1 / filterRadius.x, 1 / filterRadius.y),
+	filterTable_(filterTable),
+	filterTableWidth_(filterTableWidth),
+	pixels_(static_cast<size_t>(std::max(0, static_cast<int>(pixelBounds.surface_area()))))
+{}
+
+void FilmTile::add_sample(const Point2f& pFilm, const Vec3f& L, Float sampleWeight)
+{
+	// Compute the raster bounds of the pixels the sample contributes to.
+	// Pixel (x, y) has its center at (x + 0.5, y + 0.5).
+	const Point2f pFilmDiscrete(pFilm.x - 0.5f, pFilm.y - 0.5f);
+	const int x0 = std::max(static_cast<int>(std::ceil(pFilmDiscrete.x - filterRadius_.x)), pixelBounds_.p_min.x);
+	const int y0 = std::max(static_cast<int>(std::ceil(pFilmDiscrete.y - filterRadius_.y)), pixelBounds_.p_min.y);
+	const int x1 = std::min(static_cast<int>(std::floor(pFilmDiscrete.x + filterRadius_.x)) + 1, pixelBounds_.p_max.x);
+	const int y1 = std::min(static_cast<int>(std::floor(pFilmDiscrete.y + filterRadius_.y)) + 1, pixelBounds_.p_max.y);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	// Look up the filter table offsets once per row and column, instead of once per pixel
+	constexpr int MAX_FILTER_FOOTPRINT = 64;
+	assert(x1 - x0 <= MAX_FILTER_FOOTPRINT && y1 - y0 <= MAX_FILTER_FOOTPRINT && "Filter radius too large");
+	int ifx[MAX_FILTER_FOOTPRINT];
+	int ify[MAX_FILTER_FOOTPRINT];
+	for (int x = x0; x < x1; x++)
+	{
+		const Float fx = std::abs((x - pFilmDiscrete.x) * invFilterRadius_.x * filterTableWidth_);
+		ifx[x - x0] = std::min(static_cast<int>(std::floor(fx)), filterTableWidth_ - 1);
+	}
+	for (int y = y0; y < y1; y++)
+	{
+		const Float fy = std::abs((y - pFilmDiscrete.y) * invFilterRadius_.y * filterTableWidth_);
+		ify[y - y0] = std::min(static_cast<int>(std::floor(fy)), filterTableWidth_ - 1);
+	}
+
+	const int width = pixelBounds_.p_max.x - pixelBounds_.p_min.x;
+	for (int y = y0; y < y1; y++)
+	{
+		Pixel* row = pixels_.data() + static_cast<size_t>(y - pixelBounds_.p_min.y) * width;
+		for (int x = x0; x < x1; x++)
+		{
+			const Float filterWeight = filterTable_[ify[y - y0] * filterTableWidth_ + ifx[x - x0]];
+			Pixel& pixel = row[x - pixelBounds_.p_min.x];
+			pixel.contribution_sum += L * (sampleWeight * filterWeight);
+			pixel.filter_weight_sum += filterWeight;
+		}
+	}
+}
+
+const FilmTile::Pixel& FilmTile::get_pixel(const Point2i& p) const
+{
+	assert(inside_exclusive_bounds(p, pixelBounds_) && "Pixel outside of the film tile");
+	const int width = pixelBounds_.p_max.x - pixelBounds_.p_min.x;
+	return pixels_[static_cast<size_t>(p.y - pixelBounds_.p_min.y) * width + (p.x - pixelBounds_.p_min.x)];
+}
+
+Film::Film(const Point2i& resolution, const Filter& filter)
+	: resolution_(resolution),
+	filter_(filter),
+	pixels_(std::make_unique<Pixel[]>(static_cast<size_t>(resolution.x) * resolution.y))
+{
+	// Evaluate the filter at the center of every table cell
+	for (int y = 0; y < FILTER_TABLE_WIDTH; y++)
+	{
+		for (int x = 0; x < FILTER_TABLE_WIDTH; x++)
+		{
+			const Point2f p(
+				(x + 0.5f) * filter_.radius.x / FILTER_TABLE_WIDTH,
+				(y + 0.5f) * filter_.radius.y / FILTER_TABLE_WIDTH);
+			filterTable_[y * FILTER_TABLE_WIDTH + x] = filter_.evaluate(p);
+		}
+	}
+
+	AITO_INFO("Film created with a resolution of {}x{} ({:.2f} MB)",
+			  resolution.x, resolution.y, static_cast<size_t>(resolution.x) * resolution.y * sizeof(Pixel) / (1024.0f * 1024.0f));
+}
+
+Bounds2i Film::sample_bounds() const
+{
+	const Point2i pMin(
+		static_cast<int>(std::floor(0.5f - filter_.radius.x)),
+		static_cast<int>(std::floor(0.5f - filter_.radius.y)));
+	const Point2i pMax(
+		static_cast<int>(std::ceil(resolution_.x - 0.5f + filter_.radius.x)),
+		static_cast<int>(std::ceil(resolution_.y - 0.5f + filter_.radius.y)));
+	return Bounds2i(pMin, pMax);
+}
+
+std::unique_ptr<FilmTile> Film::get_film_tile(const Bounds2i& sampleBounds) const
+{
+	// Expand the sample bounds by the filter radius, and clip them to the image
+	const Point2f p0(
+		std::ceil(sampleBounds.p_min.x - 0.5f - filter_.radius.x),
+		std::ceil(sampleBounds.p_min.y - 0.5f - filter_.radius.y));
+	const Point2f p1(
+		std::floor(sampleBounds.p_max.x - 0.5f + filter_.radius.x) + 1,
+		std::floor(sampleBounds.p_max.y - 0.5f + filter_.radius.y) + 1);
+
+	Bounds2i tilePixelBounds;
+	tilePixelBounds.p_min = max(Point2i(static_cast<int>(p0.x), static_cast<int>(p0.y)), Point2i(0, 0));
+	tilePixelBounds.p_max = min(Point2i(static_cast<int>(p1.x), static_cast<int>(p1.y)), resolution_);
+	tilePixelBounds.p_max = max(tilePixelBounds.p_max, tilePixelBounds.p_min);
+
+	return std::make_unique<FilmTile>(tilePixelBounds, filter_.radius, filterTable_, FILTER_TABLE_WIDTH);
+}
+
+void Film::merge_film_tile(const FilmTile& tile)
+{
+	for (const Point2i pixel : tile.pixel_bounds())
+	{
+		const FilmTile::Pixel& tilePixel = tile.get_pixel(pixel);
+		if (tilePixel.filter_weight_sum == 0)
+			continue;
+
+		Pixel& filmPixel = get_pixel(pixel);
+		for (int i = 0; i < 3; i++)
+			filmPixel.rgb[i].add(tilePixel.contribution_sum[i]);
+		filmPixel.filter_weight_sum.add(tilePixel.filter_weight_sum);
+	}
+}
+
+void Film::add_splat(const Point2f& p, const Vec3f& v)
+{
+	const Point2i pi(static_cast<int>(std::floor(p.x)), static_cast<int>(std::floor(p.y)));
+	if (!inside_exclusive_bounds(pi, pixel_bounds()))
+		return;
+
+	Pixel& pixel = get_pixel(pi);
+	for (int i = 0; i < 3; i++)
+		pixel.splat_rgb[i].add(v[i]);
+}
+
+void Film::clear()
+{
+	for (const Point2i p : pixel_bounds())
+	{
+		Pixel& pixel = get_pixel(p);
+		for (int i = 0; i < 3; i++)
+		{
+			pixel.rgb[i] = 0;
+			pixel.splat_rgb[i] = 0;
+		}
+		pixel.filter_weight_sum = 0;
+	}
+}
+
+Vec3f Film::get_pixel_rgb(const Point2i& p, Float splatScale) const
+{
+	const Pixel& pixel = get_pixel(p);
+	Vec3f rgb(pixel.rgb[0], pixel.rgb[1], pixel.rgb[2]);
+
+	const Float filterWeightSum = pixel.filter_weight_sum;
+	if (filterWeightSum != 0)
+		rgb = rgb * (1 / filterWeightSum);
+
+	// Negative values can come from filters with negative lobes
+	rgb = glm::max(rgb, Vec3f(0, 0, 0));
+	return rgb + Vec3f(pixel.splat_rgb[0], pixel.splat_rgb[1], pixel.splat_rgb[2]) * splatScale;
+}
+
+void Film::write_srgba8(const Bounds2i& region, uint8_t* image, Float splatScale) const
+{
+	const auto toSrgb8 = [](Float v)
+	{
+		v = std::clamp<Float>(v, 0, 1);
+		const Float srgb = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1 / 2.4f) - 0.055f;
+		return static_cast<uint8_t>(srgb * 255 + 0.5f);
+	};
+
+	for (const Point2i p : bounds_intersect(region, pixel_bounds()))
+	{
+		const Vec3f rgb = get_pixel_rgb(p, splatScale);
+		uint8_t* dst = image + (static_cast<size_t>(p.y) * resolution_.x + p.x) * 4;
+		dst[0] = toSrgb8(rgb.x);
+		dst[1] = toSrgb8(rgb.y);
+		dst[2] = toSrgb8(rgb.z);
+		dst[3] = 255;
+	}
+}
+
+Film::Pixel& Film::get_pixel(const Point2i& p)
+{
+	assert(inside_exclusive_bounds(p, pixel_bounds()) && "Pixel outside of the film");
+	return pixels_[static_cast<size_t>(p.y) * resolution_.x + p.x];
+}
+
+const Film::Pixel& Film::get_pixel(const Point2i& p) const
+{
+	assert(inside_exclusive_bounds(p, pixel_bounds()) && "Pixel outside of the film");
+	return pixels_[static_cast<size_t>(p.y) * resolution_.x + p.x];
+}
+
+}  // namespace aito
@@ -0,0 +1,158 @@
+#ifndef AITO_FILM_H
+#define AITO_FILM_H
+
+#include "aito.h"
+
+#include "bounds.h"
+#include "parallel.h"
+#include "vecmath.h"
+
+#include <memory>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Pixel reconstruction filter. Samples contribute to every pixel within "radius" of them, weighted by the filter.
+/// </summary>
+class Filter
+{
+public:
+	enum class Type
+	{
+		Box,
+		Triangle,
+		Gaussian,
+	};
+
+	Type type;
+	Vec2f radius;
+	// Falloff of the gaussian filter
+	Float alpha;
+
+public:
+	constexpr Filter(Type type, const Vec2f& radius, Float alpha = 2)
+		: type(type), radius(radius), alpha(alpha)
+	{}
+
+	[[nodiscard]] static constexpr Filter box(Float radius = 0.5f) { return Filter(Type::Box, Vec2f(radius, radius)); }
+	[[nodiscard]] static constexpr Filter triangle(Float radius = 2) { return Filter(Type::Triangle, Vec2f(radius, radius)); }
+	[[nodiscard]] static constexpr Filter gaussian(Float radius = 1.5f, Float alpha = 2) { return Filter(Type::Gaussian, Vec2f(radius, radius), alpha); }
+
+	/// <summary>
+	/// The filter weight at offset "p" from the sample position. Zero outside the radius.
+	/// </summary>
+	[[nodiscard]] Float evaluate(const Point2f& p) const;
+};
+
+/// <summary>
+/// Private accumulation buffer for the pixels one render tile contributes to. Only the thread rendering the tile
+/// writes to it, so adding samples needs no synchronization. Merged into the Film when the tile is done.
+/// </summary>
+class FilmTile
+{
+public:
+	struct Pixel
+	{
+		Vec3f contribution_sum{};
+		Float filter_weight_sum = 0;
+	};
+
+public:
+	FilmTile(const Bounds2i& pixelBounds, const Vec2f& filterRadius, const Float* filterTable, int filterTableWidth);
+
+	/// <summary>
+	/// Adds a radiance sample at the continuous film position "pFilm" to all pixels within the filter radius.
+	/// </summary>
+	void add_sample(const Point2f& pFilm, const Vec3f& L, Float sampleWeight = 1);
+
+	[[nodiscard]] inline const Bounds2i& pixel_bounds() const { return pixelBounds_; }
+	[[nodiscard]] const Pixel& get_pixel(const Point2i& p) const;
+
+private:
+	const Bounds2i pixelBounds_;
+	const Vec2f filterRadius_;
+	const Vec2f invFilterRadius_;
+	const Float* filterTable_;
+	const int filterTableWidth_;
+	std::vector<Pixel> pixels_;
+};
+
+/// <summary>
+/// The image the offline renderer accumulates radiance into. Render tiles write into their own FilmTile and merge it
+/// back with atomic adds, so no global lock is needed; only the pixels on tile borders are ever touched by two threads.
+/// Splats (contributions to arbitrary pixels, like from light tracing) go straight into a separate atomic buffer.
+/// </summary>
+class Film
+{
+public:
+	static constexpr int FILTER_TABLE_WIDTH = 16;
+
+	struct Pixel
+	{
+		AtomicFloat rgb[3];
+		AtomicFloat filter_weight_sum;
+		AtomicFloat splat_rgb[3];
+	};
+
+public:
+	Film(const Point2i& resolution, const Filter& filter = Filter::gaussian());
+
+	Film(const Film&) = delete;
+	Film& operator=(const Film&) = delete;
+
+	[[nodiscard]] inline const Point2i& resolution() const { return resolution_; }
+	[[nodiscard]] inline const Filter& filter() const { return filter_; }
+	[[nodiscard]] inline Bounds2i pixel_bounds() const { return Bounds2i(Point2i(0, 0), resolution_); }
+	/// <summary>
+	/// The area samples have to be taken in, so every pixel gets its full filter support.
+	/// </summary>
+	[[nodiscard]] Bounds2i sample_bounds() const;
+
+	/// <summary>
+	/// Creates the tile for rendering the samples in "sampleBounds", covering all pixels those samples contribute to.
+	/// </summary>
+	[[nodiscard]] std::unique_ptr<FilmTile> get_film_tile(const Bounds2i& sampleBounds) const;
+	/// <summary>
+	/// Adds the contributions of a finished tile to the film. Can be called from several threads at once.
+	/// </summary>
+	void merge_film_tile(const FilmTile& tile);
+
+	/// <summary>
+	/// Adds "v" to the pixel containing "p", without filtering. Can be called from several threads at once.
+	/// </summary>
+	void add_splat(const Point2f& p, const Vec3f& v);
+
+	/// <summary>
+	/// Resets all pixels to zero. Must not be called while tiles are being merged.
+	/// </summary>
+	void clear();
+
+	/// <summary>
+	/// The final color of the pixel: the filtered radiance plus the splats scaled by "splatScale".
+	/// </summary>
+	[[nodiscard]] Vec3f get_pixel_rgb(const Point2i& p, Float splatScale = 1) const;
+
+	/// <summary>
+	/// Converts the pixels in "region" to 8 bit sRGB with an alpha of 255, and writes them into "image",
+	/// which holds the whole film as tightly packed RGBA rows.
+	/// </summary>
+	void write_srgba8(const Bounds2i& region, uint8_t* image, Float splatScale = 1) const;
+
+private:
+	const Point2i resolution_;
+	const Filter filter_;
+	std::unique_ptr<Pixel[]> pixels_;
+	// The filter evaluated over one quadrant of its support, since all filters are symmetric
+	Float filterTable_[FILTER_TABLE_WIDTH * FILTER_TABLE_WIDTH];
+
+	[[nodiscard]] Pixel& get_pixel(const Point2i& p);
+	[[nodiscard]] const Pixel& get_pixel(const Point2i& p) const;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_FILM_H
@@ -0,0 +1,199 @@
+#include "pch.h"
+
+#include "film_texture.h"
+
+#include "swapchain.h"
+
+#include <stdexcept>
+
+
+namespace aito
+{
+	FilmTexture::FilmTexture(Device& device, const Point2i& resolution)
+		: device_(device), resolution_(resolution)
+	{
+		createImage();
+		createSampler();
+
+		stagingBuffer_ = std::make_unique<Buffer>(device_,
+												  static_cast<VkDeviceSize>(resolution_.x) * resolution_.y * 4,
+												  Swapchain::MAX_FRAMES_IN_FLIGHT,
+												  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+												  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		stagingBuffer_->map();
+
+		clearImage();
+
+		descriptorSet_ = ImGui_ImplVulkan_AddTexture(sampler_, imageView_, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+
+	FilmTexture::~FilmTexture()
+	{
+		// Hand the descriptor back to ImGui's pool, which only has room for the font and one film.
+		// Has to run before the ImGui Vulkan backend is shut down.
+		ImGui_ImplVulkan_RemoveTexture(descriptorSet_);
+		vkDestroySampler(device_.device(), sampler_, nullptr);
+		vkDestroyImageView(device_.device(), imageView_, nullptr);
+		vkDestroyImage(device_.device(), image_, nullptr);
+		device_.allocator().free(imageMemory_);
+	}
+
+	void FilmTexture::update(VkCommandBuffer commandBuffer, int frameIndex, const Film& film, const std::vector<Bounds2i>& regions, Float splatScale)
+	{
+		if (regions.empty())
+			return;
+
+		// Each frame in flight has its own slice of the staging buffer, laid out like the image, 
+		// so the regions can be copied straight from their position in it.
+		const VkDeviceSize sliceOffset = stagingBuffer_->getAlignmentSize() * frameIndex;
+		uint8_t* slice = static_cast<uint8_t*>(stagingBuffer_->getMappedMemory()) + sliceOffset;
+
+		std::vector<VkBufferImageCopy> copies;
+		copies.reserve(regions.size());
+		for (const Bounds2i& region : regions)
+		{
+			const Bounds2i clipped = bounds_intersect(region, Bounds2i(Point2i(0, 0), resolution_));
+			if (clipped.p_max.x <= clipped.p_min.x || clipped.p_max.y <= clipped.p_min.y)
+				continue;
+
+			film.write_srgba8(clipped, slice, splatScale);
+
+			VkBufferImageCopy copy{};
+			copy.bufferOffset = sliceOffset + (static_cast<VkDeviceSize>(clipped.p_min.y) * resolution_.x + clipped.p_min.x) * 4;
+			copy.bufferRowLength = resolution_.x;
+			copy.bufferImageHeight = 0;
+			copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copy.imageSubresource.mipLevel = 0;
+			copy.imageSubresource.baseArrayLayer = 0;
+			copy.imageSubresource.layerCount = 1;
+			copy.imageOffset = { clipped.p_min.x, clipped.p_min.y, 0 };
+			copy.imageExtent = { static_cast<uint32_t>(clipped.p_max.x - clipped.p_min.x), static_cast<uint32_t>(clipped.p_max.y - clipped.p_min.y), 1 };
+			copies.push_back(copy);
+		}
+		if (copies.empty())
+			return;
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image_;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+		// The previous frame may still be sampling the texture
+		barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+							 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer_->getBuffer(), image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+							   static_cast<uint32_t>(copies.size()), copies.data());
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+							 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	void FilmTexture::createImage()
+	{
+		// The film is converted to sRGB on the CPU, and the swapchain expects linear values from the shaders
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = static_cast<uint32_t>(resolution_.x);
+		imageInfo.extent.height = static_cast<uint32_t>(resolution_.y);
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.flags = 0;
+
+		device_.createImageWithInfo(
+			imageInfo,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			image_,
+			imageMemory_);
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image_;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(device_.device(), &viewInfo, nullptr, &imageView_) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create film image view");
+		}
+	}
+
+	void FilmTexture::createSampler()
+	{
+		VkSamplerCreateInfo samplerInfo{};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.maxAnisotropy = 1.0f;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = 0.0f;
+		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+
+		if (vkCreateSampler(device_.device(), &samplerInfo, nullptr, &sampler_) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create film sampler");
+		}
+	}
+
+	void FilmTexture::clearImage()
+	{
+		// Puts the image in the layout "update" expects, and makes sure nothing undefined is shown before the first pass
+		VkCommandBuffer commandBuffer = device_.beginSingleTimeCommands();
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image_;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+							 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		const VkClearColorValue black{ { 0.0f, 0.0f, 0.0f, 1.0f } };
+		vkCmdClearColorImage(commandBuffer, image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1, &barrier.subresourceRange);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+							 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		device_.endSingleTimeCommands(commandBuffer);
+	}
+}
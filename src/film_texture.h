@@ -0,0 +1,57 @@
+#ifndef AITO_FILM_TEXTURE_H
+#define AITO_FILM_TEXTURE_H
+
+#include <memory>
+#include <vector>
+
+#include "device.h"
+#include "buffer.h"
+#include "film.h"
+
+#include "imgui_impl_vulkan.h"
+
+
+namespace aito
+{
+	/// <summary>
+	/// Sampled image showing the contents of a Film in the viewport (through ImGui).
+	/// Only the regions of the film that changed are uploaded, through a persistently mapped staging buffer
+	/// with a slice per frame in flight, so the upload never waits on the GPU.
+	/// </summary>
+	class FilmTexture
+	{
+	public:
+		FilmTexture(Device& device, const Point2i& resolution);
+		~FilmTexture();
+
+		FilmTexture(const FilmTexture&) = delete;
+		FilmTexture& operator=(const FilmTexture&) = delete;
+
+		/// <summary>
+		/// Copies the given regions of the film into the texture. Must be recorded outside of a render pass, 
+		/// before the texture is sampled in the frame.
+		/// </summary>
+		void update(VkCommandBuffer commandBuffer, int frameIndex, const Film& film, const std::vector<Bounds2i>& regions, Float splatScale = 1);
+
+		inline ImTextureID getTextureId() const { return (ImTextureID)descriptorSet_; }
+		inline const Point2i& getResolution() const { return resolution_; }
+
+	private:
+		Device& device_;
+		Point2i resolution_;
+
+		VkImage image_ = VK_NULL_HANDLE;
+		MemoryAllocator::Allocation imageMemory_{};
+		VkImageView imageView_ = VK_NULL_HANDLE;
+		VkSampler sampler_ = VK_NULL_HANDLE;
+		VkDescriptorSet descriptorSet_ = VK_NULL_HANDLE;
+
+		std::unique_ptr<Buffer> stagingBuffer_;
+
+		void createImage();
+		void createSampler();
+		void clearImage();
+	};
+}
+
+#endif /* AITO_FILM_TEXTURE_H */
@@ -0,0 +1,156 @@
+#include "pch.h"
+
+#include "frame_allocator.h"
+
+#include "device.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+
+namespace aito
+{
+	FrameAllocator::FrameAllocator(Device& device, uint32_t frameCount, VkDeviceSize frameSize)
+		: device_(device),
+		frameCount_(frameCount),
+		usage_(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+			   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT),
+		uniformAlignment_(std::max<VkDeviceSize>(device.properties.limits.minUniformBufferOffsetAlignment, 1)),
+		storageAlignment_(std::max<VkDeviceSize>(device.properties.limits.minStorageBufferOffsetAlignment, 1)),
+		overflow_(frameCount)
+	{
+		// A power of two at least as large as the alignments keeps the start of every region aligned for any slice
+		frameSize_ = std::bit_ceil(std::max({ frameSize, uniformAlignment_, storageAlignment_ }));
+		createBuffer();
+	}
+
+	FrameAllocator::~FrameAllocator()
+	{
+		for (int i = 0; i < static_cast<int>(frameCount_); i++)
+			freeOverflow(i);
+		destroyBuffer();
+	}
+
+	void FrameAllocator::beginFrame(int frameIndex)
+	{
+		assert(frameIndex >= 0 && frameIndex < static_cast<int>(frameCount_) && "The frame index is out of range");
+
+		if (peak_ > frameSize_)
+		{
+			// The regions of the other frames may still be in use, so growing waits for the queue. It only happens
+			// until the regions fit the largest frame.
+			vkQueueWaitIdle(device_.graphicsQueue());
+			for (int i = 0; i < static_cast<int>(frameCount_); i++)
+				freeOverflow(i);
+
+			AITO_INFO("Growing the frame allocator from {} to {} bytes per frame", frameSize_, std::bit_ceil(peak_));
+			frameSize_ = std::bit_ceil(peak_);
+			destroyBuffer();
+			createBuffer();
+		}
+
+		frameIndex_ = frameIndex;
+		head_ = 0;
+		used_ = 0;
+		freeOverflow(frameIndex);
+	}
+
+	FrameAllocator::Slice FrameAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		assert(alignment > 0 && (alignment & (alignment - 1)) == 0 && "The alignment must be a power of two");
+
+		const VkDeviceSize offset = (head_ + alignment - 1) & ~(alignment - 1);
+		used_ += offset - head_ + size;
+		peak_ = std::max(peak_, used_);
+
+		if (offset + size > frameSize_)
+		{
+			overflowCount_++;
+			return allocateOverflow(size, alignment);
+		}
+		head_ = offset + size;
+
+		Slice slice{};
+		slice.buffer = buffer_;
+		slice.offset = frameIndex_ * frameSize_ + offset;
+		slice.size = size;
+		slice.mapped = static_cast<char*>(memory_.mapped) + slice.offset;
+		return slice;
+	}
+
+	FrameAllocator::Slice FrameAllocator::allocateUniform(VkDeviceSize size)
+	{
+		return allocate(size, uniformAlignment_);
+	}
+
+	FrameAllocator::Slice FrameAllocator::allocateStorage(VkDeviceSize size)
+	{
+		return allocate(size, storageAlignment_);
+	}
+
+	void FrameAllocator::createBuffer()
+	{
+		device_.createBuffer(
+			frameSize_ * frameCount_,
+			usage_,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			buffer_,
+			memory_);
+		assert(memory_.mapped && "The frame allocator memory must be host visible");
+		generation_++;
+	}
+
+	void FrameAllocator::destroyBuffer()
+	{
+		vkDestroyBuffer(device_.device(), buffer_, nullptr);
+		device_.allocator().free(memory_);
+		buffer_ = VK_NULL_HANDLE;
+	}
+
+	/// <summary>
+	/// Allocates from the overflow buffers of the current frame, creating one if the last has no room.
+	/// </summary>
+	FrameAllocator::Slice FrameAllocator::allocateOverflow(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		auto& overflow = overflow_[frameIndex_];
+
+		VkDeviceSize offset = 0;
+		if (!overflow.empty())
+			offset = (overflow.back().head + alignment - 1) & ~(alignment - 1);
+
+		if (overflow.empty() || offset + size > overflow.back().size)
+		{
+			Overflow page{};
+			page.size = std::max(size, frameSize_);
+			device_.createBuffer(
+				page.size,
+				usage_,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				page.buffer,
+				page.memory);
+			overflow.push_back(page);
+			offset = 0;
+		}
+
+		Overflow& page = overflow.back();
+		page.head = offset + size;
+
+		Slice slice{};
+		slice.buffer = page.buffer;
+		slice.offset = offset;
+		slice.size = size;
+		slice.mapped = static_cast<char*>(page.memory.mapped) + offset;
+		return slice;
+	}
+
+	void FrameAllocator::freeOverflow(int frameIndex)
+	{
+		for (auto& page : overflow_[frameIndex])
+		{
+			vkDestroyBuffer(device_.device(), page.buffer, nullptr);
+			device_.allocator().free(page.memory);
+		}
+		overflow_[frameIndex].clear();
+	}
+}
@@ -0,0 +1,130 @@
+#ifndef AITO_FRAME_ALLOCATOR_H
+#define AITO_FRAME_ALLOCATOR_H
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "memory_allocator.h"
+
+
+namespace aito
+{
+	class Device;
+
+	/// <summary>
+	/// Hands out slices of a persistently mapped buffer for data that only lives for one frame, like uniform buffers and
+	/// per-draw data. Every frame in flight has its own region of the one buffer, which is reset when the frame begins,
+	/// so allocating is just bumping an offset. Since all the frames share the buffer, a single descriptor set of a dynamic
+	/// buffer type covers every frame, and the slice is picked with a dynamic offset when the set is bound.
+	///
+	/// A frame that runs out of room gets overflow buffers, which are freed the next time its region comes around,
+	/// and the regions grow to fit before the next frame. Only slices from getBuffer() are reachable through the dynamic
+	/// descriptor sets, so data bound that way should be allocated early in the frame.
+	/// </summary>
+	class FrameAllocator
+	{
+	public:
+		static constexpr VkDeviceSize DEFAULT_FRAME_SIZE = 1024 * 1024;
+
+		/// <summary>
+		/// A range of the buffer, written through "mapped". The memory is host coherent and needs no flushing.
+		/// </summary>
+		struct Slice
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+			void* mapped = nullptr;
+
+			inline uint32_t dynamicOffset() const { return static_cast<uint32_t>(offset); }
+			inline VkDescriptorBufferInfo descriptorInfo() const { return { buffer, offset, size }; }
+		};
+
+		FrameAllocator(Device& device, uint32_t frameCount, VkDeviceSize frameSize = DEFAULT_FRAME_SIZE);
+		~FrameAllocator();
+
+		// Not copyable or movable
+		FrameAllocator(const FrameAllocator&) = delete;
+		FrameAllocator& operator=(const FrameAllocator&) = delete;
+		FrameAllocator(FrameAllocator&&) = delete;
+		FrameAllocator& operator=(FrameAllocator&&) = delete;
+
+		/// <summary>
+		/// Starts handing out the region of "frameIndex". The GPU must be done with the last frame that used it.
+		/// </summary>
+		void beginFrame(int frameIndex);
+
+		/// <summary>
+		/// Allocates "size" bytes at a multiple of "alignment" (a power of two) from the region of the current frame.
+		/// </summary>
+		Slice allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+		// Aligned for binding as a (dynamic) uniform buffer
+		Slice allocateUniform(VkDeviceSize size);
+		// Aligned for binding as a (dynamic) storage buffer
+		Slice allocateStorage(VkDeviceSize size);
+
+		/// <summary>
+		/// Copies "data" into a new uniform slice.
+		/// </summary>
+		template<typename T>
+		Slice pushUniform(const T& data)
+		{
+			Slice slice = allocateUniform(sizeof(T));
+			*static_cast<T*>(slice.mapped) = data;
+			return slice;
+		}
+
+		inline VkBuffer getBuffer() const { return buffer_; }
+		/// <summary>
+		/// A descriptor for "range" bytes at the start of the buffer, for a dynamic descriptor set.
+		/// </summary>
+		inline VkDescriptorBufferInfo descriptorInfo(VkDeviceSize range) const { return { buffer_, 0, range }; }
+		/// <summary>
+		/// Changes every time the buffer is recreated to grow, when the descriptor sets pointing at it have to be written again.
+		/// </summary>
+		inline uint32_t getGeneration() const { return generation_; }
+
+		inline VkDeviceSize getFrameSize() const { return frameSize_; }
+		// The bytes the last frame allocated, overflow included
+		inline VkDeviceSize getUsedBytes() const { return used_; }
+		inline uint64_t getOverflowCount() const { return overflowCount_; }
+
+	private:
+		struct Overflow
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			MemoryAllocator::Allocation memory{};
+			VkDeviceSize size = 0;
+			VkDeviceSize head = 0;
+		};
+
+		Device& device_;
+		uint32_t frameCount_;
+		VkDeviceSize frameSize_;
+		VkBufferUsageFlags usage_;
+		VkDeviceSize uniformAlignment_;
+		VkDeviceSize storageAlignment_;
+
+		VkBuffer buffer_ = VK_NULL_HANDLE;
+		MemoryAllocator::Allocation memory_{};
+		uint32_t generation_ = 0;
+
+		int frameIndex_ = 0;
+		// The next free byte in the region of the current frame, relative to the region
+		VkDeviceSize head_ = 0;
+		VkDeviceSize used_ = 0;
+		// The most a frame has asked for, to grow the regions to
+		VkDeviceSize peak_ = 0;
+		// The overflow buffers of every frame, freed when the frame comes around again
+		std::vector<std::vector<Overflow>> overflow_;
+		uint64_t overflowCount_ = 0;
+
+		void createBuffer();
+		void destroyBuffer();
+		Slice allocateOverflow(VkDeviceSize size, VkDeviceSize alignment);
+		void freeOverflow(int frameIndex);
+	};
+}
+
+#endif /* AITO_FRAME_ALLOCATOR_H */
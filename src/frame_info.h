@@ -2,6 +2,7 @@
 #define AITO_FRAME_INFO_H
 
 #include "camera.h"
+#include "frame_allocator.h"
 
 #include <vulkan/vulkan.h>
 
@@ -15,6 +16,10 @@ namespace aito
 		VkCommandBuffer commandBuffer;
 		Camera& camera;
 		VkDescriptorSet globalDescriptorSet;
+		// The dynamic offset of the global uniform buffer of this frame, for binding globalDescriptorSet
+		uint32_t globalOffset;
+		// For the data the render systems need for this frame only
+		FrameAllocator& frameAllocator;
 	};
 }
 
@@ -0,0 +1,86 @@
+#include "pch.h"
+
+#include "geometry_pool.h"
+#include "upload_manager.h"
+
+#include <cassert>
+
+
+namespace aito
+{
+	GeometryPool::GeometryPool(Device& device)
+		: device_(device)
+	{}
+
+	GeometryPool::~GeometryPool()
+	{}
+
+	GeometryPool::Range GeometryPool::add(const std::vector<Model::Vertex>& vertices, const std::vector<uint32_t>& indices)
+	{
+		assert(!vertices.empty() && !indices.empty() && "Cannot add an empty model to the geometry pool");
+
+		Range range{};
+		range.firstIndex = indexCount_;
+		range.indexCount = static_cast<uint32_t>(indices.size());
+		range.vertexOffset = static_cast<int32_t>(vertexCount_);
+		range.vertexCount = static_cast<uint32_t>(vertices.size());
+
+		append(vertexBuffer_, vertexCount_, INITIAL_VERTEX_CAPACITY, sizeof(Model::Vertex), range.vertexCount,
+			   vertices.data(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+		append(indexBuffer_, indexCount_, INITIAL_INDEX_CAPACITY, sizeof(uint32_t), range.indexCount,
+			   indices.data(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+		vertexCount_ += range.vertexCount;
+		indexCount_ += range.indexCount;
+
+		return range;
+	}
+
+	void GeometryPool::bind(VkCommandBuffer commandBuffer)
+	{
+		assert(vertexBuffer_ && indexBuffer_ && "Cannot bind an empty geometry pool");
+
+		VkBuffer buffers[] = { vertexBuffer_->getBuffer() };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer_->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+	}
+
+	void GeometryPool::append(
+		std::unique_ptr<Buffer>& buffer,
+		uint32_t used,
+		uint32_t initialCapacity,
+		VkDeviceSize elementSize,
+		uint32_t count,
+		const void* data,
+		VkBufferUsageFlags usageFlags)
+	{
+		const uint32_t capacity = buffer ? buffer->getInstanceCount() : 0;
+		if (used + count > capacity)
+		{
+			uint32_t newCapacity = std::max(capacity, initialCapacity);
+			while (newCapacity < used + count)
+				newCapacity *= 2;
+
+			// The pool is also the source of the copy when it grows again
+			auto newBuffer = std::make_unique<Buffer>(
+				device_,
+				elementSize,
+				newCapacity,
+				usageFlags | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+				);
+
+			if (used > 0)
+			{
+				device_.uploads().copyBuffer(buffer->getBuffer(), newBuffer->getBuffer(), used * elementSize);
+				// Frames still in flight may draw from the old buffer, so it has to outlive them. Growing is rare.
+				device_.uploads().waitIdle();
+			}
+			buffer = std::move(newBuffer);
+		}
+
+		// Copy the data behind the geometry already in the pool. The copy is submitted with the next frame.
+		device_.uploads().uploadToBuffer(buffer->getBuffer(), used * elementSize, data, count * elementSize);
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef AITO_GEOMETRY_POOL_H
+#define AITO_GEOMETRY_POOL_H
+
+#include <memory>
+#include <vector>
+
+#include "device.h"
+#include "buffer.h"
+#include "shape.h"
+
+
+namespace aito
+{
+	/// <summary>
+	/// One vertex buffer and one index buffer shared by all the models, so the whole scene is drawn with the buffers
+	/// bound once, and a single indirect draw can reach every model through the first index and vertex offset of its commands.
+	/// </summary>
+	class GeometryPool
+	{
+	public:
+		static constexpr uint32_t INITIAL_VERTEX_CAPACITY = 64 * 1024;
+		static constexpr uint32_t INITIAL_INDEX_CAPACITY = 256 * 1024;
+
+		// Where the geometry of a model is in the pool
+		struct Range
+		{
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			int32_t vertexOffset;
+			uint32_t vertexCount;
+		};
+
+		explicit GeometryPool(Device& device);
+		~GeometryPool();
+
+		GeometryPool(const GeometryPool&) = delete;
+		GeometryPool& operator=(const GeometryPool&) = delete;
+
+		/// <summary>
+		/// Uploads the geometry to the end of the pool. The indices stay relative to the first vertex of the model.
+		/// The buffers grow when they are full, which waits for the GPU, so models should be added while loading.
+		/// </summary>
+		Range add(const std::vector<Model::Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+		void bind(VkCommandBuffer commandBuffer);
+
+		inline uint32_t getVertexCount() const { return vertexCount_; }
+		inline uint32_t getIndexCount() const { return indexCount_; }
+
+	private:
+		Device& device_;
+
+		std::unique_ptr<Buffer> vertexBuffer_;
+		uint32_t vertexCount_ = 0;
+
+		std::unique_ptr<Buffer> indexBuffer_;
+		uint32_t indexCount_ = 0;
+
+		/// <summary>
+		/// Copies "count" elements to the buffer after its first "used" elements, growing the buffer if they do not fit.
+		/// </summary>
+		void append(
+			std::unique_ptr<Buffer>& buffer,
+			uint32_t used,
+			uint32_t initialCapacity,
+			VkDeviceSize elementSize,
+			uint32_t count,
+			const void* data,
+			VkBufferUsageFlags usageFlags);
+	};
+}
+
+#endif /* AITO_GEOMETRY_POOL_H */
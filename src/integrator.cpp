@@ -0,0 +1,153 @@
+#include "pch.h"
+
+#include "integrator.h"
+
+#include "triangle.h"
+
+#include <algorithm>
+
+
+namespace aito
+{
+
+PathIntegrator::PathIntegrator(const Scene& scene, const RGBToSpectrumTable& rgbToSpectrum, int maxDepth)
+	: scene_(scene), rgbToSpectrum_(rgbToSpectrum), maxDepth_(maxDepth)
+{}
+
+Vec3f PathIntegrator::li(const RayDifferential& ray, Sampler& sampler) const
+{
+	// The render threads live as long as their renderer, so their arenas stay warm from one sample to the next
+	thread_local MemoryArena arena;
+
+	const SampledWavelengths lambda = SampledWavelengths::sample_visible(sampler.get_1d());
+	const SampledSpectrum L = li(ray, lambda, sampler, arena);
+	arena.reset();
+	return L.to_rgb(lambda);
+}
+
+SampledSpectrum PathIntegrator::li(const RayDifferential& cameraRay, const SampledWavelengths& lambda, Sampler& sampler, MemoryArena& arena) const
+{
+	SampledSpectrum L(0);
+	// Throughput of the path: the product of f * cos / pdf over its bounces
+	SampledSpectrum beta(1);
+	// Solid angle density the BSDF sampled the last direction with, for weighting lights that are hit
+	Float bsdfPdf = 0;
+
+	Ray ray = cameraRay;
+	for (int depth = 0;; depth++)
+	{
+		SurfaceInteraction isect;
+		if (!scene_.intersect(ray, &isect))
+		{
+			L += beta * escaped_radiance(depth, bsdfPdf, lambda);
+			break;
+		}
+
+		if (depth == maxDepth_)
+			break;
+
+		const DiffuseBSDF* bsdf = get_bsdf(isect, lambda, arena);
+
+		DirectLightSample direct;
+		if (sample_direct_light(isect, *bsdf, lambda, sampler, &direct) && !scene_.intersect_p(direct.shadow_ray))
+			L += beta * direct.ld;
+
+		if (!sample_next_direction(isect, *bsdf, depth, sampler, &beta, &bsdfPdf, &ray))
+			break;
+	}
+
+	return L;
+}
+
+SampledSpectrum PathIntegrator::escaped_radiance(int depth, Float bsdfPdf, const SampledWavelengths& lambda) const
+{
+	// Directly visible light can only be found this way. After a bounce, next event estimation could have sampled it too.
+	if (scene_.infinite_light.le() == Vec3f(0))
+		return SampledSpectrum(0);
+	const SampledSpectrum le = rgbToSpectrum_.unbounded(scene_.infinite_light.le(), lambda);
+	if (depth == 0)
+		return le;
+
+	const Float lightPdf = scene_.infinite_light.pdf_li() / scene_.light_count();
+	return le * power_heuristic(1, bsdfPdf, 1, lightPdf);
+}
+
+bool PathIntegrator::sample_direct_light(
+	const SurfaceInteraction& isect, const DiffuseBSDF& bsdf, const SampledWavelengths& lambda, Sampler& sampler,
+	DirectLightSample* sample) const
+{
+	// The samples are taken even if they are not needed, so every path vertex uses the same dimensions
+	const Float uLight = sampler.get_1d();
+	const Point2f u = sampler.get_2d();
+
+	const uint32_t lightCount = scene_.light_count();
+	if (lightCount == 0)
+		return false;
+
+	// Pick one light uniformly
+	const uint32_t lightIndex = std::min(static_cast<uint32_t>(uLight * lightCount), lightCount - 1);
+	const Float lightChoicePdf = static_cast<Float>(1) / lightCount;
+	const LightSample ls = lightIndex < scene_.point_lights.size()
+		? scene_.point_lights[lightIndex].sample_li(isect.p)
+		: scene_.infinite_light.sample_li(u);
+	if (ls.pdf == 0 || ls.L == Vec3f(0))
+		return false;
+
+	const Float cosTheta = glm::dot(ls.wi, bsdf.frame().z);
+	if (cosTheta <= 0 || !same_geometric_side(isect, ls.wi))
+		return false;
+
+	const Float lightPdf = lightChoicePdf * ls.pdf;
+	sample->ld = bsdf.f(isect.wo, ls.wi) * rgbToSpectrum_.unbounded(ls.L, lambda) * (cosTheta / lightPdf);
+	// Point lights can not be hit by BSDF sampling, so only the infinite light is weighted
+	if (ls.infinite)
+		sample->ld *= power_heuristic(1, lightPdf, 1, bsdf.pdf(isect.wo, ls.wi));
+	sample->shadow_ray = ls.infinite ? isect.spawn_ray(ls.wi) : isect.spawn_ray_from(ls.p_light);
+	return true;
+}
+
+bool PathIntegrator::sample_next_direction(
+	const SurfaceInteraction& isect, const DiffuseBSDF& bsdf, int depth, Sampler& sampler,
+	SampledSpectrum* beta, Float* bsdfPdf, Ray* ray) const
+{
+	BSDFSample bs;
+	if (!bsdf.sample_f(isect.wo, sampler.get_2d(), &bs) || !same_geometric_side(isect, bs.wi))
+		return false;
+	*bsdfPdf = bs.pdf;
+	// f * cos / pdf, which is just the albedo for the cosine sampled diffuse BSDF
+	*beta *= bs.f * (std::abs(glm::dot(bs.wi, bsdf.frame().z)) / bs.pdf);
+
+	// Russian roulette: continue the path with a probability that follows its throughput, and make up for the
+	// terminated paths by weighting up the surviving ones. The random number is always taken, so the following bounces keep their dimensions.
+	const Float uRoulette = sampler.get_1d();
+	const Float maxBeta = beta->max_component();
+	if (maxBeta < 1 && depth >= RUSSIAN_ROULETTE_DEPTH)
+	{
+		const Float q = std::max<Float>(0, 1 - maxBeta);
+		if (uRoulette < q)
+			return false;
+		*beta /= 1 - q;
+	}
+
+	*ray = isect.spawn_ray(bs.wi);
+	return true;
+}
+
+const DiffuseBSDF* PathIntegrator::get_bsdf(const SurfaceInteraction& isect, const SampledWavelengths& lambda, MemoryArena& arena) const
+{
+	return arena.alloc<DiffuseBSDF>(shading_frame(isect), surface_albedo(isect, lambda));
+}
+
+SampledSpectrum PathIntegrator::surface_albedo(const SurfaceInteraction& isect, const SampledWavelengths& lambda) const
+{
+	const TriangleMesh* mesh = isect.mesh;
+	if (mesh == nullptr || mesh->color.empty())
+		return SampledSpectrum(0.5f);
+
+	const uint32_t* v = &mesh->indices[3 * isect.triangle_index];
+	const Vec3f color = isect.b0 * mesh->color[v[0]] + isect.b1 * mesh->color[v[1]] + isect.b2 * mesh->color[v[2]];
+	// An albedo of 1 would never lose any energy
+	return rgbToSpectrum_(glm::clamp(color, Vec3f(0), Vec3f(0.95f))).sample(lambda);
+}
+
+}  // namespace aito
@@ -0,0 +1,114 @@
+#ifndef AITO_INTEGRATOR_H
+#define AITO_INTEGRATOR_H
+
+#include "aito.h"
+
+#include "bsdf.h"
+#include "memory_arena.h"
+#include "rgb_spectrum.h"
+#include "scene.h"
+#include "sampler.h"
+#include "sampling.h"
+#include "spectrum.h"
+
+
+namespace aito
+{
+
+/// <summary>
+/// Unidirectional path tracer. At every vertex the direct light is estimated by sampling a light (next event estimation),
+/// and the path is extended by sampling the BSDF. Light that both strategies can find (the infinite light) is weighted with
+/// multiple importance sampling, and paths are terminated with Russian roulette once their throughput gets low.
+/// All surfaces are diffuse, with the mesh vertex colors as their albedo. Light is carried at the sampled wavelengths of the path,
+/// and the RGB colors of the surfaces and lights are converted to spectra where they are used.
+/// </summary>
+class PathIntegrator
+{
+public:
+	// Paths are always terminated after this many bounces
+	static constexpr int DEFAULT_MAX_DEPTH = 8;
+	// Russian roulette is only used from this bounce on, so the first bounces are never terminated early
+	static constexpr int RUSSIAN_ROULETTE_DEPTH = 1;
+
+	PathIntegrator(const Scene& scene, const RGBToSpectrumTable& rgbToSpectrum, int maxDepth = DEFAULT_MAX_DEPTH);
+
+	/// <summary>
+	/// The radiance arriving along the camera ray, in RGB. The wavelengths are sampled with the next sampler dimension.
+	/// The scratch data of the path comes from the calling thread's arena, which is reset after the sample.
+	/// </summary>
+	[[nodiscard]] Vec3f li(const RayDifferential& ray, Sampler& sampler) const;
+	/// <summary>
+	/// The radiance arriving along the camera ray at the wavelengths "lambda". The BSDFs of the hits are allocated
+	/// from "arena", the caller resets it once the sample is done.
+	/// </summary>
+	[[nodiscard]] SampledSpectrum li(const RayDifferential& ray, const SampledWavelengths& lambda, Sampler& sampler, MemoryArena& arena) const;
+
+	inline void set_max_depth(int maxDepth) { maxDepth_ = maxDepth; }
+	[[nodiscard]] inline int max_depth() const { return maxDepth_; }
+	[[nodiscard]] inline const Scene& scene() const { return scene_; }
+
+	// The steps of a path below are shared with the wavefront integrator, which runs them in a different order,
+	// but takes the same samples and does the same math, so both give the same result for a path.
+
+	/// <summary>
+	/// Light from a light source reaching a surface, if the shadow ray is not blocked.
+	/// </summary>
+	struct DirectLightSample
+	{
+		SampledSpectrum ld;
+		Ray shadow_ray;
+	};
+
+	/// <summary>
+	/// The light a path that leaves the scene picks up (to be multiplied by its throughput).
+	/// "bsdfPdf" is the density the last bounce sampled the direction with.
+	/// </summary>
+	[[nodiscard]] SampledSpectrum escaped_radiance(int depth, Float bsdfPdf, const SampledWavelengths& lambda) const;
+	/// <summary>
+	/// Estimates the light arriving at the surface directly from a light source, and reflected towards "isect.wo".
+	/// Returns false if there is no contribution, otherwise the contribution still has to pass the shadow ray test.
+	/// </summary>
+	[[nodiscard]] bool sample_direct_light(
+		const SurfaceInteraction& isect, const DiffuseBSDF& bsdf, const SampledWavelengths& lambda, Sampler& sampler,
+		DirectLightSample* sample) const;
+	/// <summary>
+	/// Samples the direction the path continues in, updates the throughput and plays Russian roulette.
+	/// Returns false if the path ends here.
+	/// </summary>
+	[[nodiscard]] bool sample_next_direction(
+		const SurfaceInteraction& isect, const DiffuseBSDF& bsdf, int depth, Sampler& sampler,
+		SampledSpectrum* beta, Float* bsdfPdf, Ray* ray) const;
+
+	/// <summary>
+	/// The BSDF at the hit, at the wavelengths "lambda", allocated from "arena".
+	/// </summary>
+	[[nodiscard]] const DiffuseBSDF* get_bsdf(const SurfaceInteraction& isect, const SampledWavelengths& lambda, MemoryArena& arena) const;
+
+private:
+	const Scene& scene_;
+	const RGBToSpectrumTable& rgbToSpectrum_;
+	int maxDepth_;
+
+	/// <summary>
+	/// The shading frame, with z on the side of the surface "wo" is on.
+	/// </summary>
+	[[nodiscard]] static inline Frame shading_frame(const SurfaceInteraction& isect)
+	{
+		return Frame::from_z(Vec3f(face_forward(isect.shading_n, isect.wo)));
+	}
+	[[nodiscard]] SampledSpectrum surface_albedo(const SurfaceInteraction& isect, const SampledWavelengths& lambda) const;
+
+	/// <summary>
+	/// Light may only be reflected if both directions are on the same side of the geometric surface,
+	/// otherwise shading normals would let light leak through it.
+	/// </summary>
+	[[nodiscard]] static inline bool same_geometric_side(const SurfaceInteraction& isect, const Vec3f& wi)
+	{
+		return glm::dot(wi, Vec3f(isect.n)) * glm::dot(isect.wo, Vec3f(isect.n)) > 0;
+	}
+};
+
+}  // namespace aito
+
+
+#endif // AITO_INTEGRATOR_H
@@ -0,0 +1,80 @@
+#ifndef AITO_INTERACTION_H
+#define AITO_INTERACTION_H
+
+#include "aito.h"
+
+#include "vecmath.h"
+
+
+namespace aito
+{
+
+class TriangleMesh;
+
+/// <summary>
+/// The local geometry at a ray-surface intersection point.
+/// </summary>
+class SurfaceInteraction
+{
+public:
+	// Hit point in world space
+	Point3f p{};
+	// Geometric normal of the surface at the hit point.
+	Normal3f n{};
+	// Interpolated vertex normal. Equal to "n" if the mesh has no normals.
+	Normal3f shading_n{};
+	// Outgoing direction (the negated ray direction).
+	Vec3f wo{};
+	Point2f uv{};
+
+	// Barycentric coordinates of the hit point within the triangle.
+	Float b0 = 0, b1 = 0, b2 = 0;
+
+	// The mesh and triangle that were hit (non-owning).
+	const TriangleMesh* mesh = nullptr;
+	uint32_t triangle_index = 0;
+
+public:
+	constexpr SurfaceInteraction() = default;
+
+	/// <summary>
+	/// A ray leaving the surface in direction "d". The origin is offset along the normal, so the ray does not hit the surface it starts on.
+	/// </summary>
+	[[nodiscard]] inline Ray spawn_ray(const Vec3f& d) const
+	{
+		return Ray(offset_origin(d), d);
+	}
+	/// <summary>
+	/// A ray from the surface to "pTo", ending just before it, for visibility tests.
+	/// </summary>
+	[[nodiscard]] inline Ray spawn_ray_to(const Point3f& pTo) const
+	{
+		const Point3f o = offset_origin(pTo - p);
+		const Vec3f d = pTo - o;
+		return Ray(o, d, 1 - ShadowEpsilon);
+	}
+	/// <summary>
+	/// A ray from "pFrom" to the surface, ending just before it, for visibility tests.
+	/// Shadow rays towards a point light are traced this way, so the rays of nearby surfaces share their origin.
+	/// </summary>
+	[[nodiscard]] inline Ray spawn_ray_from(const Point3f& pFrom) const
+	{
+		const Point3f o = offset_origin(pFrom - p);
+		return Ray(pFrom, o - pFrom, 1 - ShadowEpsilon);
+	}
+
+private:
+	[[nodiscard]] inline Point3f offset_origin(const Vec3f& w) const
+	{
+		// The intersection error grows with the magnitude of the coordinates
+		const Vec3f absP = glm::abs(Vec3f(p));
+		const Float offset = 1e-4f * (1 + std::max(absP.x, std::max(absP.y, absP.z)));
+		const Vec3f offsetN = Vec3f(face_forward(n, w)) * offset;
+		return Point3f(Vec3f(p) + offsetN);
+	}
+};
+
+}  // namespace aito
+
+
+#endif // AITO_INTERACTION_H
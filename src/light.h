@@ -0,0 +1,69 @@
+#ifndef AITO_LIGHT_H
+#define AITO_LIGHT_H
+
+#include "aito.h"
+
+#include "vecmath.h"
+#include "sampling.h"
+
+
+namespace aito
+{
+
+/// <summary>
+/// Incident illumination sampled from a light.
+/// </summary>
+struct LightSample
+{
+	// Incident radiance
+	Vec3f L{ 0 };
+	// Direction towards the light
+	Vec3f wi{ 0 };
+	// Solid angle density of the sample. Lights described by a delta distribution have a pdf of 1 by convention.
+	Float pdf = 0;
+	// Point on the light, for the shadow ray. Infinitely far away lights have none.
+	Point3f p_light{};
+	bool infinite = false;
+};
+
+/// <summary>
+/// Isotropic point light, the same light the viewport shades with.
+/// </summary>
+struct PointLight
+{
+	Point3f position{};
+	// Radiant intensity (power per solid angle)
+	Vec3f intensity{ 0 };
+
+	[[nodiscard]] inline LightSample sample_li(const Point3f& p) const
+	{
+		const Vec3f toLight = Vec3f(position) - Vec3f(p);
+		const Float distanceSquared = glm::dot(toLight, toLight);
+		if (distanceSquared == 0)
+			return {};
+		return LightSample{ intensity / distanceSquared, toLight / std::sqrt(distanceSquared), 1, position, false };
+	}
+};
+
+/// <summary>
+/// Light arriving equally from every direction, from infinitely far away. The viewport's ambient light.
+/// </summary>
+struct UniformInfiniteLight
+{
+	Vec3f radiance{ 0 };
+
+	[[nodiscard]] inline LightSample sample_li(const Point2f& u) const
+	{
+		return LightSample{ radiance, sample_uniform_sphere(u), uniform_sphere_pdf(), {}, true };
+	}
+	[[nodiscard]] inline Float pdf_li() const { return uniform_sphere_pdf(); }
+	/// <summary>
+	/// The radiance along a ray that escapes the scene.
+	/// </summary>
+	[[nodiscard]] inline Vec3f le() const { return radiance; }
+};
+
+}  // namespace aito
+
+
+#endif // AITO_LIGHT_H
@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "app.h"
+#include "benchmark.h"
 
 #include <iostream>
 #include <cstdlib>
@@ -10,6 +11,17 @@ int main()
 {
 	aito::Logger::init();
 
+#ifdef AITO_BENCHMARK
+	try
+	{
+		aito::run_benchmarks();
+	} catch (const std::exception& e)
+	{
+		std::cerr << e.what();
+		return EXIT_FAILURE;
+	}
+	return 0;
+#endif
 
 	aito::Application app{ };
 
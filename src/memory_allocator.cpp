@@ -0,0 +1,245 @@
+#include "pch.h"
+
+#include "memory_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+
+namespace aito
+{
+	struct MemoryAllocator::Block
+	{
+		Block(VkDeviceSize size)
+			: tlsf(size)
+		{}
+
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		// The whole block, if the memory is host visible
+		void* mapped = nullptr;
+		uint32_t memoryType = 0;
+		// Whether the block holds buffers (and linear images) or optimally tiled images
+		bool linear = true;
+		bool dedicated = false;
+		TLSF tlsf;
+	};
+
+	MemoryAllocator::MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties)
+		: device_(device),
+		bufferImageGranularity_(properties.limits.bufferImageGranularity),
+		nonCoherentAtomSize_(properties.limits.nonCoherentAtomSize),
+		maxAllocationCount_(properties.limits.maxMemoryAllocationCount)
+	{
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties_);
+		blocks_.resize(memoryProperties_.memoryTypeCount);
+	}
+
+	MemoryAllocator::~MemoryAllocator()
+	{
+		for (auto& typeBlocks : blocks_)
+		{
+			for (auto& block : typeBlocks)
+			{
+				if (!block->tlsf.isEmpty())
+					AITO_WARN("Freeing a memory block with {} allocations still in use", block->tlsf.getAllocationCount());
+
+				if (block->mapped)
+					vkUnmapMemory(device_, block->memory);
+				vkFreeMemory(device_, block->memory, nullptr);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Finds a block with room for the resource, and creates one if there is none.
+	/// </summary>
+	/// <param name="requirements">: The memory requirements of the buffer or image. </param>
+	/// <param name="properties">: The required properties of the memory. </param>
+	/// <param name="linear">: True for buffers and linearly tiled images. </param>
+	/// <returns>The allocation, which has to be given back to free() once the resource is destroyed. </returns>
+	MemoryAllocator::Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+		const VkMemoryPropertyFlags propertyFlags = memoryProperties_.memoryTypes[memoryType].propertyFlags;
+
+		VkDeviceSize alignment = requirements.alignment;
+		VkDeviceSize size = requirements.size;
+		// Flushing and invalidating non-coherent memory works on whole atoms, which must not reach into the neighbours
+		if ((propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			alignment = std::max(alignment, nonCoherentAtomSize_);
+			size = (size + nonCoherentAtomSize_ - 1) & ~(nonCoherentAtomSize_ - 1);
+		}
+
+		// Linear and optimal resources must not share a page of bufferImageGranularity, so they get blocks of their own.
+		// Most desktop GPUs have a granularity of 1, and then everything can share.
+		const bool blockLinear = bufferImageGranularity_ <= 1 || linear;
+
+		Block* found = nullptr;
+		uint32_t range = TLSF::NO_RANGE;
+
+		const VkDeviceSize blockSize = getBlockSize(memoryType);
+		if (size > blockSize / 2)
+		{
+			// Resources this large would waste most of a shared block, and get memory of their own
+			found = createBlock(memoryType, size, blockLinear, true);
+			range = found->tlsf.allocate(size, 1);
+		}
+		else
+		{
+			for (auto& block : blocks_[memoryType])
+			{
+				if (block->dedicated || block->linear != blockLinear)
+					continue;
+
+				range = block->tlsf.allocate(size, alignment);
+				if (range != TLSF::NO_RANGE)
+				{
+					found = block.get();
+					break;
+				}
+			}
+
+			if (!found)
+			{
+				found = createBlock(memoryType, blockSize, blockLinear, false);
+				range = found->tlsf.allocate(size, alignment);
+			}
+		}
+		assert(range != TLSF::NO_RANGE && "A new block must fit the allocation");
+
+		Allocation allocation{};
+		allocation.memory = found->memory;
+		allocation.offset = found->tlsf.getOffset(range);
+		allocation.size = size;
+		allocation.mapped = found->mapped ? static_cast<char*>(found->mapped) + allocation.offset : nullptr;
+		allocation.propertyFlags = propertyFlags;
+		allocation.block = found;
+		allocation.range = range;
+		return allocation;
+	}
+
+	/// <summary>
+	/// Gives the memory of a destroyed resource back to its block. Empty blocks are given back to the driver,
+	/// except for one per memory type, so a resource that is recreated every frame does not allocate a block every time.
+	/// </summary>
+	void MemoryAllocator::free(Allocation& allocation)
+	{
+		if (allocation.block == nullptr)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		Block* block = allocation.block;
+		block->tlsf.free(allocation.range);
+		allocation = Allocation{};
+
+		if (!block->tlsf.isEmpty())
+			return;
+
+		if (block->dedicated)
+		{
+			destroyBlock(block->memoryType, block);
+			return;
+		}
+
+		const auto& typeBlocks = blocks_[block->memoryType];
+		const bool otherEmpty = std::any_of(typeBlocks.begin(), typeBlocks.end(), [block](const std::unique_ptr<Block>& other)
+			{
+				return other.get() != block && !other->dedicated && other->tlsf.isEmpty();
+			});
+		if (otherEmpty)
+			destroyBlock(block->memoryType, block);
+	}
+
+	MemoryAllocator::Stats MemoryAllocator::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		Stats stats{};
+		stats.deviceAllocations = totalDeviceAllocations_;
+		for (const auto& typeBlocks : blocks_)
+		{
+			for (const auto& block : typeBlocks)
+			{
+				stats.blockCount++;
+				if (block->dedicated)
+					stats.dedicatedBlockCount++;
+				stats.allocationCount += block->tlsf.getAllocationCount();
+				stats.blockBytes += block->tlsf.getSize();
+				stats.usedBytes += block->tlsf.getUsedBytes();
+				stats.freeRangeCount += block->tlsf.getFreeRangeCount();
+				stats.largestFreeRange = std::max(stats.largestFreeRange, block->tlsf.getLargestFreeRange());
+			}
+		}
+		return stats;
+	}
+
+	uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+	{
+		for (uint32_t i = 0; i < memoryProperties_.memoryTypeCount; i++)
+		{
+			if ((typeFilter & (1 << i)) && (memoryProperties_.memoryTypes[i].propertyFlags & properties) == properties)
+				return i;
+		}
+
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	VkDeviceSize MemoryAllocator::getBlockSize(uint32_t memoryType) const
+	{
+		const VkDeviceSize heapSize = memoryProperties_.memoryHeaps[memoryProperties_.memoryTypes[memoryType].heapIndex].size;
+		return heapSize <= SMALL_HEAP_SIZE ? heapSize / 8 : DEFAULT_BLOCK_SIZE;
+	}
+
+	MemoryAllocator::Block* MemoryAllocator::createBlock(uint32_t memoryType, VkDeviceSize size, bool linear, bool dedicated)
+	{
+		if (deviceAllocationCount_ >= maxAllocationCount_)
+			throw std::runtime_error("Reached the maximum number of device memory allocations!");
+
+		auto block = std::make_unique<Block>(size);
+		block->memoryType = memoryType;
+		block->linear = linear;
+		block->dedicated = dedicated;
+
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+
+		if (vkAllocateMemory(device_, &allocInfo, nullptr, &block->memory) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate device memory!");
+
+		if (memoryProperties_.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			if (vkMapMemory(device_, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped) != VK_SUCCESS)
+			{
+				vkFreeMemory(device_, block->memory, nullptr);
+				throw std::runtime_error("failed to map device memory!");
+			}
+		}
+
+		deviceAllocationCount_++;
+		totalDeviceAllocations_++;
+
+		blocks_[memoryType].push_back(std::move(block));
+		return blocks_[memoryType].back().get();
+	}
+
+	void MemoryAllocator::destroyBlock(uint32_t memoryType, Block* block)
+	{
+		if (block->mapped)
+			vkUnmapMemory(device_, block->memory);
+		vkFreeMemory(device_, block->memory, nullptr);
+		deviceAllocationCount_--;
+
+		auto& typeBlocks = blocks_[memoryType];
+		typeBlocks.erase(std::find_if(typeBlocks.begin(), typeBlocks.end(), [block](const std::unique_ptr<Block>& other)
+			{
+				return other.get() == block;
+			}));
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef AITO_MEMORY_ALLOCATOR_H
+#define AITO_MEMORY_ALLOCATOR_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "tlsf.h"
+
+
+namespace aito
+{
+	/// <summary>
+	/// Sub-allocates buffers and images from large blocks of device memory, instead of calling vkAllocateMemory for each,
+	/// since drivers only allow a few thousand allocations (maxMemoryAllocationCount) and allocating is slow.
+	/// Every memory type has its own list of blocks, and the ranges of a block are handed out by a TLSF allocator.
+	/// Host visible blocks stay mapped for as long as they live, so mapping an allocation is just an offset.
+	/// </summary>
+	class MemoryAllocator
+	{
+	public:
+		static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+		// Heaps up to this size (like the host visible part of device local memory) get blocks of 1/8 of the heap
+		static constexpr VkDeviceSize SMALL_HEAP_SIZE = 1024 * 1024 * 1024;
+
+		struct Block;
+
+		/// <summary>
+		/// A range of device memory owned by a buffer or an image.
+		/// </summary>
+		struct Allocation
+		{
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+			// The memory at offset, if the memory is host visible
+			void* mapped = nullptr;
+			VkMemoryPropertyFlags propertyFlags = 0;
+
+			Block* block = nullptr;
+			uint32_t range = TLSF::NO_RANGE;
+		};
+
+		/// <summary>
+		/// Counters for the memory use, and for how fragmented the free memory of the blocks is.
+		/// </summary>
+		struct Stats
+		{
+			uint32_t blockCount = 0;
+			// Blocks holding a single allocation too large to share a block
+			uint32_t dedicatedBlockCount = 0;
+			uint32_t allocationCount = 0;
+			// The memory allocated from the driver, and the part of it that is handed out
+			VkDeviceSize blockBytes = 0;
+			VkDeviceSize usedBytes = 0;
+			uint32_t freeRangeCount = 0;
+			VkDeviceSize largestFreeRange = 0;
+			// Calls to vkAllocateMemory since the allocator was created
+			uint64_t deviceAllocations = 0;
+
+			/// <summary>
+			/// 0 if all the free memory of the blocks is in one range, going towards 1 as it is split into many small ones.
+			/// </summary>
+			inline float fragmentation() const
+			{
+				const VkDeviceSize freeBytes = blockBytes - usedBytes;
+				return freeBytes == 0 ? 0.0f : 1.0f - static_cast<float>(largestFreeRange) / freeBytes;
+			}
+		};
+
+		MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, const VkPhysicalDeviceProperties& properties);
+		~MemoryAllocator();
+
+		// Not copyable or movable
+		MemoryAllocator(const MemoryAllocator&) = delete;
+		MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+		MemoryAllocator(MemoryAllocator&&) = delete;
+		MemoryAllocator& operator=(MemoryAllocator&&) = delete;
+
+		/// <summary>
+		/// Allocates memory for a resource with the given requirements. "linear" is true for buffers and linearly tiled images,
+		/// which must not share a page of bufferImageGranularity with optimally tiled images.
+		/// </summary>
+		Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+		void free(Allocation& allocation);
+
+		Stats getStats() const;
+
+	private:
+		VkDevice device_;
+		VkPhysicalDeviceMemoryProperties memoryProperties_;
+		VkDeviceSize bufferImageGranularity_;
+		VkDeviceSize nonCoherentAtomSize_;
+		uint32_t maxAllocationCount_;
+
+		mutable std::mutex mutex_;
+		// The blocks of every memory type
+		std::vector<std::vector<std::unique_ptr<Block>>> blocks_;
+		uint32_t deviceAllocationCount_ = 0;
+		uint64_t totalDeviceAllocations_ = 0;
+
+		uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+		VkDeviceSize getBlockSize(uint32_t memoryType) const;
+		Block* createBlock(uint32_t memoryType, VkDeviceSize size, bool linear, bool dedicated);
+		void destroyBlock(uint32_t memoryType, Block* block);
+	};
+}
+
+#endif /* AITO_MEMORY_ALLOCATOR_H */
@@ -0,0 +1,101 @@
+#include "pch.h"
+
+#include "memory_arena.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+namespace aito
+{
+
+MemoryArena::MemoryArena(size_t blockSize)
+	: blockSize_(blockSize)
+{}
+
+MemoryArena::~MemoryArena()
+{
+	free_blocks();
+}
+
+MemoryArena::MemoryArena(MemoryArena&& other) noexcept
+	: blockSize_(other.blockSize_), blocks_(std::move(other.blocks_)),
+	currentBlock_(other.currentBlock_), currentOffset_(other.currentOffset_), stats_(other.stats_)
+{
+	other.blocks_.clear();
+	other.reset();
+}
+
+MemoryArena& MemoryArena::operator=(MemoryArena&& other) noexcept
+{
+	if (this != &other)
+	{
+		free_blocks();
+		blockSize_ = other.blockSize_;
+		blocks_ = std::move(other.blocks_);
+		currentBlock_ = other.currentBlock_;
+		currentOffset_ = other.currentOffset_;
+		stats_ = other.stats_;
+		other.blocks_.clear();
+		other.reset();
+	}
+	return *this;
+}
+
+void MemoryArena::reset()
+{
+	stats_.peak_bytes_used = std::max(stats_.peak_bytes_used, bytes_used());
+	currentBlock_ = 0;
+	currentOffset_ = 0;
+}
+
+size_t MemoryArena::bytes_used() const
+{
+	size_t used = 0;
+	for (size_t i = 0; i < currentBlock_ && i < blocks_.size(); i++)
+		used += blocks_[i].size;
+	return used + currentOffset_;
+}
+
+MemoryArena::Stats MemoryArena::stats() const
+{
+	Stats stats = stats_;
+	stats.peak_bytes_used = std::max(stats.peak_bytes_used, bytes_used());
+	stats.bytes_reserved = 0;
+	for (const Block& block : blocks_)
+		stats.bytes_reserved += block.size;
+	return stats;
+}
+
+void MemoryArena::next_block(size_t size, size_t alignment)
+{
+	assert(alignment <= BLOCK_ALIGNMENT && "The arena can not align allocations beyond its blocks");
+
+	// The rest of the current block is left unused until the next reset. Blocks too small for the allocation are skipped the same way.
+	size_t next = blocks_.empty() ? 0 : currentBlock_ + 1;
+	while (next < blocks_.size() && blocks_[next].size < size)
+		next++;
+
+	if (next == blocks_.size())
+	{
+		// Allocations larger than a block get a block of their own
+		const size_t blockSize = std::max(size, blockSize_);
+		Block block;
+		block.memory = static_cast<std::byte*>(::operator new(blockSize, std::align_val_t{ BLOCK_ALIGNMENT }));
+		block.size = blockSize;
+		blocks_.push_back(block);
+		stats_.heap_allocations++;
+	}
+
+	currentBlock_ = next;
+	currentOffset_ = 0;
+}
+
+void MemoryArena::free_blocks()
+{
+	for (const Block& block : blocks_)
+		::operator delete(block.memory, std::align_val_t{ BLOCK_ALIGNMENT });
+	blocks_.clear();
+}
+
+}  // namespace aito
@@ -0,0 +1,123 @@
+#ifndef AITO_MEMORY_ARENA_H
+#define AITO_MEMORY_ARENA_H
+
+#include "aito.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Bump allocator for short lived scratch data, like the BSDFs of the hits of a path. Allocating moves a pointer
+/// through a block of memory, and reset() frees everything at once by moving it back. The blocks are kept for the next use,
+/// so once the arena has grown to what a sample needs, rendering does not touch the heap anymore.
+/// An arena is not thread safe, every thread uses its own.
+/// </summary>
+class MemoryArena
+{
+public:
+	static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+	// Every block starts on a cache line, and so does every allocation that asks for it
+	static constexpr size_t BLOCK_ALIGNMENT = 64;
+
+	/// <summary>
+	/// Counters for checking that the arena is used the way it is meant to be.
+	/// </summary>
+	struct Stats
+	{
+		// Allocations served by the arena since it was created
+		uint64_t allocations = 0;
+		// Blocks requested from the heap since it was created. Stays constant once the arena is warm.
+		uint64_t heap_allocations = 0;
+		// The most memory used between two resets
+		size_t peak_bytes_used = 0;
+		// The total size of the blocks the arena holds
+		size_t bytes_reserved = 0;
+	};
+
+	explicit MemoryArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+	~MemoryArena();
+
+	MemoryArena(const MemoryArena&) = delete;
+	MemoryArena& operator=(const MemoryArena&) = delete;
+	MemoryArena(MemoryArena&& other) noexcept;
+	MemoryArena& operator=(MemoryArena&& other) noexcept;
+
+	/// <summary>
+	/// Uninitialized memory, valid until the next reset(). "alignment" must be a power of two.
+	/// </summary>
+	[[nodiscard]] inline void* alloc(size_t size, size_t alignment = alignof(std::max_align_t))
+	{
+		size_t offset = (currentOffset_ + alignment - 1) & ~(alignment - 1);
+		if (currentBlock_ >= blocks_.size() || offset + size > blocks_[currentBlock_].size)
+		{
+			next_block(size, alignment);
+			offset = 0;
+		}
+		currentOffset_ = offset + size;
+		stats_.allocations++;
+		return blocks_[currentBlock_].memory + offset;
+	}
+
+	/// <summary>
+	/// Constructs a T in the arena. reset() does not run destructors, so T has to be trivially destructible.
+	/// </summary>
+	template<typename T, typename... Args>
+	[[nodiscard]] inline T* alloc(Args&&... args)
+	{
+		static_assert(std::is_trivially_destructible_v<T>, "The arena never destroys what it allocates");
+		return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	/// <summary>
+	/// An uninitialized array of "count" Ts.
+	/// </summary>
+	template<typename T>
+	[[nodiscard]] inline T* alloc_array(size_t count)
+	{
+		static_assert(std::is_trivially_destructible_v<T>, "The arena never destroys what it allocates");
+		return static_cast<T*>(alloc(count * sizeof(T), alignof(T)));
+	}
+
+	/// <summary>
+	/// Frees all allocations at once. The blocks stay with the arena.
+	/// </summary>
+	void reset();
+
+	/// <summary>
+	/// The memory used since the last reset.
+	/// </summary>
+	[[nodiscard]] size_t bytes_used() const;
+	[[nodiscard]] Stats stats() const;
+
+private:
+	struct Block
+	{
+		std::byte* memory;
+		size_t size;
+	};
+
+	size_t blockSize_;
+	std::vector<Block> blocks_;
+	// The block allocations currently come from, and the first free byte in it
+	size_t currentBlock_ = 0;
+	size_t currentOffset_ = 0;
+	Stats stats_;
+
+	/// <summary>
+	/// Moves on to the next block that fits the allocation, and allocates one if none of the remaining blocks do.
+	/// </summary>
+	void next_block(size_t size, size_t alignment);
+	void free_blocks();
+};
+
+}  // namespace aito
+
+
+#endif // AITO_MEMORY_ARENA_H
@@ -0,0 +1,217 @@
+#include "pch.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+
+namespace aito
+{
+
+namespace
+{
+
+/// <summary>
+/// A call to parallel_for_chunks, shared by the calling thread and the workers that help with it.
+/// Lives on the stack of the caller, which only returns once every chunk is done.
+/// </summary>
+struct ParallelJob
+{
+	const std::function<void(uint32_t, uint32_t, int)>* func;
+	uint32_t begin;
+	uint32_t count;
+	int chunks;
+	// The next chunk nobody has claimed yet, and the chunks not done yet. Both guarded by the pool mutex.
+	int nextChunk;
+	int remaining;
+	// The first exception a chunk threw, rethrown to the caller. Guarded by the pool mutex.
+	std::exception_ptr exception;
+
+	/// <summary>
+	/// Runs chunk "i", catching anything it throws, so a worker never lets an exception escape its thread.
+	/// </summary>
+	/// <returns>The exception the chunk threw, if any. </returns>
+	std::exception_ptr run_chunk(int i) const
+	{
+		const auto chunkBegin = [&](int c) { return begin + static_cast<uint32_t>(static_cast<uint64_t>(count) * c / chunks); };
+		try
+		{
+			(*func)(chunkBegin(i), chunkBegin(i + 1), i);
+		} catch (...)
+		{
+			return std::current_exception();
+		}
+		return nullptr;
+	}
+};
+
+/// <summary>
+/// The worker threads every parallel_for_chunks call shares, so the calls don't pay for creating threads.
+/// The chunks are claimed one at a time by the workers and the calling thread. The caller claims the chunks nobody has
+/// started yet itself, so it never waits for a busy pool, and calls nested in a chunk or made by several threads at once can't deadlock.
+/// </summary>
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int workerCount)
+	{
+		workers_.reserve(workerCount);
+		for (int i = 0; i < workerCount; i++)
+			workers_.emplace_back(&ThreadPool::worker_loop, this);
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard lock(mutex_);
+			stopping_ = true;
+		}
+		jobAdded_.notify_all();
+		for (auto& worker : workers_)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// <summary>
+	/// Runs every chunk of "job", on the calling thread and any free workers, and returns once all of them are done.
+	/// If a chunk throws, the chunks nobody has started are skipped, and the first exception is rethrown once the running ones are done.
+	/// </summary>
+	void run(ParallelJob& job)
+	{
+		{
+			std::lock_guard lock(mutex_);
+			jobs_.push_back(&job);
+		}
+		jobAdded_.notify_all();
+
+		std::unique_lock lock(mutex_);
+		while (true)
+		{
+			const int chunk = claim_chunk(job);
+			if (chunk < 0)
+				break;
+			lock.unlock();
+			const std::exception_ptr exception = job.run_chunk(chunk);
+			lock.lock();
+			finish_chunk(job, exception);
+		}
+		// Only the chunks other threads are running are left
+		chunkDone_.wait(lock, [&]() { return job.remaining == 0; });
+
+		if (job.exception)
+			std::rethrow_exception(job.exception);
+	}
+
+private:
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable jobAdded_;
+	std::condition_variable chunkDone_;
+	// The jobs with chunks nobody has claimed yet
+	std::deque<ParallelJob*> jobs_;
+	bool stopping_ = false;
+
+	/// <summary>
+	/// Claims the next chunk of "job", dropping the job from the queue once its last chunk is claimed. Call with the mutex held.
+	/// </summary>
+	/// <returns>The chunk, or -1 if all of them are claimed. </returns>
+	int claim_chunk(ParallelJob& job)
+	{
+		if (job.nextChunk >= job.chunks)
+			return -1;
+		const int chunk = job.nextChunk++;
+		if (job.nextChunk == job.chunks)
+			jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+		return chunk;
+	}
+
+	/// <summary>
+	/// Counts a chunk of "job" as done. A chunk that threw cancels the chunks nobody has claimed yet. Call with the mutex held.
+	/// </summary>
+	void finish_chunk(ParallelJob& job, const std::exception_ptr& exception)
+	{
+		if (exception)
+		{
+			if (!job.exception)
+				job.exception = exception;
+			if (job.nextChunk < job.chunks)
+			{
+				jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+				job.remaining -= job.chunks - job.nextChunk;
+				job.nextChunk = job.chunks;
+			}
+		}
+
+		// The caller may return as soon as this reaches zero, so the job is not touched after it
+		if (--job.remaining == 0)
+			chunkDone_.notify_all();
+	}
+
+	void worker_loop()
+	{
+		std::unique_lock lock(mutex_);
+		while (true)
+		{
+			jobAdded_.wait(lock, [&]() { return stopping_ || !jobs_.empty(); });
+			if (stopping_)
+				return;
+
+			ParallelJob& job = *jobs_.front();
+			const int chunk = claim_chunk(job);
+			lock.unlock();
+			const std::exception_ptr exception = job.run_chunk(chunk);
+			lock.lock();
+			finish_chunk(job, exception);
+		}
+	}
+};
+
+ThreadPool& thread_pool()
+{
+	// The calling thread always works on its own call too
+	static ThreadPool pool(available_cores() - 1);
+	return pool;
+}
+
+}
+
+int available_cores()
+{
+	return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+int chunk_count(uint32_t count, uint32_t minChunkSize, int threadCount)
+{
+	if (count == 0)
+		return 0;
+	const uint32_t maxChunks = std::max(1u, count / std::max(1u, minChunkSize));
+	return static_cast<int>(std::min(maxChunks, static_cast<uint32_t>(std::max(1, threadCount))));
+}
+
+int parallel_for_chunks(
+	uint32_t begin, uint32_t end, uint32_t minChunkSize, int threadCount,
+	const std::function<void(uint32_t, uint32_t, int)>& func)
+{
+	const uint32_t count = end - begin;
+	const int chunks = chunk_count(count, minChunkSize, threadCount);
+	if (chunks <= 1)
+	{
+		if (chunks == 1)
+			func(begin, end, 0);
+		return chunks;
+	}
+
+	ParallelJob job{ &func, begin, count, chunks, 0, chunks, nullptr };
+	thread_pool().run(job);
+
+	return chunks;
+}
+
+}  // namespace aito
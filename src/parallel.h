@@ -0,0 +1,69 @@
+#ifndef AITO_PARALLEL_H
+#define AITO_PARALLEL_H
+
+#include "aito.h"
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+
+
+namespace aito
+{
+
+/// <summary>
+/// The number of hardware threads available. Always at least 1.
+/// </summary>
+int available_cores();
+
+/// <summary>
+/// Splits [begin, end) into at most "threadCount" contiguous chunks of at least "minChunkSize" elements,
+/// and calls func(chunkBegin, chunkEnd, chunkIndex) for each chunk. The chunks run on the calling thread and a pool of worker threads
+/// shared by all calls, which is created once. Blocks until all chunks are done. Can be called from inside a chunk or from several threads.
+/// If "func" throws, the chunks that have not started are skipped and the first exception is rethrown once the others are done.
+/// Chunk i always covers the same range for the same arguments, so per-chunk results can be merged deterministically.
+/// </summary>
+/// <returns>The number of chunks used. </returns>
+int parallel_for_chunks(
+	uint32_t begin, uint32_t end, uint32_t minChunkSize, int threadCount,
+	const std::function<void(uint32_t, uint32_t, int)>& func);
+
+/// <summary>
+/// The number of chunks "parallel_for_chunks" will use for the given arguments.
+/// </summary>
+int chunk_count(uint32_t count, uint32_t minChunkSize, int threadCount);
+
+/// <summary>
+/// Float that several threads can add to at the same time without locks, by compare-and-swapping its bit pattern.
+/// </summary>
+class AtomicFloat
+{
+public:
+	explicit AtomicFloat(Float v = 0) : bits_(std::bit_cast<FloatBits>(v)) {}
+
+	operator Float() const { return std::bit_cast<Float>(bits_.load(std::memory_order_relaxed)); }
+	Float operator=(Float v)
+	{
+		bits_.store(std::bit_cast<FloatBits>(v), std::memory_order_relaxed);
+		return v;
+	}
+
+	void add(Float v)
+	{
+		FloatBits oldBits = bits_.load(std::memory_order_relaxed);
+		FloatBits newBits;
+		do
+		{
+			newBits = std::bit_cast<FloatBits>(std::bit_cast<Float>(oldBits) + v);
+		} while (!bits_.compare_exchange_weak(oldBits, newBits, std::memory_order_relaxed));
+	}
+
+private:
+	std::atomic<FloatBits> bits_;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_PARALLEL_H
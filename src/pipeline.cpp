@@ -148,6 +148,49 @@ namespace aito
 		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline_);
 	}
 
+	ComputePipeline::ComputePipeline(Device& device, const std::string& compFilePath, VkPipelineLayout pipelineLayout)
+		: device_(device)
+	{
+		assert(pipelineLayout != VK_NULL_HANDLE && "Unable to create compute pipeline: No pipelineLayout provided");
+
+		const std::vector<char> compCode = Pipeline::readFile(compFilePath);
+
+		VkShaderModuleCreateInfo moduleInfo{};
+		moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		moduleInfo.codeSize = compCode.size();
+		moduleInfo.pCode = reinterpret_cast<const uint32_t*>(compCode.data());
+		if (vkCreateShaderModule(device_.device(), &moduleInfo, nullptr, &computeShaderModule_) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create shader module");
+		}
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = computeShaderModule_;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = pipelineLayout;
+		pipelineInfo.basePipelineIndex = -1;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+		if (vkCreateComputePipelines(device_.device(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline_) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create compute pipeline");
+		}
+	}
+
+	ComputePipeline::~ComputePipeline()
+	{
+		vkDestroyShaderModule(device_.device(), computeShaderModule_, nullptr);
+		vkDestroyPipeline(device_.device(), computePipeline_, nullptr);
+	}
+
+	void ComputePipeline::bind(VkCommandBuffer commandBuffer)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline_);
+	}
+
 	/// <summary>
 	/// Takes in a reference to a configInfo object and writes default values to it.
 	/// </summary>
@@ -52,6 +52,7 @@ namespace aito
 
 		// Static methods
 		static void defaultPipelineConfigInfo(PipelineConfigInfo& configInfo);
+		static std::vector<char> readFile(const std::string& filename);
 
 	private:
 		// Private member variables
@@ -62,8 +63,6 @@ namespace aito
 
 
 		// Private methods
-		static std::vector<char> readFile(const std::string& filename);
-
 		void createGraphicsPipeline(
 			const std::string& vertFilePath, 
 			const std::string& fragFilePath, 
@@ -73,6 +72,29 @@ namespace aito
 
 	};
 
+	/// <summary>
+	/// A pipeline with a single compute shader, for work the GPU does outside of the render pass.
+	/// </summary>
+	class ComputePipeline
+	{
+	public:
+		ComputePipeline(Device& device, const std::string& compFilePath, VkPipelineLayout pipelineLayout);
+		~ComputePipeline();
+
+		// Not copyable or movable
+		ComputePipeline(const ComputePipeline&) = delete;
+		void operator=(const ComputePipeline&) = delete;
+		ComputePipeline(ComputePipeline&&) = delete;
+		ComputePipeline& operator=(ComputePipeline&&) = delete;
+
+		void bind(VkCommandBuffer commandBuffer);
+
+	private:
+		Device& device_;
+		VkPipeline computePipeline_;
+		VkShaderModule computeShaderModule_;
+	};
+
 }
 
 
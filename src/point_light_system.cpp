@@ -82,8 +82,8 @@ namespace aito
 			0,
 			1,
 			&frameInfo.globalDescriptorSet,
-			0,
-			nullptr
+			1,
+			&frameInfo.globalOffset
 		);
 
 		vkCmdDraw(frameInfo.commandBuffer, 6, 1, 0, 0);
@@ -0,0 +1,295 @@
+#include "pch.h"
+
+#include "progressive_renderer.h"
+
+#include "parallel.h"
+
+#include <chrono>
+#include <optional>
+
+
+namespace aito
+{
+
+ProgressiveRenderer::ProgressiveRenderer(
+	const Point2i& resolution,
+	RadianceFunction radiance,
+	Sampler::Type samplerType,
+	int samplesPerPass,
+	int threadCount,
+	WavefrontIntegrator* wavefront)
+	: film_(resolution),
+	// Leave a core for the viewer
+	scheduler_(film_.sample_bounds(), TileScheduler::DEFAULT_TILE_SIZE, threadCount > 0 ? threadCount : std::max(1, available_cores() - 1)),
+	radiance_(std::move(radiance)),
+	wavefront_(wavefront),
+	tileDirty_(std::make_unique<std::atomic<bool>[]>(scheduler_.tile_count())),
+	sampler_(samplerType, resolution),
+	samplesPerPass_(std::max(1, samplesPerPass))
+{
+	tileRegions_.reserve(scheduler_.tile_count());
+	for (const RenderTile& tile : scheduler_.tiles())
+		tileRegions_.push_back(film_.get_film_tile(tile.pixel_bounds)->pixel_bounds());
+
+	renderThread_ = std::thread(&ProgressiveRenderer::render_loop, this);
+}
+
+ProgressiveRenderer::~ProgressiveRenderer()
+{
+	{
+		std::lock_guard lock(mutex_);
+		stopping_ = true;
+	}
+	cancel_pass();
+	stateChanged_.notify_all();
+	renderThread_.join();
+}
+
+void ProgressiveRenderer::set_camera(const Mat4f& view, const Mat4f& projection)
+{
+	{
+		std::lock_guard lock(mutex_);
+		if (view == view_ && projection == projection_)
+			return;
+		view_ = view;
+		projection_ = projection;
+		inverseViewProjection_ = glm::inverse(projection * view);
+		restartRequested_ = true;
+	}
+	cancel_pass();
+	stateChanged_.notify_all();
+}
+
+void ProgressiveRenderer::restart()
+{
+	{
+		std::lock_guard lock(mutex_);
+		restartRequested_ = true;
+	}
+	cancel_pass();
+	stateChanged_.notify_all();
+}
+
+void ProgressiveRenderer::edit_scene(const std::function<void()>& edit)
+{
+	{
+		std::unique_lock lock(mutex_);
+		editingScene_ = true;
+		cancel_pass();
+		stateChanged_.wait(lock, [&]() { return !passRunning_; });
+
+		edit();
+		editingScene_ = false;
+		restartRequested_ = true;
+	}
+	stateChanged_.notify_all();
+}
+
+void ProgressiveRenderer::set_sampler(Sampler::Type type)
+{
+	{
+		std::lock_guard lock(mutex_);
+		if (type == sampler_.type())
+			return;
+		sampler_ = Sampler(type, film_.resolution());
+		restartRequested_ = true;
+	}
+	cancel_pass();
+	stateChanged_.notify_all();
+}
+
+void ProgressiveRenderer::set_samples_per_pass(int samplesPerPass)
+{
+	std::lock_guard lock(mutex_);
+	samplesPerPass_ = std::max(1, samplesPerPass);
+}
+
+void ProgressiveRenderer::set_max_samples_per_pixel(int maxSamplesPerPixel)
+{
+	{
+		std::lock_guard lock(mutex_);
+		maxSamplesPerPixel_ = std::max(0, maxSamplesPerPixel);
+	}
+	stateChanged_.notify_all();
+}
+
+void ProgressiveRenderer::set_paused(bool paused)
+{
+	{
+		std::lock_guard lock(mutex_);
+		paused_ = paused;
+	}
+	stateChanged_.notify_all();
+}
+
+void ProgressiveRenderer::set_wavefront(bool enabled)
+{
+	{
+		std::lock_guard lock(mutex_);
+		if (wavefront_ == nullptr || enabled == useWavefront_)
+			return;
+		useWavefront_ = enabled;
+		restartRequested_ = true;
+	}
+	cancel_pass();
+	stateChanged_.notify_all();
+}
+
+float ProgressiveRenderer::pass_progress() const
+{
+	if (wavefrontPass_)
+		return wavefront_->progress();
+	return static_cast<float>(scheduler_.tiles_done()) / scheduler_.tile_count();
+}
+
+void ProgressiveRenderer::collect_dirty_regions(std::vector<Bounds2i>& regions)
+{
+	for (uint32_t i = 0; i < scheduler_.tile_count(); i++)
+	{
+		if (tileDirty_[i].exchange(false))
+			regions.push_back(tileRegions_[i]);
+	}
+}
+
+void ProgressiveRenderer::mark_all_dirty()
+{
+	for (uint32_t i = 0; i < scheduler_.tile_count(); i++)
+		tileDirty_[i] = true;
+}
+
+void ProgressiveRenderer::cancel_pass()
+{
+	scheduler_.cancel();
+	cancelWavefront_ = true;
+}
+
+void ProgressiveRenderer::render_loop()
+{
+	while (true)
+	{
+		Mat4f inverseViewProjection;
+		std::optional<Sampler> sampler;
+		int sampleCount;
+		bool wavefront;
+		{
+			std::unique_lock lock(mutex_);
+			stateChanged_.wait(lock, [&]()
+				{
+					const bool converged = maxSamplesPerPixel_ > 0 && samplesPerPixel_ >= maxSamplesPerPixel_;
+					return stopping_ || (!editingScene_ && (restartRequested_ || (!paused_ && !converged)));
+				});
+			if (stopping_)
+				return;
+
+			if (restartRequested_)
+			{
+				restartRequested_ = false;
+				samplesPerPixel_ = 0;
+				film_.clear();
+				mark_all_dirty();
+				continue;
+			}
+
+			inverseViewProjection = inverseViewProjection_;
+			sampler = sampler_;
+			sampleCount = samplesPerPass_;
+			wavefront = useWavefront_;
+			// Cleared while holding the lock, so a cancel requested after this point always reaches the pass
+			cancelWavefront_ = false;
+			scheduler_.reset_cancel();
+			passRunning_ = true;
+			if (maxSamplesPerPixel_ > 0)
+				sampleCount = std::min(sampleCount, maxSamplesPerPixel_ - samplesPerPixel_);
+		}
+
+		const auto startTime = std::chrono::steady_clock::now();
+		const uint32_t firstSample = static_cast<uint32_t>(samplesPerPixel_.load());
+		bool completed;
+		try
+		{
+			if (wavefront)
+			{
+				wavefrontPass_ = true;
+				const auto camera = [&](const Point2f& pFilm) { return generate_ray(inverseViewProjection, pFilm); };
+				completed = wavefront_->render(film_, camera, *sampler, firstSample, sampleCount, &cancelWavefront_);
+				wavefrontPass_ = false;
+				// The paths of a wave are spread over the whole image
+				mark_all_dirty();
+			}
+			else
+			{
+				scheduler_.run([&](const RenderTile& tile, int)
+					{
+						// Samplers hold the state of the current sample, so every tile gets its own copy
+						Sampler tileSampler = *sampler;
+						render_tile(tile, tileSampler, inverseViewProjection, firstSample, sampleCount);
+					});
+				completed = scheduler_.tiles_done() == scheduler_.tile_count();
+			}
+		} catch (const std::exception& e)
+		{
+			// The render thread must not die with the exception, and the waiters in edit_scene must not wait forever.
+			// The pass is thrown away and the renderer pauses, so a failing scene doesn't fail over and over.
+			AITO_ERROR("Progressive render pass failed: {}", e.what());
+			wavefrontPass_ = false;
+			std::lock_guard lock(mutex_);
+			passRunning_ = false;
+			paused_ = true;
+			restartRequested_ = true;
+			stateChanged_.notify_all();
+			continue;
+		}
+
+		// A pass that was cancelled for a restart is thrown away with the rest of the film.
+		// A cancel that arrived just after a restart leaves a partial pass in the film, so that one restarts again.
+		std::lock_guard lock(mutex_);
+		passRunning_ = false;
+		stateChanged_.notify_all();
+		if (!completed)
+			restartRequested_ = true;
+		if (restartRequested_ || stopping_)
+			continue;
+		samplesPerPixel_ += sampleCount;
+		lastPassTime_ = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+	}
+}
+
+void ProgressiveRenderer::render_tile(const RenderTile& tile, Sampler& sampler, const Mat4f& inverseViewProjection, uint32_t firstSample, int sampleCount)
+{
+	std::unique_ptr<FilmTile> filmTile = film_.get_film_tile(tile.pixel_bounds);
+
+	for (const Point2i pixel : tile.pixel_bounds)
+	{
+		for (int i = 0; i < sampleCount; i++)
+		{
+			// The sample index continues from the previous passes, so all passes together form one well distributed sequence
+			sampler.start_pixel_sample(pixel, firstSample + i);
+			const Point2f u = sampler.get_pixel_2d();
+			const Point2f pFilm(pixel.x + u.x, pixel.y + u.y);
+			const Vec3f L = radiance_(generate_ray(inverseViewProjection, pFilm), sampler);
+
+			// Drop invalid samples instead of letting them spread through the filter
+			if (std::isnan(L.x + L.y + L.z) || std::isinf(L.x + L.y + L.z))
+				continue;
+			filmTile->add_sample(pFilm, L);
+		}
+	}
+
+	film_.merge_film_tile(*filmTile);
+	tileDirty_[tile.index] = true;
+}
+
+Ray ProgressiveRenderer::generate_ray(const Mat4f& inverseViewProjection, const Point2f& pFilm) const
+{
+	// Unproject the film position on the near and far plane (the projection maps depth to [0, 1])
+	const Float ndcX = 2 * pFilm.x / film_.resolution().x - 1;
+	const Float ndcY = 2 * pFilm.y / film_.resolution().y - 1;
+	const Vec4f pNear = inverseViewProjection * Vec4f(ndcX, ndcY, 0, 1);
+	const Vec4f pFar = inverseViewProjection * Vec4f(ndcX, ndcY, 1, 1);
+
+	const Point3f o(Vec3f(pNear) / pNear.w);
+	const Vec3f d = glm::normalize(Vec3f(pFar) / pFar.w - Vec3f(o));
+	return Ray(o, d);
+}
+
+}  // namespace aito
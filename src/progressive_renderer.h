@@ -0,0 +1,137 @@
+#ifndef AITO_PROGRESSIVE_RENDERER_H
+#define AITO_PROGRESSIVE_RENDERER_H
+
+#include "aito.h"
+
+#include "film.h"
+#include "sampler.h"
+#include "tile_scheduler.h"
+#include "wavefront_integrator.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Renders the image in passes of a few samples per pixel on a background thread, accumulating into a Film,
+/// so a viewer can show the partial result while it converges. Changing the camera restarts the accumulation.
+/// Every tile that gets merged into the film is flagged, so the viewer only has to upload the regions that changed.
+/// </summary>
+class ProgressiveRenderer
+{
+public:
+	// The radiance arriving at the camera along the ray. Called concurrently from the worker threads,
+	// with a sampler that is positioned at the dimension after the film position.
+	// If a wavefront integrator is given, the passes can be rendered with it instead (see set_wavefront).
+	using RadianceFunction = std::function<Vec3f(const Ray& ray, Sampler& sampler)>;
+
+	ProgressiveRenderer(
+		const Point2i& resolution,
+		RadianceFunction radiance,
+		Sampler::Type samplerType = Sampler::Type::Sobol,
+		int samplesPerPass = 1,
+		int threadCount = 0,
+		WavefrontIntegrator* wavefront = nullptr);
+	~ProgressiveRenderer();
+
+	ProgressiveRenderer(const ProgressiveRenderer&) = delete;
+	ProgressiveRenderer& operator=(const ProgressiveRenderer&) = delete;
+
+	/// <summary>
+	/// Sets the camera used for the following passes. If the matrices changed, the running pass is cancelled and the film is cleared.
+	/// </summary>
+	void set_camera(const Mat4f& view, const Mat4f& projection);
+	/// <summary>
+	/// Throws away everything rendered so far, and starts over.
+	/// </summary>
+	void restart();
+
+	/// <summary>
+	/// Runs "edit" while no pass is rendering, so it can change the scene the radiance function traces, and restarts.
+	/// The running pass is cancelled first. Blocks until "edit" is done.
+	/// </summary>
+	void edit_scene(const std::function<void()>& edit);
+	/// <summary>
+	/// Switches to another sampler, and restarts.
+	/// </summary>
+	void set_sampler(Sampler::Type type);
+	void set_samples_per_pass(int samplesPerPass);
+	/// <summary>
+	/// Rendering pauses once every pixel has this many samples. 0 renders forever.
+	/// </summary>
+	void set_max_samples_per_pixel(int maxSamplesPerPixel);
+	/// <summary>
+	/// Stops or resumes rendering passes. A pass that throws is logged and discarded, and pauses the renderer too.
+	/// </summary>
+	void set_paused(bool paused);
+	/// <summary>
+	/// Renders the passes with the wavefront integrator instead of tile by tile, and restarts. Ignored without a wavefront integrator.
+	/// </summary>
+	void set_wavefront(bool enabled);
+
+	/// <summary>
+	/// Appends the film regions that changed since the last call to "regions", and marks them as clean.
+	/// </summary>
+	void collect_dirty_regions(std::vector<Bounds2i>& regions);
+
+	[[nodiscard]] inline const Film& film() const { return film_; }
+	[[nodiscard]] inline int samples_per_pixel() const { return samplesPerPixel_.load(); }
+	[[nodiscard]] float pass_progress() const;
+	[[nodiscard]] inline float last_pass_time() const { return lastPassTime_.load(); }
+
+private:
+	Film film_;
+	TileScheduler scheduler_;
+	RadianceFunction radiance_;
+	WavefrontIntegrator* wavefront_;
+	// The film pixels each tile contributes to, given the filter radius
+	std::vector<Bounds2i> tileRegions_;
+	std::unique_ptr<std::atomic<bool>[]> tileDirty_;
+
+	// Guards the settings below, which are picked up by the render thread at the start of every pass
+	std::mutex mutex_;
+	std::condition_variable stateChanged_;
+	Mat4f inverseViewProjection_{ 1.0f };
+	Mat4f view_{ 1.0f };
+	Mat4f projection_{ 1.0f };
+	Sampler sampler_;
+	int samplesPerPass_;
+	int maxSamplesPerPixel_ = 0;
+	bool paused_ = false;
+	bool useWavefront_ = false;
+	bool restartRequested_ = true;
+	bool stopping_ = false;
+	// No pass starts while the scene is edited, and edits wait for the running pass to end
+	bool editingScene_ = false;
+	bool passRunning_ = false;
+
+	std::atomic<int> samplesPerPixel_{ 0 };
+	// Whether the running pass uses the wavefront integrator, and the flag that cancels it
+	std::atomic<bool> wavefrontPass_{ false };
+	std::atomic<bool> cancelWavefront_{ false };
+	std::atomic<float> lastPassTime_{ 0 };
+
+	std::thread renderThread_;
+
+	void render_loop();
+	void render_tile(const RenderTile& tile, Sampler& sampler, const Mat4f& inverseViewProjection, uint32_t firstSample, int sampleCount);
+	[[nodiscard]] Ray generate_ray(const Mat4f& inverseViewProjection, const Point2f& pFilm) const;
+	void mark_all_dirty();
+	/// <summary>
+	/// Stops the running pass early.
+	/// </summary>
+	void cancel_pass();
+};
+
+}  // namespace aito
+
+
+#endif // AITO_PROGRESSIVE_RENDERER_H
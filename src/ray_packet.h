@@ -0,0 +1,36 @@
+#ifndef AITO_RAY_PACKET_H
+#define AITO_RAY_PACKET_H
+
+#include "aito.h"
+
+#include "vecmath.h"
+
+#include <cstdint>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Up to K rays that are traced through the BVH together. Works best for coherent rays, like the primary rays of a
+/// small block of pixels or shadow rays towards the same point light: the whole packet is then culled against the
+/// BVH nodes at once, and every node is only fetched once for all of its rays.
+/// </summary>
+template<int K>
+struct RayPacket
+{
+	static_assert(K > 0 && K <= 32, "The rays of a packet are tracked in a 32 bit mask");
+	static constexpr uint32_t ALL_RAYS = K == 32 ? 0xffffffffu : (1u << K) - 1;
+
+	Ray rays[K];
+	// Bit i is set if rays[i] takes part in the query. The other rays are left untouched.
+	uint32_t active = ALL_RAYS;
+};
+
+using RayPacket8 = RayPacket<8>;
+using RayPacket16 = RayPacket<16>;
+
+}  // namespace aito
+
+
+#endif // AITO_RAY_PACKET_H
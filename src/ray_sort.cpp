@@ -0,0 +1,75 @@
+#include "pch.h"
+
+#include "ray_sort.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+
+namespace aito
+{
+
+uint32_t RaySorter::sort_key(const Point3f& o, const Vec3f& d, const Bounds3f& bounds)
+{
+	constexpr uint32_t cellCount = 1u << MORTON_BITS_PER_AXIS;
+
+	const Vec3f offset = bounds.offset(o);
+	uint32_t cells[3];
+	for (int a = 0; a < 3; a++)
+	{
+		// Also catches NaN origins, which compare false
+		const Float cell = offset[a] * cellCount;
+		cells[a] = cell > 0 ? std::min(static_cast<uint32_t>(cell), cellCount - 1) : 0;
+	}
+
+	constexpr int fineBits = 3 * (MORTON_BITS_PER_AXIS - BUCKET_BITS_PER_AXIS);
+	const uint32_t morton = encode_morton_3(cells[0], cells[1], cells[2]);
+	const uint32_t octant = (d.x < 0 ? 1 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 4 : 0);
+	return ((morton >> fineBits) << (fineBits + 3)) | (octant << fineBits) | (morton & ((1u << fineBits) - 1));
+}
+
+void RaySorter::sort(uint32_t* keys, uint32_t* values, uint32_t count)
+{
+	constexpr uint32_t bucketCount = 1u << DIGIT_BITS;
+
+	if (keyScratch_.size() < count)
+	{
+		keyScratch_.resize(count);
+		valueScratch_.resize(count);
+	}
+
+	uint32_t* keysIn = keys;
+	uint32_t* valuesIn = values;
+	uint32_t* keysOut = keyScratch_.data();
+	uint32_t* valuesOut = valueScratch_.data();
+	for (int shift = 0; shift < KEY_BITS; shift += DIGIT_BITS)
+	{
+		std::array<uint32_t, bucketCount> bucketStart{};
+		for (uint32_t i = 0; i < count; i++)
+			bucketStart[(keysIn[i] >> shift) & (bucketCount - 1)]++;
+
+		uint32_t start = 0;
+		for (uint32_t& bucket : bucketStart)
+			start += std::exchange(bucket, start);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const uint32_t dst = bucketStart[(keysIn[i] >> shift) & (bucketCount - 1)]++;
+			keysOut[dst] = keysIn[i];
+			valuesOut[dst] = valuesIn[i];
+		}
+
+		std::swap(keysIn, keysOut);
+		std::swap(valuesIn, valuesOut);
+	}
+
+	// After an odd number of passes the result is in the scratch arrays
+	if (keysIn != keys)
+	{
+		std::copy(keysIn, keysIn + count, keys);
+		std::copy(valuesIn, valuesIn + count, values);
+	}
+}
+
+}  // namespace aito
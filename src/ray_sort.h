@@ -0,0 +1,77 @@
+#ifndef AITO_RAY_SORT_H
+#define AITO_RAY_SORT_H
+
+#include "aito.h"
+
+#include "bounds.h"
+#include "vecmath.h"
+
+#include <cstdint>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Spreads the lower 10 bits of "v" out to every third bit.
+/// </summary>
+[[nodiscard]] constexpr uint32_t left_shift_3(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+/// <summary>
+/// Interleaves the bits of three 10 bit coordinates, so cells that are close in space get close codes.
+/// </summary>
+[[nodiscard]] constexpr uint32_t encode_morton_3(uint32_t x, uint32_t y, uint32_t z)
+{
+	return (left_shift_3(z) << 2) | (left_shift_3(y) << 1) | left_shift_3(x);
+}
+
+/// <summary>
+/// Reorders rays so that rays which start close to each other and go in the same general direction are traced together,
+/// and so walk mostly the same BVH nodes. The rays are bucketed by the cell of a coarse grid their origin is in and the
+/// octant of their direction, and ordered by the Morton code of their origin within a bucket. The buckets are ordered
+/// by the Morton code of their cell, so neighbouring buckets are close in space as well.
+/// </summary>
+class RaySorter
+{
+public:
+	// The origins are placed in a grid of 2^MORTON_BITS_PER_AXIS cells along every axis of the scene bounds
+	static constexpr int MORTON_BITS_PER_AXIS = 9;
+	// The buckets use the upper bits of every axis. With the octant above the whole Morton code instead,
+	// the rays leaving a small area are split up by direction, which traces slower.
+	static constexpr int BUCKET_BITS_PER_AXIS = 6;
+	// Bucket cell, octant, and the position within the cell, from the highest bits to the lowest
+	static constexpr int KEY_BITS = 3 * MORTON_BITS_PER_AXIS + 3;
+
+	/// <summary>
+	/// The sort key of a ray starting at "o" in direction "d". Origins outside "bounds" are clamped to it.
+	/// </summary>
+	[[nodiscard]] static uint32_t sort_key(const Point3f& o, const Vec3f& d, const Bounds3f& bounds);
+
+	/// <summary>
+	/// Sorts values[0, count) by keys[0, count), keeping the order of equal keys. The keys are sorted as well.
+	/// </summary>
+	void sort(uint32_t* keys, uint32_t* values, uint32_t count);
+
+private:
+	// The keys are sorted one digit at a time, from the lowest to the highest
+	static constexpr int DIGIT_BITS = 10;
+	static_assert(KEY_BITS % DIGIT_BITS == 0);
+
+	// Kept between calls, so sorting every bounce does not allocate
+	std::vector<uint32_t> keyScratch_;
+	std::vector<uint32_t> valueScratch_;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_RAY_SORT_H
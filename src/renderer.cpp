@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "renderer.h"
+#include "upload_manager.h"
 
 #include <stdexcept>
 #include <array>
@@ -99,6 +100,9 @@ namespace aito
 
 		isFrameStarted_ = true;
 
+		// The fence of the frame was waited on while acquiring, so its region of the frame allocator is free again
+		frameAllocator_.beginFrame(currentFrameIndex_);
+
 		// Get the current command buffer
 		auto commandBuffer = getCurrentCommandBuffer();
 
@@ -125,6 +129,9 @@ namespace aito
 			throw std::runtime_error("Failed to end recording command buffer");
 		}
 
+		// The copies recorded since the last frame go to the queue first, so the frame sees them
+		device_.uploads().submit();
+
 		auto result = swapchain_->submitCommandBuffers(&commandBuffer, &currentImageIndex_);
 
 		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || window_.wasWindowResized())
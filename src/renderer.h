@@ -7,6 +7,7 @@
 
 #include "window.h"
 #include "swapchain.h"
+#include "frame_allocator.h"
 
 
 namespace aito
@@ -26,6 +27,9 @@ namespace aito
 
 		void populateImGui_initInfo(ImGui_ImplVulkan_InitInfo& init_info);
 
+		// The transient data of the frames in flight, reset by beginFrame
+		inline FrameAllocator& getFrameAllocator() { return frameAllocator_; }
+
 		inline VkCommandBuffer getCurrentCommandBuffer() const 
 		{ 
 			assert(isFrameStarted_ && "Tried to retrieve command buffer before a frame draw was initialised");
@@ -48,6 +52,7 @@ namespace aito
 		Device& device_; // ^^^
 		std::unique_ptr<Swapchain> swapchain_;
 		std::vector<VkCommandBuffer> commandBuffers_;
+		FrameAllocator frameAllocator_{ device_, Swapchain::MAX_FRAMES_IN_FLIGHT };
 
 		uint32_t currentImageIndex_ = 0;
 		int currentFrameIndex_ = 0;
@@ -0,0 +1,245 @@
+// Standalone tool that generates the RGBToSpectrumTable coefficients (see rgb_spectrum.h).
+// Usage: rgb2spec_opt <output file> [resolution]
+//
+// For every grid point the sigmoid polynomial coefficients are found with Gauss-Newton iterations, so that the spectrum
+// integrated against the color matching functions (the same integral SampledSpectrum::to_rgb estimates) gives the
+// grid point's color. Neighbouring grid points have similar coefficients, so each one starts from the last solution.
+#include "pch.h"
+
+#include "rgb_spectrum.h"
+#include "parallel.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+
+namespace aito
+{
+
+namespace
+{
+
+// The integrals are sums over every integer wavelength in [LambdaMin, LambdaMax]
+constexpr int SAMPLE_COUNT = static_cast<int>(LambdaMax - LambdaMin) + 1;
+constexpr int MAX_ITERATIONS = 50;
+constexpr double MAX_RESIDUAL = 1e-6;
+
+using Coefficients = std::array<double, 3>;
+using Color = std::array<double, 3>;
+
+/// <summary>
+/// The integrals the optimization evaluates. The polynomial is evaluated on wavelengths normalized to [0, 1],
+/// which keeps the problem well conditioned, and converted to nm at the end.
+/// </summary>
+struct ColorIntegral
+{
+	std::array<double, SAMPLE_COUNT> lambda;
+	// The color matching functions in RGB, times the integration weight
+	std::array<Color, SAMPLE_COUNT> weight;
+
+	ColorIntegral()
+	{
+		const Float yIntegral = cie_y_integral();
+		for (int i = 0; i < SAMPLE_COUNT; i++)
+		{
+			const Float l = LambdaMin + i;
+			lambda[i] = (l - LambdaMin) / (LambdaMax - LambdaMin);
+
+			// Trapezoid rule
+			const double w = (i == 0 || i == SAMPLE_COUNT - 1) ? 0.5 : 1;
+			const Vec3f rgb = xyz_to_rgb(Vec3f(cie_x(l), cie_y(l), cie_z(l)) / yIntegral);
+			weight[i] = { w * rgb.x, w * rgb.y, w * rgb.z };
+		}
+	}
+
+	/// <summary>
+	/// The color of the spectrum with coefficients "c", and its derivatives by c ("jacobian[color][coefficient]").
+	/// </summary>
+	void evaluate(const Coefficients& c, Color* color, std::array<Color, 3>* jacobian) const
+	{
+		*color = {};
+		*jacobian = {};
+		for (int i = 0; i < SAMPLE_COUNT; i++)
+		{
+			const double l = lambda[i];
+			const double x = (c[0] * l + c[1]) * l + c[2];
+			const double r = 1 / std::sqrt(1 + x * x);
+			const double s = 0.5 + 0.5 * x * r;
+			// The derivative of the sigmoid
+			const double ds = 0.5 * r * r * r;
+			const double dx[3] = { l * l, l, 1 };
+			for (int k = 0; k < 3; k++)
+			{
+				(*color)[k] += s * weight[i][k];
+				for (int j = 0; j < 3; j++)
+					(*jacobian)[k][j] += ds * dx[j] * weight[i][k];
+			}
+		}
+	}
+};
+
+[[nodiscard]] double squared_norm(const Color& v)
+{
+	return v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+}
+
+/// <summary>
+/// Solves a * x = b with Cramer's rule. Returns false if "a" is singular.
+/// </summary>
+[[nodiscard]] bool solve_3x3(const std::array<Color, 3>& a, const Color& b, Coefficients* x)
+{
+	const auto det = [](const std::array<Color, 3>& m)
+	{
+		return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+	};
+	const double d = det(a);
+	if (std::abs(d) < 1e-15)
+		return false;
+	for (int j = 0; j < 3; j++)
+	{
+		std::array<Color, 3> m = a;
+		for (int k = 0; k < 3; k++)
+			m[k][j] = b[k];
+		(*x)[j] = det(m) / d;
+	}
+	return true;
+}
+
+/// <summary>
+/// Moves "c" towards the coefficients of "target". Colors that no sigmoid polynomial reaches (on the edge of the gamut)
+/// end at the closest one the iterations get to.
+/// </summary>
+void optimize(const ColorIntegral& integral, const Color& target, Coefficients* c)
+{
+	Color color;
+	std::array<Color, 3> jacobian;
+	integral.evaluate(*c, &color, &jacobian);
+	Color residual = { color[0] - target[0], color[1] - target[1], color[2] - target[2] };
+
+	for (int iteration = 0; iteration < MAX_ITERATIONS && squared_norm(residual) > MAX_RESIDUAL * MAX_RESIDUAL; iteration++)
+	{
+		Coefficients step;
+		if (!solve_3x3(jacobian, residual, &step))
+			break;
+
+		// Halve the step until it improves the color, the full Gauss-Newton step overshoots far from the solution
+		bool improved = false;
+		for (double scale = 1; scale > 1e-4 && !improved; scale /= 2)
+		{
+			const Coefficients next = { (*c)[0] - scale * step[0], (*c)[1] - scale * step[1], (*c)[2] - scale * step[2] };
+			Color nextColor;
+			std::array<Color, 3> nextJacobian;
+			integral.evaluate(next, &nextColor, &nextJacobian);
+			const Color nextResidual = { nextColor[0] - target[0], nextColor[1] - target[1], nextColor[2] - target[2] };
+			if (squared_norm(nextResidual) < squared_norm(residual))
+			{
+				*c = next;
+				residual = nextResidual;
+				jacobian = nextJacobian;
+				improved = true;
+			}
+		}
+		if (!improved)
+			break;
+	}
+}
+
+[[nodiscard]] double smoothstep(double x)
+{
+	return x * x * (3 - 2 * x);
+}
+
+}
+
+}  // namespace aito
+
+
+int main(int argc, char** argv)
+{
+	using namespace aito;
+
+	if (argc < 2)
+	{
+		std::printf("Usage: rgb2spec_opt <output file> [resolution]\n");
+		return EXIT_FAILURE;
+	}
+	const int resolution = argc > 2 ? std::atoi(argv[2]) : 64;
+	if (resolution < 2)
+	{
+		std::printf("The resolution must be at least 2\n");
+		return EXIT_FAILURE;
+	}
+
+	const auto startTime = std::chrono::steady_clock::now();
+	const ColorIntegral integral;
+
+	// The grid is denser towards black and white, where the coefficients change the fastest
+	std::vector<float> zNodes(resolution);
+	for (int k = 0; k < resolution; k++)
+		zNodes[k] = static_cast<float>(smoothstep(smoothstep(static_cast<double>(k) / (resolution - 1))));
+
+	// Every grid row (fixed largest component and y) is one job. Along z the optimization starts at a medium brightness,
+	// where it converges easily, and works its way up and down from there.
+	std::vector<float> coefficients(3 * static_cast<size_t>(resolution) * resolution * resolution * 3);
+	const uint32_t rowCount = static_cast<uint32_t>(3 * resolution);
+	parallel_for_chunks(0, rowCount, 1, available_cores(), [&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t row = begin; row < end; row++)
+			{
+				const int l = static_cast<int>(row) / resolution;
+				const int j = static_cast<int>(row) % resolution;
+				const double y = static_cast<double>(j) / (resolution - 1);
+				for (int i = 0; i < resolution; i++)
+				{
+					const double x = static_cast<double>(i) / (resolution - 1);
+					const int startK = resolution / 5;
+
+					const auto solve = [&](int k, Coefficients* c)
+					{
+						const double z = zNodes[k];
+						Color target;
+						target[l] = z;
+						target[(l + 1) % 3] = x * z;
+						target[(l + 2) % 3] = y * z;
+						optimize(integral, target, c);
+
+						// Convert from normalized wavelengths to nm
+						const double scale = 1.0 / (LambdaMax - LambdaMin);
+						const double c0 = (*c)[0] * scale * scale;
+						const double c1 = (*c)[1] * scale;
+						const size_t index = ((((static_cast<size_t>(l) * resolution + k) * resolution + j) * resolution) + i) * 3;
+						coefficients[index + 0] = static_cast<float>(c0);
+						coefficients[index + 1] = static_cast<float>(c1 - 2 * c0 * LambdaMin);
+						coefficients[index + 2] = static_cast<float>((*c)[2] - c1 * LambdaMin + c0 * LambdaMin * LambdaMin);
+					};
+
+					Coefficients start{};
+					solve(startK, &start);
+					Coefficients c = start;
+					for (int k = startK + 1; k < resolution; k++)
+						solve(k, &c);
+					c = start;
+					for (int k = startK - 1; k >= 0; k--)
+						solve(k, &c);
+				}
+			}
+		});
+
+	try
+	{
+		RGBToSpectrumTable(std::move(zNodes), std::move(coefficients)).write(argv[1]);
+	}
+	catch (const std::exception& e)
+	{
+		std::printf("%s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+	std::printf("Wrote the %dx%dx%d RGB to spectrum table to %s in %.1f s\n", resolution, resolution, resolution, argv[1], seconds);
+	return EXIT_SUCCESS;
+}
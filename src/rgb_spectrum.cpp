@@ -0,0 +1,144 @@
+#include "pch.h"
+
+#include "rgb_spectrum.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+
+namespace aito
+{
+
+namespace
+{
+
+// The file starts with this, followed by the resolution (int32), the z nodes and the coefficients (floats)
+constexpr char FILE_MAGIC[4] = { 'S', 'P', 'E', 'C' };
+
+[[nodiscard]] size_t coefficient_count(int resolution)
+{
+	return 3 * static_cast<size_t>(resolution) * resolution * resolution * 3;
+}
+
+}
+
+RGBToSpectrumTable::RGBToSpectrumTable(std::vector<float> zNodes, std::vector<float> coefficients)
+	: resolution_(static_cast<int>(zNodes.size())), zNodes_(std::move(zNodes)), coefficients_(std::move(coefficients))
+{
+	if (resolution_ < 2 || coefficients_.size() != coefficient_count(resolution_))
+		throw std::runtime_error("Invalid RGB to spectrum table");
+}
+
+std::string RGBToSpectrumTable::default_path()
+{
+	std::filesystem::path executable;
+#ifdef _WIN32
+	wchar_t buffer[MAX_PATH];
+	const DWORD length = GetModuleFileNameW(nullptr, buffer, MAX_PATH);
+	if (length > 0 && length < MAX_PATH)
+		executable = std::filesystem::path(buffer, buffer + length);
+#else
+	std::error_code error;
+	executable = std::filesystem::read_symlink("/proc/self/exe", error);
+#endif
+
+	if (executable.empty())
+		return DEFAULT_FILE_NAME;
+	return (executable.parent_path() / DEFAULT_FILE_NAME).string();
+}
+
+RGBToSpectrumTable RGBToSpectrumTable::load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open the RGB to spectrum table " + path + " (built by the rgb2spec_opt target)");
+
+	char magic[4];
+	int32_t resolution = 0;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&resolution), sizeof(resolution));
+	if (!file || std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 || resolution < 2 || resolution > 1024)
+		throw std::runtime_error("Invalid RGB to spectrum table " + path);
+
+	std::vector<float> zNodes(resolution);
+	std::vector<float> coefficients(coefficient_count(resolution));
+	file.read(reinterpret_cast<char*>(zNodes.data()), zNodes.size() * sizeof(float));
+	file.read(reinterpret_cast<char*>(coefficients.data()), coefficients.size() * sizeof(float));
+	if (!file)
+		throw std::runtime_error("Truncated RGB to spectrum table " + path);
+
+	AITO_INFO("RGB to spectrum table loaded with a resolution of {}", resolution);
+	return RGBToSpectrumTable(std::move(zNodes), std::move(coefficients));
+}
+
+void RGBToSpectrumTable::write(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::binary);
+	const int32_t resolution = resolution_;
+	file.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+	file.write(reinterpret_cast<const char*>(&resolution), sizeof(resolution));
+	file.write(reinterpret_cast<const char*>(zNodes_.data()), zNodes_.size() * sizeof(float));
+	file.write(reinterpret_cast<const char*>(coefficients_.data()), coefficients_.size() * sizeof(float));
+	if (!file)
+		throw std::runtime_error("Failed to write the RGB to spectrum table " + path);
+}
+
+RGBSigmoidPolynomial RGBToSpectrumTable::operator()(const Vec3f& rgb) const
+{
+	const Vec3f c = glm::clamp(rgb, Vec3f(0), Vec3f(1));
+
+	// Grays have a constant spectrum, sigmoid(c2) = c. The table can not represent black and white, where c2 is infinite.
+	if (c.x == c.y && c.y == c.z)
+	{
+		const Float v = std::clamp<Float>(c.x, 1e-6f, 1 - 1e-6f);
+		return RGBSigmoidPolynomial{ 0, 0, (v - 0.5f) / std::sqrt(v * (1 - v)) };
+	}
+
+	// The largest component picks the table, the other two are relative to it
+	const int maxComponent = c.x >= c.y ? (c.x >= c.z ? 0 : 2) : (c.y >= c.z ? 1 : 2);
+	const Float z = c[maxComponent];
+	const Float x = c[(maxComponent + 1) % 3] * (resolution_ - 1) / z;
+	const Float y = c[(maxComponent + 2) % 3] * (resolution_ - 1) / z;
+
+	const int xi = std::min(static_cast<int>(x), resolution_ - 2);
+	const int yi = std::min(static_cast<int>(y), resolution_ - 2);
+	const int zi = std::clamp(static_cast<int>(std::upper_bound(zNodes_.begin(), zNodes_.end(), z) - zNodes_.begin()) - 1, 0, resolution_ - 2);
+	const Float dx = x - xi;
+	const Float dy = y - yi;
+	const Float dz = (z - zNodes_[zi]) / (zNodes_[zi + 1] - zNodes_[zi]);
+
+	const size_t strideX = 3;
+	const size_t strideY = strideX * resolution_;
+	const size_t strideZ = strideY * resolution_;
+	const float* p = &coefficients_[maxComponent * strideZ * resolution_ + zi * strideZ + yi * strideY + xi * strideX];
+
+	Float coefficients[3];
+	for (int i = 0; i < 3; i++)
+	{
+		const auto co = [&](size_t offset) { return static_cast<Float>(p[offset + i]); };
+		coefficients[i] = lerp(dz,
+			lerp(dy, lerp(dx, co(0), co(strideX)), lerp(dx, co(strideY), co(strideY + strideX))),
+			lerp(dy, lerp(dx, co(strideZ), co(strideZ + strideX)), lerp(dx, co(strideZ + strideY), co(strideZ + strideY + strideX))));
+	}
+	return RGBSigmoidPolynomial{ coefficients[0], coefficients[1], coefficients[2] };
+}
+
+SampledSpectrum RGBToSpectrumTable::unbounded(const Vec3f& rgb, const SampledWavelengths& lambda) const
+{
+	// Scaled so the largest component is 1/2, which leaves the spectrum room on both sides (pbrt's RGBUnboundedSpectrum)
+	const Float m = std::max(rgb.x, std::max(rgb.y, rgb.z));
+	if (m <= 0)
+		return SampledSpectrum(0);
+	const Float scale = 2 * m;
+	return scale * (*this)(rgb / scale).sample(lambda);
+}
+
+}  // namespace aito
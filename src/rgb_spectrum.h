@@ -0,0 +1,97 @@
+#ifndef AITO_RGB_SPECTRUM_H
+#define AITO_RGB_SPECTRUM_H
+
+#include "aito.h"
+
+#include "spectrum.h"
+#include "vecmath.h"
+
+#include <string>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Smooth, bounded spectrum s(lambda) = sigmoid(c0 * lambda^2 + c1 * lambda + c2) with values in (0, 1), "lambda" in nm
+/// (Jakob and Hanika, "A Low-Dimensional Function Space for Efficient Spectral Upsampling", 2019).
+/// </summary>
+struct RGBSigmoidPolynomial
+{
+	Float c0 = 0, c1 = 0, c2 = 0;
+
+	[[nodiscard]] inline Float operator()(Float lambda) const
+	{
+		return sigmoid((c0 * lambda + c1) * lambda + c2);
+	}
+
+	/// <summary>
+	/// The spectrum at all wavelengths of a path at once.
+	/// </summary>
+	[[nodiscard]] inline SampledSpectrum sample(const SampledWavelengths& lambda) const
+	{
+		const SampledSpectrum l = lambda.as_spectrum();
+		const SampledSpectrum x = (SampledSpectrum(c0) * l + SampledSpectrum(c1)) * l + SampledSpectrum(c2);
+		return SampledSpectrum(0.5f) + 0.5f * x / sqrt(SampledSpectrum(1) + x * x);
+	}
+
+	[[nodiscard]] static inline Float sigmoid(Float x)
+	{
+		return 0.5f + 0.5f * x / std::sqrt(1 + x * x);
+	}
+};
+
+/// <summary>
+/// Converts RGB colors (in the renderer's RGB, see xyz_to_rgb) to the sigmoid polynomial spectrum with that color.
+/// The coefficients are found by an optimization ahead of time, by the rgb2spec_opt tool, over a grid of colors:
+/// for each choice of the largest component, over that component (z) and the other two relative to it (x and y).
+/// Converting a color is then a trilinear interpolation in the grid.
+/// </summary>
+class RGBToSpectrumTable
+{
+public:
+	// The file the build writes the table to, next to the executable
+	static constexpr const char* DEFAULT_FILE_NAME = "rgb2spec.coeff";
+
+	/// <summary>
+	/// The path of DEFAULT_FILE_NAME next to the executable, so the table is found whatever the working directory is.
+	/// Falls back to the working directory if the location of the executable is unknown.
+	/// </summary>
+	[[nodiscard]] static std::string default_path();
+
+	/// <summary>
+	/// "zNodes" are the values of the largest component the grid is sampled at. "coefficients" holds the c0, c1 and c2 of every
+	/// grid point, indexed [largest component][z][y][x][coefficient].
+	/// </summary>
+	RGBToSpectrumTable(std::vector<float> zNodes, std::vector<float> coefficients);
+
+	/// <summary>
+	/// Loads a table written by "write". Throws std::runtime_error if the file is missing or not a table.
+	/// </summary>
+	[[nodiscard]] static RGBToSpectrumTable load(const std::string& path);
+	void write(const std::string& path) const;
+
+	[[nodiscard]] inline int resolution() const { return resolution_; }
+
+	/// <summary>
+	/// The spectrum of an RGB color in [0, 1] (reflectances, like albedos).
+	/// </summary>
+	[[nodiscard]] RGBSigmoidPolynomial operator()(const Vec3f& rgb) const;
+
+	/// <summary>
+	/// The spectrum of a non-negative RGB color without an upper bound, like the color of a light:
+	/// a scaled sigmoid polynomial spectrum.
+	/// </summary>
+	[[nodiscard]] SampledSpectrum unbounded(const Vec3f& rgb, const SampledWavelengths& lambda) const;
+
+private:
+	int resolution_;
+	std::vector<float> zNodes_;
+	std::vector<float> coefficients_;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_RGB_SPECTRUM_H
@@ -0,0 +1,460 @@
+#include "pch.h"
+
+#include "sampler.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <random>
+#include <utility>
+
+
+namespace aito
+{
+
+uint32_t permutation_element(uint32_t i, uint32_t n, uint32_t seed)
+{
+	uint32_t w = n - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	// Permutes [0, w] (a power of two) with a hash that is invertible on it, and skips the values that are out of range
+	do
+	{
+		i ^= seed;
+		i *= 0xe170893d;
+		i ^= seed >> 16;
+		i ^= (i & w) >> 4;
+		i ^= seed >> 8;
+		i *= 0x0929eb3f;
+		i ^= seed >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | seed >> 27;
+		i *= 0x6935fa69;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3df;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= n);
+	return (i + seed) % n;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Sobol
+
+uint32_t SobolSampler::sobol_dimension_1(uint32_t index)
+{
+	uint32_t v = 0;
+	for (int digit = 0; digit < 8; digit++, index >>= 4)
+		v ^= SOBOL_DIMENSION_1[digit][index & 15];
+	return v;
+}
+
+Float SobolSampler::get_1d()
+{
+	const uint64_t h = mix_bits(pixelHash_ ^ dimension_);
+	dimension_++;
+
+	const uint32_t index = nested_uniform_scramble(sampleIndex_, static_cast<uint32_t>(h));
+	return fixed_to_float(nested_uniform_scramble(reverse_bits_32(index), static_cast<uint32_t>(h >> 32)));
+}
+
+Point2f SobolSampler::get_2d()
+{
+	const uint64_t h = mix_bits(pixelHash_ ^ dimension_);
+	dimension_ += 2;
+
+	// Shuffling the index with an Owen scramble keeps every power of two prefix a (0,2)-net
+	const uint32_t index = nested_uniform_scramble(sampleIndex_, static_cast<uint32_t>(h));
+	return Point2f(
+		fixed_to_float(nested_uniform_scramble(reverse_bits_32(index), static_cast<uint32_t>(h >> 32))),
+		fixed_to_float(nested_uniform_scramble(sobol_dimension_1(index), static_cast<uint32_t>(mix_bits(h)))));
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Halton
+
+namespace
+{
+
+Float radical_inverse(uint32_t base, uint64_t a)
+{
+	const Float invBase = static_cast<Float>(1) / base;
+	Float invBaseM = 1;
+	uint64_t reversedDigits = 0;
+	while (a)
+	{
+		const uint64_t next = a / base;
+		const uint64_t digit = a - next * base;
+		reversedDigits = reversedDigits * base + digit;
+		invBaseM *= invBase;
+		a = next;
+	}
+	return std::min(reversedDigits * invBaseM, OneMinusEpsilon);
+}
+
+uint64_t inverse_radical_inverse(uint64_t inverse, uint32_t base, int digitCount)
+{
+	uint64_t index = 0;
+	for (int i = 0; i < digitCount; i++)
+	{
+		const uint64_t digit = inverse % base;
+		inverse /= base;
+		index = index * base + digit;
+	}
+	return index;
+}
+
+/// <summary>
+/// The inverse of "a" modulo "n", for coprime a and n.
+/// </summary>
+uint64_t multiplicative_inverse(int64_t a, int64_t n)
+{
+	// Extended Euclidean algorithm
+	int64_t oldR = a, r = n;
+	int64_t oldS = 1, s = 0;
+	while (r != 0)
+	{
+		const int64_t quotient = oldR / r;
+		oldR = std::exchange(r, oldR - quotient * r);
+		oldS = std::exchange(s, oldS - quotient * s);
+	}
+	return static_cast<uint64_t>(((oldS % n) + n) % n);
+}
+
+}
+
+HaltonSampler::HaltonSampler(const Point2i& resolution, uint32_t seed)
+{
+	auto tables = std::make_shared<Tables>();
+
+	uint32_t candidate = 2;
+	for (int i = 0; i < PRIME_COUNT; candidate++)
+	{
+		bool isPrime = true;
+		for (int j = 0; j < i && tables->primes[j] * tables->primes[j] <= candidate; j++)
+			isPrime &= candidate % tables->primes[j] != 0;
+		if (isPrime)
+			tables->primes[i++] = candidate;
+	}
+
+	for (int i = 0; i < PRIME_COUNT; i++)
+	{
+		const uint32_t base = tables->primes[i];
+
+		// Enough digits to reach the precision of Float
+		uint32_t digitCount = 0;
+		const Float invBase = static_cast<Float>(1) / base;
+		Float invBaseM = 1;
+		while (1 - (base - 1) * invBaseM < 1)
+		{
+			digitCount++;
+			invBaseM *= invBase;
+		}
+
+		tables->digit_counts[i] = digitCount;
+		tables->permutation_offsets[i] = static_cast<uint32_t>(tables->permutations.size());
+		for (uint32_t digit = 0; digit < digitCount; digit++)
+		{
+			const uint32_t digitSeed = static_cast<uint32_t>(hash(base, digit, seed));
+			for (uint32_t value = 0; value < base; value++)
+				tables->permutations.push_back(static_cast<uint16_t>(permutation_element(value, base, digitSeed)));
+		}
+	}
+	tables_ = std::move(tables);
+
+	const std::array<int, 2> fullResolution = { resolution.x, resolution.y };
+	for (int i = 0; i < 2; i++)
+	{
+		const uint32_t base = i == 0 ? 2 : 3;
+		uint64_t scale = 1;
+		int exponent = 0;
+		while (scale < static_cast<uint64_t>(std::min(fullResolution[i], MAX_RESOLUTION)))
+		{
+			scale *= base;
+			exponent++;
+		}
+		baseScales_[i] = scale;
+		baseExponents_[i] = exponent;
+	}
+
+	multInverse_[0] = multiplicative_inverse(static_cast<int64_t>(baseScales_[1]), static_cast<int64_t>(baseScales_[0]));
+	multInverse_[1] = multiplicative_inverse(static_cast<int64_t>(baseScales_[0]), static_cast<int64_t>(baseScales_[1]));
+}
+
+void HaltonSampler::start_pixel_sample(const Point2i& pixel, uint64_t sampleIndex, uint32_t dimension)
+{
+	// The first two dimensions, scaled by baseScales_, give the pixel. The index of the first sample in the pixel
+	// is the one whose radical inverses have the pixel coordinates as their first digits, found with the Chinese remainder theorem.
+	haltonIndex_ = 0;
+	const uint64_t sampleStride = baseScales_[0] * baseScales_[1];
+	if (sampleStride > 1)
+	{
+		const std::array<int, 2> pm = {
+			((pixel.x % MAX_RESOLUTION) + MAX_RESOLUTION) % MAX_RESOLUTION,
+			((pixel.y % MAX_RESOLUTION) + MAX_RESOLUTION) % MAX_RESOLUTION };
+		for (int i = 0; i < 2; i++)
+		{
+			const uint64_t dimensionOffset = inverse_radical_inverse(pm[i], i == 0 ? 2 : 3, baseExponents_[i]);
+			haltonIndex_ += dimensionOffset * (sampleStride / baseScales_[i]) * multInverse_[i];
+		}
+		haltonIndex_ %= sampleStride;
+	}
+
+	haltonIndex_ += sampleIndex * sampleStride;
+	dimension_ = std::max(2u, dimension);
+}
+
+Float HaltonSampler::get_1d()
+{
+	if (dimension_ >= PRIME_COUNT)
+		dimension_ = 2;
+	return scrambled_radical_inverse(dimension_++, haltonIndex_);
+}
+
+Point2f HaltonSampler::get_2d()
+{
+	if (dimension_ + 1 >= PRIME_COUNT)
+		dimension_ = 2;
+	const uint32_t dimension = dimension_;
+	dimension_ += 2;
+	return Point2f(scrambled_radical_inverse(dimension, haltonIndex_), scrambled_radical_inverse(dimension + 1, haltonIndex_));
+}
+
+Point2f HaltonSampler::get_pixel_2d() const
+{
+	return Point2f(
+		radical_inverse(2, haltonIndex_ >> baseExponents_[0]),
+		radical_inverse(3, haltonIndex_ / baseScales_[1]));
+}
+
+Float HaltonSampler::scrambled_radical_inverse(uint32_t dimension, uint64_t a) const
+{
+	const uint32_t base = tables_->primes[dimension];
+	const uint32_t digitCount = tables_->digit_counts[dimension];
+	const uint16_t* permutations = tables_->permutations.data() + tables_->permutation_offsets[dimension];
+
+	// All digits are permuted, including the leading zeros, so the permutations of the higher digits still have an effect
+	const Float invBase = static_cast<Float>(1) / base;
+	Float invBaseM = 1;
+	uint64_t reversedDigits = 0;
+	for (uint32_t digit = 0; digit < digitCount; digit++)
+	{
+		const uint64_t next = a / base;
+		const uint32_t digitValue = static_cast<uint32_t>(a - next * base);
+		reversedDigits = reversedDigits * base + permutations[digit * base + digitValue];
+		invBaseM *= invBase;
+		a = next;
+	}
+	return std::min(invBaseM * reversedDigits, OneMinusEpsilon);
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// PMJ02
+
+PMJ02Sampler::PMJ02Sampler(uint32_t seed)
+	: padding_(seed), seed_(seed)
+{
+	// The tables do not depend on the seed (it only changes the shifts), so all samplers share them
+	static const std::shared_ptr<const std::vector<std::array<uint32_t, 2>>> tables = []()
+	{
+		[[maybe_unused]] const auto startTime = std::chrono::high_resolution_clock::now();
+
+		auto tables = std::make_shared<std::vector<std::array<uint32_t, 2>>>();
+		tables->reserve(TABLE_SIZE * TABLE_COUNT);
+		for (uint32_t i = 0; i < TABLE_COUNT; i++)
+		{
+			const auto sequence = generate_sequence(TABLE_SIZE, i);
+			tables->insert(tables->end(), sequence.begin(), sequence.end());
+		}
+
+		[[maybe_unused]] const auto endTime = std::chrono::high_resolution_clock::now();
+		AITO_TRACE("Generated {} pmj02 tables of {} samples in {} ms", TABLE_COUNT, TABLE_SIZE,
+				   std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count());
+		return tables;
+	}();
+	tables_ = tables;
+}
+
+Float PMJ02Sampler::get_1d()
+{
+	// A 1D projection of a (0,2)-sequence is stratified just as well
+	if (dimension_ >= 2 * TABLE_COUNT)
+	{
+		padding_.start_pixel_sample(pixel_, sampleIndex_, dimension_++);
+		return padding_.get_1d();
+	}
+	const Point2f u = get_2d();
+	dimension_--;
+	return u.x;
+}
+
+Point2f PMJ02Sampler::get_2d()
+{
+	if (dimension_ + 1 >= 2 * TABLE_COUNT)
+	{
+		padding_.start_pixel_sample(pixel_, sampleIndex_, dimension_);
+		dimension_ += 2;
+		return padding_.get_2d();
+	}
+
+	// Past the end of a table, its samples are reused with a different shift
+	const uint64_t h = hash(pixelHash_, dimension_, sampleIndex_ / TABLE_SIZE);
+	const uint32_t table = (dimension_ / 2 + static_cast<uint32_t>(pixelHash_)) % TABLE_COUNT;
+	dimension_ += 2;
+
+	// A digital shift (xor) moves all points of an elementary interval to the same other one, so the strata stay intact
+	const std::array<uint32_t, 2>& p = (*tables_)[table * TABLE_SIZE + sampleIndex_ % TABLE_SIZE];
+	return Point2f(
+		fixed_to_float(p[0] ^ static_cast<uint32_t>(h)),
+		fixed_to_float(p[1] ^ static_cast<uint32_t>(h >> 32)));
+}
+
+std::vector<std::array<uint32_t, 2>> PMJ02Sampler::generate_sequence(uint32_t count, uint32_t seed)
+{
+	assert(std::has_single_bit(count) && "The pmj02 sequence length must be a power of two");
+
+	std::mt19937 rng(seed);
+	std::vector<std::array<uint32_t, 2>> points(count);
+	points[0] = { static_cast<uint32_t>(rng()), static_cast<uint32_t>(rng()) };
+
+	// occupied[a] marks the elementary intervals of 2^a x 2^(bits-a) strata that contain a point
+	std::vector<std::vector<bool>> occupied;
+	std::vector<std::array<uint32_t, 2>> candidates;
+
+	// Every step doubles the number of points. The new points go into the empty subquadrants of the n x n grid cells,
+	// at a position that is in an empty elementary interval for every shape.
+	for (uint32_t n = 1; n < count; n *= 2)
+	{
+		const int bits = std::countr_zero(2 * n);
+		const bool evenStep = bits % 2 == 1;
+		const uint32_t gridSize = 1u << ((bits - 1) / 2);
+
+		constexpr int maxAttempts = 64;
+		int attempt = 0;
+		for (; attempt < maxAttempts; attempt++)
+		{
+			occupied.assign(bits + 1, std::vector<bool>(2 * n, false));
+			const auto markOccupied = [&](const std::array<uint32_t, 2>& p)
+			{
+				for (int a = 0; a <= bits; a++)
+				{
+					const uint32_t x = a == 0 ? 0 : p[0] >> (32 - a);
+					const uint32_t y = a == bits ? 0 : p[1] >> (32 - (bits - a));
+					occupied[a][(y << a) | x] = true;
+				}
+			};
+			for (uint32_t i = 0; i < n; i++)
+				markOccupied(points[i]);
+
+			bool failed = false;
+			for (uint32_t i = 0; i < n && !failed; i++)
+			{
+				// The subquadrant the new point goes into
+				const std::array<uint32_t, 2>& reference = points[evenStep ? i : i % (n / 2)];
+				std::array<uint32_t, 2> cell, half;
+				for (int d = 0; d < 2; d++)
+				{
+					const uint64_t scaled = static_cast<uint64_t>(reference[d]) * gridSize;
+					cell[d] = static_cast<uint32_t>(scaled >> 32);
+					half[d] = static_cast<uint32_t>(scaled >> 31) & 1;
+				}
+				if (evenStep)
+				{
+					// Each cell has one point, the new one goes into the diagonally opposite subquadrant
+					half = { half[0] ^ 1, half[1] ^ 1 };
+				}
+				else if (i < n / 2)
+				{
+					// Each cell has two points in diagonally opposite subquadrants. The first new point takes one of the others...
+					if (rng() & 1)
+						half[0] ^= 1;
+					else
+						half[1] ^= 1;
+				}
+				else
+				{
+					// ...and the second one the last one
+					const std::array<uint32_t, 2>& first = points[n + i - n / 2];
+					half = { (static_cast<uint32_t>((static_cast<uint64_t>(first[0]) * gridSize) >> 31) & 1) ^ 1,
+							 (static_cast<uint32_t>((static_cast<uint64_t>(first[1]) * gridSize) >> 31) & 1) ^ 1 };
+				}
+
+				// The 1D strata (of 2n) within the subquadrant
+				const uint32_t strataPerHalf = (2 * n) / (2 * gridSize);
+				const uint32_t xBegin = (2 * cell[0] + half[0]) * strataPerHalf;
+				const uint32_t yBegin = (2 * cell[1] + half[1]) * strataPerHalf;
+
+				candidates.clear();
+				for (uint32_t y = yBegin; y < yBegin + strataPerHalf; y++)
+				{
+					if (occupied[0][y])
+						continue;
+					for (uint32_t x = xBegin; x < xBegin + strataPerHalf; x++)
+					{
+						if (occupied[bits][x])
+							continue;
+						bool valid = true;
+						for (int a = 1; a < bits && valid; a++)
+							valid = !occupied[a][((y >> a) << a) | (x >> (bits - a))];
+						if (valid)
+							candidates.push_back({ x, y });
+					}
+				}
+				if (candidates.empty())
+				{
+					failed = true;
+					break;
+				}
+
+				const std::array<uint32_t, 2>& chosen = candidates[rng() % candidates.size()];
+				// Jitter within the finest stratum
+				const uint32_t jitterMask = bits == 32 ? 0 : ~0u >> bits;
+				points[n + i] = {
+					(chosen[0] << (32 - bits)) | (static_cast<uint32_t>(rng()) & jitterMask),
+					(chosen[1] << (32 - bits)) | (static_cast<uint32_t>(rng()) & jitterMask) };
+				markOccupied(points[n + i]);
+			}
+
+			if (!failed)
+				break;
+		}
+
+		if (attempt == maxAttempts)
+			throw std::runtime_error("Failed to generate a pmj02 sequence");
+	}
+
+	return points;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+
+Sampler::Sampler(Type type, const Point2i& resolution, uint32_t seed)
+	: sampler_(create(type, resolution, seed))
+{}
+
+Sampler::SamplerVariant Sampler::create(Type type, const Point2i& resolution, uint32_t seed)
+{
+	switch (type)
+	{
+	case Type::Sobol:
+		return SobolSampler(seed);
+	case Type::Halton:
+		return HaltonSampler(resolution, seed);
+	case Type::PMJ02:
+		return PMJ02Sampler(seed);
+	}
+	throw std::runtime_error("Unknown sampler type");
+}
+
+}  // namespace aito
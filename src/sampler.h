@@ -0,0 +1,284 @@
+#ifndef AITO_SAMPLER_H
+#define AITO_SAMPLER_H
+
+#include "aito.h"
+
+#include "vecmath.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <variant>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Finalizer of MurmurHash3 (64 bit version). Every input bit affects every output bit.
+/// </summary>
+[[nodiscard]] constexpr uint64_t mix_bits(uint64_t v)
+{
+	v ^= v >> 31;
+	v *= 0x7fb5d329728ea185ull;
+	v ^= v >> 27;
+	v *= 0x81dadef4bc2dd44dull;
+	v ^= v >> 33;
+	return v;
+}
+
+/// <summary>
+/// Hashes any number of integer values together.
+/// </summary>
+template<typename... Args>
+[[nodiscard]] constexpr uint64_t hash(Args... args)
+{
+	uint64_t h = 0;
+	((h = mix_bits(h ^ (static_cast<uint64_t>(args) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)))), ...);
+	return h;
+}
+
+[[nodiscard]] constexpr uint32_t reverse_bits_32(uint32_t n)
+{
+	n = (n << 16) | (n >> 16);
+	n = ((n & 0x00ff00ff) << 8) | ((n & 0xff00ff00) >> 8);
+	n = ((n & 0x0f0f0f0f) << 4) | ((n & 0xf0f0f0f0) >> 4);
+	n = ((n & 0x33333333) << 2) | ((n & 0xcccccccc) >> 2);
+	n = ((n & 0x55555555) << 1) | ((n & 0xaaaaaaaa) >> 1);
+	return n;
+}
+
+/// <summary>
+/// Owen scrambles the bits of "v" (Burley, "Practical Hash-based Owen Scrambling", 2020):
+/// whether a bit is flipped only depends on the bits above it and the seed.
+/// Scrambling a sample index this way maps every aligned block of 2^k indices to another aligned block.
+/// </summary>
+[[nodiscard]] constexpr uint32_t nested_uniform_scramble(uint32_t v, uint32_t seed)
+{
+	v = reverse_bits_32(v);
+	v += seed;
+	v ^= v * 0x6c50b47cu;
+	v ^= v * 0xb82f1e52u;
+	v ^= v * 0xc7afe638u;
+	v ^= v * 0x8d22f6e6u;
+	return reverse_bits_32(v);
+}
+
+/// <summary>
+/// Element "i" of a random permutation of [0, n), chosen by "seed", without storing the permutation (Kensler, "Correlated Multi-Jittered Sampling").
+/// </summary>
+[[nodiscard]] uint32_t permutation_element(uint32_t i, uint32_t n, uint32_t seed);
+
+/// <summary>
+/// Converts 32 bits of fixed point to a Float in [0, 1). The bits that do not fit are truncated,
+/// since rounding could move a sample into the next stratum.
+/// </summary>
+[[nodiscard]] constexpr Float fixed_to_float(uint32_t v)
+{
+#ifdef AITO_FLOAT_AS_DOUBLE
+	return v * 0x1p-32;
+#else
+	return static_cast<Float>(v >> 8) * 0x1p-24f;
+#endif
+}
+
+
+// The samplers below all have the same interface:
+//   start_pixel_sample(pixel, sampleIndex, dimension) jumps straight to sample "sampleIndex" of the pixel, in constant time.
+//   get_pixel_2d() returns the position of the sample within the pixel, and has to be called first.
+//   get_1d() and get_2d() return the next dimensions of the sample.
+//   dimension() is the next dimension, so a sample can be continued later with start_pixel_sample.
+// The sample sequences of a pixel are progressive: every prefix of a power of two samples is well distributed,
+// so the samples can be taken one pass at a time without knowing the final sample count.
+// A sampler holds the state of a single sample, so every thread needs its own copy. The copies share their tables.
+
+/// <summary>
+/// Sobol (0,2)-sequence with Owen scrambling. Higher dimensions are padded with independently scrambled and shuffled 2D sequences,
+/// which avoids the large generator matrix tables and the correlation between high Sobol dimensions.
+/// </summary>
+class SobolSampler
+{
+public:
+	explicit SobolSampler(uint32_t seed = 0) : seed_(seed) {}
+
+	inline void start_pixel_sample(const Point2i& pixel, uint64_t sampleIndex, uint32_t dimension = 0)
+	{
+		pixel_ = pixel;
+		pixelHash_ = hash(pixel.x, pixel.y, seed_);
+		sampleIndex_ = static_cast<uint32_t>(sampleIndex);
+		dimension_ = dimension;
+	}
+
+	[[nodiscard]] Float get_1d();
+	[[nodiscard]] Point2f get_2d();
+	[[nodiscard]] inline Point2f get_pixel_2d() { return get_2d(); }
+	[[nodiscard]] inline uint32_t dimension() const { return dimension_; }
+
+private:
+	// The second Sobol dimension, as the xor of the generator matrix columns for every 4 bit digit of the index.
+	// The first dimension is the bit reversal of the index.
+	static constexpr std::array<std::array<uint32_t, 16>, 8> SOBOL_DIMENSION_1 = []()
+	{
+		std::array<uint32_t, 32> directions{};
+		uint32_t m = 1;
+		for (int k = 0; k < 32; k++)
+		{
+			directions[k] = m << (31 - k);
+			m ^= m << 1;
+		}
+
+		std::array<std::array<uint32_t, 16>, 8> table{};
+		for (int digit = 0; digit < 8; digit++)
+		{
+			for (uint32_t value = 0; value < 16; value++)
+			{
+				for (int bit = 0; bit < 4; bit++)
+				{
+					if (value & (1u << bit))
+						table[digit][value] ^= directions[4 * digit + bit];
+				}
+			}
+		}
+		return table;
+	}();
+
+	uint32_t seed_;
+	Point2i pixel_{};
+	uint64_t pixelHash_ = 0;
+	uint32_t sampleIndex_ = 0;
+	uint32_t dimension_ = 0;
+
+	[[nodiscard]] static uint32_t sobol_dimension_1(uint32_t index);
+};
+
+/// <summary>
+/// Halton sequence with random digit permutations. The first two dimensions are spread over the image, with
+/// pixels repeating every MAX_RESOLUTION pixels, so the sample index of a given pixel is found with the
+/// Chinese remainder theorem instead of searching the sequence.
+/// </summary>
+class HaltonSampler
+{
+public:
+	static constexpr int MAX_RESOLUTION = 128;
+	// Dimensions above this wrap around (with different permutations)
+	static constexpr int PRIME_COUNT = 128;
+
+	explicit HaltonSampler(const Point2i& resolution, uint32_t seed = 0);
+
+	void start_pixel_sample(const Point2i& pixel, uint64_t sampleIndex, uint32_t dimension = 0);
+
+	[[nodiscard]] Float get_1d();
+	[[nodiscard]] Point2f get_2d();
+	[[nodiscard]] Point2f get_pixel_2d() const;
+	[[nodiscard]] inline uint32_t dimension() const { return dimension_; }
+
+private:
+	/// <summary>
+	/// Random permutations of the digits of every base, a different one for every digit.
+	/// </summary>
+	struct Tables
+	{
+		std::array<uint32_t, PRIME_COUNT> primes;
+		std::array<uint32_t, PRIME_COUNT> digit_counts;
+		std::array<uint32_t, PRIME_COUNT> permutation_offsets;
+		std::vector<uint16_t> permutations;
+	};
+
+	std::shared_ptr<const Tables> tables_;
+	// base^exponent, the smallest power of 2 (x) and 3 (y) that covers the image (up to MAX_RESOLUTION)
+	std::array<uint64_t, 2> baseScales_;
+	std::array<int, 2> baseExponents_;
+	std::array<uint64_t, 2> multInverse_;
+
+	uint64_t haltonIndex_ = 0;
+	uint32_t dimension_ = 0;
+
+	[[nodiscard]] Float scrambled_radical_inverse(uint32_t dimension, uint64_t a) const;
+};
+
+/// <summary>
+/// Progressive multi-jittered (0,2) sequences (Christensen et al., "Progressive Multi-Jittered Sample Sequences").
+/// The sequences are generated once into tables, so a sample is a table lookup. Every pixel starts at a different table
+/// for its first dimension pair, and the tables are digitally shifted per pixel and dimension, which keeps every power of two prefix stratified.
+/// Dimensions past the tables are padded with scrambled Sobol samples, so they are never correlated with earlier dimensions.
+/// </summary>
+class PMJ02Sampler
+{
+public:
+	static constexpr uint32_t TABLE_SIZE = 4096;
+	static constexpr uint32_t TABLE_COUNT = 4;
+
+	explicit PMJ02Sampler(uint32_t seed = 0);
+
+	inline void start_pixel_sample(const Point2i& pixel, uint64_t sampleIndex, uint32_t dimension = 0)
+	{
+		pixel_ = pixel;
+		pixelHash_ = hash(pixel.x, pixel.y, seed_);
+		sampleIndex_ = sampleIndex;
+		dimension_ = dimension;
+	}
+
+	[[nodiscard]] Float get_1d();
+	[[nodiscard]] Point2f get_2d();
+	[[nodiscard]] inline Point2f get_pixel_2d() { return get_2d(); }
+	[[nodiscard]] inline uint32_t dimension() const { return dimension_; }
+
+	/// <summary>
+	/// Generates a pmj02 sequence of "count" points (a power of two) in 32 bit fixed point.
+	/// </summary>
+	[[nodiscard]] static std::vector<std::array<uint32_t, 2>> generate_sequence(uint32_t count, uint32_t seed);
+
+private:
+	// TABLE_COUNT sequences of TABLE_SIZE points, in 32 bit fixed point so they can be shifted with a xor
+	std::shared_ptr<const std::vector<std::array<uint32_t, 2>>> tables_;
+	SobolSampler padding_;
+	uint32_t seed_;
+	Point2i pixel_{};
+	uint64_t pixelHash_ = 0;
+	uint64_t sampleIndex_ = 0;
+	uint32_t dimension_ = 0;
+};
+
+/// <summary>
+/// Any of the samplers above.
+/// </summary>
+class Sampler
+{
+public:
+	enum class Type
+	{
+		Sobol,
+		Halton,
+		PMJ02,
+	};
+
+	/// <summary>
+	/// "resolution" is the resolution of the image that is sampled (used by the Halton sampler).
+	/// </summary>
+	Sampler(Type type, const Point2i& resolution, uint32_t seed = 0);
+
+	[[nodiscard]] inline Type type() const { return static_cast<Type>(sampler_.index()); }
+
+	inline void start_pixel_sample(const Point2i& pixel, uint64_t sampleIndex, uint32_t dimension = 0)
+	{
+		std::visit([&](auto& sampler) { sampler.start_pixel_sample(pixel, sampleIndex, dimension); }, sampler_);
+	}
+
+	[[nodiscard]] inline Float get_1d() { return std::visit([](auto& sampler) { return sampler.get_1d(); }, sampler_); }
+	[[nodiscard]] inline Point2f get_2d() { return std::visit([](auto& sampler) { return sampler.get_2d(); }, sampler_); }
+	[[nodiscard]] inline Point2f get_pixel_2d() { return std::visit([](auto& sampler) { return sampler.get_pixel_2d(); }, sampler_); }
+	[[nodiscard]] inline uint32_t dimension() const { return std::visit([](const auto& sampler) { return sampler.dimension(); }, sampler_); }
+
+private:
+	// In the same order as Type
+	using SamplerVariant = std::variant<SobolSampler, HaltonSampler, PMJ02Sampler>;
+	SamplerVariant sampler_;
+
+	[[nodiscard]] static SamplerVariant create(Type type, const Point2i& resolution, uint32_t seed);
+};
+
+}  // namespace aito
+
+
+#endif // AITO_SAMPLER_H
@@ -0,0 +1,107 @@
+#ifndef AITO_SAMPLING_H
+#define AITO_SAMPLING_H
+
+#include "aito.h"
+
+#include "vecmath.h"
+
+#include <algorithm>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Maps the unit square to the unit disk, keeping the relative areas (Shirley and Chiu's concentric mapping).
+/// </summary>
+[[nodiscard]] inline Point2f sample_uniform_disk_concentric(const Point2f& u)
+{
+	const Float ux = 2 * u.x - 1;
+	const Float uy = 2 * u.y - 1;
+	if (ux == 0 && uy == 0)
+		return Point2f(0, 0);
+
+	Float r, theta;
+	if (std::abs(ux) > std::abs(uy))
+	{
+		r = ux;
+		theta = PiOver4 * (uy / ux);
+	}
+	else
+	{
+		r = uy;
+		theta = PiOver2 - PiOver4 * (ux / uy);
+	}
+	return Point2f(r * std::cos(theta), r * std::sin(theta));
+}
+
+/// <summary>
+/// Cosine weighted direction in the hemisphere around +z.
+/// </summary>
+[[nodiscard]] inline Vec3f sample_cosine_hemisphere(const Point2f& u)
+{
+	const Point2f d = sample_uniform_disk_concentric(u);
+	const Float z = std::sqrt(std::max<Float>(0, 1 - d.x * d.x - d.y * d.y));
+	return Vec3f(d.x, d.y, z);
+}
+
+[[nodiscard]] constexpr Float cosine_hemisphere_pdf(Float cosTheta)
+{
+	return cosTheta * InvPi;
+}
+
+[[nodiscard]] inline Vec3f sample_uniform_sphere(const Point2f& u)
+{
+	const Float z = 1 - 2 * u.x;
+	const Float r = std::sqrt(std::max<Float>(0, 1 - z * z));
+	const Float phi = 2 * Pi * u.y;
+	return Vec3f(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+[[nodiscard]] constexpr Float uniform_sphere_pdf()
+{
+	return Inv4Pi;
+}
+
+/// <summary>
+/// Multiple importance sampling weight of a sample taken from f, when g could have produced it too (Veach's power heuristic, beta = 2).
+/// </summary>
+[[nodiscard]] constexpr Float power_heuristic(int nf, Float fPdf, int ng, Float gPdf)
+{
+	const Float f = nf * fPdf;
+	const Float g = ng * gPdf;
+	if (std::isinf(f * f))
+		return 1;
+	return (f * f) / (f * f + g * g);
+}
+
+/// <summary>
+/// Orthonormal basis around a normalized vector, for going between world space and the local shading space where the vector is +z.
+/// </summary>
+class Frame
+{
+public:
+	Vec3f x, y, z;
+
+	/// <summary>
+	/// Builds a frame with "z" as its z axis (Duff et al., "Building an Orthonormal Basis, Revisited").
+	/// </summary>
+	[[nodiscard]] static inline Frame from_z(const Vec3f& z)
+	{
+		const Float sign = std::copysign(Float(1), z.z);
+		const Float a = -1 / (sign + z.z);
+		const Float b = z.x * z.y * a;
+		return Frame{
+			Vec3f(1 + sign * z.x * z.x * a, sign * b, -sign * z.x),
+			Vec3f(b, sign + z.y * z.y * a, -z.y),
+			z };
+	}
+
+	[[nodiscard]] inline Vec3f to_local(const Vec3f& v) const { return Vec3f(glm::dot(v, x), glm::dot(v, y), glm::dot(v, z)); }
+	[[nodiscard]] inline Vec3f from_local(const Vec3f& v) const { return v.x * x + v.y * y + v.z * z; }
+};
+
+}  // namespace aito
+
+
+#endif // AITO_SAMPLING_H
@@ -0,0 +1,82 @@
+#include "pch.h"
+
+#include "scene.h"
+
+#include <stdexcept>
+
+
+namespace aito
+{
+
+namespace
+{
+
+[[nodiscard]] std::vector<std::unique_ptr<BVH8>> build_mesh_bvh(std::vector<Triangle> primitives, int buildThreads, BVHNodeLayout layout)
+{
+	std::vector<std::unique_ptr<BVH8>> meshBVHs;
+	meshBVHs.push_back(std::make_unique<BVH8>(std::move(primitives), 4, buildThreads, layout));
+	return meshBVHs;
+}
+
+[[nodiscard]] std::vector<std::unique_ptr<BVH8>> build_mesh_bvhs(const std::vector<std::shared_ptr<TriangleMesh>>& meshes, int buildThreads, BVHNodeLayout layout)
+{
+	std::vector<std::unique_ptr<BVH8>> meshBVHs;
+	meshBVHs.reserve(meshes.size());
+	for (const auto& mesh : meshes)
+	{
+		std::vector<Triangle> triangles;
+		triangles.reserve(mesh->triangle_count());
+		for (uint32_t i = 0; i < mesh->triangle_count(); i++)
+			triangles.emplace_back(mesh.get(), i);
+		meshBVHs.push_back(std::make_unique<BVH8>(std::move(triangles), 4, buildThreads, layout));
+	}
+	return meshBVHs;
+}
+
+}
+
+Scene::Scene(std::vector<Triangle> primitives, int buildThreads, BVHNodeLayout layout)
+	: meshBVHs_(build_mesh_bvh(std::move(primitives), buildThreads, layout)),
+	accel_(create_instances(meshBVHs_, { MeshInstance{} }))
+{
+	AITO_INFO("Scene created with {} triangles", meshBVHs_[0]->primitives().size());
+}
+
+Scene::Scene(const std::vector<std::shared_ptr<TriangleMesh>>& meshes, const std::vector<MeshInstance>& instances, int buildThreads,
+			 BVHNodeLayout layout)
+	: meshBVHs_(build_mesh_bvhs(meshes, buildThreads, layout)),
+	accel_(create_instances(meshBVHs_, instances))
+{
+	size_t meshMemory = 0;
+	for (const auto& bvh : meshBVHs_)
+		meshMemory += bvh->memory_usage();
+	uint64_t instancedTriangles = 0;
+	for (const BVHInstance& instance : accel_.instances())
+		instancedTriangles += instance.blas().primitives().size();
+
+	AITO_INFO("Scene created with {} instances of {} meshes ({} triangles after instancing, {:.2f} MB of mesh BVHs, {:.2f} MB of instance BVH)",
+			  accel_.instances().size(), meshBVHs_.size(), instancedTriangles,
+			  static_cast<double>(meshMemory) / (1024 * 1024), static_cast<double>(accel_.memory_usage()) / (1024 * 1024));
+}
+
+void Scene::refit_mesh(uint32_t mesh)
+{
+	if (mesh >= meshBVHs_.size())
+		throw std::runtime_error("Can not refit mesh " + std::to_string(mesh) + ", there are only " + std::to_string(meshBVHs_.size()));
+	meshBVHs_[mesh]->refit();
+}
+
+std::vector<BVHInstance> Scene::create_instances(const std::vector<std::unique_ptr<BVH8>>& meshBVHs, const std::vector<MeshInstance>& instances)
+{
+	std::vector<BVHInstance> bvhInstances;
+	bvhInstances.reserve(instances.size());
+	for (const MeshInstance& instance : instances)
+	{
+		if (instance.mesh >= meshBVHs.size())
+			throw std::runtime_error("Scene instance references mesh " + std::to_string(instance.mesh) + ", but there are only " + std::to_string(meshBVHs.size()));
+		bvhInstances.emplace_back(meshBVHs[instance.mesh].get(), instance.object_to_world);
+	}
+	return bvhInstances;
+}
+
+}  // namespace aito
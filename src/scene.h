@@ -0,0 +1,112 @@
+#ifndef AITO_SCENE_H
+#define AITO_SCENE_H
+
+#include "aito.h"
+
+#include "two_level_bvh.h"
+#include "wide_bvh.h"
+#include "light.h"
+
+#include <memory>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// A placement of one of the meshes of a scene in the world.
+/// </summary>
+struct MeshInstance
+{
+	// Index into the meshes the scene was created with
+	uint32_t mesh = 0;
+	Mat4f object_to_world{ 1 };
+};
+
+/// <summary>
+/// Everything the offline renderer needs to know about the world: the geometry (in an acceleration structure) and the lights.
+/// The geometry is a set of meshes with one BVH each, and instances that place them in the world (see TwoLevelBVH).
+/// The scene must not be changed while it is being rendered.
+/// </summary>
+class Scene
+{
+public:
+	std::vector<PointLight> point_lights;
+	UniformInfiniteLight infinite_light;
+
+public:
+	/// <summary>
+	/// A scene of triangles that are already in world space, as a single mesh placed once.
+	/// "layout" is the node layout of the mesh BVHs: compressed nodes for scenes too large for the memory of full nodes.
+	/// </summary>
+	explicit Scene(std::vector<Triangle> primitives, int buildThreads = 0, BVHNodeLayout layout = BVHNodeLayout::Full);
+	/// <summary>
+	/// A scene of meshes in object space and their instances. The meshes are not copied and must outlive the scene.
+	/// </summary>
+	Scene(const std::vector<std::shared_ptr<TriangleMesh>>& meshes, const std::vector<MeshInstance>& instances, int buildThreads = 0,
+		  BVHNodeLayout layout = BVHNodeLayout::Full);
+
+	Scene(const Scene&) = delete;
+	Scene& operator=(const Scene&) = delete;
+
+	/// <summary>
+	/// Finds the closest intersection along the ray. On a hit "ray.t_max" is set to the distance of the hit and "isect" is filled in.
+	/// </summary>
+	inline bool intersect(const Ray& ray, SurfaceInteraction* isect) const { return accel_.intersect(ray, isect); }
+	/// <summary>
+	/// Checks if anything blocks the ray before "ray.t_max".
+	/// </summary>
+	[[nodiscard]] inline bool intersect_p(const Ray& ray) const { return accel_.intersect_p(ray); }
+
+	/// <summary>
+	/// Finds the closest intersection of every active ray of the packet. The hit of ray i is written to isects[i].
+	/// </summary>
+	/// <returns>A bit mask of the rays that hit something. </returns>
+	template<int K>
+	inline uint32_t intersect(const RayPacket<K>& packet, SurfaceInteraction* isects) const { return accel_.intersect(packet, isects); }
+	/// <summary>
+	/// Checks which of the active rays of the packet are blocked before their "t_max".
+	/// </summary>
+	template<int K>
+	[[nodiscard]] inline uint32_t intersect_p(const RayPacket<K>& packet) const { return accel_.intersect_p(packet); }
+
+	[[nodiscard]] inline Bounds3f world_bound() const { return accel_.world_bound(); }
+
+	/// <summary>
+	/// Moves instance "instance" (in the order the scene was created with). Takes effect with the next update().
+	/// </summary>
+	inline void set_instance_transform(uint32_t instance, const Mat4f& objectToWorld) { accel_.set_transform(instance, objectToWorld); }
+	/// <summary>
+	/// Refits the BVH of mesh "mesh" after its vertices were moved (keeping its triangles). Takes effect with the next update().
+	/// </summary>
+	void refit_mesh(uint32_t mesh);
+	/// <summary>
+	/// Brings the instance BVH up to date after instances were moved or meshes refit. Refits it, and only rebuilds it
+	/// when refitting made it too slow (see TwoLevelBVH::update).
+	/// </summary>
+	/// <returns>True if the instance BVH was rebuilt. </returns>
+	inline bool update() { return accel_.update(); }
+
+	/// <summary>
+	/// The number of lights that can be sampled: the point lights, and the infinite light if it emits anything.
+	/// </summary>
+	[[nodiscard]] inline uint32_t light_count() const
+	{
+		const bool hasInfiniteLight = infinite_light.radiance != Vec3f(0);
+		return static_cast<uint32_t>(point_lights.size()) + (hasInfiniteLight ? 1 : 0);
+	}
+
+private:
+	// The bottom level BVH of every mesh, shared by all of its instances
+	std::vector<std::unique_ptr<BVH8>> meshBVHs_;
+	TwoLevelBVH accel_;
+
+	[[nodiscard]] static std::vector<BVHInstance> create_instances(
+		const std::vector<std::unique_ptr<BVH8>>& meshBVHs, const std::vector<MeshInstance>& instances);
+};
+
+}  // namespace aito
+
+
+#endif // AITO_SCENE_H
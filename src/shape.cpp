@@ -1,6 +1,7 @@
 #include "pch.h"
 
 #include "shape.h"
+#include "geometry_pool.h"
 
 #include "utils.h"
 
@@ -58,17 +59,37 @@ bool Model::Vertex::operator==(const Vertex& other) const
 }
 
 
-Model::Model(Device& device, const Model::Builder& builder)
-	: device_(device)
+Model::Model(GeometryPool& geometry, const Model::Builder& builder)
+	: geometry_(geometry)
 {
-	createVertexBuffers(builder.vertices);
-	createIndexBuffers(builder.indices);
+	assert(builder.vertices.size() > 2 && "Vertex Count must be at least 3");
+
+	// Models without an index buffer get one that draws the vertices in order
+	GeometryPool::Range range;
+	if (builder.indices.empty())
+	{
+		std::vector<uint32_t> indices(builder.vertices.size() - builder.vertices.size() % 3);
+		for (uint32_t i = 0; i < indices.size(); i++)
+			indices[i] = i;
+		range = geometry_.add(builder.vertices, indices);
+	}
+	else
+	{
+		range = geometry_.add(builder.vertices, builder.indices);
+	}
+
+	firstIndex_ = range.firstIndex;
+	indexCount_ = range.indexCount;
+	vertexOffset_ = range.vertexOffset;
+
+	for (const auto& vertex : builder.vertices)
+		bounds_ = bounds_union(bounds_, vertex.position);
 }
 
 Model::~Model()
 {}
 
-std::unique_ptr<Model> Model::createModelFromFile(Device& device, std::string_view filePath)
+std::unique_ptr<Model> Model::createModelFromFile(GeometryPool& geometry, std::string_view filePath)
 {
 	Builder builder{};
 	builder.loadModel(filePath);
@@ -77,98 +98,48 @@ std::unique_ptr<Model> Model::createModelFromFile(Device& device, std::string_vi
 	AITO_TRACE("Vertex count: {}", builder.vertices.size());
 	AITO_TRACE("Index buffer length: {}", builder.indices.size());
 
-	return std::make_unique<Model>(device, builder);
+	return std::make_unique<Model>(geometry, builder);
 }
 
 void Model::bind(VkCommandBuffer commandBuffer)
 {
-	VkBuffer buffers[] = { vertexBuffer_->getBuffer() };
-	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
-
-	if (hasIndexBuffer)
-	{
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer_->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
-	}
+	geometry_.bind(commandBuffer);
 }
 
 void Model::draw(VkCommandBuffer commandBuffer)
 {
-	if (hasIndexBuffer)
-		vkCmdDrawIndexed(commandBuffer, indexCount_, 1, 0, 0, 0);
-	else
-		vkCmdDraw(commandBuffer, vertexCount_, 1, 0, 0);
+	vkCmdDrawIndexed(commandBuffer, indexCount_, 1, firstIndex_, vertexOffset_, 0);
 }
 
-void Model::createVertexBuffers(const std::vector<Vertex>& vertices)
+std::shared_ptr<TriangleMesh> Model::Builder::createTriangleMesh(const Mat4f& objectToWorld) const
 {
-	vertexCount_ = static_cast<uint32_t>(vertices.size());
-	assert(vertexCount_ > 2 && "Vertex Count must be at least 3");
-
-	//VkDeviceSize bufferSize = sizeof(vertices[0]) * vertexCount_;
-
-	uint32_t vertexSize = sizeof(vertices[0]);
-
-	// Create staging buffer for transfer to the GPU
-	Buffer stagingBuffer{
-		device_,
-		vertexSize,
-		vertexCount_,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	};
-
-	// Map the memory to the host and copy the data into the mapped region. 
-	stagingBuffer.map();
-	stagingBuffer.writeToBuffer((void*)vertices.data());
-
-	// Create the actual memory buffer on the GPU
-	vertexBuffer_ = std::make_unique<Buffer>(
-		device_,
-		vertexSize,
-		vertexCount_,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-		);
-
-	// Copy the data from the staging buffer to the vertex buffer.
-	device_.copyBuffer(stagingBuffer.getBuffer(), vertexBuffer_->getBuffer(), stagingBuffer.getBufferSize());
-}
+	std::vector<Point3f> positions;
+	std::vector<Normal3f> normals;
+	std::vector<Point2f> uvs;
+	std::vector<Vec3f> colors;
+	positions.reserve(vertices.size());
+	normals.reserve(vertices.size());
+	uvs.reserve(vertices.size());
+	colors.reserve(vertices.size());
+
+	for (const auto& vertex : vertices)
+	{
+		positions.push_back(vertex.position);
+		normals.push_back(Normal3f(vertex.normal));
+		uvs.push_back(Point2f(vertex.uv.x, vertex.uv.y));
+		colors.push_back(vertex.color);
+	}
 
-void Model::createIndexBuffers(const std::vector<uint32_t>& indices)
-{
-	indexCount_ = static_cast<uint32_t>(indices.size());
-	hasIndexBuffer = indexCount_ > 0;
-
-	if (!hasIndexBuffer)
-		return;
-
-	uint32_t indexSize = sizeof(indices[0]);
-
-	// Create staging buffer for transfer to the GPU
-	Buffer stagingBuffer{
-		device_,
-		indexSize,
-		indexCount_,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	};
-
-	// Map the memory to the host and copy the data into the mapped region.
-	stagingBuffer.map();
-	stagingBuffer.writeToBuffer((void*)indices.data());
-
-	// Create the actual memory buffer on the GPU
-	indexBuffer_ = std::make_unique<Buffer>(
-		device_,
-		indexSize,
-		indexCount_,
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-		);
-
-	// Copy the data from the staging buffer to the index buffer.
-	device_.copyBuffer(stagingBuffer.getBuffer(), indexBuffer_->getBuffer(), stagingBuffer.getBufferSize());
+	// Models without an index buffer are drawn as a plain triangle list.
+	std::vector<uint32_t> meshIndices = indices;
+	if (meshIndices.empty())
+	{
+		meshIndices.resize(vertices.size() - vertices.size() % 3);
+		for (uint32_t i = 0; i < meshIndices.size(); i++)
+			meshIndices[i] = i;
+	}
+
+	return std::make_shared<TriangleMesh>(objectToWorld, positions, meshIndices, normals, uvs, colors);
 }
 
 void Model::Builder::loadModel(std::string_view filePath)
@@ -5,6 +5,8 @@
 #include "buffer.h"
 
 #include "vecmath.h"
+#include "bounds.h"
+#include "triangle.h"
 
 #include <vector>
 #include <memory>
@@ -12,6 +14,8 @@
 namespace aito
 {
 
+class GeometryPool;
+
 // Something that can be rendered
 class Model
 {
@@ -38,12 +42,16 @@ public:
 		std::vector<uint32_t> indices{};
 
 		void loadModel(std::string_view filePath);
+
+		// Creates a CPU side copy of the geometry for the offline renderer.
+		std::shared_ptr<TriangleMesh> createTriangleMesh(const Mat4f& objectToWorld) const;
 	};
 
 
 	// Constructors
 
-	Model(Device& device, const Model::Builder& builder);
+	// The geometry is uploaded to the pool, which has to outlive the model
+	Model(GeometryPool& geometry, const Model::Builder& builder);
 	~Model();
 
 	Model(const Model&) = delete;
@@ -51,23 +59,27 @@ public:
 
 	// Public methods
 
-	static std::unique_ptr<Model> createModelFromFile(Device& device, std::string_view filePath);
+	static std::unique_ptr<Model> createModelFromFile(GeometryPool& geometry, std::string_view filePath);
 
 	void bind(VkCommandBuffer commandBuffer);
 	void draw(VkCommandBuffer commandBuffer);
 
-private:
-	Device& device_;
+	[[nodiscard]] inline GeometryPool& getGeometryPool() const { return geometry_; }
+	// Models are always drawn indexed, so they can be drawn by indirect commands the GPU writes
+	[[nodiscard]] inline uint32_t getFirstIndex() const { return firstIndex_; }
+	[[nodiscard]] inline uint32_t getIndexCount() const { return indexCount_; }
+	[[nodiscard]] inline int32_t getVertexOffset() const { return vertexOffset_; }
+	// The bounds of the vertices in object space, for culling
+	[[nodiscard]] inline const Bounds3f& getBounds() const { return bounds_; }
 
-	std::unique_ptr<Buffer> vertexBuffer_;
-	uint32_t vertexCount_;
+private:
+	GeometryPool& geometry_;
 
-	bool hasIndexBuffer = false;
-	std::unique_ptr<Buffer> indexBuffer_;
+	uint32_t firstIndex_;
 	uint32_t indexCount_;
+	int32_t vertexOffset_;
 
-	void createVertexBuffers(const std::vector<Vertex>& vertices);
-	void createIndexBuffers(const std::vector<uint32_t>& indices);
+	Bounds3f bounds_;
 };
 
 }
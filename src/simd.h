@@ -0,0 +1,160 @@
+#ifndef AITO_SIMD_H
+#define AITO_SIMD_H
+
+// The instruction sets the SIMD code paths may use. SSE2 is always there on x86-64,
+// AVX is only used when it is enabled at compile time (AITO_ENABLE_AVX2 in CMake).
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AITO_SSE
+#endif
+
+#if defined(__AVX__)
+#define AITO_AVX
+#endif
+
+#if defined(AITO_SSE) || defined(AITO_AVX)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+
+namespace aito
+{
+
+/// <summary>
+/// N floats processed at once. Comparisons return masks with all bits set in the lanes where they hold,
+/// which can be combined with the bitwise operators and turned into a bit mask with "movemask".
+/// This generic version is plain scalar code; the 4 and 8 wide versions below map to SSE and AVX.
+/// </summary>
+template<int N>
+struct SimdFloat
+{
+	float v[N];
+
+	[[nodiscard]] static SimdFloat broadcast(float f) { SimdFloat r; for (int i = 0; i < N; i++) r.v[i] = f; return r; }
+	[[nodiscard]] static SimdFloat load(const float* p) { SimdFloat r; for (int i = 0; i < N; i++) r.v[i] = p[i]; return r; }
+	void store(float* p) const { for (int i = 0; i < N; i++) p[i] = v[i]; }
+
+	template<typename Op>
+	[[nodiscard]] static SimdFloat apply(const SimdFloat& a, const SimdFloat& b, Op op) { SimdFloat r; for (int i = 0; i < N; i++) r.v[i] = op(a.v[i], b.v[i]); return r; }
+	template<typename Op>
+	[[nodiscard]] static SimdFloat compare(const SimdFloat& a, const SimdFloat& b, Op op)
+	{
+		SimdFloat r;
+		for (int i = 0; i < N; i++) r.v[i] = std::bit_cast<float>(op(a.v[i], b.v[i]) ? 0xffffffffu : 0u);
+		return r;
+	}
+	template<typename Op>
+	[[nodiscard]] static SimdFloat bitwise(const SimdFloat& a, const SimdFloat& b, Op op)
+	{
+		SimdFloat r;
+		for (int i = 0; i < N; i++) r.v[i] = std::bit_cast<float>(op(std::bit_cast<uint32_t>(a.v[i]), std::bit_cast<uint32_t>(b.v[i])));
+		return r;
+	}
+
+	[[nodiscard]] friend SimdFloat operator+(const SimdFloat& a, const SimdFloat& b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+	[[nodiscard]] friend SimdFloat operator-(const SimdFloat& a, const SimdFloat& b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+	[[nodiscard]] friend SimdFloat operator*(const SimdFloat& a, const SimdFloat& b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+	[[nodiscard]] friend SimdFloat operator/(const SimdFloat& a, const SimdFloat& b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+	[[nodiscard]] friend SimdFloat min(const SimdFloat& a, const SimdFloat& b) { return apply(a, b, [](float x, float y) { return std::min(x, y); }); }
+	[[nodiscard]] friend SimdFloat max(const SimdFloat& a, const SimdFloat& b) { return apply(a, b, [](float x, float y) { return std::max(x, y); }); }
+	[[nodiscard]] friend SimdFloat abs(const SimdFloat& a) { return apply(a, a, [](float x, float) { return std::abs(x); }); }
+	[[nodiscard]] friend SimdFloat sqrt(const SimdFloat& a) { return apply(a, a, [](float x, float) { return std::sqrt(x); }); }
+
+	[[nodiscard]] friend SimdFloat operator<(const SimdFloat& a, const SimdFloat& b) { return compare(a, b, [](float x, float y) { return x < y; }); }
+	[[nodiscard]] friend SimdFloat operator<=(const SimdFloat& a, const SimdFloat& b) { return compare(a, b, [](float x, float y) { return x <= y; }); }
+	[[nodiscard]] friend SimdFloat operator>(const SimdFloat& a, const SimdFloat& b) { return compare(a, b, [](float x, float y) { return x > y; }); }
+	[[nodiscard]] friend SimdFloat operator>=(const SimdFloat& a, const SimdFloat& b) { return compare(a, b, [](float x, float y) { return x >= y; }); }
+	[[nodiscard]] friend SimdFloat operator==(const SimdFloat& a, const SimdFloat& b) { return compare(a, b, [](float x, float y) { return x == y; }); }
+	[[nodiscard]] friend SimdFloat operator!=(const SimdFloat& a, const SimdFloat& b) { return compare(a, b, [](float x, float y) { return x != y; }); }
+
+	[[nodiscard]] friend SimdFloat operator&(const SimdFloat& a, const SimdFloat& b) { return bitwise(a, b, [](uint32_t x, uint32_t y) { return x & y; }); }
+	[[nodiscard]] friend SimdFloat operator|(const SimdFloat& a, const SimdFloat& b) { return bitwise(a, b, [](uint32_t x, uint32_t y) { return x | y; }); }
+	[[nodiscard]] friend SimdFloat operator^(const SimdFloat& a, const SimdFloat& b) { return bitwise(a, b, [](uint32_t x, uint32_t y) { return x ^ y; }); }
+
+	/// <summary>
+	/// Bit i is set if the sign bit of lane i is set.
+	/// </summary>
+	[[nodiscard]] friend uint32_t movemask(const SimdFloat& a)
+	{
+		uint32_t mask = 0;
+		for (int i = 0; i < N; i++) mask |= (std::bit_cast<uint32_t>(a.v[i]) >> 31) << i;
+		return mask;
+	}
+};
+
+#ifdef AITO_SSE
+template<>
+struct SimdFloat<4>
+{
+	__m128 v;
+
+	[[nodiscard]] static SimdFloat broadcast(float f) { return { _mm_set1_ps(f) }; }
+	[[nodiscard]] static SimdFloat load(const float* p) { return { _mm_load_ps(p) }; }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+
+	[[nodiscard]] friend SimdFloat operator+(const SimdFloat& a, const SimdFloat& b) { return { _mm_add_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator-(const SimdFloat& a, const SimdFloat& b) { return { _mm_sub_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator*(const SimdFloat& a, const SimdFloat& b) { return { _mm_mul_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator/(const SimdFloat& a, const SimdFloat& b) { return { _mm_div_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat min(const SimdFloat& a, const SimdFloat& b) { return { _mm_min_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat max(const SimdFloat& a, const SimdFloat& b) { return { _mm_max_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat abs(const SimdFloat& a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+	[[nodiscard]] friend SimdFloat sqrt(const SimdFloat& a) { return { _mm_sqrt_ps(a.v) }; }
+
+	[[nodiscard]] friend SimdFloat operator<(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator<=(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmple_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator>(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator>=(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator==(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmpeq_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator!=(const SimdFloat& a, const SimdFloat& b) { return { _mm_cmpneq_ps(a.v, b.v) }; }
+
+	[[nodiscard]] friend SimdFloat operator&(const SimdFloat& a, const SimdFloat& b) { return { _mm_and_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator|(const SimdFloat& a, const SimdFloat& b) { return { _mm_or_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator^(const SimdFloat& a, const SimdFloat& b) { return { _mm_xor_ps(a.v, b.v) }; }
+
+	[[nodiscard]] friend uint32_t movemask(const SimdFloat& a) { return static_cast<uint32_t>(_mm_movemask_ps(a.v)); }
+};
+#endif
+
+#ifdef AITO_AVX
+template<>
+struct SimdFloat<8>
+{
+	__m256 v;
+
+	[[nodiscard]] static SimdFloat broadcast(float f) { return { _mm256_set1_ps(f) }; }
+	[[nodiscard]] static SimdFloat load(const float* p) { return { _mm256_load_ps(p) }; }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+	[[nodiscard]] friend SimdFloat operator+(const SimdFloat& a, const SimdFloat& b) { return { _mm256_add_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator-(const SimdFloat& a, const SimdFloat& b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator*(const SimdFloat& a, const SimdFloat& b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator/(const SimdFloat& a, const SimdFloat& b) { return { _mm256_div_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat min(const SimdFloat& a, const SimdFloat& b) { return { _mm256_min_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat max(const SimdFloat& a, const SimdFloat& b) { return { _mm256_max_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat abs(const SimdFloat& a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+	[[nodiscard]] friend SimdFloat sqrt(const SimdFloat& a) { return { _mm256_sqrt_ps(a.v) }; }
+
+	[[nodiscard]] friend SimdFloat operator<(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	[[nodiscard]] friend SimdFloat operator<=(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+	[[nodiscard]] friend SimdFloat operator>(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	[[nodiscard]] friend SimdFloat operator>=(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	[[nodiscard]] friend SimdFloat operator==(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) }; }
+	[[nodiscard]] friend SimdFloat operator!=(const SimdFloat& a, const SimdFloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ) }; }
+
+	[[nodiscard]] friend SimdFloat operator&(const SimdFloat& a, const SimdFloat& b) { return { _mm256_and_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator|(const SimdFloat& a, const SimdFloat& b) { return { _mm256_or_ps(a.v, b.v) }; }
+	[[nodiscard]] friend SimdFloat operator^(const SimdFloat& a, const SimdFloat& b) { return { _mm256_xor_ps(a.v, b.v) }; }
+
+	[[nodiscard]] friend uint32_t movemask(const SimdFloat& a) { return static_cast<uint32_t>(_mm256_movemask_ps(a.v)); }
+};
+#endif
+
+}  // namespace aito
+
+
+#endif // AITO_SIMD_H
@@ -12,40 +12,75 @@
 
 namespace aito
 {
-	struct SimplePushConstantData
+	// Matches ObjectData in cull.comp and simple_shader.vert (std430)
+	struct ObjectData
 	{
 		Mat4f modelMatrix{ 1.0f };
 		Mat4f normalMatrix{ 1.0f };
+		Vec4f boundsMin{ 0.0f };
+		Vec4f boundsMax{ 0.0f };
+		uint32_t indexCount = 0;
+		uint32_t firstIndex = 0;
+		int32_t vertexOffset = 0;
+		uint32_t padding = 0;
 	};
+	static_assert(sizeof(ObjectData) == 176, "ObjectData must match the std430 layout of the shaders");
 
-	SimpleRenderSystem::SimpleRenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout)
-		: device_(device)
+	struct CullPushConstantData
 	{
+		Vec4f frustumPlanes[6];
+		uint32_t objectCount = 0;
+	};
+
+	SimpleRenderSystem::SimpleRenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout, GeometryPool& geometry)
+		: device_(device), geometry_(geometry)
+	{
+		createDescriptorSetLayouts();
 		createPipelineLayout(globalSetLayout);
 		createPipeline(renderPass);
+		createCullPipeline();
+
+		frames_.resize(Swapchain::MAX_FRAMES_IN_FLIGHT);
+		for (auto& frame : frames_)
+			createFrameBuffers(frame, INITIAL_OBJECT_CAPACITY);
 	}
 
 	SimpleRenderSystem::~SimpleRenderSystem()
 	{
 		vkDestroyPipelineLayout(device_.device(), pipelineLayout_, nullptr);
+		vkDestroyPipelineLayout(device_.device(), cullPipelineLayout_, nullptr);
+	}
+
+	void SimpleRenderSystem::createDescriptorSetLayouts()
+	{
+		// Every frame has a set for the culling pass and one for the vertex shader
+		descriptorPool_ = DescriptorPool::Builder(device_)
+			.setMaxSets(2 * Swapchain::MAX_FRAMES_IN_FLIGHT)
+			.addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * Swapchain::MAX_FRAMES_IN_FLIGHT)
+			.build();
+
+		cullSetLayout_ = DescriptorSetLayout::Builder(device_)
+			.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)	// objects
+			.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)	// draw commands
+			.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)	// counts
+			.build();
+
+		objectSetLayout_ = DescriptorSetLayout::Builder(device_)
+			.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+			.build();
 	}
 
 	// Self documenting
 	void SimpleRenderSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLayout)
 	{
-		VkPushConstantRange pushConstantRange{};
-		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-		pushConstantRange.offset = 0;
-		pushConstantRange.size = sizeof(SimplePushConstantData);
-
-		std::vector<VkDescriptorSetLayout> descriptorSetLayouts{ globalSetLayout };
+		std::vector<VkDescriptorSetLayout> descriptorSetLayouts{ globalSetLayout, objectSetLayout_->getDescriptorSetLayout() };
 
 		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
 		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 		pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
 		pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
+		pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
 
 		if (vkCreatePipelineLayout(device_.device(), &pipelineLayoutCreateInfo, nullptr, &pipelineLayout_) != VK_SUCCESS)
 		{
@@ -74,38 +109,225 @@ namespace aito
 
 	}
 
-	void SimpleRenderSystem::renderObjects(
-		const FrameInfo& frameInfo, 
+	void SimpleRenderSystem::createCullPipeline()
+	{
+		VkPushConstantRange pushConstantRange{};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(CullPushConstantData);
+
+		VkDescriptorSetLayout cullSetLayout = cullSetLayout_->getDescriptorSetLayout();
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+		pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutCreateInfo.setLayoutCount = 1;
+		pipelineLayoutCreateInfo.pSetLayouts = &cullSetLayout;
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+		if (vkCreatePipelineLayout(device_.device(), &pipelineLayoutCreateInfo, nullptr, &cullPipelineLayout_) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create pipeline layout. ");
+		}
+
+		cullPipeline_ = std::make_unique<ComputePipeline>(device_, "shaders/cull.comp.spv", cullPipelineLayout_);
+	}
+
+	void SimpleRenderSystem::createFrameBuffers(FrameResources& frame, uint32_t capacity)
+	{
+		const bool update = frame.capacity > 0;
+		frame.capacity = capacity;
+
+		// Written by the host every frame
+		frame.objectBuffer = std::make_unique<Buffer>(
+			device_,
+			sizeof(ObjectData),
+			capacity,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			);
+		frame.objectBuffer->map();
+
+		// Written and read by the GPU only, a command per object
+		frame.commandBuffer = std::make_unique<Buffer>(
+			device_,
+			sizeof(VkDrawIndexedIndirectCommand),
+			capacity,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+			);
+
+		// The visible object count, read back by the host for the UI
+		frame.countBuffer = std::make_unique<Buffer>(
+			device_,
+			sizeof(uint32_t),
+			1,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			);
+		frame.countBuffer->map();
+		*static_cast<uint32_t*>(frame.countBuffer->getMappedMemory()) = 0;
+
+		auto objectInfo = frame.objectBuffer->descriptorInfo();
+		auto commandInfo = frame.commandBuffer->descriptorInfo();
+		auto countInfo = frame.countBuffer->descriptorInfo();
+
+		DescriptorWriter cullWriter(*cullSetLayout_, *descriptorPool_);
+		cullWriter
+			.writeBuffer(0, &objectInfo)
+			.writeBuffer(1, &commandInfo)
+			.writeBuffer(2, &countInfo);
+		DescriptorWriter objectWriter(*objectSetLayout_, *descriptorPool_);
+		objectWriter.writeBuffer(0, &objectInfo);
+
+		if (update)
+		{
+			cullWriter.overwrite(frame.cullDescriptorSet);
+			objectWriter.overwrite(frame.objectDescriptorSet);
+		}
+		else if (!cullWriter.build(frame.cullDescriptorSet) || !objectWriter.build(frame.objectDescriptorSet))
+		{
+			throw std::runtime_error("Failed to allocate the culling descriptor sets");
+		}
+	}
+
+	void SimpleRenderSystem::cullObjects(
+		const FrameInfo& frameInfo,
 		const std::vector<Object>& objects)
 	{
+		// The fence of this frame was waited on before recording, so the GPU is done with its buffers
+		FrameResources& frame = frames_[frameInfo.frameIndex];
+		visibleObjectCount_ = *static_cast<const uint32_t*>(frame.countBuffer->getMappedMemory());
+
+		const uint32_t objectCount = static_cast<uint32_t>(objects.size());
+		if (objectCount > frame.capacity)
+		{
+			uint32_t capacity = frame.capacity;
+			while (capacity < objectCount)
+				capacity *= 2;
+			createFrameBuffers(frame, capacity);
+		}
+
+		frame.objectCount = objectCount;
+
+		ObjectData* objectData = static_cast<ObjectData*>(frame.objectBuffer->getMappedMemory());
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			const Object& obj = objects[i];
+			assert(&obj.model->getGeometryPool() == &geometry_ && "The model of the object is not in the geometry pool of the render system");
+			const Bounds3f& bounds = obj.model->getBounds();
+
+			ObjectData data{};
+			data.modelMatrix = obj.transform.mat4();
+			data.normalMatrix = obj.transform.normalMatrix();
+			data.boundsMin = Vec4f(Vec3f(bounds.p_min), 1.0f);
+			data.boundsMax = Vec4f(Vec3f(bounds.p_max), 1.0f);
+			data.indexCount = obj.model->getIndexCount();
+			data.firstIndex = obj.model->getFirstIndex();
+			data.vertexOffset = obj.model->getVertexOffset();
+			objectData[i] = data;
+		}
+		// Nothing to flush in the coherent memory the buffer asks for, but the writes stay correct if it lands elsewhere
+		frame.objectBuffer->markDirty(static_cast<VkDeviceSize>(objectCount) * sizeof(ObjectData));
+		frame.objectBuffer->flushDirtyRanges();
+
+		if (objectCount == 0)
+		{
+			*static_cast<uint32_t*>(frame.countBuffer->getMappedMemory()) = 0;
+			return;
+		}
+
+		// The culling pass writes every command, only the visible count has to start from zero
+		VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+		vkCmdFillBuffer(commandBuffer, frame.countBuffer->getBuffer(), 0, VK_WHOLE_SIZE, 0);
+
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+							 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		// The planes of the clip volume (-w <= x, y <= w, 0 <= z <= w) in world space, from the rows of the view projection matrix
+		const Mat4f viewProjection = frameInfo.camera.getProjection() * frameInfo.camera.getView();
+		Vec4f rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = Vec4f(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+		CullPushConstantData push{};
+		push.frustumPlanes[0] = rows[3] + rows[0];
+		push.frustumPlanes[1] = rows[3] - rows[0];
+		push.frustumPlanes[2] = rows[3] + rows[1];
+		push.frustumPlanes[3] = rows[3] - rows[1];
+		push.frustumPlanes[4] = rows[2];
+		push.frustumPlanes[5] = rows[3] - rows[2];
+		push.objectCount = objectCount;
+
+		cullPipeline_->bind(commandBuffer);
+		vkCmdBindDescriptorSets(
+			commandBuffer,
+			VK_PIPELINE_BIND_POINT_COMPUTE,
+			cullPipelineLayout_,
+			0,
+			1,
+			&frame.cullDescriptorSet,
+			0,
+			nullptr
+		);
+		vkCmdPushConstants(
+			commandBuffer,
+			cullPipelineLayout_,
+			VK_SHADER_STAGE_COMPUTE_BIT,
+			0,
+			sizeof(CullPushConstantData),
+			&push);
+		vkCmdDispatch(commandBuffer, (objectCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+		// The draws read the commands, and the host reads the visible count once the frame is done
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+							 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+
+	void SimpleRenderSystem::renderObjects(const FrameInfo& frameInfo)
+	{
+		const FrameResources& frame = frames_[frameInfo.frameIndex];
+		if (frame.objectCount == 0)
+			return;
+
 		pipeline_->bind(frameInfo.commandBuffer);
 
+		const VkDescriptorSet descriptorSets[] = { frameInfo.globalDescriptorSet, frame.objectDescriptorSet };
 		vkCmdBindDescriptorSets(
 			frameInfo.commandBuffer,
 			VK_PIPELINE_BIND_POINT_GRAPHICS,
 			pipelineLayout_,
 			0,
+			2,
+			descriptorSets,
+			// Only the global set has a dynamic buffer
 			1,
-			&frameInfo.globalDescriptorSet,
-			0,
-			nullptr
+			&frameInfo.globalOffset
 		);
 
-		for (auto& obj : objects)
+		// Without multiDrawIndirect every command needs a draw call of its own
+		const uint32_t maxDrawCount = device_.enabledFeatures.multiDrawIndirect ? device_.properties.limits.maxDrawIndirectCount : 1;
+		const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+		geometry_.bind(frameInfo.commandBuffer);
+		for (uint32_t drawn = 0; drawn < frame.objectCount;)
 		{
-			SimplePushConstantData push{};
-			push.modelMatrix = obj.transform.mat4();
-			push.normalMatrix = obj.transform.normalMatrix();
-			
-			vkCmdPushConstants(
+			const uint32_t drawCount = std::min(frame.objectCount - drawn, maxDrawCount);
+			vkCmdDrawIndexedIndirect(
 				frameInfo.commandBuffer,
-				pipelineLayout_,
-				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-				0,
-				sizeof(SimplePushConstantData),
-				&push);
-			obj.model->bind(frameInfo.commandBuffer);
-			obj.model->draw(frameInfo.commandBuffer);
+				frame.commandBuffer->getBuffer(),
+				static_cast<VkDeviceSize>(drawn) * stride,
+				drawCount,
+				stride);
+			drawn += drawCount;
 		}
 	}
 }
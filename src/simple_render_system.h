@@ -8,34 +8,89 @@
 #include "pipeline.h"
 #include "object.h"
 #include "frame_info.h"
+#include "buffer.h"
+#include "descriptor.h"
+#include "swapchain.h"
+#include "geometry_pool.h"
 
 
 namespace aito
 {
+	/// <summary>
+	/// Draws the objects of the scene. The objects are culled against the view frustum on the GPU: a compute pass tests
+	/// the bounds of every object and writes its indirect draw command, so the CPU never has to know which objects are visible.
+	/// All the models share the buffers of one GeometryPool, so the whole scene is a single indirect draw.
+	/// </summary>
 	class SimpleRenderSystem
 	{
 
 	public:
-		SimpleRenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout);
+		// The objects the buffers are sized for at first. They grow as needed.
+		static constexpr uint32_t INITIAL_OBJECT_CAPACITY = 64;
+		static constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+
+		// Every object drawn by the system must have its model in "geometry"
+		SimpleRenderSystem(Device& device, VkRenderPass renderPass, VkDescriptorSetLayout globalSetLayout, GeometryPool& geometry);
 		~SimpleRenderSystem();
 
 		SimpleRenderSystem(const SimpleRenderSystem&) = delete;
 		SimpleRenderSystem& operator=(const SimpleRenderSystem&) = delete;
 
-		void renderObjects(
-			const FrameInfo& frameInfo, 
+		/// <summary>
+		/// Uploads the objects and records the culling pass that writes their draw commands.
+		/// Must be recorded outside of a render pass, before renderObjects in the same frame.
+		/// </summary>
+		void cullObjects(
+			const FrameInfo& frameInfo,
 			const std::vector<Object>& objects);
+		/// <summary>
+		/// Draws the objects that survived the culling pass of this frame.
+		/// </summary>
+		void renderObjects(const FrameInfo& frameInfo);
+
+		/// <summary>
+		/// The objects the culling pass found visible, the last time it ran on the GPU. Lags a few frames behind.
+		/// </summary>
+		inline uint32_t getVisibleObjectCount() const { return visibleObjectCount_; }
 
 	private:
+		// Everything the GPU may still be using while the next frame is recorded
+		struct FrameResources
+		{
+			std::unique_ptr<Buffer> objectBuffer;
+			std::unique_ptr<Buffer> commandBuffer;
+			std::unique_ptr<Buffer> countBuffer;
+			VkDescriptorSet cullDescriptorSet = VK_NULL_HANDLE;
+			VkDescriptorSet objectDescriptorSet = VK_NULL_HANDLE;
+			uint32_t capacity = 0;
+			uint32_t objectCount = 0;
+		};
+
 		Device& device_;
+		GeometryPool& geometry_;
 
 		std::unique_ptr<Pipeline> pipeline_;
 		VkPipelineLayout pipelineLayout_;
 
+		std::unique_ptr<ComputePipeline> cullPipeline_;
+		VkPipelineLayout cullPipelineLayout_;
+
+		std::unique_ptr<DescriptorPool> descriptorPool_;
+		std::unique_ptr<DescriptorSetLayout> cullSetLayout_;
+		std::unique_ptr<DescriptorSetLayout> objectSetLayout_;
+
+		std::vector<FrameResources> frames_;
+		uint32_t visibleObjectCount_ = 0;
+
+		void createDescriptorSetLayouts();
 		void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
 		void createPipeline(VkRenderPass renderPass);
+		void createCullPipeline();
+		/// <summary>
+		/// (Re)creates the buffers of a frame to hold "capacity" objects, and points its descriptor sets at them.
+		/// </summary>
+		void createFrameBuffers(FrameResources& frame, uint32_t capacity);
 	};
 }
 
 #endif /* AITO_SIMPLE_RENDER_SYSTEM_H */
-
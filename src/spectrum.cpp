@@ -0,0 +1,206 @@
+#include "pch.h"
+
+#include "spectrum.h"
+
+#include <algorithm>
+#include <numeric>
+
+
+namespace aito
+{
+
+namespace
+{
+
+/// <summary>
+/// Gaussian with a different width on each side of its peak, the building block of the matching function fits.
+/// </summary>
+inline Float piecewise_gaussian(Float lambda, Float mu, Float sigmaLow, Float sigmaHigh)
+{
+	const Float t = (lambda - mu) / (lambda < mu ? sigmaLow : sigmaHigh);
+	return std::exp(-0.5f * t * t);
+}
+
+/// <summary>
+/// The matching functions at every integer wavelength in [LambdaMin, LambdaMax], divided by cie_y_integral(),
+/// so converting a sample takes a few lookups instead of evaluating the fits.
+/// </summary>
+class CieTable
+{
+public:
+	CieTable()
+	{
+		const Float yIntegral = cie_y_integral();
+		for (int i = 0; i < SIZE; i++)
+		{
+			const Float lambda = LambdaMin + i;
+			xyz_[i] = Vec3f(cie_x(lambda), cie_y(lambda), cie_z(lambda)) / yIntegral;
+		}
+	}
+
+	[[nodiscard]] inline Vec3f operator()(Float lambda) const
+	{
+		const Float x = std::clamp(lambda - LambdaMin, Float(0), Float(SIZE - 1));
+		const int i = std::min(static_cast<int>(x), SIZE - 2);
+		return lerp(x - i, xyz_[i], xyz_[i + 1]);
+	}
+
+	[[nodiscard]] static const CieTable& get()
+	{
+		static const CieTable table;
+		return table;
+	}
+
+private:
+	static constexpr int SIZE = static_cast<int>(LambdaMax - LambdaMin) + 1;
+
+	std::array<Vec3f, SIZE> xyz_;
+};
+
+}
+
+Float SampledSpectrum::max_component() const
+{
+	const std::array<Float, NSpectrumSamples> v = values();
+	return *std::max_element(v.begin(), v.end());
+}
+
+Float SampledSpectrum::average() const
+{
+	const std::array<Float, NSpectrumSamples> v = values();
+	return std::accumulate(v.begin(), v.end(), Float(0)) / NSpectrumSamples;
+}
+
+Vec3f SampledSpectrum::to_xyz(const SampledWavelengths& lambda) const
+{
+	// The average of s * cie(lambda) / pdf(lambda) over the wavelengths. Wavelengths with a pdf of 0 (terminated secondaries) do not count.
+	const CieTable& cie = CieTable::get();
+	const std::array<Float, NSpectrumSamples> values = safe_div(*this, lambda.pdf()).values();
+	Vec3f xyz(0);
+	for (int i = 0; i < NSpectrumSamples; i++)
+		xyz += values[i] * cie(lambda[i]);
+	return xyz / static_cast<Float>(NSpectrumSamples);
+}
+
+Float SampledSpectrum::y(const SampledWavelengths& lambda) const
+{
+	return to_xyz(lambda).y;
+}
+
+Vec3f SampledSpectrum::to_rgb(const SampledWavelengths& lambda) const
+{
+	return xyz_to_rgb(to_xyz(lambda));
+}
+
+SampledWavelengths SampledWavelengths::sample_uniform(Float u, Float lambdaMin, Float lambdaMax)
+{
+	SampledWavelengths wavelengths;
+	const Float delta = (lambdaMax - lambdaMin) / NSpectrumSamples;
+	wavelengths.lambda_[0] = lerp(u, lambdaMin, lambdaMax);
+	for (int i = 1; i < NSpectrumSamples; i++)
+	{
+		wavelengths.lambda_[i] = wavelengths.lambda_[i - 1] + delta;
+		if (wavelengths.lambda_[i] > lambdaMax)
+			wavelengths.lambda_[i] = lambdaMin + (wavelengths.lambda_[i] - lambdaMax);
+	}
+	wavelengths.pdf_ = SampledSpectrum(1 / (lambdaMax - lambdaMin));
+	return wavelengths;
+}
+
+SampledWavelengths SampledWavelengths::sample_visible(Float u)
+{
+	SampledWavelengths wavelengths;
+	std::array<Float, NSpectrumSamples> pdf;
+	for (int i = 0; i < NSpectrumSamples; i++)
+	{
+		Float up = u + static_cast<Float>(i) / NSpectrumSamples;
+		if (up > 1)
+			up -= 1;
+		// Inverts the cdf of visible_wavelengths_pdf, 538 - 138.888889 * atanh(t) with atanh written out (much cheaper than std::atanh)
+		const Float t = 0.85691062f - 1.82750197f * up;
+		wavelengths.lambda_[i] = 538 - 69.4444444f * std::log((1 + t) / (1 - t));
+		pdf[i] = visible_wavelengths_pdf(wavelengths.lambda_[i]);
+	}
+	wavelengths.pdf_ = SampledSpectrum(pdf);
+	return wavelengths;
+}
+
+void SampledWavelengths::terminate_secondary()
+{
+	if (secondary_terminated())
+		return;
+
+	// The estimates average over all wavelengths, so the hero wavelength now stands in for all of them
+	std::array<Float, NSpectrumSamples> pdf = pdf_.values();
+	pdf[0] /= NSpectrumSamples;
+	std::fill(pdf.begin() + 1, pdf.end(), Float(0));
+	pdf_ = SampledSpectrum(pdf);
+}
+
+bool SampledWavelengths::secondary_terminated() const
+{
+	const std::array<Float, NSpectrumSamples> pdf = pdf_.values();
+	return std::all_of(pdf.begin() + 1, pdf.end(), [](Float p) { return p == 0; });
+}
+
+Float visible_wavelengths_pdf(Float lambda)
+{
+	if (lambda < LambdaMin || lambda > LambdaMax)
+		return 0;
+	// 0.0039398042 / cosh^2(x) = 4 * 0.0039398042 / (e^x + e^-x)^2
+	const Float e = std::exp(0.0072f * (lambda - 538));
+	const Float c = e + 1 / e;
+	return 0.0157592168f / (c * c);
+}
+
+Float cie_x(Float lambda)
+{
+	return 1.056f * piecewise_gaussian(lambda, 599.8f, 37.9f, 31.0f)
+		+ 0.362f * piecewise_gaussian(lambda, 442.0f, 16.0f, 26.7f)
+		- 0.065f * piecewise_gaussian(lambda, 501.1f, 20.4f, 26.2f);
+}
+
+Float cie_y(Float lambda)
+{
+	return 0.821f * piecewise_gaussian(lambda, 568.8f, 46.9f, 40.5f)
+		+ 0.286f * piecewise_gaussian(lambda, 530.9f, 16.3f, 31.1f);
+}
+
+Float cie_z(Float lambda)
+{
+	return 1.217f * piecewise_gaussian(lambda, 437.0f, 11.8f, 36.0f)
+		+ 0.681f * piecewise_gaussian(lambda, 459.0f, 26.0f, 13.8f);
+}
+
+Float cie_y_integral()
+{
+	static const Float integral = []()
+	{
+		const int count = static_cast<int>(LambdaMax - LambdaMin) + 1;
+		double sum = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const double weight = (i == 0 || i == count - 1) ? 0.5 : 1;
+			sum += weight * cie_y(LambdaMin + i);
+		}
+		return static_cast<Float>(sum);
+	}();
+	return integral;
+}
+
+Vec3f xyz_to_linear_srgb(const Vec3f& xyz)
+{
+	return Vec3f(
+		3.2404542f * xyz.x - 1.5371385f * xyz.y - 0.4985314f * xyz.z,
+		-0.9692660f * xyz.x + 1.8760108f * xyz.y + 0.0415560f * xyz.z,
+		0.0556434f * xyz.x - 0.2040259f * xyz.y + 1.0572252f * xyz.z);
+}
+
+Vec3f xyz_to_rgb(const Vec3f& xyz)
+{
+	// The linear sRGB of XYZ = (1, 1, 1)
+	static const Vec3f equalEnergyWhite = xyz_to_linear_srgb(Vec3f(1));
+	return xyz_to_linear_srgb(xyz) / equalEnergyWhite;
+}
+
+}  // namespace aito
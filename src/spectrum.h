@@ -0,0 +1,178 @@
+#ifndef AITO_SPECTRUM_H
+#define AITO_SPECTRUM_H
+
+#include "aito.h"
+
+#include "simd.h"
+#include "vecmath.h"
+
+#include <array>
+
+
+namespace aito
+{
+
+// The range of visible wavelengths, in nm
+static constexpr Float LambdaMin = 360;
+static constexpr Float LambdaMax = 830;
+
+// The number of wavelengths a path carries, which fills one SSE register. It is the same with or without AVX,
+// so a build renders the same image whatever instructions it was compiled with.
+static constexpr int NSpectrumSamples = 4;
+
+class SampledWavelengths;
+
+/// <summary>
+/// A spectral quantity (radiance, reflectance, throughput...) at the NSpectrumSamples wavelengths of a path.
+/// The values are kept in a single SIMD vector, so the arithmetic costs the same as with an RGB color.
+/// </summary>
+class SampledSpectrum
+{
+public:
+	SampledSpectrum() : values_(Simd::broadcast(0)) {}
+	explicit SampledSpectrum(Float c) : values_(Simd::broadcast(static_cast<float>(c))) {}
+	explicit SampledSpectrum(const std::array<Float, NSpectrumSamples>& values)
+	{
+		alignas(32) float v[NSpectrumSamples];
+		for (int i = 0; i < NSpectrumSamples; i++)
+			v[i] = static_cast<float>(values[i]);
+		values_ = Simd::load(v);
+	}
+
+	[[nodiscard]] inline std::array<Float, NSpectrumSamples> values() const
+	{
+		alignas(32) float v[NSpectrumSamples];
+		values_.store(v);
+		std::array<Float, NSpectrumSamples> values;
+		for (int i = 0; i < NSpectrumSamples; i++)
+			values[i] = v[i];
+		return values;
+	}
+	[[nodiscard]] inline Float operator[](int i) const { return values()[i]; }
+
+	[[nodiscard]] friend inline SampledSpectrum operator+(const SampledSpectrum& a, const SampledSpectrum& b) { return SampledSpectrum(a.values_ + b.values_); }
+	[[nodiscard]] friend inline SampledSpectrum operator-(const SampledSpectrum& a, const SampledSpectrum& b) { return SampledSpectrum(a.values_ - b.values_); }
+	[[nodiscard]] friend inline SampledSpectrum operator*(const SampledSpectrum& a, const SampledSpectrum& b) { return SampledSpectrum(a.values_ * b.values_); }
+	[[nodiscard]] friend inline SampledSpectrum operator/(const SampledSpectrum& a, const SampledSpectrum& b) { return SampledSpectrum(a.values_ / b.values_); }
+	[[nodiscard]] friend inline SampledSpectrum operator*(const SampledSpectrum& s, Float a) { return SampledSpectrum(s.values_ * Simd::broadcast(static_cast<float>(a))); }
+	[[nodiscard]] friend inline SampledSpectrum operator*(Float a, const SampledSpectrum& s) { return s * a; }
+	[[nodiscard]] friend inline SampledSpectrum operator/(const SampledSpectrum& s, Float a) { return s * (1 / a); }
+
+	inline SampledSpectrum& operator+=(const SampledSpectrum& s) { return *this = *this + s; }
+	inline SampledSpectrum& operator-=(const SampledSpectrum& s) { return *this = *this - s; }
+	inline SampledSpectrum& operator*=(const SampledSpectrum& s) { return *this = *this * s; }
+	inline SampledSpectrum& operator/=(const SampledSpectrum& s) { return *this = *this / s; }
+	inline SampledSpectrum& operator*=(Float a) { return *this = *this * a; }
+	inline SampledSpectrum& operator/=(Float a) { return *this = *this / a; }
+
+	[[nodiscard]] friend inline SampledSpectrum sqrt(const SampledSpectrum& s) { return SampledSpectrum(sqrt(s.values_)); }
+
+	/// <summary>
+	/// a / b, with 0 where b is 0 (like the wavelengths of a terminated secondary, which have a pdf of 0).
+	/// </summary>
+	[[nodiscard]] friend inline SampledSpectrum safe_div(const SampledSpectrum& a, const SampledSpectrum& b)
+	{
+		return SampledSpectrum((a.values_ / b.values_) & (b.values_ != Simd::broadcast(0)));
+	}
+
+	[[nodiscard]] inline bool is_zero() const { return movemask(values_ != Simd::broadcast(0)) == 0; }
+	[[nodiscard]] inline explicit operator bool() const { return !is_zero(); }
+
+	[[nodiscard]] Float max_component() const;
+	[[nodiscard]] Float average() const;
+
+	/// <summary>
+	/// CIE XYZ of the spectrum, estimated from its samples at "lambda". Averaged over many samples, this converges to
+	/// the integral with the CIE matching functions, normalized so a constant spectrum of 1 has Y = 1.
+	/// </summary>
+	[[nodiscard]] Vec3f to_xyz(const SampledWavelengths& lambda) const;
+	/// <summary>
+	/// The Y (luminance) part of to_xyz.
+	/// </summary>
+	[[nodiscard]] Float y(const SampledWavelengths& lambda) const;
+	/// <summary>
+	/// The RGB of the spectrum (see xyz_to_rgb), estimated like to_xyz.
+	/// </summary>
+	[[nodiscard]] Vec3f to_rgb(const SampledWavelengths& lambda) const;
+
+private:
+	using Simd = SimdFloat<NSpectrumSamples>;
+
+	Simd values_;
+
+	explicit SampledSpectrum(const Simd& values) : values_(values) {}
+};
+
+/// <summary>
+/// The wavelengths a path carries, and the density they were sampled with. All wavelengths follow the same path,
+/// so a path is only traced once for NSpectrumSamples wavelengths. Wavelength dependent scattering (dispersion) is handled
+/// by terminating the secondary wavelengths, which leaves the other paths without any extra cost.
+/// </summary>
+class SampledWavelengths
+{
+public:
+	/// <summary>
+	/// Hero wavelength sampling (Wilkie et al., "Hero Wavelength Spectral Sampling", 2014): "u" picks the first (hero) wavelength
+	/// uniformly in [lambdaMin, lambdaMax], and the others are spread evenly over the range from it, wrapping around.
+	/// </summary>
+	[[nodiscard]] static SampledWavelengths sample_uniform(Float u, Float lambdaMin = LambdaMin, Float lambdaMax = LambdaMax);
+	/// <summary>
+	/// Like sample_uniform, but the wavelengths are warped to a density that follows the sensitivity of the eye,
+	/// which reduces color noise. The offsets between the wavelengths are taken before the warp.
+	/// </summary>
+	[[nodiscard]] static SampledWavelengths sample_visible(Float u);
+
+	[[nodiscard]] inline Float operator[](int i) const { return lambda_[i]; }
+	[[nodiscard]] inline SampledSpectrum pdf() const { return pdf_; }
+	/// <summary>
+	/// The wavelengths themselves as a spectrum, for evaluating a function of the wavelength on all of them at once.
+	/// </summary>
+	[[nodiscard]] inline SampledSpectrum as_spectrum() const { return SampledSpectrum(lambda_); }
+
+	/// <summary>
+	/// Keeps only the hero wavelength, for when the path scatters differently per wavelength (e.g. refraction with dispersion).
+	/// The other wavelengths get a pdf of 0, and the hero wavelength continues as the only sample.
+	/// </summary>
+	void terminate_secondary();
+	[[nodiscard]] bool secondary_terminated() const;
+
+private:
+	std::array<Float, NSpectrumSamples> lambda_{};
+	SampledSpectrum pdf_;
+};
+
+/// <summary>
+/// Density of SampledWavelengths::sample_visible for a single wavelength (zero outside [LambdaMin, LambdaMax]).
+/// </summary>
+[[nodiscard]] Float visible_wavelengths_pdf(Float lambda);
+
+/// <summary>
+/// The integral of cie_y over [LambdaMin, LambdaMax], by the trapezoid rule on every integer wavelength. That is the exact
+/// integral of the table the renderer interpolates and the sum rgb2spec_opt integrates with, so normalizing by it keeps
+/// a constant spectrum of 1 at exactly Y = 1 for both.
+/// </summary>
+[[nodiscard]] Float cie_y_integral();
+
+/// <summary>
+/// Analytic fits of the CIE 1931 color matching functions (Wyman et al., "Simple Analytic Approximations to the CIE XYZ
+/// Color Matching Functions", 2013), with "lambda" in nm.
+/// </summary>
+[[nodiscard]] Float cie_x(Float lambda);
+[[nodiscard]] Float cie_y(Float lambda);
+[[nodiscard]] Float cie_z(Float lambda);
+
+/// <summary>
+/// Converts CIE XYZ to linear sRGB (Rec. 709 primaries, D65 white point).
+/// </summary>
+[[nodiscard]] Vec3f xyz_to_linear_srgb(const Vec3f& xyz);
+/// <summary>
+/// Converts CIE XYZ to the RGB the renderer works in: linear sRGB, with the channels scaled so that the equal energy white
+/// (a constant spectrum) is (1, 1, 1). White surfaces lit by white lights, which are both constant spectra
+/// after RGB to spectrum conversion, stay white.
+/// </summary>
+[[nodiscard]] Vec3f xyz_to_rgb(const Vec3f& xyz);
+
+}  // namespace aito
+
+
+#endif // AITO_SPECTRUM_H
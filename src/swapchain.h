@@ -61,7 +61,7 @@ namespace aito
 		VkRenderPass renderPass_;
 
 		std::vector<VkImage> depthImages_;
-		std::vector<VkDeviceMemory> depthImageMemories_;
+		std::vector<MemoryAllocator::Allocation> depthImageMemories_;
 		std::vector<VkImageView> depthImageViews_;
 		std::vector<VkImage> swapChainImages_;
 		std::vector<VkImageView> swapChainImageViews_;
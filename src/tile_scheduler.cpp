@@ -0,0 +1,166 @@
+#include "pch.h"
+
+#include "tile_scheduler.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+namespace aito
+{
+
+TileScheduler::TileScheduler(const Bounds2i& imageBounds, int tileSize, int threadCount)
+{
+	assert(tileSize > 0 && "The tile size must be positive");
+
+	for (int y = imageBounds.p_min.y; y < imageBounds.p_max.y; y += tileSize)
+	{
+		for (int x = imageBounds.p_min.x; x < imageBounds.p_max.x; x += tileSize)
+		{
+			const Point2i tileMin(x, y);
+			const Point2i tileMax(std::min(x + tileSize, imageBounds.p_max.x), std::min(y + tileSize, imageBounds.p_max.y));
+			tiles_.push_back({ Bounds2i(tileMin, tileMax), static_cast<uint32_t>(tiles_.size()) });
+		}
+	}
+
+	const int workerCount = threadCount > 0 ? threadCount : available_cores();
+	for (int i = 0; i < workerCount; i++)
+		queues_.push_back(std::make_unique<WorkerQueue>());
+	for (int i = 0; i < workerCount; i++)
+		workers_.emplace_back(&TileScheduler::worker_loop, this, i);
+
+	AITO_INFO("Tile scheduler created with {} tiles of {}x{} pixels and {} worker threads", tiles_.size(), tileSize, tileSize, workerCount);
+}
+
+TileScheduler::~TileScheduler()
+{
+	{
+		std::lock_guard lock(jobMutex_);
+		shutdown_ = true;
+	}
+	jobStart_.notify_all();
+
+	for (auto& worker : workers_)
+		worker.join();
+}
+
+void TileScheduler::run(const TileFunction& tileFunction, const ProgressFunction& progressFunction)
+{
+	[[maybe_unused]] const auto startTime = std::chrono::steady_clock::now();
+
+	{
+		std::lock_guard lock(jobMutex_);
+
+		// Give every worker a contiguous block of tiles. Neighbouring tiles tend to cost about the same,
+		// so the blocks are uneven, and the stealing evens them out.
+		const uint32_t workerCount = static_cast<uint32_t>(queues_.size());
+		for (uint32_t i = 0; i < workerCount; i++)
+		{
+			const uint32_t begin = tile_count() * i / workerCount;
+			const uint32_t end = tile_count() * (i + 1) / workerCount;
+			std::lock_guard queueLock(queues_[i]->mutex);
+			queues_[i]->tiles.clear();
+			for (uint32_t tile = begin; tile < end; tile++)
+				queues_[i]->tiles.push_back(tile);
+		}
+
+		tileFunction_ = &tileFunction;
+		progressFunction_ = &progressFunction;
+		exception_ = nullptr;
+		failed_ = false;
+		tilesDone_ = 0;
+		tilesStolen_ = 0;
+		activeWorkers_ = static_cast<int>(workerCount);
+		jobGeneration_++;
+	}
+	jobStart_.notify_all();
+
+	std::exception_ptr exception;
+	{
+		std::unique_lock lock(jobMutex_);
+		jobDone_.wait(lock, [&]() { return activeWorkers_ == 0; });
+		tileFunction_ = nullptr;
+		progressFunction_ = nullptr;
+		exception = exception_;
+	}
+
+	if (exception)
+		std::rethrow_exception(exception);
+
+	AITO_TRACE("Rendered {}/{} tiles in {:.1f} ms, {} of them stolen", tilesDone_.load(), tile_count(),
+			   std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count(), tilesStolen_.load());
+}
+
+void TileScheduler::worker_loop(int threadIndex)
+{
+	uint64_t seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock lock(jobMutex_);
+			jobStart_.wait(lock, [&]() { return shutdown_ || jobGeneration_ != seenGeneration; });
+			if (shutdown_)
+				return;
+			seenGeneration = jobGeneration_;
+		}
+
+		uint32_t tileIndex;
+		while (!cancelled_ && !failed_ && next_tile(threadIndex, &tileIndex))
+		{
+			try
+			{
+				(*tileFunction_)(tiles_[tileIndex], threadIndex);
+				const uint32_t tilesDone = ++tilesDone_;
+				if (*progressFunction_)
+					(*progressFunction_)(tiles_[tileIndex], tilesDone, tile_count());
+			} catch (...)
+			{
+				std::lock_guard lock(jobMutex_);
+				if (!exception_)
+					exception_ = std::current_exception();
+				failed_ = true;
+			}
+		}
+
+		{
+			std::lock_guard lock(jobMutex_);
+			if (--activeWorkers_ == 0)
+				jobDone_.notify_all();
+		}
+	}
+}
+
+bool TileScheduler::next_tile(int threadIndex, uint32_t* tileIndex)
+{
+	{
+		WorkerQueue& queue = *queues_[threadIndex];
+		std::lock_guard lock(queue.mutex);
+		if (!queue.tiles.empty())
+		{
+			*tileIndex = queue.tiles.front();
+			queue.tiles.pop_front();
+			return true;
+		}
+	}
+
+	// Steal from the back of the other queues, which is the furthest away from where their owners are working
+	const int workerCount = static_cast<int>(queues_.size());
+	for (int i = 1; i < workerCount; i++)
+	{
+		WorkerQueue& victim = *queues_[(threadIndex + i) % workerCount];
+		std::lock_guard lock(victim.mutex);
+		if (!victim.tiles.empty())
+		{
+			*tileIndex = victim.tiles.back();
+			victim.tiles.pop_back();
+			tilesStolen_++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+}  // namespace aito
@@ -0,0 +1,117 @@
+#ifndef AITO_TILE_SCHEDULER_H
+#define AITO_TILE_SCHEDULER_H
+
+#include "aito.h"
+
+#include "bounds.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// A rectangle of pixels that is rendered as one unit of work.
+/// </summary>
+struct RenderTile
+{
+	Bounds2i pixel_bounds;
+	uint32_t index;
+};
+
+/// <summary>
+/// Splits an image into square tiles and renders them on a persistent pool of worker threads.
+/// Every worker starts with a contiguous block of tiles, and steals tiles from the back of the other
+/// workers' queues once its own queue runs dry, so expensive regions of the image do not leave threads idle.
+/// </summary>
+class TileScheduler
+{
+public:
+	static constexpr int DEFAULT_TILE_SIZE = 16;
+
+	// Renders one tile. "threadIndex" is in [0, thread_count()), so it can be used to index per-thread state.
+	using TileFunction = std::function<void(const RenderTile& tile, int threadIndex)>;
+	// Called after every finished tile, from the thread that rendered it.
+	using ProgressFunction = std::function<void(const RenderTile& tile, uint32_t tilesDone, uint32_t tileCount)>;
+
+	/// <summary>
+	/// Creates the tiles and starts the worker threads. "threadCount" 0 uses all available cores.
+	/// </summary>
+	TileScheduler(const Bounds2i& imageBounds, int tileSize = DEFAULT_TILE_SIZE, int threadCount = 0);
+	~TileScheduler();
+
+	TileScheduler(const TileScheduler&) = delete;
+	TileScheduler& operator=(const TileScheduler&) = delete;
+
+	/// <summary>
+	/// Renders all tiles and blocks until they are done, or until the render is cancelled.
+	/// If a tile function throws, the remaining tiles are skipped and the exception is rethrown here.
+	/// A cancel that arrived before the call is kept, and skips the whole render: call reset_cancel() to arm the next one.
+	/// </summary>
+	void run(const TileFunction& tileFunction, const ProgressFunction& progressFunction = {});
+
+	/// <summary>
+	/// Makes the running render stop after the tiles that are currently being rendered. Can be called from any thread.
+	/// </summary>
+	void cancel() { cancelled_ = true; }
+	/// <summary>
+	/// Clears a cancel, so the next run() renders. Callers that cancel from other threads clear it under the same lock
+	/// they cancel with, so no cancel is lost between deciding to render and starting the render.
+	/// </summary>
+	void reset_cancel() { cancelled_ = false; }
+
+	[[nodiscard]] inline const std::vector<RenderTile>& tiles() const { return tiles_; }
+	[[nodiscard]] inline uint32_t tile_count() const { return static_cast<uint32_t>(tiles_.size()); }
+	[[nodiscard]] inline int thread_count() const { return static_cast<int>(workers_.size()); }
+	[[nodiscard]] inline uint32_t tiles_done() const { return tilesDone_.load(); }
+
+private:
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<uint32_t> tiles;
+	};
+
+	std::vector<RenderTile> tiles_;
+	std::vector<std::unique_ptr<WorkerQueue>> queues_;
+	std::vector<std::thread> workers_;
+
+	// Guards the job state below, and is used to start the workers and wait for them
+	std::mutex jobMutex_;
+	std::condition_variable jobStart_;
+	std::condition_variable jobDone_;
+	uint64_t jobGeneration_ = 0;
+	int activeWorkers_ = 0;
+	bool shutdown_ = false;
+	const TileFunction* tileFunction_ = nullptr;
+	const ProgressFunction* progressFunction_ = nullptr;
+	std::exception_ptr exception_;
+
+	std::atomic<uint32_t> tilesDone_{ 0 };
+	std::atomic<uint32_t> tilesStolen_{ 0 };
+	// Only set by cancel(), so a cancel from before run() is kept
+	std::atomic<bool> cancelled_{ false };
+	// Set when a tile function throws, to skip the remaining tiles of this run. Cleared by every run().
+	std::atomic<bool> failed_{ false };
+
+	void worker_loop(int threadIndex);
+
+	/// <summary>
+	/// Takes the next tile from the front of the worker's own queue, or steals one from the back of another queue.
+	/// </summary>
+	/// <returns>False once all queues are empty. </returns>
+	bool next_tile(int threadIndex, uint32_t* tileIndex);
+};
+
+}  // namespace aito
+
+
+#endif // AITO_TILE_SCHEDULER_H
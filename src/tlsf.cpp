@@ -0,0 +1,248 @@
+#include "pch.h"
+
+#include "tlsf.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+
+namespace aito
+{
+	TLSF::TLSF(uint64_t size)
+		: size_(size)
+	{
+		assert(size > 0 && "Cannot manage an empty block");
+
+		for (auto& lists : freeLists_)
+			std::fill(std::begin(lists), std::end(lists), NO_RANGE);
+
+		insertFree(createRange(0, size));
+	}
+
+	uint32_t TLSF::allocate(uint64_t size, uint64_t alignment)
+	{
+		assert(alignment > 0 && (alignment & (alignment - 1)) == 0 && "The alignment must be a power of two");
+		size = std::max<uint64_t>(size, 1);
+
+		// Any free range of at least this size fits the allocation, wherever the aligned offset falls in it
+		const uint64_t fitSize = size + alignment - 1;
+		// Round up to the next size class, so every range in the class found is large enough (good fit instead of best fit)
+		uint64_t searchSize = fitSize;
+		if (searchSize >= SL_COUNT)
+			searchSize += (uint64_t{ 1 } << (std::bit_width(searchSize) - 1 - SL_BITS)) - 1;
+
+		uint32_t fl, sl;
+		mapping(searchSize, fl, sl);
+
+		uint32_t range = NO_RANGE;
+		if (fl < FL_COUNT)
+		{
+			// The first non-empty list of this or a larger size class
+			uint32_t slMap = slBitmaps_[fl] & (~0u << sl);
+			if (slMap == 0)
+			{
+				const uint64_t flMap = fl + 1 < 64 ? flBitmap_ & (~uint64_t{ 0 } << (fl + 1)) : 0;
+				if (flMap != 0)
+				{
+					fl = static_cast<uint32_t>(std::countr_zero(flMap));
+					slMap = slBitmaps_[fl];
+				}
+			}
+			if (slMap != 0)
+				range = freeLists_[fl][std::countr_zero(slMap)];
+		}
+
+		// The class the size falls in may still hold a range that fits, like the whole of a block made for the allocation
+		if (range == NO_RANGE)
+		{
+			mapping(fitSize, fl, sl);
+			if (fl >= FL_COUNT)
+				return NO_RANGE;
+			range = freeLists_[fl][sl];
+			while (range != NO_RANGE && ranges_[range].size < fitSize)
+				range = ranges_[range].nextFree;
+			if (range == NO_RANGE)
+				return NO_RANGE;
+		}
+
+		removeFree(range);
+
+		// The padding in front of the aligned offset stays free. The range before is in use, or it would have been merged.
+		const uint64_t offset = ranges_[range].offset;
+		const uint64_t padding = ((offset + alignment - 1) & ~(alignment - 1)) - offset;
+		if (padding > 0)
+		{
+			const uint32_t front = createRange(offset, padding);
+			const uint32_t prev = ranges_[range].prevPhysical;
+			ranges_[front].prevPhysical = prev;
+			ranges_[front].nextPhysical = range;
+			if (prev != NO_RANGE)
+				ranges_[prev].nextPhysical = front;
+			ranges_[range].prevPhysical = front;
+			ranges_[range].offset += padding;
+			ranges_[range].size -= padding;
+			insertFree(front);
+		}
+
+		assert(ranges_[range].size >= size && "The size class of the free range is too small");
+		if (ranges_[range].size > size)
+			splitTail(range, ranges_[range].size - size);
+
+		ranges_[range].free = false;
+		usedBytes_ += size;
+		allocationCount_++;
+		return range;
+	}
+
+	void TLSF::free(uint32_t range)
+	{
+		assert(range < ranges_.size() && !ranges_[range].free && "The range is not allocated");
+
+		usedBytes_ -= ranges_[range].size;
+		allocationCount_--;
+		ranges_[range].free = true;
+
+		const uint32_t next = ranges_[range].nextPhysical;
+		if (next != NO_RANGE && ranges_[next].free)
+		{
+			removeFree(next);
+			range = mergePrev(next);
+		}
+
+		const uint32_t prev = ranges_[range].prevPhysical;
+		if (prev != NO_RANGE && ranges_[prev].free)
+		{
+			removeFree(prev);
+			range = mergePrev(range);
+		}
+
+		insertFree(range);
+	}
+
+	uint64_t TLSF::getLargestFreeRange() const
+	{
+		if (flBitmap_ == 0)
+			return 0;
+
+		const uint32_t fl = static_cast<uint32_t>(std::bit_width(flBitmap_) - 1);
+		const uint32_t sl = static_cast<uint32_t>(std::bit_width(slBitmaps_[fl]) - 1);
+
+		uint64_t largest = 0;
+		for (uint32_t range = freeLists_[fl][sl]; range != NO_RANGE; range = ranges_[range].nextFree)
+			largest = std::max(largest, ranges_[range].size);
+		return largest;
+	}
+
+	/// <summary>
+	/// The size class of a size: the first level is the power of two below it, the second level the linear step
+	/// within that power of two. Sizes below SL_COUNT all get a class of their own.
+	/// </summary>
+	void TLSF::mapping(uint64_t size, uint32_t& fl, uint32_t& sl)
+	{
+		if (size < SL_COUNT)
+		{
+			fl = 0;
+			sl = static_cast<uint32_t>(size);
+			return;
+		}
+
+		const uint32_t log2 = static_cast<uint32_t>(std::bit_width(size) - 1);
+		sl = static_cast<uint32_t>(size >> (log2 - SL_BITS)) ^ SL_COUNT;
+		fl = log2 - SL_BITS + 1;
+	}
+
+	uint32_t TLSF::createRange(uint64_t offset, uint64_t size)
+	{
+		uint32_t range;
+		if (!unusedRanges_.empty())
+		{
+			range = unusedRanges_.back();
+			unusedRanges_.pop_back();
+		}
+		else
+		{
+			range = static_cast<uint32_t>(ranges_.size());
+			ranges_.emplace_back();
+		}
+
+		ranges_[range] = Range{};
+		ranges_[range].offset = offset;
+		ranges_[range].size = size;
+		return range;
+	}
+
+	void TLSF::releaseRange(uint32_t range)
+	{
+		unusedRanges_.push_back(range);
+	}
+
+	void TLSF::insertFree(uint32_t range)
+	{
+		uint32_t fl, sl;
+		mapping(ranges_[range].size, fl, sl);
+
+		const uint32_t head = freeLists_[fl][sl];
+		ranges_[range].free = true;
+		ranges_[range].prevFree = NO_RANGE;
+		ranges_[range].nextFree = head;
+		if (head != NO_RANGE)
+			ranges_[head].prevFree = range;
+		freeLists_[fl][sl] = range;
+
+		flBitmap_ |= uint64_t{ 1 } << fl;
+		slBitmaps_[fl] |= 1u << sl;
+		freeRangeCount_++;
+	}
+
+	void TLSF::removeFree(uint32_t range)
+	{
+		uint32_t fl, sl;
+		mapping(ranges_[range].size, fl, sl);
+
+		const uint32_t prev = ranges_[range].prevFree;
+		const uint32_t next = ranges_[range].nextFree;
+		if (prev != NO_RANGE)
+			ranges_[prev].nextFree = next;
+		else
+			freeLists_[fl][sl] = next;
+		if (next != NO_RANGE)
+			ranges_[next].prevFree = prev;
+
+		if (freeLists_[fl][sl] == NO_RANGE)
+		{
+			slBitmaps_[fl] &= ~(1u << sl);
+			if (slBitmaps_[fl] == 0)
+				flBitmap_ &= ~(uint64_t{ 1 } << fl);
+		}
+
+		ranges_[range].prevFree = NO_RANGE;
+		ranges_[range].nextFree = NO_RANGE;
+		freeRangeCount_--;
+	}
+
+	void TLSF::splitTail(uint32_t range, uint64_t size)
+	{
+		const uint32_t tail = createRange(ranges_[range].offset + ranges_[range].size - size, size);
+		const uint32_t next = ranges_[range].nextPhysical;
+		ranges_[tail].prevPhysical = range;
+		ranges_[tail].nextPhysical = next;
+		if (next != NO_RANGE)
+			ranges_[next].prevPhysical = tail;
+		ranges_[range].nextPhysical = tail;
+		ranges_[range].size -= size;
+		insertFree(tail);
+	}
+
+	uint32_t TLSF::mergePrev(uint32_t range)
+	{
+		const uint32_t prev = ranges_[range].prevPhysical;
+		const uint32_t next = ranges_[range].nextPhysical;
+		ranges_[prev].size += ranges_[range].size;
+		ranges_[prev].nextPhysical = next;
+		if (next != NO_RANGE)
+			ranges_[next].prevPhysical = prev;
+		releaseRange(range);
+		return prev;
+	}
+}
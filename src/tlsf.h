@@ -0,0 +1,88 @@
+#ifndef AITO_TLSF_H
+#define AITO_TLSF_H
+
+#include <cstdint>
+#include <vector>
+
+
+namespace aito
+{
+	/// <summary>
+	/// Two level segregated fit allocator: hands out ranges of a block of memory it never touches, so it can manage GPU memory.
+	/// The free ranges are kept in lists by size class, a power of two split into SL_COUNT linear steps, and two levels of
+	/// bitmaps find a non-empty list that is large enough in constant time. Freed ranges are merged with their free neighbours.
+	/// </summary>
+	class TLSF
+	{
+	public:
+		static constexpr uint32_t SL_BITS = 4;
+		static constexpr uint32_t SL_COUNT = 1u << SL_BITS;
+		static constexpr uint32_t FL_COUNT = 64 - SL_BITS + 1;
+		static constexpr uint32_t NO_RANGE = 0xffffffffu;
+
+		explicit TLSF(uint64_t size);
+
+		/// <summary>
+		/// Finds a range of "size" bytes, starting at a multiple of "alignment" (a power of two).
+		/// </summary>
+		/// <returns>A handle to the range, or NO_RANGE if no free range is large enough. </returns>
+		uint32_t allocate(uint64_t size, uint64_t alignment);
+		void free(uint32_t range);
+
+		inline uint64_t getOffset(uint32_t range) const { return ranges_[range].offset; }
+
+		inline uint64_t getSize() const { return size_; }
+		inline uint64_t getUsedBytes() const { return usedBytes_; }
+		inline uint32_t getAllocationCount() const { return allocationCount_; }
+		inline uint32_t getFreeRangeCount() const { return freeRangeCount_; }
+		inline bool isEmpty() const { return allocationCount_ == 0; }
+		/// <summary>
+		/// The largest allocation (without alignment) that is certain to succeed. Walks the free lists of the largest size class.
+		/// </summary>
+		uint64_t getLargestFreeRange() const;
+
+	private:
+		struct Range
+		{
+			uint64_t offset = 0;
+			uint64_t size = 0;
+			// Neighbours in memory, to merge free ranges
+			uint32_t prevPhysical = NO_RANGE;
+			uint32_t nextPhysical = NO_RANGE;
+			// Neighbours in the free list of the size class, while the range is free
+			uint32_t prevFree = NO_RANGE;
+			uint32_t nextFree = NO_RANGE;
+			bool free = false;
+		};
+
+		uint64_t size_;
+		uint64_t usedBytes_ = 0;
+		uint32_t allocationCount_ = 0;
+		uint32_t freeRangeCount_ = 0;
+
+		std::vector<Range> ranges_;
+		// Slots of ranges_ that were merged away, for reuse
+		std::vector<uint32_t> unusedRanges_;
+
+		uint64_t flBitmap_ = 0;
+		uint32_t slBitmaps_[FL_COUNT] = {};
+		uint32_t freeLists_[FL_COUNT][SL_COUNT];
+
+		static void mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+
+		uint32_t createRange(uint64_t offset, uint64_t size);
+		void releaseRange(uint32_t range);
+		void insertFree(uint32_t range);
+		void removeFree(uint32_t range);
+		/// <summary>
+		/// Splits "size" bytes off the end of the range into a new free range.
+		/// </summary>
+		void splitTail(uint32_t range, uint64_t size);
+		/// <summary>
+		/// Merges the range into the range before it in memory, which is released.
+		/// </summary>
+		uint32_t mergePrev(uint32_t range);
+	};
+}
+
+#endif /* AITO_TLSF_H */
@@ -0,0 +1,195 @@
+#include "pch.h"
+
+#include "triangle.h"
+
+#include <algorithm>
+
+
+namespace aito
+{
+
+TriangleMesh::TriangleMesh(
+	const Mat4f& objectToWorld,
+	const std::vector<Point3f>& positions,
+	const std::vector<uint32_t>& vertexIndices,
+	const std::vector<Normal3f>& normals,
+	const std::vector<Point2f>& uvs,
+	const std::vector<Vec3f>& colors)
+	: uv(uvs), color(colors), indices(vertexIndices)
+{
+	assert(indices.size() % 3 == 0 && "Triangle mesh index count must be a multiple of 3");
+	assert((normals.empty() || normals.size() == positions.size()) && "Normal count must match the position count");
+	assert((uvs.empty() || uvs.size() == positions.size()) && "Uv count must match the position count");
+	assert((colors.empty() || colors.size() == positions.size()) && "Color count must match the position count");
+
+	// Transform the vertices to world space
+	p.reserve(positions.size());
+	for (const auto& position : positions)
+		p.push_back(Point3f(Vec3f(objectToWorld * Vec4f(position, 1.0f))));
+
+	// Normals are transformed by the inverse transpose
+	const Mat3f normalMatrix = glm::transpose(glm::inverse(Mat3f(objectToWorld)));
+	n.reserve(normals.size());
+	for (const auto& normal : normals)
+		n.push_back(Normal3f(glm::normalize(normalMatrix * normal)));
+}
+
+Triangle::Triangle(const TriangleMesh* mesh, uint32_t triangleIndex)
+	: mesh_(mesh), triangleIndex_(triangleIndex)
+{}
+
+Bounds3f Triangle::world_bound() const
+{
+	const uint32_t* v = &mesh_->indices[3 * triangleIndex_];
+	return bounds_union(Bounds3f(mesh_->p[v[0]], mesh_->p[v[1]]), mesh_->p[v[2]]);
+}
+
+Float Triangle::area() const
+{
+	const uint32_t* v = &mesh_->indices[3 * triangleIndex_];
+	const Point3f& p0 = mesh_->p[v[0]];
+	const Point3f& p1 = mesh_->p[v[1]];
+	const Point3f& p2 = mesh_->p[v[2]];
+	return 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
+}
+
+WatertightRay::WatertightRay(const Ray& ray)
+	: o(ray.o)
+{
+	// Permute the largest dimension of the direction to z, keeping the winding of the triangles
+	const Vec3f absD(std::abs(ray.d.x), std::abs(ray.d.y), std::abs(ray.d.z));
+	kz = absD.x > absD.y ? (absD.x > absD.z ? 0 : 2) : (absD.y > absD.z ? 1 : 2);
+	kx = kz + 1 == 3 ? 0 : kz + 1;
+	ky = kx + 1 == 3 ? 0 : kx + 1;
+
+	sx = -ray.d[kx] / ray.d[kz];
+	sy = -ray.d[ky] / ray.d[kz];
+	sz = 1 / ray.d[kz];
+}
+
+bool Triangle::intersect_barycentric(const Ray& ray, Float* tHit, Float* b0Out, Float* b1Out, Float* b2Out) const
+{
+	const uint32_t* v = &mesh_->indices[3 * triangleIndex_];
+	const WatertightRay wRay(ray);
+
+	// Transform the vertices to the ray coordinate space: translate, permute and shear
+	const auto transform = [&](const Point3f& p)
+	{
+		const Vec3f pt = p - wRay.o;
+		return Vec3f(pt[wRay.kx] + wRay.sx * pt[wRay.kz], pt[wRay.ky] + wRay.sy * pt[wRay.kz], pt[wRay.kz]);
+	};
+	Vec3f p0t = transform(mesh_->p[v[0]]);
+	Vec3f p1t = transform(mesh_->p[v[1]]);
+	Vec3f p2t = transform(mesh_->p[v[2]]);
+
+	// Edge functions
+	Float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
+	Float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
+	Float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+
+	// Recompute the edge functions in double precision when the ray goes exactly through an edge
+	if constexpr (sizeof(Float) == sizeof(float))
+	{
+		if (e0 == 0 || e1 == 0 || e2 == 0)
+		{
+			e0 = static_cast<Float>(static_cast<double>(p1t.x) * p2t.y - static_cast<double>(p1t.y) * p2t.x);
+			e1 = static_cast<Float>(static_cast<double>(p2t.x) * p0t.y - static_cast<double>(p2t.y) * p0t.x);
+			e2 = static_cast<Float>(static_cast<double>(p0t.x) * p1t.y - static_cast<double>(p0t.y) * p1t.x);
+		}
+	}
+
+	// The ray misses if the edge functions have different signs
+	if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+		return false;
+	const Float det = e0 + e1 + e2;
+	if (det == 0)
+		return false;
+
+	// Compute the scaled distance, and test it against the ray range before dividing
+	p0t.z *= wRay.sz;
+	p1t.z *= wRay.sz;
+	p2t.z *= wRay.sz;
+	const Float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
+	if (det < 0 && (tScaled >= 0 || tScaled < ray.t_max * det))
+		return false;
+	if (det > 0 && (tScaled <= 0 || tScaled > ray.t_max * det))
+		return false;
+
+	const Float invDet = 1 / det;
+	const Float t = tScaled * invDet;
+
+	// Make sure the distance is conservatively greater than zero, so surfaces do not intersect themselves
+	const Float maxZt = std::max({ std::abs(p0t.z), std::abs(p1t.z), std::abs(p2t.z) });
+	const Float maxXt = std::max({ std::abs(p0t.x), std::abs(p1t.x), std::abs(p2t.x) });
+	const Float maxYt = std::max({ std::abs(p0t.y), std::abs(p1t.y), std::abs(p2t.y) });
+	const Float maxE = std::max({ std::abs(e0), std::abs(e1), std::abs(e2) });
+	const Float deltaZ = gamma(3) * maxZt;
+	const Float deltaX = gamma(5) * (maxXt + maxZt);
+	const Float deltaY = gamma(5) * (maxYt + maxZt);
+	const Float deltaE = 2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+	const Float deltaT = 3 * (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) * std::abs(invDet);
+	if (t <= deltaT)
+		return false;
+
+	*tHit = t;
+	*b0Out = e0 * invDet;
+	*b1Out = e1 * invDet;
+	*b2Out = e2 * invDet;
+	return true;
+}
+
+bool Triangle::intersect(const Ray& ray, Float* tHit, SurfaceInteraction* isect) const
+{
+	Float b0, b1, b2;
+	if (!intersect_barycentric(ray, tHit, &b0, &b1, &b2))
+		return false;
+
+	compute_interaction(ray, b0, b1, b2, isect);
+	return true;
+}
+
+void Triangle::compute_interaction(const Ray& ray, Float b0, Float b1, Float b2, SurfaceInteraction* isect) const
+{
+	const uint32_t* v = &mesh_->indices[3 * triangleIndex_];
+	const Point3f& p0 = mesh_->p[v[0]];
+	const Point3f& p1 = mesh_->p[v[1]];
+	const Point3f& p2 = mesh_->p[v[2]];
+
+	isect->p = b0 * p0 + b1 * p1 + b2 * p2;
+	isect->n = Normal3f(glm::normalize(glm::cross(p1 - p0, p2 - p0)));
+	isect->wo = -ray.d;
+	isect->b0 = b0;
+	isect->b1 = b1;
+	isect->b2 = b2;
+	isect->mesh = mesh_;
+	isect->triangle_index = triangleIndex_;
+
+	// Models without normals have all vertex normals set to zero
+	const Vec3f shadingN = mesh_->n.empty() ? Vec3f(0) : b0 * mesh_->n[v[0]] + b1 * mesh_->n[v[1]] + b2 * mesh_->n[v[2]];
+	if (glm::dot(shadingN, shadingN) > 0)
+	{
+		isect->shading_n = Normal3f(glm::normalize(shadingN));
+		// Make the geometric normal lie in the same hemisphere as the shading normal.
+		isect->n = face_forward(isect->n, isect->shading_n);
+	}
+	else
+	{
+		isect->shading_n = isect->n;
+	}
+
+	if (!mesh_->uv.empty())
+	{
+		const glm::vec<2, Float, glm::packed_highp> uv = b0 * mesh_->uv[v[0]] + b1 * mesh_->uv[v[1]] + b2 * mesh_->uv[v[2]];
+		isect->uv = Point2f(uv.x, uv.y);
+	}
+	else
+		isect->uv = Point2f(b1, b2);
+}
+
+bool Triangle::intersect_p(const Ray& ray) const
+{
+	Float tHit, b0, b1, b2;
+	return intersect_barycentric(ray, &tHit, &b0, &b1, &b2);
+}
+
+}  // namespace aito
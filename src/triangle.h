@@ -0,0 +1,101 @@
+#ifndef AITO_TRIANGLE_H
+#define AITO_TRIANGLE_H
+
+#include "aito.h"
+
+#include "vecmath.h"
+#include "bounds.h"
+#include "interaction.h"
+
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// CPU side triangle mesh used by the offline renderer. The vertex data is stored in world space.
+/// </summary>
+class TriangleMesh
+{
+public:
+	std::vector<Point3f> p;
+	std::vector<Normal3f> n;
+	std::vector<Point2f> uv;
+	std::vector<Vec3f> color;
+	std::vector<uint32_t> indices;
+
+public:
+	/// <summary>
+	/// Creates a mesh from indexed vertex data, transforming it from object space into world space.
+	/// "normals", "uvs" and "colors" may be empty, otherwise they must have one entry per position.
+	/// </summary>
+	TriangleMesh(
+		const Mat4f& objectToWorld,
+		const std::vector<Point3f>& positions,
+		const std::vector<uint32_t>& vertexIndices,
+		const std::vector<Normal3f>& normals = {},
+		const std::vector<Point2f>& uvs = {},
+		const std::vector<Vec3f>& colors = {});
+
+	[[nodiscard]] inline uint32_t triangle_count() const { return static_cast<uint32_t>(indices.size() / 3); }
+};
+
+/// <summary>
+/// Per ray setup of the watertight ray-triangle test (Woop, Benthin and Wald). The axes are permuted so the largest
+/// component of the direction is z, and the shear (sx, sy, sz) maps the ray direction to +z.
+/// </summary>
+struct WatertightRay
+{
+	Point3f o{};
+	int kx = 0, ky = 1, kz = 2;
+	Float sx = 0, sy = 0, sz = 1;
+
+	WatertightRay() = default;
+	explicit WatertightRay(const Ray& ray);
+};
+
+/// <summary>
+/// A single triangle of a TriangleMesh. Only holds a pointer to the mesh and its vertex indices, so it is cheap to copy around.
+/// </summary>
+class Triangle
+{
+public:
+	Triangle(const TriangleMesh* mesh, uint32_t triangleIndex);
+
+	[[nodiscard]] Bounds3f world_bound() const;
+	[[nodiscard]] Float area() const;
+
+	/// <summary>
+	/// Finds the intersection of the ray with the triangle.
+	/// If there is a hit closer than "ray.t_max", "tHit" and "isect" are written and true is returned.
+	/// </summary>
+	bool intersect(const Ray& ray, Float* tHit, SurfaceInteraction* isect) const;
+	/// <summary>
+	/// Checks if the ray hits the triangle, without computing any information about the hit.
+	/// </summary>
+	[[nodiscard]] bool intersect_p(const Ray& ray) const;
+	/// <summary>
+	/// Fills in the surface interaction for a hit at the given barycentric coordinates.
+	/// Used by the batched intersection kernels, which only find the barycentric coordinates themselves.
+	/// </summary>
+	void compute_interaction(const Ray& ray, Float b0, Float b1, Float b2, SurfaceInteraction* isect) const;
+
+	[[nodiscard]] inline uint32_t triangle_index() const { return triangleIndex_; }
+	[[nodiscard]] inline const TriangleMesh* mesh() const { return mesh_; }
+
+private:
+	const TriangleMesh* mesh_;
+	uint32_t triangleIndex_;
+
+	/// <summary>
+	/// Watertight ray-triangle test: rays through shared edges and vertices always hit at least one of the triangles.
+	/// Writes the distance and the barycentric coordinates of the hit on success.
+	/// </summary>
+	bool intersect_barycentric(const Ray& ray, Float* tHit, Float* b0Out, Float* b1Out, Float* b2Out) const;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_TRIANGLE_H
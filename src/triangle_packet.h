@@ -0,0 +1,203 @@
+#ifndef AITO_TRIANGLE_PACKET_H
+#define AITO_TRIANGLE_PACKET_H
+
+#include "aito.h"
+
+#include "simd.h"
+#include "triangle.h"
+
+#include <bit>
+#include <limits>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Up to N triangles with their vertex positions stored as structure of arrays, so one ray can be intersected
+/// with all of them at once. Unused lanes hold NaN vertices, which never pass any of the tests.
+/// </summary>
+template<int N>
+struct alignas(N * sizeof(float)) TrianglePacket
+{
+	static constexpr uint32_t INVALID_PRIMITIVE = 0xffffffffu;
+
+	// Vertex positions, p[vertex][axis][lane]
+	float p[3][3][N];
+	// Index of the triangle in each lane into the primitive array, or INVALID_PRIMITIVE for unused lanes
+	uint32_t primitive[N];
+
+	/// <summary>
+	/// Fills the packet with "count" (at most N) triangles, starting at primitives[offset].
+	/// </summary>
+	void set(const std::vector<Triangle>& primitives, uint32_t offset, uint32_t count)
+	{
+		assert(count <= N && "Too many triangles for the packet");
+		for (int lane = 0; lane < N; lane++)
+		{
+			if (static_cast<uint32_t>(lane) < count)
+			{
+				const Triangle& triangle = primitives[offset + lane];
+				const uint32_t* v = &triangle.mesh()->indices[3 * triangle.triangle_index()];
+				for (int vertex = 0; vertex < 3; vertex++)
+				{
+					for (int a = 0; a < 3; a++)
+						p[vertex][a][lane] = static_cast<float>(triangle.mesh()->p[v[vertex]][a]);
+				}
+				primitive[lane] = offset + lane;
+			}
+			else
+			{
+				for (int vertex = 0; vertex < 3; vertex++)
+				{
+					for (int a = 0; a < 3; a++)
+						p[vertex][a][lane] = std::numeric_limits<float>::quiet_NaN();
+				}
+				primitive[lane] = INVALID_PRIMITIVE;
+			}
+		}
+	}
+};
+
+using Triangle4 = TrianglePacket<4>;
+using Triangle8 = TrianglePacket<8>;
+
+/// <summary>
+/// The closest hit found in a triangle packet.
+/// </summary>
+struct PacketHit
+{
+	Float t;
+	Float b0, b1, b2;
+	uint32_t primitive;
+};
+
+/// <summary>
+/// Intersects the ray with all triangles of the packet at once, using the same watertight test as Triangle::intersect.
+/// Only hits closer than "tMax" count. For closest hit queries the nearest hit is written to "hit",
+/// any hit queries (AnyHit = true) only return whether there was a hit and leave "hit" untouched.
+/// </summary>
+template<int N, bool AnyHit = false>
+inline bool intersect_packet(const TrianglePacket<N>& packet, const WatertightRay& ray, Float tMax, PacketHit* hit)
+{
+	using SimdF = SimdFloat<N>;
+	const SimdF zero = SimdF::broadcast(0);
+
+	// Transform the vertices to the ray coordinate space: translate, permute and shear
+	const SimdF ox = SimdF::broadcast(static_cast<float>(ray.o[ray.kx]));
+	const SimdF oy = SimdF::broadcast(static_cast<float>(ray.o[ray.ky]));
+	const SimdF oz = SimdF::broadcast(static_cast<float>(ray.o[ray.kz]));
+	const SimdF sx = SimdF::broadcast(static_cast<float>(ray.sx));
+	const SimdF sy = SimdF::broadcast(static_cast<float>(ray.sy));
+	const SimdF sz = SimdF::broadcast(static_cast<float>(ray.sz));
+
+	SimdF x[3], y[3], z[3];
+	for (int v = 0; v < 3; v++)
+	{
+		z[v] = SimdF::load(packet.p[v][ray.kz]) - oz;
+		x[v] = SimdF::load(packet.p[v][ray.kx]) - ox + sx * z[v];
+		y[v] = SimdF::load(packet.p[v][ray.ky]) - oy + sy * z[v];
+	}
+
+	// Edge functions
+	SimdF e0 = x[1] * y[2] - y[1] * x[2];
+	SimdF e1 = x[2] * y[0] - y[2] * x[0];
+	SimdF e2 = x[0] * y[1] - y[0] * x[1];
+
+	// Recompute the edge functions in double precision in the lanes where the ray goes exactly through an edge
+	if (uint32_t edgeMask = movemask((e0 == zero) | (e1 == zero) | (e2 == zero)); edgeMask != 0)
+	{
+		float xs[3][N], ys[3][N];
+		alignas(N * sizeof(float)) float es[3][N];
+		for (int v = 0; v < 3; v++)
+		{
+			x[v].store(xs[v]);
+			y[v].store(ys[v]);
+		}
+		e0.store(es[0]);
+		e1.store(es[1]);
+		e2.store(es[2]);
+
+		while (edgeMask != 0)
+		{
+			const int lane = std::countr_zero(edgeMask);
+			edgeMask &= edgeMask - 1;
+			for (int e = 0; e < 3; e++)
+			{
+				const int v1 = e == 2 ? 0 : e + 1;
+				const int v2 = v1 == 2 ? 0 : v1 + 1;
+				es[e][lane] = static_cast<float>(static_cast<double>(xs[v1][lane]) * ys[v2][lane] - static_cast<double>(ys[v1][lane]) * xs[v2][lane]);
+			}
+		}
+
+		e0 = SimdF::load(es[0]);
+		e1 = SimdF::load(es[1]);
+		e2 = SimdF::load(es[2]);
+	}
+
+	// The ray misses where the edge functions have different signs
+	SimdF valid = ((e0 >= zero) & (e1 >= zero) & (e2 >= zero)) | ((e0 <= zero) & (e1 <= zero) & (e2 <= zero));
+	const SimdF det = e0 + e1 + e2;
+	valid = valid & (det != zero);
+
+	// Compute the scaled distance, and test it against the ray range before dividing.
+	// Flipping the signs by the sign of the determinant handles both triangle orientations at once.
+	const SimdF tScaled = e0 * (z[0] * sz) + e1 * (z[1] * sz) + e2 * (z[2] * sz);
+	const SimdF detSign = det & SimdF::broadcast(-0.0f);
+	const SimdF tScaledSigned = tScaled ^ detSign;
+	valid = valid & (tScaledSigned > zero) & (tScaledSigned <= SimdF::broadcast(static_cast<float>(tMax)) * abs(det));
+	if (movemask(valid) == 0)
+		return false;
+
+	const SimdF invDet = SimdF::broadcast(1) / det;
+	const SimdF t = tScaled * invDet;
+
+	// Make sure the distance is conservatively greater than zero, so surfaces do not intersect themselves
+	const SimdF maxZt = max(max(abs(z[0]), abs(z[1])), abs(z[2])) * abs(sz);
+	const SimdF maxXt = max(max(abs(x[0]), abs(x[1])), abs(x[2]));
+	const SimdF maxYt = max(max(abs(y[0]), abs(y[1])), abs(y[2]));
+	const SimdF maxE = max(max(abs(e0), abs(e1)), abs(e2));
+	const SimdF deltaZ = SimdF::broadcast(gamma(3)) * maxZt;
+	const SimdF deltaX = SimdF::broadcast(gamma(5)) * (maxXt + maxZt);
+	const SimdF deltaY = SimdF::broadcast(gamma(5)) * (maxYt + maxZt);
+	const SimdF deltaE = SimdF::broadcast(2) * (SimdF::broadcast(gamma(2)) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+	const SimdF deltaT = SimdF::broadcast(3) * (SimdF::broadcast(gamma(3)) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) * abs(invDet);
+	valid = valid & (t > deltaT);
+
+	uint32_t hitMask = movemask(valid);
+	if (hitMask == 0)
+		return false;
+	if constexpr (AnyHit)
+		return true;
+
+	// Find the closest of the hits
+	float ts[N];
+	t.store(ts);
+	int closest = std::countr_zero(hitMask);
+	hitMask &= hitMask - 1;
+	while (hitMask != 0)
+	{
+		const int lane = std::countr_zero(hitMask);
+		hitMask &= hitMask - 1;
+		if (ts[lane] < ts[closest])
+			closest = lane;
+	}
+
+	float b0[N], b1[N], b2[N];
+	(e0 * invDet).store(b0);
+	(e1 * invDet).store(b1);
+	(e2 * invDet).store(b2);
+
+	hit->t = ts[closest];
+	hit->b0 = b0[closest];
+	hit->b1 = b1[closest];
+	hit->b2 = b2[closest];
+	hit->primitive = packet.primitive[closest];
+	return true;
+}
+
+}  // namespace aito
+
+
+#endif // AITO_TRIANGLE_PACKET_H
@@ -0,0 +1,528 @@
+#include "pch.h"
+
+#include "two_level_bvh.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+
+
+namespace aito
+{
+
+namespace
+{
+
+// Leaves reference at most this many instances, and only when no split is cheaper
+constexpr uint32_t MAX_INSTANCES_IN_NODE = 4;
+// Instances per chunk when updating their bounds in parallel
+constexpr uint32_t MIN_REFIT_CHUNK_SIZE = 1024;
+// Trees with fewer instances are refit on the calling thread, since starting threads would take longer
+constexpr uint32_t MIN_PARALLEL_REFIT_INSTANCES = 4096;
+
+}
+
+BVHInstance::BVHInstance(const BVH8* blas, const Mat4f& objectToWorld)
+	: blas_(blas)
+{
+	set_transform(objectToWorld);
+}
+
+void BVHInstance::set_transform(const Mat4f& objectToWorld)
+{
+	objectToWorld_ = objectToWorld;
+	worldToObject_ = glm::inverse(objectToWorld);
+	normalToWorld_ = glm::transpose(glm::inverse(Mat3f(objectToWorld)));
+	identity_ = objectToWorld == Mat4f(1);
+	update_world_bound();
+}
+
+void BVHInstance::update_world_bound()
+{
+	// The world bounds of the object space bounds, through their corners
+	const Bounds3f objectBound = blas_->world_bound();
+	worldBound_ = Bounds3f{};
+	if (blas_->primitives().empty())
+		return;
+	for (size_t i = 0; i < 8; i++)
+		worldBound_ = bounds_union(worldBound_, Point3f(Vec3f(objectToWorld_ * Vec4f(Vec3f(objectBound.corner(i)), 1))));
+}
+
+void BVHInstance::to_world(const Ray& ray, SurfaceInteraction* isect) const
+{
+	isect->p = Point3f(Vec3f(objectToWorld_ * Vec4f(Vec3f(isect->p), 1)));
+	isect->n = Normal3f(glm::normalize(normalToWorld_ * Vec3f(isect->n)));
+	isect->shading_n = Normal3f(glm::normalize(normalToWorld_ * Vec3f(isect->shading_n)));
+	isect->wo = -ray.d;
+}
+
+TwoLevelBVH::TwoLevelBVH(std::vector<BVHInstance> instances)
+{
+	// Instances without geometry can never be hit
+	instances_.reserve(instances.size());
+	for (uint32_t i = 0; i < instances.size(); i++)
+	{
+		if (instances[i].blas().primitives().empty())
+			continue;
+		instances_.push_back(instances[i]);
+		instanceIds_.push_back(i);
+	}
+	instanceIndex_.assign(instances.size(), NO_INSTANCE);
+	build();
+}
+
+void TwoLevelBVH::build()
+{
+	nodes_.clear();
+	if (instances_.empty())
+		return;
+
+	std::vector<uint32_t> order(instances_.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	nodes_.reserve(2 * instances_.size());
+	recursive_build(order, 0, static_cast<uint32_t>(order.size()));
+
+	// The leaves reference ranges of the build order
+	std::vector<BVHInstance> ordered;
+	std::vector<uint32_t> orderedIds;
+	ordered.reserve(instances_.size());
+	orderedIds.reserve(instances_.size());
+	for (const uint32_t i : order)
+	{
+		ordered.push_back(instances_[i]);
+		orderedIds.push_back(instanceIds_[i]);
+	}
+	instances_ = std::move(ordered);
+	instanceIds_ = std::move(orderedIds);
+	for (uint32_t i = 0; i < instanceIds_.size(); i++)
+		instanceIndex_[instanceIds_[i]] = i;
+
+	builtCost_ = sah_cost();
+}
+
+void TwoLevelBVH::set_transform(uint32_t instance, const Mat4f& objectToWorld)
+{
+	assert(instance < instanceIndex_.size() && "Instance index out of range");
+	// Instances without geometry are not in the tree, wherever they are
+	if (instanceIndex_[instance] != NO_INSTANCE)
+		instances_[instanceIndex_[instance]].set_transform(objectToWorld);
+}
+
+bool TwoLevelBVH::update(int threadCount)
+{
+	if (nodes_.empty())
+		return false;
+
+	refit(threadCount);
+	const Float cost = sah_cost();
+	if (cost <= REBUILD_COST_RATIO * builtCost_)
+		return false;
+
+	const Float previousCost = builtCost_;
+	const auto startTime = std::chrono::steady_clock::now();
+	build();
+	const float buildTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+	AITO_INFO("Instance BVH rebuilt in {:.1f} ms: refitting raised its SAH cost from {:.2f} to {:.2f}, the new tree costs {:.2f}",
+			  buildTime, previousCost, cost, builtCost_);
+	return true;
+}
+
+void TwoLevelBVH::refit(int threadCount)
+{
+	if (nodes_.empty())
+		return;
+
+	const uint32_t instanceCount = static_cast<uint32_t>(instances_.size());
+	if (instanceCount < MIN_PARALLEL_REFIT_INSTANCES)
+	{
+		for (BVHInstance& instance : instances_)
+			instance.update_world_bound();
+		refit_node(0);
+		return;
+	}
+
+	const int threads = threadCount > 0 ? threadCount : available_cores();
+	parallel_for_chunks(0, instanceCount, MIN_REFIT_CHUNK_SIZE, threads, [&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t i = begin; i < end; i++)
+				instances_[i].update_world_bound();
+		});
+
+	// A few subtrees per thread, so uneven subtrees still keep all threads busy
+	const int depth = std::bit_width(static_cast<uint32_t>(threads)) + 2;
+	std::vector<uint32_t> subtrees;
+	collect_subtrees(0, depth, subtrees);
+	parallel_for_chunks(0, static_cast<uint32_t>(subtrees.size()), 1, threads, [&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t i = begin; i < end; i++)
+				refit_node(subtrees[i]);
+		});
+	refit_top(0, depth);
+}
+
+Bounds3f TwoLevelBVH::refit_node(uint32_t nodeIndex)
+{
+	LinearBVHNode& node = nodes_[nodeIndex];
+	if (node.n_primitives > 0)
+	{
+		Bounds3f bounds{};
+		for (uint32_t i = 0; i < node.n_primitives; i++)
+			bounds = bounds_union(bounds, instances_[node.primitives_offset + i].world_bound());
+		node.bounds = bounds;
+	}
+	else
+	{
+		const Bounds3f first = refit_node(nodeIndex + 1);
+		node.bounds = bounds_union(first, refit_node(node.second_child_offset));
+	}
+	return node.bounds;
+}
+
+void TwoLevelBVH::collect_subtrees(uint32_t nodeIndex, int depth, std::vector<uint32_t>& subtrees) const
+{
+	const LinearBVHNode& node = nodes_[nodeIndex];
+	if (depth == 0 || node.n_primitives > 0)
+	{
+		subtrees.push_back(nodeIndex);
+		return;
+	}
+	collect_subtrees(nodeIndex + 1, depth - 1, subtrees);
+	collect_subtrees(node.second_child_offset, depth - 1, subtrees);
+}
+
+Bounds3f TwoLevelBVH::refit_top(uint32_t nodeIndex, int depth)
+{
+	LinearBVHNode& node = nodes_[nodeIndex];
+	if (depth == 0 || node.n_primitives > 0)
+		return node.bounds;
+	const Bounds3f first = refit_top(nodeIndex + 1, depth - 1);
+	node.bounds = bounds_union(first, refit_top(node.second_child_offset, depth - 1));
+	return node.bounds;
+}
+
+Float TwoLevelBVH::sah_cost() const
+{
+	if (nodes_.empty() || nodes_[0].bounds.surface_area() <= 0)
+		return 0;
+
+	Float cost = 0;
+	for (const LinearBVHNode& node : nodes_)
+	{
+		const Float nodeCost = node.n_primitives > 0 ? SAH_INSTANCE_COST * node.n_primitives : BVHAccel::SAH_TRAVERSAL_COST;
+		cost += nodeCost * node.bounds.surface_area();
+	}
+	return cost / nodes_[0].bounds.surface_area();
+}
+
+uint32_t TwoLevelBVH::recursive_build(std::vector<uint32_t>& order, uint32_t start, uint32_t end)
+{
+	const auto centroid = [&](uint32_t i) { return instances_[i].world_bound().lerp(Point3f(0.5f, 0.5f, 0.5f)); };
+
+	Bounds3f bounds{};
+	Bounds3f centroidBounds{};
+	for (uint32_t i = start; i < end; i++)
+	{
+		bounds = bounds_union(bounds, instances_[order[i]].world_bound());
+		centroidBounds = bounds_union(centroidBounds, centroid(order[i]));
+	}
+
+	const uint32_t nodeIndex = static_cast<uint32_t>(nodes_.size());
+	nodes_.emplace_back();
+	nodes_[nodeIndex].bounds = bounds;
+
+	const auto makeLeaf = [&]()
+	{
+		nodes_[nodeIndex].primitives_offset = start;
+		nodes_[nodeIndex].n_primitives = static_cast<uint16_t>(end - start);
+		return nodeIndex;
+	};
+
+	const uint32_t count = end - start;
+	if (count == 1)
+		return makeLeaf();
+
+	const int dim = static_cast<int>(centroidBounds.maximum_extent());
+	uint32_t mid = start;
+	if (centroidBounds.p_max[dim] > centroidBounds.p_min[dim])
+	{
+		// Binned SAH split, like the bottom level build
+		struct Bucket
+		{
+			uint32_t count = 0;
+			Bounds3f bounds{};
+		};
+		Bucket buckets[SAH_BUCKET_COUNT];
+		const auto bucketIndex = [&](uint32_t i)
+		{
+			const int b = static_cast<int>(SAH_BUCKET_COUNT * centroidBounds.offset(centroid(i))[dim]);
+			return std::min(b, SAH_BUCKET_COUNT - 1);
+		};
+		for (uint32_t i = start; i < end; i++)
+		{
+			Bucket& bucket = buckets[bucketIndex(order[i])];
+			bucket.count++;
+			bucket.bounds = bounds_union(bucket.bounds, instances_[order[i]].world_bound());
+		}
+
+		Float minCost = std::numeric_limits<Float>::infinity();
+		int minCostSplit = 0;
+		for (int split = 0; split < SAH_BUCKET_COUNT - 1; split++)
+		{
+			Bucket below, above;
+			for (int b = 0; b <= split; b++)
+			{
+				below.count += buckets[b].count;
+				below.bounds = bounds_union(below.bounds, buckets[b].bounds);
+			}
+			for (int b = split + 1; b < SAH_BUCKET_COUNT; b++)
+			{
+				above.count += buckets[b].count;
+				above.bounds = bounds_union(above.bounds, buckets[b].bounds);
+			}
+			if (below.count == 0 || above.count == 0)
+				continue;
+
+			const Float cost = BVHAccel::SAH_TRAVERSAL_COST + SAH_INSTANCE_COST *
+				(below.count * below.bounds.surface_area() + above.count * above.bounds.surface_area()) / bounds.surface_area();
+			if (cost < minCost)
+			{
+				minCost = cost;
+				minCostSplit = split;
+			}
+		}
+
+		if (count <= MAX_INSTANCES_IN_NODE && count * SAH_INSTANCE_COST <= minCost)
+			return makeLeaf();
+
+		mid = static_cast<uint32_t>(std::partition(order.begin() + start, order.begin() + end,
+			[&](uint32_t i) { return bucketIndex(i) <= minCostSplit; }) - order.begin());
+	}
+	else if (count <= MAX_INSTANCES_IN_NODE)
+	{
+		return makeLeaf();
+	}
+
+	// Instances on top of each other (or a split that left one side empty) are split into halves
+	if (mid == start || mid == end)
+	{
+		mid = start + count / 2;
+		std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+			[&](uint32_t a, uint32_t b) { return centroid(a)[dim] < centroid(b)[dim]; });
+	}
+
+	recursive_build(order, start, mid);
+	const uint32_t secondChild = recursive_build(order, mid, end);
+	nodes_[nodeIndex].second_child_offset = secondChild;
+	nodes_[nodeIndex].n_primitives = 0;
+	nodes_[nodeIndex].axis = static_cast<uint8_t>(dim);
+	return nodeIndex;
+}
+
+bool TwoLevelBVH::intersect(const Ray& ray, SurfaceInteraction* isect) const
+{
+	return traverse<false>(ray, isect);
+}
+
+bool TwoLevelBVH::intersect_p(const Ray& ray) const
+{
+	return traverse<true>(ray, nullptr);
+}
+
+template<int K>
+uint32_t TwoLevelBVH::intersect(const RayPacket<K>& packet, SurfaceInteraction* isects) const
+{
+	return traverse_packet<false, K>(packet, isects);
+}
+
+template<int K>
+uint32_t TwoLevelBVH::intersect_p(const RayPacket<K>& packet) const
+{
+	return traverse_packet<true, K>(packet, nullptr);
+}
+
+template<bool AnyHit>
+bool TwoLevelBVH::traverse(const Ray& ray, SurfaceInteraction* isect) const
+{
+	if (nodes_.empty())
+		return false;
+
+	const Vec3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+	const int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	// The closest hit is kept in the space of its instance until the traversal is done
+	const BVHInstance* hitInstance = nullptr;
+
+	uint32_t toVisitOffset = 0, currentNodeIndex = 0;
+	uint32_t nodesToVisit[64];
+	while (true)
+	{
+		const LinearBVHNode* node = &nodes_[currentNodeIndex];
+		if (node->bounds.intersect_p(ray, invDir, dirIsNeg))
+		{
+			if (node->n_primitives > 0)
+			{
+				for (uint32_t i = 0; i < node->n_primitives; i++)
+				{
+					const BVHInstance& instance = instances_[node->primitives_offset + i];
+					const Ray objectRay = instance.identity() ? ray : instance.to_object(ray);
+					if constexpr (AnyHit)
+					{
+						if (instance.blas().intersect_p(objectRay))
+							return true;
+					}
+					else if (instance.blas().intersect(objectRay, isect))
+					{
+						ray.t_max = objectRay.t_max;
+						hitInstance = &instance;
+					}
+				}
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+			else
+			{
+				// Visit the near child first, so the far child is more likely to be culled by the shortened ray
+				if (dirIsNeg[node->axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node->second_child_offset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node->second_child_offset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+		}
+		else
+		{
+			if (toVisitOffset == 0) break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+	}
+
+	if (hitInstance != nullptr && !hitInstance->identity())
+		hitInstance->to_world(ray, isect);
+	return hitInstance != nullptr;
+}
+
+template<bool AnyHit, int K>
+uint32_t TwoLevelBVH::traverse_packet(const RayPacket<K>& packet, SurfaceInteraction* isects) const
+{
+	if (nodes_.empty() || packet.active == 0)
+		return 0;
+
+	Vec3f invDirs[K];
+	int dirIsNeg[K][3];
+	for (uint32_t rays = packet.active; rays != 0; rays &= rays - 1)
+	{
+		const int r = std::countr_zero(rays);
+		const Vec3f& d = packet.rays[r].d;
+		invDirs[r] = Vec3f(1 / d.x, 1 / d.y, 1 / d.z);
+		for (int axis = 0; axis < 3; axis++)
+			dirIsNeg[r][axis] = invDirs[r][axis] < 0;
+	}
+	// The children are visited in the order of the first ray, for coherent packets it is the order of all of them
+	const int* orderDirIsNeg = dirIsNeg[std::countr_zero(packet.active)];
+
+	const BVHInstance* hitInstances[K] = {};
+	uint32_t hitRays = 0;
+
+	struct StackEntry
+	{
+		uint32_t node;
+		// The rays that reached the parent of the node
+		uint32_t rays;
+	};
+	StackEntry stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, packet.active };
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		const LinearBVHNode& node = nodes_[entry.node];
+
+		uint32_t rays = 0;
+		uint32_t candidates = entry.rays;
+		if constexpr (AnyHit)
+			candidates &= ~hitRays;
+		for (; candidates != 0; candidates &= candidates - 1)
+		{
+			const int r = std::countr_zero(candidates);
+			if (node.bounds.intersect_p(packet.rays[r], invDirs[r], dirIsNeg[r]))
+				rays |= 1u << r;
+		}
+		if (rays == 0)
+			continue;
+
+		if (node.n_primitives > 0)
+		{
+			for (uint32_t i = 0; i < node.n_primitives && rays != 0; i++)
+			{
+				const BVHInstance& instance = instances_[node.primitives_offset + i];
+				RayPacket<K> objectPacket;
+				objectPacket.active = rays;
+				for (uint32_t remaining = rays; remaining != 0; remaining &= remaining - 1)
+				{
+					const int r = std::countr_zero(remaining);
+					objectPacket.rays[r] = instance.identity() ? packet.rays[r] : instance.to_object(packet.rays[r]);
+				}
+
+				if constexpr (AnyHit)
+				{
+					const uint32_t blocked = instance.blas().intersect_p(objectPacket);
+					hitRays |= blocked;
+					rays &= ~blocked;
+				}
+				else
+				{
+					// Only hits closer than the ones found so far are written, so isects always holds the closest hit
+					const uint32_t hits = instance.blas().intersect(objectPacket, isects);
+					for (uint32_t remaining = hits; remaining != 0; remaining &= remaining - 1)
+					{
+						const int r = std::countr_zero(remaining);
+						packet.rays[r].t_max = objectPacket.rays[r].t_max;
+						hitInstances[r] = &instance;
+					}
+					hitRays |= hits;
+				}
+			}
+			continue;
+		}
+
+		// Push the far child first, so the near one is visited next
+		if (orderDirIsNeg[node.axis])
+		{
+			stack[stackSize++] = { entry.node + 1, rays };
+			stack[stackSize++] = { node.second_child_offset, rays };
+		}
+		else
+		{
+			stack[stackSize++] = { node.second_child_offset, rays };
+			stack[stackSize++] = { entry.node + 1, rays };
+		}
+	}
+
+	if constexpr (!AnyHit)
+	{
+		for (uint32_t rays = hitRays; rays != 0; rays &= rays - 1)
+		{
+			const int r = std::countr_zero(rays);
+			if (!hitInstances[r]->identity())
+				hitInstances[r]->to_world(packet.rays[r], &isects[r]);
+		}
+	}
+	return hitRays;
+}
+
+template uint32_t TwoLevelBVH::intersect(const RayPacket8&, SurfaceInteraction*) const;
+template uint32_t TwoLevelBVH::intersect(const RayPacket16&, SurfaceInteraction*) const;
+template uint32_t TwoLevelBVH::intersect_p(const RayPacket8&) const;
+template uint32_t TwoLevelBVH::intersect_p(const RayPacket16&) const;
+
+}  // namespace aito
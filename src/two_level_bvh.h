@@ -0,0 +1,183 @@
+#ifndef AITO_TWO_LEVEL_BVH_H
+#define AITO_TWO_LEVEL_BVH_H
+
+#include "aito.h"
+
+#include "bvh.h"
+#include "ray_packet.h"
+#include "wide_bvh.h"
+
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// A placement of a bottom level BVH (the geometry of one mesh, in object space) in the world.
+/// </summary>
+class BVHInstance
+{
+public:
+	BVHInstance(const BVH8* blas, const Mat4f& objectToWorld);
+
+	/// <summary>
+	/// Moves the instance, and updates its world bounds.
+	/// </summary>
+	void set_transform(const Mat4f& objectToWorld);
+	/// <summary>
+	/// Recomputes the world bounds from the bounds of the bottom level BVH, after it was refit.
+	/// </summary>
+	void update_world_bound();
+
+	[[nodiscard]] inline const BVH8& blas() const { return *blas_; }
+	[[nodiscard]] inline const Mat4f& object_to_world() const { return objectToWorld_; }
+	[[nodiscard]] inline Bounds3f world_bound() const { return worldBound_; }
+	// Instances that are not moved skip transforming rays and hits
+	[[nodiscard]] inline bool identity() const { return identity_; }
+
+	/// <summary>
+	/// The ray in object space. The direction is not normalized, so distances along the ray ("t_max") stay the same in both spaces.
+	/// </summary>
+	[[nodiscard]] inline Ray to_object(const Ray& ray) const
+	{
+		return Ray(Point3f(Vec3f(worldToObject_ * Vec4f(Vec3f(ray.o), 1))), Mat3f(worldToObject_) * ray.d, ray.t_max);
+	}
+	/// <summary>
+	/// Moves a hit found in object space to world space. "ray" is the world space ray that found it.
+	/// </summary>
+	void to_world(const Ray& ray, SurfaceInteraction* isect) const;
+
+private:
+	const BVH8* blas_;
+	Mat4f objectToWorld_;
+	Mat4f worldToObject_;
+	// The inverse transpose of objectToWorld_, for normals
+	Mat3f normalToWorld_;
+	Bounds3f worldBound_;
+	bool identity_;
+};
+
+/// <summary>
+/// Two level acceleration structure for instanced geometry: a top level binary SAH BVH over instances, each of which
+/// places a bottom level BVH8 in the world with a transform. The rays are transformed into the space of an instance
+/// instead of the triangles into world space, so a mesh placed many times is only stored once.
+/// Moving instances does not need a new build: update() refits the bounds of the nodes bottom up, and only rebuilds
+/// once the refit tree has become too slow to traverse, as estimated by its SAH cost.
+/// </summary>
+class TwoLevelBVH
+{
+public:
+	static constexpr int SAH_BUCKET_COUNT = BVHAccel::SAH_BUCKET_COUNT;
+	// Entering an instance transforms the ray and starts a new traversal, so it costs about as much as a few node tests
+	static constexpr Float SAH_INSTANCE_COST = 2.0f;
+	// update() rebuilds the tree when refitting made its SAH cost this much higher than right after the last build
+	static constexpr Float REBUILD_COST_RATIO = 1.5f;
+	// The index of instances that are not in the tree, since they have no geometry
+	static constexpr uint32_t NO_INSTANCE = 0xffffffffu;
+
+	explicit TwoLevelBVH(std::vector<BVHInstance> instances);
+
+	TwoLevelBVH(const TwoLevelBVH&) = delete;
+	TwoLevelBVH& operator=(const TwoLevelBVH&) = delete;
+
+	[[nodiscard]] inline Bounds3f world_bound() const { return nodes_.empty() ? Bounds3f{} : nodes_[0].bounds; }
+
+	/// <summary>
+	/// Finds the closest intersection along the ray. On a hit "ray.t_max" is set to the distance of the hit and "isect" is filled in.
+	/// </summary>
+	bool intersect(const Ray& ray, SurfaceInteraction* isect) const;
+	/// <summary>
+	/// Checks if the ray hits anything before "ray.t_max". Terminates at the first hit found (any-hit query).
+	/// </summary>
+	[[nodiscard]] bool intersect_p(const Ray& ray) const;
+
+	/// <summary>
+	/// Finds the closest intersection of every active ray of the packet. The rays that reach an instance are traced
+	/// through its BVH8 as a packet, so coherent rays stay coherent in object space.
+	/// </summary>
+	/// <returns>A bit mask of the rays that hit something. </returns>
+	template<int K>
+	uint32_t intersect(const RayPacket<K>& packet, SurfaceInteraction* isects) const;
+	/// <summary>
+	/// Checks which of the active rays of the packet hit anything before their "t_max".
+	/// </summary>
+	/// <returns>A bit mask of the rays that are blocked. </returns>
+	template<int K>
+	[[nodiscard]] uint32_t intersect_p(const RayPacket<K>& packet) const;
+
+	/// <summary>
+	/// Moves instance "instance", counted in the order the instances were given to the constructor.
+	/// The tree is out of date until the next update().
+	/// </summary>
+	void set_transform(uint32_t instance, const Mat4f& objectToWorld);
+	/// <summary>
+	/// Brings the tree up to date after instances were moved or their bottom level BVHs refit: refits the bounds,
+	/// and rebuilds the tree if that made its SAH cost more than REBUILD_COST_RATIO times the cost after the last build.
+	/// </summary>
+	/// <returns>True if the tree was rebuilt. </returns>
+	bool update(int threadCount = 0);
+	/// <summary>
+	/// Recomputes the bounds of the instances and the nodes bottom up, keeping the structure of the tree.
+	/// Independent subtrees are refit in parallel.
+	/// </summary>
+	void refit(int threadCount = 0);
+	/// <summary>
+	/// The expected cost of tracing a ray through the tree: the cost of every node weighted by its surface area,
+	/// relative to the root. Grows as refitting makes the nodes overlap.
+	/// </summary>
+	[[nodiscard]] Float sah_cost() const;
+	[[nodiscard]] inline Float built_sah_cost() const { return builtCost_; }
+
+	// The instances in the order of the tree, which changes with every rebuild
+	[[nodiscard]] inline const std::vector<BVHInstance>& instances() const { return instances_; }
+	[[nodiscard]] inline const std::vector<LinearBVHNode>& nodes() const { return nodes_; }
+	/// <summary>
+	/// The memory of the top level only. The bottom level BVHs are shared between instances, and owned by whoever created them.
+	/// </summary>
+	[[nodiscard]] inline size_t memory_usage() const { return nodes_.size() * sizeof(LinearBVHNode) + instances_.size() * sizeof(BVHInstance); }
+
+private:
+	std::vector<BVHInstance> instances_;
+	std::vector<LinearBVHNode> nodes_;
+	// The position in instances_ of every instance given to the constructor, or NO_INSTANCE
+	std::vector<uint32_t> instanceIndex_;
+	// The constructor index of every instance in instances_
+	std::vector<uint32_t> instanceIds_;
+	Float builtCost_ = 0;
+
+	/// <summary>
+	/// Builds the tree over instances_ from scratch, and puts them in the order of the tree.
+	/// </summary>
+	void build();
+
+	/// <summary>
+	/// Builds the subtree over order[start, end), reordering that range so leaves reference consecutive instances.
+	/// </summary>
+	/// <returns>The index of the root node of the subtree. </returns>
+	uint32_t recursive_build(std::vector<uint32_t>& order, uint32_t start, uint32_t end);
+
+	/// <summary>
+	/// Refits the subtree below the node serially.
+	/// </summary>
+	/// <returns>The new bounds of the node. </returns>
+	Bounds3f refit_node(uint32_t nodeIndex);
+	/// <summary>
+	/// Splits the tree into the subtrees at "depth" (and the leaves above it), which can be refit independently.
+	/// </summary>
+	void collect_subtrees(uint32_t nodeIndex, int depth, std::vector<uint32_t>& subtrees) const;
+	/// <summary>
+	/// Refits the nodes above the subtrees from collect_subtrees, once the subtrees are done.
+	/// </summary>
+	Bounds3f refit_top(uint32_t nodeIndex, int depth);
+
+	template<bool AnyHit>
+	bool traverse(const Ray& ray, SurfaceInteraction* isect) const;
+	template<bool AnyHit, int K>
+	uint32_t traverse_packet(const RayPacket<K>& packet, SurfaceInteraction* isects) const;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_TWO_LEVEL_BVH_H
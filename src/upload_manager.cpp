@@ -0,0 +1,525 @@
+#include "pch.h"
+
+#include "upload_manager.h"
+
+#include "device.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace aito
+{
+	UploadManager::UploadManager(Device& device, VkDeviceSize stagingSize)
+		: device_(device),
+		dedicated_(device.hasDedicatedTransferQueue()),
+		stagingSize_((stagingSize + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1))
+	{
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = device_.transferQueueFamily();
+		// The command buffers of the batches are reset and recorded again once the GPU is done with them
+		poolInfo.flags =
+			VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+			VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+		if (vkCreateCommandPool(device_.device(), &poolInfo, nullptr, &transferPool_) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create upload command pool!");
+		}
+
+		// The acquiring half of the batches is recorded for the graphics queue
+		if (dedicated_)
+		{
+			poolInfo.queueFamilyIndex = device_.graphicsQueueFamily();
+			if (vkCreateCommandPool(device_.device(), &poolInfo, nullptr, &graphicsPool_) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create upload command pool!");
+			}
+		}
+
+		// The ring stays mapped for as long as it lives, through the persistently mapped block of the allocator
+		device_.createBuffer(
+			stagingSize_,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffer_,
+			stagingMemory_);
+		assert(stagingMemory_.mapped && "The staging memory must be host visible");
+	}
+
+	UploadManager::~UploadManager()
+	{
+		waitIdle();
+
+		for (auto& batch : freeBatches_)
+		{
+			vkDestroyFence(device_.device(), batch.fence, nullptr);
+			if (batch.copied != VK_NULL_HANDLE)
+				vkDestroySemaphore(device_.device(), batch.copied, nullptr);
+		}
+		// Destroying the pools frees the command buffers
+		vkDestroyCommandPool(device_.device(), transferPool_, nullptr);
+		if (graphicsPool_ != VK_NULL_HANDLE)
+			vkDestroyCommandPool(device_.device(), graphicsPool_, nullptr);
+
+		vkDestroyBuffer(device_.device(), stagingBuffer_, nullptr);
+		device_.allocator().free(stagingMemory_);
+	}
+
+	/// <summary>
+	/// Copies the data to the staging ring and records the copy to the destination buffer.
+	/// </summary>
+	/// <param name="dstBuffer">: The buffer to copy to, created with VK_BUFFER_USAGE_TRANSFER_DST_BIT. </param>
+	/// <param name="dstOffset">: Where the data goes in the destination buffer. </param>
+	/// <param name="data">: The data to copy. </param>
+	/// <param name="size">: The size of the data in bytes. </param>
+	void UploadManager::uploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+	{
+		uploadedBytes_ += size;
+
+		const char* source = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			// Uploads larger than the ring go in pieces, each waiting for the ring to empty enough
+			const VkDeviceSize chunk = std::min(size, stagingSize_);
+			const VkDeviceSize stagingOffset = reserveStaging(chunk);
+			std::memcpy(static_cast<char*>(stagingMemory_.mapped) + stagingOffset, source, chunk);
+
+			VkBufferCopy copyRegion{};
+			copyRegion.srcOffset = stagingOffset;
+			copyRegion.dstOffset = dstOffset;
+			copyRegion.size = chunk;
+			vkCmdCopyBuffer(getCommandBuffer(), stagingBuffer_, dstBuffer, 1, &copyRegion);
+
+			if (dedicated_)
+			{
+				// Consecutive uploads to a buffer, like the geometry of a model, share one ownership transfer
+				if (!bufferTransfers_.empty() && bufferTransfers_.back().buffer == dstBuffer &&
+					bufferTransfers_.back().offset + bufferTransfers_.back().size == dstOffset)
+				{
+					bufferTransfers_.back().size += chunk;
+				}
+				else
+				{
+					VkBufferMemoryBarrier transfer{};
+					transfer.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+					transfer.srcQueueFamilyIndex = device_.transferQueueFamily();
+					transfer.dstQueueFamilyIndex = device_.graphicsQueueFamily();
+					transfer.buffer = dstBuffer;
+					transfer.offset = dstOffset;
+					transfer.size = chunk;
+					bufferTransfers_.push_back(transfer);
+				}
+			}
+
+			source += chunk;
+			dstOffset += chunk;
+			size -= chunk;
+		}
+	}
+
+	/// <summary>
+	/// Copies the texels to the staging ring and records the copy to the image, with the layout transitions around it.
+	/// </summary>
+	/// <param name="image">: A color image created with VK_IMAGE_USAGE_TRANSFER_DST_BIT. </param>
+	/// <param name="width">: The width of the image. </param>
+	/// <param name="height">: The height of the image. </param>
+	/// <param name="layerCount">: The number of array layers to copy, one after the other in the data. </param>
+	/// <param name="data">: The texel data. </param>
+	/// <param name="size">: The size of the data in bytes. </param>
+	/// <param name="finalLayout">: The layout the graphics queue uses the image in. </param>
+	void UploadManager::uploadToImage(VkImage image, uint32_t width, uint32_t height, uint32_t layerCount, const void* data, VkDeviceSize size, VkImageLayout finalLayout)
+	{
+		if (size > stagingSize_)
+		{
+			throw std::runtime_error("image upload is larger than the staging ring!");
+		}
+		uploadedBytes_ += size;
+
+		const VkDeviceSize stagingOffset = reserveStaging(size);
+		std::memcpy(static_cast<char*>(stagingMemory_.mapped) + stagingOffset, data, size);
+
+		VkCommandBuffer commandBuffer = getCommandBuffer();
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = layerCount;
+
+		// The old contents are not needed, so the image needs no ownership transfer to the transfer queue family first
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = stagingOffset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = layerCount;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { width, height, 1 };
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer_, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = finalLayout;
+		if (dedicated_)
+		{
+			// The layout transition happens as part of the ownership transfer, recorded when the batch is submitted
+			barrier.srcQueueFamilyIndex = device_.transferQueueFamily();
+			barrier.dstQueueFamilyIndex = device_.graphicsQueueFamily();
+			imageTransfers_.push_back(barrier);
+		}
+		else
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(
+				commandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				0,
+				0, nullptr,
+				0, nullptr,
+				1, &barrier);
+		}
+	}
+
+	void UploadManager::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+	{
+		// Starts the batch, if this is its first copy
+		getCommandBuffer();
+
+		PendingCopy copy{};
+		copy.srcBuffer = srcBuffer;
+		copy.dstBuffer = dstBuffer;
+		copy.region.srcOffset = srcOffset;
+		copy.region.dstOffset = dstOffset;
+		copy.region.size = size;
+		pendingCopies_.push_back(copy);
+	}
+
+	uint64_t UploadManager::submit()
+	{
+		if (!recording_)
+		{
+			retire(false);
+			return nextTicket_ - 1;
+		}
+
+		submitBatch();
+
+		current_.stagingEnd = stagingHead_;
+		inFlight_.push_back(current_);
+		recording_ = false;
+		nextTicket_++;
+		submitCount_++;
+
+		retire(false);
+		return inFlight_.empty() ? completedTicket_ : inFlight_.back().ticket;
+	}
+
+	bool UploadManager::isComplete(uint64_t ticket)
+	{
+		retire(false);
+		return ticket <= completedTicket_;
+	}
+
+	void UploadManager::wait(uint64_t ticket)
+	{
+		if (recording_ && ticket >= current_.ticket)
+			submit();
+
+		while (completedTicket_ < ticket && !inFlight_.empty())
+			retire(true);
+	}
+
+	void UploadManager::waitIdle()
+	{
+		submit();
+		// The graphics half of a batch waits for its transfer half, so the graphics queue is the last to go idle
+		vkQueueWaitIdle(device_.graphicsQueue());
+		// Every fence is signaled now
+		retire(false);
+	}
+
+	VkCommandBuffer UploadManager::getCommandBuffer()
+	{
+		if (recording_)
+			return current_.transferCommands;
+
+		if (!freeBatches_.empty())
+		{
+			current_ = freeBatches_.back();
+			freeBatches_.pop_back();
+			vkResetFences(device_.device(), 1, &current_.fence);
+			vkResetCommandBuffer(current_.transferCommands, 0);
+			if (dedicated_)
+				vkResetCommandBuffer(current_.graphicsCommands, 0);
+		}
+		else
+		{
+			current_ = Batch{};
+			current_.transferCommands = allocateCommandBuffer(transferPool_);
+			current_.graphicsCommands = dedicated_ ? allocateCommandBuffer(graphicsPool_) : current_.transferCommands;
+
+			VkFenceCreateInfo fenceInfo{};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			if (vkCreateFence(device_.device(), &fenceInfo, nullptr, &current_.fence) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create upload fence!");
+			}
+
+			if (dedicated_)
+			{
+				VkSemaphoreCreateInfo semaphoreInfo{};
+				semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+				if (vkCreateSemaphore(device_.device(), &semaphoreInfo, nullptr, &current_.copied) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create upload semaphore!");
+				}
+			}
+		}
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(current_.transferCommands, &beginInfo);
+		if (dedicated_)
+			vkBeginCommandBuffer(current_.graphicsCommands, &beginInfo);
+
+		current_.ticket = nextTicket_;
+		recording_ = true;
+		return current_.transferCommands;
+	}
+
+	VkCommandBuffer UploadManager::allocateCommandBuffer(VkCommandPool pool)
+	{
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = pool;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(device_.device(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate upload command buffer!");
+		}
+		return commandBuffer;
+	}
+
+	void UploadManager::submitBatch()
+	{
+		const uint32_t bufferTransferCount = static_cast<uint32_t>(bufferTransfers_.size());
+		const uint32_t imageTransferCount = static_cast<uint32_t>(imageTransfers_.size());
+
+		if (dedicated_)
+		{
+			// Release the written resources from the transfer queue family. The destination stage is ignored for a release.
+			for (auto& barrier : bufferTransfers_)
+			{
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = 0;
+			}
+			for (auto& barrier : imageTransfers_)
+			{
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = 0;
+			}
+			if (bufferTransferCount + imageTransferCount > 0)
+			{
+				vkCmdPipelineBarrier(
+					current_.transferCommands,
+					VK_PIPELINE_STAGE_TRANSFER_BIT,
+					VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+					0,
+					0, nullptr,
+					bufferTransferCount, bufferTransfers_.data(),
+					imageTransferCount, imageTransfers_.data());
+			}
+
+			if (vkEndCommandBuffer(current_.transferCommands) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to record upload command buffer!");
+			}
+
+			// And acquire them for the graphics queue family, with the same ranges and layouts. The semaphore makes the copies available.
+			for (auto& barrier : bufferTransfers_)
+			{
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			}
+			for (auto& barrier : imageTransfers_)
+			{
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			}
+			if (bufferTransferCount + imageTransferCount > 0)
+			{
+				vkCmdPipelineBarrier(
+					current_.graphicsCommands,
+					VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+					VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+					0,
+					0, nullptr,
+					bufferTransferCount, bufferTransfers_.data(),
+					imageTransferCount, imageTransfers_.data());
+			}
+		}
+
+		if (!pendingCopies_.empty())
+		{
+			// The copies may read what the uploads of the batch wrote
+			if (!dedicated_)
+			{
+				VkMemoryBarrier barrier{};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+				vkCmdPipelineBarrier(
+					current_.graphicsCommands,
+					VK_PIPELINE_STAGE_TRANSFER_BIT,
+					VK_PIPELINE_STAGE_TRANSFER_BIT,
+					0,
+					1, &barrier,
+					0, nullptr,
+					0, nullptr);
+			}
+
+			for (const auto& copy : pendingCopies_)
+				vkCmdCopyBuffer(current_.graphicsCommands, copy.srcBuffer, copy.dstBuffer, 1, &copy.region);
+		}
+
+		// Everything submitted to the graphics queue after the batch sees the copies, whatever stage reads them
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			current_.graphicsCommands,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0,
+			1, &barrier,
+			0, nullptr,
+			0, nullptr);
+
+		if (vkEndCommandBuffer(current_.graphicsCommands) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to record upload command buffer!");
+		}
+
+		if (dedicated_)
+		{
+			VkSubmitInfo transferInfo{};
+			transferInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			transferInfo.commandBufferCount = 1;
+			transferInfo.pCommandBuffers = &current_.transferCommands;
+			transferInfo.signalSemaphoreCount = 1;
+			transferInfo.pSignalSemaphores = &current_.copied;
+
+			if (vkQueueSubmit(device_.transferQueue(), 1, &transferInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to submit upload command buffer!");
+			}
+		}
+
+		// The graphics half goes on the graphics queue ahead of the frame, and only holds it up if the copies are not done yet
+		const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		if (dedicated_)
+		{
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &current_.copied;
+			submitInfo.pWaitDstStageMask = &waitStage;
+		}
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &current_.graphicsCommands;
+
+		if (vkQueueSubmit(device_.graphicsQueue(), 1, &submitInfo, current_.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to submit upload command buffer!");
+		}
+
+		bufferTransfers_.clear();
+		imageTransfers_.clear();
+		pendingCopies_.clear();
+	}
+
+	VkDeviceSize UploadManager::reserveStaging(VkDeviceSize size)
+	{
+		size = (size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+		assert(size <= stagingSize_ && "The staging reservation is larger than the ring");
+
+		for (;;)
+		{
+			// A reservation never wraps around the end of the ring, the bytes left at the end are skipped
+			const VkDeviceSize position = stagingHead_ % stagingSize_;
+			VkDeviceSize skipped = position + size > stagingSize_ ? stagingSize_ - position : 0;
+			// With nothing in use, the skipped bytes do not have to be given back first
+			if (stagingHead_ == stagingTail_)
+			{
+				stagingHead_ += skipped;
+				stagingTail_ = stagingHead_;
+				skipped = 0;
+			}
+			if (stagingHead_ + skipped + size - stagingTail_ <= stagingSize_)
+			{
+				stagingHead_ += skipped;
+				const VkDeviceSize offset = stagingHead_ % stagingSize_;
+				stagingHead_ += size;
+				return offset;
+			}
+
+			// The ring is full. If all of it is held by the batch being recorded, that batch has to go first.
+			if (inFlight_.empty())
+				submit();
+			retire(true);
+		}
+	}
+
+	void UploadManager::retire(bool wait)
+	{
+		while (!inFlight_.empty())
+		{
+			Batch& batch = inFlight_.front();
+			if (wait)
+			{
+				vkWaitForFences(device_.device(), 1, &batch.fence, VK_TRUE, UINT64_MAX);
+				wait = false;
+			}
+			else if (vkGetFenceStatus(device_.device(), batch.fence) != VK_SUCCESS)
+			{
+				break;
+			}
+
+			// The batches of a queue finish in the order they were submitted
+			stagingTail_ = std::max(stagingTail_, batch.stagingEnd);
+			completedTicket_ = batch.ticket;
+			freeBatches_.push_back(batch);
+			inFlight_.pop_front();
+		}
+	}
+}
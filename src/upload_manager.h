@@ -0,0 +1,156 @@
+#ifndef AITO_UPLOAD_MANAGER_H
+#define AITO_UPLOAD_MANAGER_H
+
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "memory_allocator.h"
+
+
+namespace aito
+{
+	class Device;
+
+	/// <summary>
+	/// Copies data from the host into device local buffers and images without waiting for the GPU. The data goes through a persistently
+	/// mapped ring of staging memory, and the copies are recorded into a batch that is submitted as one command buffer.
+	/// Every batch has a fence, so the staging memory it used is reused once the GPU is done with it, and callers can check
+	/// whether their copies have landed. Not thread safe: uploads are recorded by the main thread.
+	///
+	/// If the device has a dedicated transfer queue, the copies run on it, alongside the rendering. The resources they write are then
+	/// released by the transfer queue family and acquired by the graphics queue family in a second command buffer of the batch,
+	/// which waits for the copies with a semaphore. Otherwise both halves of the batch are the same command buffer on the graphics queue.
+	/// </summary>
+	class UploadManager
+	{
+	public:
+		static constexpr VkDeviceSize DEFAULT_STAGING_SIZE = 32 * 1024 * 1024;
+		// Keeps the copies aligned for any format they are copied as
+		static constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+		UploadManager(Device& device, VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+		~UploadManager();
+
+		// Not copyable or movable
+		UploadManager(const UploadManager&) = delete;
+		UploadManager& operator=(const UploadManager&) = delete;
+		UploadManager(UploadManager&&) = delete;
+		UploadManager& operator=(UploadManager&&) = delete;
+
+		/// <summary>
+		/// Records a copy of "size" bytes of "data" to "dstBuffer" at "dstOffset". The data is copied to the staging ring
+		/// right away, so it can be freed once this returns. Uploads larger than the ring are split up.
+		/// </summary>
+		void uploadToBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+		/// <summary>
+		/// Records a copy of tightly packed texel data to the first mip level of "image", which ends up in "finalLayout".
+		/// The previous contents of the image are discarded. The data has to fit in the staging ring.
+		/// </summary>
+		void uploadToImage(VkImage image, uint32_t width, uint32_t height, uint32_t layerCount, const void* data, VkDeviceSize size, VkImageLayout finalLayout);
+		/// <summary>
+		/// Records a copy between two device buffers. It runs on the graphics queue after the uploads of the batch,
+		/// since the buffers belong to the graphics queue family.
+		/// </summary>
+		void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+
+		/// <summary>
+		/// Submits the copies recorded since the last submit, if any. Commands submitted to the graphics queue after this
+		/// see the copied data. Also gives back the staging memory of the batches the GPU has finished.
+		/// </summary>
+		/// <returns>The ticket of the batch, for isComplete() and wait(). </returns>
+		uint64_t submit();
+		/// <summary>
+		/// The ticket of the copies recorded since the last submit.
+		/// </summary>
+		inline uint64_t getPendingTicket() const { return nextTicket_; }
+		bool isComplete(uint64_t ticket);
+		/// <summary>
+		/// Submits the batch of "ticket" if it is still recording, and waits for the GPU to finish it.
+		/// </summary>
+		void wait(uint64_t ticket);
+		/// <summary>
+		/// Submits the recorded copies and waits for the queues to go idle, for resources that are about to be destroyed.
+		/// </summary>
+		void waitIdle();
+
+		inline bool usesDedicatedQueue() const { return dedicated_; }
+		inline uint64_t getSubmitCount() const { return submitCount_; }
+		inline uint64_t getUploadedBytes() const { return uploadedBytes_; }
+
+	private:
+		struct Batch
+		{
+			// The copies from the staging ring, on the transfer queue
+			VkCommandBuffer transferCommands = VK_NULL_HANDLE;
+			// The acquire barriers and copies between device buffers, on the graphics queue. The same as transferCommands without a dedicated queue.
+			VkCommandBuffer graphicsCommands = VK_NULL_HANDLE;
+			// Signaled by the transfer half and waited for by the graphics half, with a dedicated queue
+			VkSemaphore copied = VK_NULL_HANDLE;
+			// Signaled once the whole batch is done
+			VkFence fence = VK_NULL_HANDLE;
+			uint64_t ticket = 0;
+			// The position of the ring up to which the batch used staging memory
+			uint64_t stagingEnd = 0;
+		};
+
+		struct PendingCopy
+		{
+			VkBuffer srcBuffer;
+			VkBuffer dstBuffer;
+			VkBufferCopy region;
+		};
+
+		Device& device_;
+		bool dedicated_;
+
+		VkCommandPool transferPool_ = VK_NULL_HANDLE;
+		// Only created with a dedicated transfer queue
+		VkCommandPool graphicsPool_ = VK_NULL_HANDLE;
+
+		VkBuffer stagingBuffer_ = VK_NULL_HANDLE;
+		MemoryAllocator::Allocation stagingMemory_{};
+		VkDeviceSize stagingSize_;
+		// Bytes ever written to and given back from the ring. The ring position is the count modulo its size.
+		uint64_t stagingHead_ = 0;
+		uint64_t stagingTail_ = 0;
+
+		// The batch being recorded, if any copies were recorded since the last submit
+		bool recording_ = false;
+		Batch current_{};
+		// The queue family ownership transfers of the resources written by the batch being recorded
+		std::vector<VkBufferMemoryBarrier> bufferTransfers_;
+		std::vector<VkImageMemoryBarrier> imageTransfers_;
+		std::vector<PendingCopy> pendingCopies_;
+		std::deque<Batch> inFlight_;
+		std::vector<Batch> freeBatches_;
+		uint64_t nextTicket_ = 1;
+		// Every batch up to this ticket is done
+		uint64_t completedTicket_ = 0;
+
+		uint64_t submitCount_ = 0;
+		uint64_t uploadedBytes_ = 0;
+
+		/// <summary>
+		/// The transfer command buffer of the batch being recorded, starting a new batch if needed.
+		/// </summary>
+		VkCommandBuffer getCommandBuffer();
+		VkCommandBuffer allocateCommandBuffer(VkCommandPool pool);
+		/// <summary>
+		/// Records the ownership transfers and the copies between device buffers, and submits the halves of the batch.
+		/// </summary>
+		void submitBatch();
+		/// <summary>
+		/// Reserves "size" bytes of the ring, retiring batches (and waiting for them if needed) until they fit.
+		/// </summary>
+		/// <returns>The offset of the reserved bytes in the staging buffer. </returns>
+		VkDeviceSize reserveStaging(VkDeviceSize size);
+		/// <summary>
+		/// Gives back the staging memory of the finished batches. With "wait" set, waits for the oldest batch first.
+		/// </summary>
+		void retire(bool wait);
+	};
+}
+
+#endif /* AITO_UPLOAD_MANAGER_H */
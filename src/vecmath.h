@@ -15,6 +15,8 @@ namespace aito
 
 // Vectors
 
+typedef glm::vec<2, Float, glm::packed_highp> Vec2f;
+typedef glm::vec<2, int, glm::packed_highp> Vec2i;
 typedef glm::vec<3, Float, glm::packed_highp> Vec3f;
 typedef glm::vec<3, int, glm::packed_highp> Vec3i;
 typedef glm::vec<4, Float, glm::packed_highp> Vec4f;
@@ -213,7 +215,7 @@ public:
 template<typename T>
 [[nodiscard]] constexpr Normal3<T> face_forward(const Normal3<T>& n, const glm::vec<3, T, glm::packed_highp>& v)
 {
-	return (dot(Normal3<T>(v), n) < static_cast<T>(0)) ? -n : n;
+	return (dot(Normal3<T>(v), n) < static_cast<T>(0)) ? Normal3<T>(-n) : n;
 }
 
 template<typename T>
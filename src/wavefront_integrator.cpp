@@ -0,0 +1,397 @@
+#include "pch.h"
+
+#include "wavefront_integrator.h"
+
+#include "parallel.h"
+#include "tile_scheduler.h"
+
+#include <algorithm>
+
+
+namespace aito
+{
+
+void WavefrontIntegrator::WorkQueue::push(const std::vector<uint32_t>& batch)
+{
+	const uint32_t offset = size.fetch_add(static_cast<uint32_t>(batch.size()), std::memory_order_relaxed);
+	std::copy(batch.begin(), batch.end(), paths.begin() + offset);
+}
+
+void WavefrontIntegrator::PathStates::resize(size_t size)
+{
+	ray_o.resize(size);
+	ray_d.resize(size);
+	beta.resize(size);
+	L.resize(size);
+	lambda.resize(size);
+	bsdf_pdf.resize(size);
+	depth.resize(size);
+	p_film.resize(size);
+	pixel.resize(size);
+	sample_index.resize(size);
+	dimension.resize(size);
+	isect.resize(size);
+}
+
+void WavefrontIntegrator::ShadowRays::resize(size_t size)
+{
+	path.resize(size);
+	ray_o.resize(size);
+	ray_d.resize(size);
+	t_max.resize(size);
+	ld.resize(size);
+}
+
+WavefrontIntegrator::WavefrontIntegrator(const PathIntegrator& integrator, int threadCount)
+	: integrator_(integrator),
+	threadCount_(threadCount > 0 ? threadCount : std::max(1, available_cores() - 1)),
+	arenas_(threadCount_)
+{}
+
+bool WavefrontIntegrator::render(
+	Film& film, const CameraFunction& camera, const Sampler& sampler, uint32_t firstSample, int sampleCount,
+	const std::atomic<bool>* cancel)
+{
+	const auto cancelled = [&]() { return cancel != nullptr && cancel->load(std::memory_order_relaxed); };
+
+	const Bounds2i sampleBounds = film.sample_bounds();
+	if (pixelOrder_.empty() || !(sampleBounds.p_min == pixelOrderBounds_.p_min && sampleBounds.p_max == pixelOrderBounds_.p_max))
+		compute_pixel_order(sampleBounds, TileScheduler::DEFAULT_TILE_SIZE);
+
+	// Every sample of every pixel is a path. Paths are numbered pixel by pixel in the pixel order.
+	const uint64_t pathCount = static_cast<uint64_t>(pixelOrder_.size()) * std::max(0, sampleCount);
+	const uint32_t maxWaveSize = static_cast<uint32_t>(std::min<uint64_t>(pathCount, MAX_WAVE_SIZE));
+	if (paths_.bsdf_pdf.size() < maxWaveSize)
+	{
+		paths_.resize(maxWaveSize);
+		for (WorkQueue& queue : rayQueues_)
+			queue.paths.resize(maxWaveSize);
+		diffuseQueue_.paths.resize(maxWaveSize);
+		sortKeys_.resize(maxWaveSize);
+		shadowRays_.resize(maxWaveSize);
+	}
+
+	progress_ = 0;
+	for (uint64_t firstPath = 0; firstPath < pathCount; firstPath += maxWaveSize)
+	{
+		const uint32_t waveSize = static_cast<uint32_t>(std::min<uint64_t>(maxWaveSize, pathCount - firstPath));
+
+		generate_camera_rays(camera, sampler, firstPath, waveSize, firstSample, sampleCount);
+
+		// Bounce all paths of the wave until none are left. Each bounce reads one ray queue and fills the other.
+		int current = 0;
+		for (int bounce = 0; rayQueues_[current].size.load() > 0; bounce++)
+		{
+			if (cancelled())
+				return false;
+
+			WorkQueue& rayQueue = rayQueues_[current];
+			WorkQueue& nextRayQueue = rayQueues_[1 - current];
+
+			// The camera rays are already coherent in tile order
+			if (bounce > 0 && sortRays_)
+				sort_rays(rayQueue);
+
+			diffuseQueue_.size = 0;
+			intersect(rayQueue);
+
+			shadowRays_.size = 0;
+			nextRayQueue.size = 0;
+			shade_diffuse(sampler, nextRayQueue);
+
+			trace_shadow_rays();
+
+			current = 1 - current;
+		}
+
+		accumulate(film, firstPath, waveSize, sampleCount);
+		progress_ = static_cast<float>(static_cast<double>(firstPath + waveSize) / pathCount);
+	}
+
+	return !cancelled();
+}
+
+MemoryArena::Stats WavefrontIntegrator::arena_stats() const
+{
+	MemoryArena::Stats total;
+	for (const MemoryArena& arena : arenas_)
+	{
+		const MemoryArena::Stats stats = arena.stats();
+		total.allocations += stats.allocations;
+		total.heap_allocations += stats.heap_allocations;
+		total.peak_bytes_used = std::max(total.peak_bytes_used, stats.peak_bytes_used);
+		total.bytes_reserved += stats.bytes_reserved;
+	}
+	return total;
+}
+
+void WavefrontIntegrator::compute_pixel_order(const Bounds2i& sampleBounds, int tileSize)
+{
+	pixelOrder_.clear();
+	tileBounds_.clear();
+	tileFirstPixel_.clear();
+
+	for (int y = sampleBounds.p_min.y; y < sampleBounds.p_max.y; y += tileSize)
+	{
+		for (int x = sampleBounds.p_min.x; x < sampleBounds.p_max.x; x += tileSize)
+		{
+			const Point2i tileMin(x, y);
+			const Point2i tileMax(std::min(x + tileSize, sampleBounds.p_max.x), std::min(y + tileSize, sampleBounds.p_max.y));
+			tileBounds_.push_back(Bounds2i(tileMin, tileMax));
+			tileFirstPixel_.push_back(static_cast<uint32_t>(pixelOrder_.size()));
+			for (const Point2i pixel : tileBounds_.back())
+				pixelOrder_.push_back(pixel);
+		}
+	}
+	tileFirstPixel_.push_back(static_cast<uint32_t>(pixelOrder_.size()));
+	pixelOrderBounds_ = sampleBounds;
+}
+
+void WavefrontIntegrator::generate_camera_rays(
+	const CameraFunction& camera, const Sampler& sampler, uint64_t firstPath, uint32_t waveSize, uint32_t firstSample, int sampleCount)
+{
+	WorkQueue& rayQueue = rayQueues_[0];
+	parallel_for(waveSize, [&](uint32_t begin, uint32_t end)
+		{
+			Sampler pathSampler = sampler;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const uint64_t path = firstPath + i;
+				const Point2i pixel = pixelOrder_[path / sampleCount];
+				const uint32_t sampleIndex = firstSample + static_cast<uint32_t>(path % sampleCount);
+
+				pathSampler.start_pixel_sample(pixel, sampleIndex);
+				const Point2f u = pathSampler.get_pixel_2d();
+				const Point2f pFilm(pixel.x + u.x, pixel.y + u.y);
+				const Ray ray = camera(pFilm);
+
+				paths_.ray_o.set(i, Vec3f(ray.o));
+				paths_.ray_d.set(i, ray.d);
+				paths_.beta[i] = SampledSpectrum(1);
+				paths_.L[i] = SampledSpectrum(0);
+				paths_.lambda[i] = SampledWavelengths::sample_visible(pathSampler.get_1d());
+				paths_.bsdf_pdf[i] = 0;
+				paths_.depth[i] = 0;
+				paths_.p_film[i] = pFilm;
+				paths_.pixel[i] = pixel;
+				paths_.sample_index[i] = sampleIndex;
+				paths_.dimension[i] = pathSampler.dimension();
+				// The paths start out in order, so they can be written directly
+				rayQueue.paths[i] = i;
+			}
+		});
+	rayQueue.size = waveSize;
+}
+
+void WavefrontIntegrator::sort_rays(WorkQueue& rayQueue)
+{
+	const Bounds3f bounds = integrator_.scene().world_bound();
+	const uint32_t queueSize = rayQueue.size.load();
+	parallel_for(queueSize, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const uint32_t path = rayQueue.paths[i];
+				sortKeys_[i] = RaySorter::sort_key(Point3f(paths_.ray_o.get(path)), paths_.ray_d.get(path), bounds);
+			}
+		});
+	raySorter_.sort(sortKeys_.data(), rayQueue.paths.data(), queueSize);
+}
+
+void WavefrontIntegrator::intersect(WorkQueue& rayQueue)
+{
+	const Scene& scene = integrator_.scene();
+	const uint32_t queueSize = rayQueue.size.load();
+	parallel_for(queueSize, [&](uint32_t begin, uint32_t end)
+		{
+			std::vector<uint32_t> hits;
+			hits.reserve(end - begin);
+			for (uint32_t packetBegin = begin; packetBegin < end; packetBegin += PACKET_SIZE)
+			{
+				const uint32_t packetSize = std::min(PACKET_SIZE, end - packetBegin);
+				RayPacket<PACKET_SIZE> packet;
+				packet.active = RayPacket<PACKET_SIZE>::ALL_RAYS >> (PACKET_SIZE - packetSize);
+				for (uint32_t j = 0; j < packetSize; j++)
+				{
+					const uint32_t path = rayQueue.paths[packetBegin + j];
+					packet.rays[j] = Ray(Point3f(paths_.ray_o.get(path)), paths_.ray_d.get(path));
+				}
+
+				SurfaceInteraction isects[PACKET_SIZE];
+				const uint32_t hitMask = scene.intersect(packet, isects);
+				for (uint32_t j = 0; j < packetSize; j++)
+				{
+					const uint32_t path = rayQueue.paths[packetBegin + j];
+					if (!(hitMask & (1u << j)))
+					{
+						const SampledSpectrum le = integrator_.escaped_radiance(paths_.depth[path], paths_.bsdf_pdf[path], paths_.lambda[path]);
+						paths_.L[path] += paths_.beta[path] * le;
+						continue;
+					}
+
+					if (paths_.depth[path] == integrator_.max_depth())
+						continue;
+
+					paths_.isect[path] = isects[j];
+					hits.push_back(path);
+				}
+			}
+			diffuseQueue_.push(hits);
+		});
+}
+
+void WavefrontIntegrator::shade_diffuse(const Sampler& sampler, WorkQueue& nextRayQueue)
+{
+	const uint32_t queueSize = diffuseQueue_.size.load();
+	parallel_for_chunks(0, queueSize, MIN_CHUNK_SIZE, threadCount_, [&](uint32_t begin, uint32_t end, int chunk)
+		{
+			MemoryArena& arena = arenas_[chunk];
+			Sampler pathSampler = sampler;
+			std::vector<uint32_t> continued;
+			continued.reserve(end - begin);
+			std::vector<uint32_t> shadowed;
+			std::vector<PathIntegrator::DirectLightSample> shadowSamples;
+			shadowed.reserve(end - begin);
+			shadowSamples.reserve(end - begin);
+
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const uint32_t path = diffuseQueue_.paths[i];
+				const SurfaceInteraction& isect = paths_.isect[path];
+				// Continue the path's sample where the last stage left it
+				pathSampler.start_pixel_sample(paths_.pixel[path], paths_.sample_index[path], paths_.dimension[path]);
+
+				const SampledWavelengths& lambda = paths_.lambda[path];
+				const DiffuseBSDF* bsdf = integrator_.get_bsdf(isect, lambda, arena);
+				SampledSpectrum beta = paths_.beta[path];
+
+				PathIntegrator::DirectLightSample direct;
+				if (integrator_.sample_direct_light(isect, *bsdf, lambda, pathSampler, &direct))
+				{
+					direct.ld *= beta;
+					shadowed.push_back(path);
+					shadowSamples.push_back(direct);
+				}
+
+				Float bsdfPdf;
+				Ray ray;
+				const bool continues = integrator_.sample_next_direction(isect, *bsdf, paths_.depth[path], pathSampler, &beta, &bsdfPdf, &ray);
+				// Nothing allocated for the hit outlives its shading
+				arena.reset();
+				if (!continues)
+					continue;
+
+				paths_.ray_o.set(path, Vec3f(ray.o));
+				paths_.ray_d.set(path, ray.d);
+				paths_.beta[path] = beta;
+				paths_.bsdf_pdf[path] = bsdfPdf;
+				paths_.depth[path]++;
+				paths_.dimension[path] = pathSampler.dimension();
+				continued.push_back(path);
+			}
+			nextRayQueue.push(continued);
+
+			// The rays towards point lights (the finite ones) are written first, so they are not mixed into packets
+			// with the incoherent rays towards the environment
+			const uint32_t offset = shadowRays_.size.fetch_add(static_cast<uint32_t>(shadowed.size()), std::memory_order_relaxed);
+			uint32_t next = offset;
+			for (const bool finite : { true, false })
+			{
+				for (uint32_t j = 0; j < shadowed.size(); j++)
+				{
+					const Ray& ray = shadowSamples[j].shadow_ray;
+					if (std::isfinite(ray.t_max) != finite)
+						continue;
+
+					shadowRays_.path[next] = shadowed[j];
+					shadowRays_.ray_o.set(next, Vec3f(ray.o));
+					shadowRays_.ray_d.set(next, ray.d);
+					shadowRays_.t_max[next] = ray.t_max;
+					shadowRays_.ld[next] = shadowSamples[j].ld;
+					next++;
+				}
+			}
+		});
+}
+
+void WavefrontIntegrator::trace_shadow_rays()
+{
+	const Scene& scene = integrator_.scene();
+	const uint32_t shadowRayCount = shadowRays_.size.load();
+	parallel_for(shadowRayCount, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t packetBegin = begin; packetBegin < end; packetBegin += PACKET_SIZE)
+			{
+				const uint32_t packetSize = std::min(PACKET_SIZE, end - packetBegin);
+				RayPacket<PACKET_SIZE> packet;
+				packet.active = RayPacket<PACKET_SIZE>::ALL_RAYS >> (PACKET_SIZE - packetSize);
+				for (uint32_t j = 0; j < packetSize; j++)
+				{
+					const uint32_t i = packetBegin + j;
+					packet.rays[j] = Ray(Point3f(shadowRays_.ray_o.get(i)), shadowRays_.ray_d.get(i), shadowRays_.t_max[i]);
+				}
+
+				const uint32_t blocked = scene.intersect_p(packet);
+				for (uint32_t j = 0; j < packetSize; j++)
+				{
+					if (blocked & (1u << j))
+						continue;
+
+					// Every path has at most one shadow ray per bounce, so no other thread writes to it
+					const uint32_t i = packetBegin + j;
+					const uint32_t path = shadowRays_.path[i];
+					paths_.L[path] += shadowRays_.ld[i];
+				}
+			}
+		});
+}
+
+void WavefrontIntegrator::accumulate(Film& film, uint64_t firstPath, uint32_t waveSize, int sampleCount) const
+{
+	const uint64_t endPath = firstPath + waveSize;
+	const auto tilePathRange = [&](uint32_t tile)
+		{
+			return std::make_pair(static_cast<uint64_t>(tileFirstPixel_[tile]) * sampleCount, static_cast<uint64_t>(tileFirstPixel_[tile + 1]) * sampleCount);
+		};
+
+	// The tiles with paths in this wave. The first and last one may only be partly covered, the rest of their paths are in the neighbouring waves.
+	const uint32_t tileCount = static_cast<uint32_t>(tileBounds_.size());
+	uint32_t firstTile = 0;
+	while (tilePathRange(firstTile).second <= firstPath)
+		firstTile++;
+	uint32_t endTile = firstTile;
+	while (endTile < tileCount && tilePathRange(endTile).first < endPath)
+		endTile++;
+
+	const int threadCount = threadCount_;
+	parallel_for_chunks(firstTile, endTile, 1, threadCount, [&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t tile = begin; tile < end; tile++)
+			{
+				std::unique_ptr<FilmTile> filmTile = film.get_film_tile(tileBounds_[tile]);
+
+				const auto [tileBegin, tileEnd] = tilePathRange(tile);
+				for (uint64_t path = std::max(tileBegin, firstPath); path < std::min(tileEnd, endPath); path++)
+				{
+					const uint32_t i = static_cast<uint32_t>(path - firstPath);
+					const Vec3f L = paths_.L[i].to_rgb(paths_.lambda[i]);
+					// Drop invalid samples instead of letting them spread through the filter
+					if (std::isnan(L.x + L.y + L.z) || std::isinf(L.x + L.y + L.z))
+						continue;
+					filmTile->add_sample(paths_.p_film[i], L);
+				}
+
+				film.merge_film_tile(*filmTile);
+			}
+		});
+}
+
+void WavefrontIntegrator::parallel_for(uint32_t count, const std::function<void(uint32_t, uint32_t)>& func) const
+{
+	parallel_for_chunks(0, count, MIN_CHUNK_SIZE, threadCount_, [&](uint32_t begin, uint32_t end, int)
+		{
+			func(begin, end);
+		});
+}
+
+}  // namespace aito
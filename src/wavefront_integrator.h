@@ -0,0 +1,196 @@
+#ifndef AITO_WAVEFRONT_INTEGRATOR_H
+#define AITO_WAVEFRONT_INTEGRATOR_H
+
+#include "aito.h"
+
+#include "film.h"
+#include "integrator.h"
+#include "memory_arena.h"
+#include "ray_sort.h"
+#include "sampler.h"
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Breadth-first version of the path integrator. Instead of following one path to its end, a whole wave of paths
+/// is kept in structure of arrays form and advanced one bounce at a time, stage by stage: generate camera rays, intersect,
+/// shade (queued per material), and trace the shadow rays. Every stage runs the same code over a long queue of paths,
+/// so the BVH stays in cache and the loops are easy to vectorize. The stages use the same steps as PathIntegrator,
+/// so a path gives the same result in both.
+/// </summary>
+class WavefrontIntegrator
+{
+public:
+	// The number of paths in flight at once. A path takes about 250 bytes of state.
+	static constexpr uint32_t MAX_WAVE_SIZE = 1 << 20;
+	// The smallest number of queue entries a thread is given in a stage
+	static constexpr uint32_t MIN_CHUNK_SIZE = 1024;
+	// Rays are traced in packets of consecutive queue entries. The camera rays of a tile and the shadow rays towards
+	// a point light are coherent enough to be culled together, the others fall back to single ray traversal.
+	static constexpr uint32_t PACKET_SIZE = 8;
+
+	// Generates the camera ray through a film position
+	using CameraFunction = std::function<Ray(const Point2f& pFilm)>;
+
+	/// <summary>
+	/// "threadCount" 0 uses all available cores but one.
+	/// </summary>
+	explicit WavefrontIntegrator(const PathIntegrator& integrator, int threadCount = 0);
+
+	WavefrontIntegrator(const WavefrontIntegrator&) = delete;
+	WavefrontIntegrator& operator=(const WavefrontIntegrator&) = delete;
+
+	/// <summary>
+	/// Renders samples [firstSample, firstSample + sampleCount) of every pixel of the film and adds them to it.
+	/// "cancel" is checked between the stages. A cancelled render leaves the film with part of the samples.
+	/// </summary>
+	/// <returns>False if the render was cancelled. </returns>
+	bool render(
+		Film& film, const CameraFunction& camera, const Sampler& sampler, uint32_t firstSample, int sampleCount,
+		const std::atomic<bool>* cancel = nullptr);
+
+	/// <summary>
+	/// The fraction of the paths of the running (or last) render that are done.
+	/// </summary>
+	[[nodiscard]] inline float progress() const { return progress_.load(); }
+
+	/// <summary>
+	/// Sorts the rays of every bounce after the camera rays by origin and direction before they are traced (see RaySorter).
+	/// Only changes the order the rays are traced in, so it can be switched during a render.
+	/// </summary>
+	inline void set_ray_sorting(bool enabled) { sortRays_ = enabled; }
+	[[nodiscard]] inline bool ray_sorting() const { return sortRays_.load(); }
+
+	/// <summary>
+	/// The counters of the shading threads' arenas, summed up (peak usage is the largest of them).
+	/// Must not be called during a render.
+	/// </summary>
+	[[nodiscard]] MemoryArena::Stats arena_stats() const;
+
+private:
+	/// <summary>
+	/// Vectors stored as one array per component.
+	/// </summary>
+	struct Vec3Array
+	{
+		std::vector<Float> x, y, z;
+
+		inline void resize(size_t size)
+		{
+			x.resize(size);
+			y.resize(size);
+			z.resize(size);
+		}
+		[[nodiscard]] inline Vec3f get(uint32_t i) const { return Vec3f(x[i], y[i], z[i]); }
+		inline void set(uint32_t i, const Vec3f& v)
+		{
+			x[i] = v.x;
+			y[i] = v.y;
+			z[i] = v.z;
+		}
+	};
+
+	/// <summary>
+	/// Paths whose next step is the same stage. Threads append to it concurrently.
+	/// </summary>
+	struct WorkQueue
+	{
+		std::vector<uint32_t> paths;
+		std::atomic<uint32_t> size{ 0 };
+
+		/// <summary>
+		/// Appends a thread's local batch of paths with a single atomic.
+		/// </summary>
+		void push(const std::vector<uint32_t>& batch);
+	};
+
+	/// <summary>
+	/// The state of every path in the wave, indexed by the path's position in the wave.
+	/// </summary>
+	struct PathStates
+	{
+		// The ray the path continues along
+		Vec3Array ray_o;
+		Vec3Array ray_d;
+		// Throughput and radiance gathered so far, at the path's wavelengths
+		std::vector<SampledSpectrum> beta;
+		std::vector<SampledSpectrum> L;
+		std::vector<SampledWavelengths> lambda;
+		// Density the last direction was sampled with
+		std::vector<Float> bsdf_pdf;
+		std::vector<uint16_t> depth;
+		std::vector<Point2f> p_film;
+		// Where the sampler continues for this path
+		std::vector<Point2i> pixel;
+		std::vector<uint32_t> sample_index;
+		std::vector<uint32_t> dimension;
+		// The hit of the last intersection stage, read by the shading stage
+		std::vector<SurfaceInteraction> isect;
+
+		void resize(size_t size);
+	};
+
+	/// <summary>
+	/// Shadow rays of the current bounce, with the light they carry if they are not blocked.
+	/// </summary>
+	struct ShadowRays
+	{
+		std::vector<uint32_t> path;
+		Vec3Array ray_o;
+		Vec3Array ray_d;
+		std::vector<Float> t_max;
+		std::vector<SampledSpectrum> ld;
+		std::atomic<uint32_t> size{ 0 };
+
+		void resize(size_t size);
+	};
+
+	const PathIntegrator& integrator_;
+	const int threadCount_;
+
+	PathStates paths_;
+	WorkQueue rayQueues_[2];
+	// Every surface is diffuse for now. More materials get a queue each, so each shading kernel runs over one material.
+	WorkQueue diffuseQueue_;
+	ShadowRays shadowRays_;
+	// Scratch memory for shading a path, one arena per thread
+	std::vector<MemoryArena> arenas_;
+
+	std::atomic<bool> sortRays_{ true };
+	RaySorter raySorter_;
+	std::vector<uint32_t> sortKeys_;
+
+	// The film pixels in the order their paths are generated in, tile by tile, so neighbouring paths start out coherent.
+	// Tile i covers pixelOrder_[tileFirstPixel_[i], tileFirstPixel_[i + 1]).
+	std::vector<Point2i> pixelOrder_;
+	std::vector<Bounds2i> tileBounds_;
+	std::vector<uint32_t> tileFirstPixel_;
+	Bounds2i pixelOrderBounds_;
+
+	std::atomic<float> progress_{ 0 };
+
+	void compute_pixel_order(const Bounds2i& sampleBounds, int tileSize);
+
+	void generate_camera_rays(const CameraFunction& camera, const Sampler& sampler, uint64_t firstPath, uint32_t waveSize, uint32_t firstSample, int sampleCount);
+	void sort_rays(WorkQueue& rayQueue);
+	void intersect(WorkQueue& rayQueue);
+	void shade_diffuse(const Sampler& sampler, WorkQueue& nextRayQueue);
+	void trace_shadow_rays();
+	void accumulate(Film& film, uint64_t firstPath, uint32_t waveSize, int sampleCount) const;
+
+	/// <summary>
+	/// Runs func(begin, end) over [0, count) split across the threads.
+	/// </summary>
+	void parallel_for(uint32_t count, const std::function<void(uint32_t, uint32_t)>& func) const;
+};
+
+}  // namespace aito
+
+
+#endif // AITO_WAVEFRONT_INTEGRATOR_H
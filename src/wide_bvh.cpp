@@ -0,0 +1,925 @@
+#include "pch.h"
+
+#include "wide_bvh.h"
+
+#include "parallel.h"
+#include "simd.h"
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+
+namespace aito
+{
+
+/// <summary>
+/// The ray data needed for the node tests, set up once per traversal.
+/// </summary>
+struct NodeRay
+{
+	float o[3];
+	float inv_dir[3];
+	// Offsets of the near and far slab of each axis into the child bounds of a node
+	uint32_t near_offset[3];
+	uint32_t far_offset[3];
+	// With a common origin (like the primary rays of a pinhole camera) the frustum is tight,
+	// and culling against it is nearly as precise as testing the rays one by one.
+	bool common_origin;
+};
+
+namespace
+{
+
+// Triangle packets per chunk when refilling them in parallel
+constexpr uint32_t MIN_REFIT_CHUNK_SIZE = 4096;
+// Smaller trees are refit on the calling thread, since starting threads would take longer
+constexpr size_t MIN_PARALLEL_REFIT_PRIMITIVES = 65536;
+
+template<int N>
+NodeRay make_node_ray(const Ray& ray)
+{
+	NodeRay nodeRay{};
+	for (int a = 0; a < 3; a++)
+	{
+		const Float invDir = 1 / ray.d[a];
+		const uint32_t dirIsNeg = invDir < 0 ? 1 : 0;
+		nodeRay.o[a] = static_cast<float>(ray.o[a]);
+		nodeRay.inv_dir[a] = static_cast<float>(invDir);
+		nodeRay.near_offset[a] = (dirIsNeg * 3 + a) * N;
+		nodeRay.far_offset[a] = ((1 - dirIsNeg) * 3 + a) * N;
+	}
+	return nodeRay;
+}
+
+/// <summary>
+/// Tests the ray against all children of the node at once. Writes the entry distance of every child to "tEntry".
+/// The far slab distances are enlarged by the same error bound as in Bounds3::intersect_p.
+/// </summary>
+/// <returns>A bit mask of the children that were hit. </returns>
+template<int N>
+inline uint32_t intersect_children(const WideBVHNode<N>& node, const NodeRay& ray, float tMax, float tEntry[N])
+{
+	const float* bounds = &node.bounds[0][0][0];
+	constexpr float errorScale = static_cast<float>(1 + 2 * gamma(3));
+
+#ifdef AITO_AVX
+	if constexpr (N == 8)
+	{
+		__m256 tNear = _mm256_setzero_ps();
+		__m256 tFar = _mm256_set1_ps(tMax);
+		for (int a = 0; a < 3; a++)
+		{
+			const __m256 o = _mm256_set1_ps(ray.o[a]);
+			const __m256 invDir = _mm256_set1_ps(ray.inv_dir[a]);
+			const __m256 tSlabNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds + ray.near_offset[a]), o), invDir);
+			const __m256 tSlabFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds + ray.far_offset[a]), o), invDir);
+			tNear = _mm256_max_ps(tNear, tSlabNear);
+			tFar = _mm256_min_ps(tFar, _mm256_mul_ps(tSlabFar, _mm256_set1_ps(errorScale)));
+		}
+		_mm256_storeu_ps(tEntry, tNear);
+		return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+	}
+#endif
+#ifdef AITO_SSE
+	if constexpr (N == 4)
+	{
+		__m128 tNear = _mm_setzero_ps();
+		__m128 tFar = _mm_set1_ps(tMax);
+		for (int a = 0; a < 3; a++)
+		{
+			const __m128 o = _mm_set1_ps(ray.o[a]);
+			const __m128 invDir = _mm_set1_ps(ray.inv_dir[a]);
+			const __m128 tSlabNear = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.near_offset[a]), o), invDir);
+			const __m128 tSlabFar = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds + ray.far_offset[a]), o), invDir);
+			tNear = _mm_max_ps(tNear, tSlabNear);
+			tFar = _mm_min_ps(tFar, _mm_mul_ps(tSlabFar, _mm_set1_ps(errorScale)));
+		}
+		_mm_storeu_ps(tEntry, tNear);
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+	}
+#endif
+
+	// Scalar fallback, for builds without the needed instruction set
+	uint32_t mask = 0;
+	for (int i = 0; i < N; i++)
+	{
+		float tNear = 0;
+		float tFar = tMax;
+		for (int a = 0; a < 3; a++)
+		{
+			tNear = std::max(tNear, (bounds[ray.near_offset[a] + i] - ray.o[a]) * ray.inv_dir[a]);
+			tFar = std::min(tFar, (bounds[ray.far_offset[a] + i] - ray.o[a]) * ray.inv_dir[a] * errorScale);
+		}
+		tEntry[i] = tNear;
+		mask |= (tNear <= tFar ? 1u : 0u) << i;
+	}
+	return mask;
+}
+
+/// <summary>
+/// Bounds on the origins and inverse directions of the rays of a packet. Every slab distance of every ray of the packet
+/// lies within the interval spanned by these bounds (interval arithmetic), so the bounds act as a frustum that whole nodes can be culled against.
+/// </summary>
+struct PacketFrustum
+{
+	float o_min[3], o_max[3];
+	float inv_dir_min[3], inv_dir_max[3];
+	uint32_t near_offset[3];
+	uint32_t far_offset[3];
+};
+
+/// <summary>
+/// Computes the frustum of the active rays of the packet.
+/// </summary>
+/// <returns>False if the rays are not coherent enough for a tight frustum: if they do not (nearly) share their origin and direction signs,
+/// if their directions are too far apart, or if a direction has a zero component. </returns>
+template<int N, int K>
+bool make_packet_frustum(const RayPacket<K>& packet, PacketFrustum* frustum)
+{
+	// The largest angle between the rays, as the cosine. Wider packets fall apart into rays that visit different parts of the tree,
+	// and the frustum grows much faster than the rays it bounds, since every axis is bounded separately.
+	constexpr Float minCosSpread = 0.9999f;
+	// The largest distance between the origins, relative to the magnitude of their coordinates.
+	// Allows camera rays that start on the near plane.
+	constexpr float maxOriginSpread = 1e-3f;
+
+	const Ray& firstRay = packet.rays[std::countr_zero(packet.active)];
+	const Vec3f firstDir = glm::normalize(firstRay.d);
+	for (int a = 0; a < 3; a++)
+	{
+		frustum->o_min[a] = frustum->o_max[a] = static_cast<float>(firstRay.o[a]);
+		frustum->inv_dir_min[a] = std::numeric_limits<float>::infinity();
+		frustum->inv_dir_max[a] = -std::numeric_limits<float>::infinity();
+	}
+
+	for (uint32_t rays = packet.active; rays != 0; rays &= rays - 1)
+	{
+		const Ray& ray = packet.rays[std::countr_zero(rays)];
+		if (glm::dot(glm::normalize(ray.d), firstDir) < minCosSpread)
+			return false;
+
+		for (int a = 0; a < 3; a++)
+		{
+			const float invDir = static_cast<float>(1 / ray.d[a]);
+			if (!std::isfinite(invDir))
+				return false;
+			frustum->o_min[a] = std::min(frustum->o_min[a], static_cast<float>(ray.o[a]));
+			frustum->o_max[a] = std::max(frustum->o_max[a], static_cast<float>(ray.o[a]));
+			frustum->inv_dir_min[a] = std::min(frustum->inv_dir_min[a], invDir);
+			frustum->inv_dir_max[a] = std::max(frustum->inv_dir_max[a], invDir);
+		}
+	}
+
+	for (int a = 0; a < 3; a++)
+	{
+		const float magnitude = std::max(std::abs(frustum->o_min[a]), std::abs(frustum->o_max[a]));
+		if (frustum->o_max[a] - frustum->o_min[a] > maxOriginSpread * (1 + magnitude))
+			return false;
+
+		// Mixed direction signs would make the inverse direction interval contain infinity
+		if (frustum->inv_dir_min[a] < 0 && frustum->inv_dir_max[a] > 0)
+			return false;
+		const uint32_t dirIsNeg = frustum->inv_dir_min[a] < 0 ? 1 : 0;
+		frustum->near_offset[a] = (dirIsNeg * 3 + a) * N;
+		frustum->far_offset[a] = ((1 - dirIsNeg) * 3 + a) * N;
+	}
+	return true;
+}
+
+/// <summary>
+/// Tests the frustum against all children of the node at once, for rays that end at "tMax" at the latest.
+/// Writes a lower bound on the entry distance of the rays into every child to "tEntry".
+/// </summary>
+/// <returns>A bit mask of the children that some ray of the packet may hit. </returns>
+template<int N>
+inline uint32_t cull_children(const WideBVHNode<N>& node, const PacketFrustum& frustum, float tMax, float tEntry[N])
+{
+	using SimdN = SimdFloat<N>;
+	const float* bounds = &node.bounds[0][0][0];
+	const SimdN errorScale = SimdN::broadcast(static_cast<float>(1 + 2 * gamma(3)));
+
+	SimdN tNear = SimdN::broadcast(0);
+	SimdN tFar = SimdN::broadcast(tMax);
+	for (int a = 0; a < 3; a++)
+	{
+		const SimdN oMin = SimdN::broadcast(frustum.o_min[a]);
+		const SimdN oMax = SimdN::broadcast(frustum.o_max[a]);
+		const SimdN invDirMin = SimdN::broadcast(frustum.inv_dir_min[a]);
+		const SimdN invDirMax = SimdN::broadcast(frustum.inv_dir_max[a]);
+
+		// (plane - o) * invDir is smallest and largest at the ends of the intervals
+		const auto slabDistances = [&](uint32_t offset, SimdN* tMin, SimdN* tMax)
+			{
+				const SimdN plane = SimdN::load(bounds + offset);
+				const SimdN d0 = plane - oMax;
+				const SimdN d1 = plane - oMin;
+				const SimdN t00 = d0 * invDirMin;
+				const SimdN t01 = d0 * invDirMax;
+				const SimdN t10 = d1 * invDirMin;
+				const SimdN t11 = d1 * invDirMax;
+				*tMin = min(min(t00, t01), min(t10, t11));
+				*tMax = max(max(t00, t01), max(t10, t11));
+			};
+
+		SimdN nearMin, nearMax, farMin, farMax;
+		slabDistances(frustum.near_offset[a], &nearMin, &nearMax);
+		slabDistances(frustum.far_offset[a], &farMin, &farMax);
+		tNear = max(tNear, nearMin);
+		tFar = min(tFar, farMax * errorScale);
+	}
+	tNear.store(tEntry);
+	return movemask(tNear <= tFar);
+}
+
+}
+
+template<int N>
+WideBVH<N>::WideBVH(std::vector<Triangle> primitives, int maxPrimsInNode, int buildThreads, BVHNodeLayout layout)
+	: layout_(layout)
+{
+	collapse(BVHAccel(std::move(primitives), maxPrimsInNode, buildThreads));
+	if (layout_ == BVHNodeLayout::Compressed)
+		compress();
+}
+
+template<int N>
+WideBVH<N>::WideBVH(const BVHAccel& bvh, BVHNodeLayout layout)
+	: layout_(layout)
+{
+	collapse(bvh);
+	if (layout_ == BVHNodeLayout::Compressed)
+		compress();
+}
+
+template<int N>
+void WideBVH<N>::collapse(const BVHAccel& bvh)
+{
+	primitives_ = bvh.primitives();
+	worldBound_ = bvh.world_bound();
+	if (bvh.nodes().empty())
+		return;
+
+	const auto startTime = std::chrono::steady_clock::now();
+
+	// Find the range of primitives below every binary node. The children always come after their parent,
+	// and the primitives of a subtree are contiguous, since the nodes and primitives are both in depth-first order.
+	const std::vector<LinearBVHNode>& binaryNodes = bvh.nodes();
+	std::vector<SubtreeRange> subtrees(binaryNodes.size());
+	for (size_t i = binaryNodes.size(); i-- > 0;)
+	{
+		const LinearBVHNode& node = binaryNodes[i];
+		if (node.n_primitives > 0)
+			subtrees[i] = { node.primitives_offset, node.n_primitives };
+		else
+			subtrees[i] = { subtrees[i + 1].first, subtrees[i + 1].count + subtrees[node.second_child_offset].count };
+	}
+
+	nodes_.reserve(binaryNodes.size() / (N - 1) + 1);
+	packets_.reserve(primitives_.size() / N + 1);
+	collapse_node(binaryNodes, subtrees, 0);
+	nodes_.shrink_to_fit();
+	packets_.shrink_to_fit();
+
+	const float collapseTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+	AITO_INFO("BVH{} created with {} nodes for {} primitives ({:.2f} MB) in {:.1f} ms",
+			  N, nodes_.size(), primitives_.size(), memory_usage() / (1024.0f * 1024.0f), collapseTime);
+}
+
+template<int N>
+uint32_t WideBVH<N>::create_leaf(const SubtreeRange& range)
+{
+	const uint32_t packetOffset = static_cast<uint32_t>(packets_.size());
+	for (uint32_t i = 0; i < range.count; i += N)
+	{
+		packets_.emplace_back();
+		packets_.back().set(primitives_, range.first + i, std::min<uint32_t>(N, range.count - i));
+	}
+	return WideBVHNode<N>::LEAF_FLAG | packetOffset;
+}
+
+template<int N>
+uint32_t WideBVH<N>::collapse_node(const std::vector<LinearBVHNode>& binaryNodes, const std::vector<SubtreeRange>& subtrees, uint32_t binaryIndex)
+{
+	// Binary subtrees that fit in one packet become a single leaf
+	const auto isLeaf = [&](uint32_t index) { return binaryNodes[index].n_primitives > 0 || subtrees[index].count <= N; };
+
+	// Gather the children of the wide node from the binary tree
+	std::array<uint32_t, N> children{};
+	int childCount = 0;
+	if (isLeaf(binaryIndex))
+	{
+		// Only happens when the whole tree is a single leaf
+		children[childCount++] = binaryIndex;
+	}
+	else
+	{
+		children[childCount++] = binaryIndex + 1;
+		children[childCount++] = binaryNodes[binaryIndex].second_child_offset;
+	}
+
+	while (childCount < N)
+	{
+		int largest = -1;
+		Float largestArea = -1;
+		for (int i = 0; i < childCount; i++)
+		{
+			const LinearBVHNode& child = binaryNodes[children[i]];
+			if (!isLeaf(children[i]) && child.bounds.surface_area() > largestArea)
+			{
+				largest = i;
+				largestArea = child.bounds.surface_area();
+			}
+		}
+		if (largest < 0)
+			break;
+
+		const uint32_t opened = children[largest];
+		children[largest] = opened + 1;
+		children[childCount++] = binaryNodes[opened].second_child_offset;
+	}
+
+	const uint32_t nodeIndex = static_cast<uint32_t>(nodes_.size());
+	nodes_.emplace_back();
+	{
+		WideBVHNode<N>& node = nodes_[nodeIndex];
+		for (int i = 0; i < N; i++)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				node.bounds[0][a][i] = std::numeric_limits<float>::infinity();
+				node.bounds[1][a][i] = -std::numeric_limits<float>::infinity();
+			}
+			node.child[i] = WideBVHNode<N>::EMPTY_CHILD;
+			node.n_packets[i] = 0;
+		}
+	}
+
+	for (int i = 0; i < childCount; i++)
+	{
+		const LinearBVHNode& child = binaryNodes[children[i]];
+
+		uint32_t childRef;
+		uint8_t packetCount = 0;
+		if (isLeaf(children[i]))
+		{
+			// The binary leaves hold at most 255 primitives (see BVHAccel), so the packet count fits in a byte
+			const uint32_t leafPackets = (subtrees[children[i]].count + N - 1) / N;
+			assert(leafPackets <= 255 && "A leaf holds too many triangle packets");
+			childRef = create_leaf(subtrees[children[i]]);
+			packetCount = static_cast<uint8_t>(leafPackets);
+		}
+		else
+		{
+			childRef = collapse_node(binaryNodes, subtrees, children[i]);
+		}
+
+		// The recursion may have reallocated the nodes
+		WideBVHNode<N>& node = nodes_[nodeIndex];
+		for (int a = 0; a < 3; a++)
+		{
+			node.bounds[0][a][i] = static_cast<float>(child.bounds.p_min[a]);
+			node.bounds[1][a][i] = static_cast<float>(child.bounds.p_max[a]);
+		}
+		node.child[i] = childRef;
+		node.n_packets[i] = packetCount;
+	}
+
+	return nodeIndex;
+}
+
+template<int N>
+void WideBVH<N>::compress()
+{
+	if (nodes_.empty())
+		return;
+
+	const auto startTime = std::chrono::steady_clock::now();
+	const size_t fullMemory = node_memory_usage();
+
+	// The full node every compressed node is made from, in breadth first order
+	std::vector<uint32_t> order;
+	order.reserve(nodes_.size());
+	order.push_back(0);
+	compressedNodes_.reserve(nodes_.size());
+	std::vector<TrianglePacket<N>> packets;
+	packets.reserve(packets_.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const WideBVHNode<N>& node = nodes_[order[i]];
+		CompressedWideBVHNode<N> compressed{};
+		quantize_bounds(node, &compressed);
+		compressed.child_base = static_cast<uint32_t>(order.size());
+		compressed.packet_base = static_cast<uint32_t>(packets.size());
+
+		for (int c = 0; c < N; c++)
+		{
+			if (node.child[c] == WideBVHNode<N>::EMPTY_CHILD)
+				continue;
+			compressed.child_mask |= static_cast<uint8_t>(1u << c);
+
+			if (node.child[c] & WideBVHNode<N>::LEAF_FLAG)
+			{
+				const uint32_t offset = node.child[c] & ~WideBVHNode<N>::LEAF_FLAG;
+				// At most N - 1 leaves of at most ceil(255 / N) packets come before this one, which always fits in a byte
+				assert(packets.size() - compressed.packet_base <= 255 && "The leaves of a BVH node hold too many triangle packets to compress it");
+				compressed.child_offset[c] = static_cast<uint8_t>(packets.size() - compressed.packet_base);
+				compressed.n_packets[c] = node.n_packets[c];
+				packets.insert(packets.end(), packets_.begin() + offset, packets_.begin() + offset + node.n_packets[c]);
+			}
+			else
+			{
+				compressed.child_offset[c] = static_cast<uint8_t>(order.size() - compressed.child_base);
+				order.push_back(node.child[c]);
+			}
+		}
+		compressedNodes_.push_back(compressed);
+	}
+
+	packets_ = std::move(packets);
+	nodes_.clear();
+	nodes_.shrink_to_fit();
+
+	const float compressTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - startTime).count();
+	AITO_INFO("BVH{} compressed: {:.2f} MB of nodes instead of {:.2f} MB ({:.2f}x smaller) in {:.1f} ms",
+			  N, node_memory_usage() / (1024.0f * 1024.0f), fullMemory / (1024.0f * 1024.0f),
+			  static_cast<float>(fullMemory) / static_cast<float>(node_memory_usage()), compressTime);
+}
+
+template<int N>
+void WideBVH<N>::quantize_bounds(const WideBVHNode<N>& node, CompressedWideBVHNode<N>* compressed)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		float nodeMin = std::numeric_limits<float>::infinity();
+		float nodeMax = -std::numeric_limits<float>::infinity();
+		for (int c = 0; c < N; c++)
+		{
+			if (node.child[c] == WideBVHNode<N>::EMPTY_CHILD)
+				continue;
+			nodeMin = std::min(nodeMin, node.bounds[0][a][c]);
+			nodeMax = std::max(nodeMax, node.bounds[1][a][c]);
+		}
+		if (nodeMin > nodeMax)
+			nodeMin = nodeMax = 0;
+
+		// The smallest power of two step for which 255 steps cover the node. The sum is rounded,
+		// so the step is made larger until the last step really reaches the maximum.
+		int exponent = -126;
+		if (nodeMax > nodeMin)
+		{
+			std::frexp((nodeMax - nodeMin) / 255.0f, &exponent);
+			exponent = std::max(exponent, -126);
+		}
+		while (exponent < 127 && nodeMin + 255.0f * std::ldexp(1.0f, exponent) < nodeMax)
+			exponent++;
+		const float scale = std::ldexp(1.0f, exponent);
+
+		compressed->origin[a] = nodeMin;
+		compressed->exponent[a] = static_cast<int8_t>(exponent);
+		for (int c = 0; c < N; c++)
+		{
+			if (node.child[c] == WideBVHNode<N>::EMPTY_CHILD)
+				continue;
+
+			// Round outwards, and check against the decoded bounds, since the decoding rounds as well
+			const float childMin = node.bounds[0][a][c];
+			const float childMax = node.bounds[1][a][c];
+			int qMin = std::clamp(static_cast<int>(std::floor((childMin - nodeMin) / scale)), 0, 255);
+			int qMax = std::clamp(static_cast<int>(std::ceil((childMax - nodeMin) / scale)), 0, 255);
+			while (qMin > 0 && nodeMin + static_cast<float>(qMin) * scale > childMin)
+				qMin--;
+			while (qMax < 255 && nodeMin + static_cast<float>(qMax) * scale < childMax)
+				qMax++;
+			compressed->q_min[a][c] = static_cast<uint8_t>(qMin);
+			compressed->q_max[a][c] = static_cast<uint8_t>(qMax);
+		}
+	}
+}
+
+template<int N>
+void WideBVH<N>::decode_node(const CompressedWideBVHNode<N>& compressed, WideBVHNode<N>* node)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		const float origin = compressed.origin[a];
+		// 2^exponent, built directly from the bits
+		const float scale = std::bit_cast<float>(static_cast<uint32_t>(compressed.exponent[a] + 127) << 23);
+		for (int c = 0; c < N; c++)
+		{
+			node->bounds[0][a][c] = origin + static_cast<float>(compressed.q_min[a][c]) * scale;
+			node->bounds[1][a][c] = origin + static_cast<float>(compressed.q_max[a][c]) * scale;
+		}
+	}
+	for (int c = 0; c < N; c++)
+	{
+		node->n_packets[c] = compressed.n_packets[c];
+		node->child[c] = compressed.n_packets[c] > 0
+			? WideBVHNode<N>::LEAF_FLAG | (compressed.packet_base + compressed.child_offset[c])
+			: compressed.child_base + compressed.child_offset[c];
+	}
+
+	// Unused slots get inverted bounds, like in the full nodes
+	for (uint32_t empty = ~static_cast<uint32_t>(compressed.child_mask) & ((1u << N) - 1); empty != 0; empty &= empty - 1)
+	{
+		const int c = std::countr_zero(empty);
+		for (int a = 0; a < 3; a++)
+		{
+			node->bounds[0][a][c] = std::numeric_limits<float>::infinity();
+			node->bounds[1][a][c] = -std::numeric_limits<float>::infinity();
+		}
+		node->child[c] = WideBVHNode<N>::EMPTY_CHILD;
+	}
+}
+
+template<int N>
+void WideBVH<N>::refit(int threadCount)
+{
+	if (empty())
+		return;
+
+	const int threads = threadCount > 0 ? threadCount : available_cores();
+	parallel_for_chunks(0, static_cast<uint32_t>(packets_.size()), MIN_REFIT_CHUNK_SIZE, threads, [&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				// The triangles of a packet are consecutive primitives, in the lanes from the first one
+				TrianglePacket<N>& packet = packets_[i];
+				uint32_t count = 0;
+				while (count < N && packet.primitive[count] != TrianglePacket<N>::INVALID_PRIMITIVE)
+					count++;
+				packet.set(primitives_, packet.primitive[0], count);
+			}
+		});
+
+	WideBVHNode<N> decoded;
+	WideBVHNode<N> root = fetch_node(0, &decoded);
+	Bounds3f childBounds[N];
+	const bool parallel = primitives_.size() >= MIN_PARALLEL_REFIT_PRIMITIVES;
+	parallel_for_chunks(0, N, 1, parallel ? threads : 1, [&](uint32_t begin, uint32_t end, int)
+		{
+			for (uint32_t c = begin; c < end; c++)
+				childBounds[c] = refit_child(root.child[c], root.n_packets[c]);
+		});
+	worldBound_ = store_refit_node(0, root, childBounds);
+}
+
+template<int N>
+Bounds3f WideBVH<N>::refit_child(uint32_t child, uint32_t packetCount)
+{
+	if (child == WideBVHNode<N>::EMPTY_CHILD)
+		return Bounds3f{};
+	if (!(child & WideBVHNode<N>::LEAF_FLAG))
+		return refit_node(child);
+
+	Bounds3f bounds{};
+	const uint32_t offset = child & ~WideBVHNode<N>::LEAF_FLAG;
+	for (uint32_t i = 0; i < packetCount; i++)
+	{
+		const TrianglePacket<N>& packet = packets_[offset + i];
+		for (int lane = 0; lane < N && packet.primitive[lane] != TrianglePacket<N>::INVALID_PRIMITIVE; lane++)
+		{
+			for (int vertex = 0; vertex < 3; vertex++)
+				bounds = bounds_union(bounds, Point3f(packet.p[vertex][0][lane], packet.p[vertex][1][lane], packet.p[vertex][2][lane]));
+		}
+	}
+	return bounds;
+}
+
+template<int N>
+Bounds3f WideBVH<N>::refit_node(uint32_t nodeIndex)
+{
+	WideBVHNode<N> decoded;
+	WideBVHNode<N> node = fetch_node(nodeIndex, &decoded);
+	Bounds3f childBounds[N];
+	for (int c = 0; c < N; c++)
+		childBounds[c] = refit_child(node.child[c], node.n_packets[c]);
+	return store_refit_node(nodeIndex, node, childBounds);
+}
+
+template<int N>
+Bounds3f WideBVH<N>::store_refit_node(uint32_t nodeIndex, WideBVHNode<N>& node, const Bounds3f childBounds[N])
+{
+	Bounds3f bounds{};
+	for (int c = 0; c < N; c++)
+	{
+		if (node.child[c] == WideBVHNode<N>::EMPTY_CHILD)
+			continue;
+		for (int a = 0; a < 3; a++)
+		{
+			node.bounds[0][a][c] = static_cast<float>(childBounds[c].p_min[a]);
+			node.bounds[1][a][c] = static_cast<float>(childBounds[c].p_max[a]);
+		}
+		bounds = bounds_union(bounds, childBounds[c]);
+	}
+
+	if (layout_ == BVHNodeLayout::Full)
+		nodes_[nodeIndex] = node;
+	else
+		quantize_bounds(node, &compressedNodes_[nodeIndex]);
+	return bounds;
+}
+
+template<int N>
+template<bool AnyHit>
+bool WideBVH<N>::traverse(const Ray& ray, SurfaceInteraction* isect) const
+{
+	if (empty())
+		return false;
+
+	const NodeRay nodeRay = make_node_ray<N>(ray);
+	const WatertightRay triangleRay(ray);
+
+	// The surface interaction is only computed once for the closest hit, after the traversal
+	PacketHit closestHit{};
+	const bool hit = traverse_subtree<AnyHit>(0, 0, ray, nodeRay, triangleRay, &closestHit);
+
+	if constexpr (!AnyHit)
+	{
+		if (hit)
+			primitives_[closestHit.primitive].compute_interaction(ray, closestHit.b0, closestHit.b1, closestHit.b2, isect);
+	}
+	return hit;
+}
+
+template<int N>
+template<bool AnyHit>
+bool WideBVH<N>::traverse_subtree(
+	uint32_t child, uint32_t packetCount, const Ray& ray, const NodeRay& nodeRay, const WatertightRay& triangleRay, PacketHit* closestHit) const
+{
+	struct StackEntry
+	{
+		uint32_t child;
+		uint32_t n_packets;
+		float t;
+	};
+	// Every level of the tree leaves at most N - 1 entries on the stack
+	StackEntry stack[64 * N];
+	int stackSize = 0;
+	stack[stackSize++] = { child, packetCount, 0 };
+
+	WideBVHNode<N> decoded;
+	bool hit = false;
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+
+		// The ray may have been shortened since the entry was pushed
+		if (entry.t > ray.t_max)
+			continue;
+
+		if (entry.child & WideBVHNode<N>::LEAF_FLAG)
+		{
+			const uint32_t offset = entry.child & ~WideBVHNode<N>::LEAF_FLAG;
+			for (uint32_t i = 0; i < entry.n_packets; i++)
+			{
+				if (intersect_packet<N, AnyHit>(packets_[offset + i], triangleRay, ray.t_max, closestHit))
+				{
+					if constexpr (AnyHit)
+						return true;
+					hit = true;
+					ray.t_max = closestHit->t;
+				}
+			}
+			continue;
+		}
+
+		const WideBVHNode<N>& node = fetch_node(entry.child, &decoded);
+		float tEntry[N];
+		uint32_t hitMask = intersect_children(node, nodeRay, static_cast<float>(ray.t_max), tEntry);
+
+		// Push the hit children sorted far to near, so the nearest one is visited next
+		const int first = stackSize;
+		while (hitMask != 0)
+		{
+			const int i = std::countr_zero(hitMask);
+			hitMask &= hitMask - 1;
+
+			const StackEntry childEntry{ node.child[i], node.n_packets[i], tEntry[i] };
+			int j = stackSize++;
+			while (j > first && stack[j - 1].t < childEntry.t)
+			{
+				stack[j] = stack[j - 1];
+				j--;
+			}
+			stack[j] = childEntry;
+		}
+	}
+
+	return hit;
+}
+
+template<int N>
+template<bool AnyHit, int K>
+uint32_t WideBVH<N>::traverse_packet(const RayPacket<K>& packet, SurfaceInteraction* isects) const
+{
+	if (empty() || packet.active == 0)
+		return 0;
+
+	NodeRay nodeRays[K];
+	WatertightRay triangleRays[K];
+	PacketHit closestHits[K];
+	for (uint32_t rays = packet.active; rays != 0; rays &= rays - 1)
+	{
+		const int r = std::countr_zero(rays);
+		nodeRays[r] = make_node_ray<N>(packet.rays[r]);
+		triangleRays[r] = WatertightRay(packet.rays[r]);
+	}
+
+	uint32_t hitRays = 0;
+	const auto traceRayByRay = [&](uint32_t child, uint32_t packetCount, uint32_t rays)
+		{
+			for (; rays != 0; rays &= rays - 1)
+			{
+				const int r = std::countr_zero(rays);
+				if (traverse_subtree<AnyHit>(child, packetCount, packet.rays[r], nodeRays[r], triangleRays[r], &closestHits[r]))
+					hitRays |= 1u << r;
+			}
+		};
+
+	// Incoherent rays are traced one by one from the start
+	PacketFrustum frustum;
+	if (!make_packet_frustum<N>(packet, &frustum))
+	{
+		traceRayByRay(0, 0, packet.active);
+	}
+	else
+	{
+		struct StackEntry
+		{
+			uint32_t child;
+			uint32_t n_packets;
+			// The rays that reached the entry
+			uint32_t rays;
+			// The smallest entry distance of those rays
+			float t;
+		};
+		StackEntry stack[64 * N];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, 0, packet.active, 0 };
+		WideBVHNode<N> decoded;
+
+		while (stackSize > 0)
+		{
+			const StackEntry entry = stack[--stackSize];
+
+			// Drop the rays that are done with: any hit rays that found a hit, and rays that found a closer hit since the entry was pushed
+			uint32_t rays = entry.rays;
+			if constexpr (AnyHit)
+				rays &= ~hitRays;
+			float tMax = 0;
+			for (uint32_t remaining = rays; remaining != 0; remaining &= remaining - 1)
+			{
+				const int r = std::countr_zero(remaining);
+				if (entry.t > packet.rays[r].t_max)
+					rays &= ~(1u << r);
+				else
+					tMax = std::max(tMax, static_cast<float>(packet.rays[r].t_max));
+			}
+			if (rays == 0)
+				continue;
+
+			// The packet has diverged, so the shared node tests would mostly be wasted
+			if (std::popcount(rays) < MIN_PACKET_RAYS)
+			{
+				traceRayByRay(entry.child, entry.n_packets, rays);
+				continue;
+			}
+
+			if (entry.child & WideBVHNode<N>::LEAF_FLAG)
+			{
+				const uint32_t offset = entry.child & ~WideBVHNode<N>::LEAF_FLAG;
+				for (uint32_t i = 0; i < entry.n_packets; i++)
+				{
+					for (uint32_t remaining = rays; remaining != 0; remaining &= remaining - 1)
+					{
+						const int r = std::countr_zero(remaining);
+						const Ray& ray = packet.rays[r];
+						if (intersect_packet<N, AnyHit>(packets_[offset + i], triangleRays[r], ray.t_max, &closestHits[r]))
+						{
+							hitRays |= 1u << r;
+							if constexpr (AnyHit)
+								rays &= ~(1u << r);
+							else
+								ray.t_max = closestHits[r].t;
+						}
+					}
+				}
+				continue;
+			}
+
+			const WideBVHNode<N>& node = fetch_node(entry.child, &decoded);
+			float frustumEntry[N];
+			const uint32_t frustumMask = cull_children(node, frustum, tMax, frustumEntry);
+			if (frustumMask == 0)
+				continue;
+
+			// Interior children that pass the frustum test get all rays of the packet. The rays are only tested one by one
+			// against leaf children, where each ray that is culled saves its triangle tests.
+			uint32_t childRays[N] = {};
+			float childT[N];
+			uint32_t rayTestMask = 0;
+			for (int i = 0; i < N; i++)
+			{
+				childT[i] = std::numeric_limits<float>::infinity();
+				if (!(frustumMask & (1u << i)))
+					continue;
+				if (node.child[i] & WideBVHNode<N>::LEAF_FLAG)
+				{
+					rayTestMask |= 1u << i;
+				}
+				else
+				{
+					childRays[i] = rays;
+					childT[i] = frustumEntry[i];
+				}
+			}
+			if (rayTestMask != 0)
+			{
+				for (uint32_t remaining = rays; remaining != 0; remaining &= remaining - 1)
+				{
+					const int r = std::countr_zero(remaining);
+					float tEntry[N];
+					uint32_t hitMask = intersect_children(node, nodeRays[r], static_cast<float>(packet.rays[r].t_max), tEntry) & rayTestMask;
+					for (; hitMask != 0; hitMask &= hitMask - 1)
+					{
+						const int i = std::countr_zero(hitMask);
+						childRays[i] |= 1u << r;
+						childT[i] = std::min(childT[i], tEntry[i]);
+					}
+				}
+			}
+
+			// Push the hit children sorted far to near, like the single ray traversal
+			const int first = stackSize;
+			for (int i = 0; i < N; i++)
+			{
+				if (childRays[i] == 0)
+					continue;
+
+				const StackEntry childEntry{ node.child[i], node.n_packets[i], childRays[i], childT[i] };
+				int j = stackSize++;
+				while (j > first && stack[j - 1].t < childEntry.t)
+				{
+					stack[j] = stack[j - 1];
+					j--;
+				}
+				stack[j] = childEntry;
+			}
+		}
+	}
+
+	if constexpr (!AnyHit)
+	{
+		for (uint32_t rays = hitRays; rays != 0; rays &= rays - 1)
+		{
+			const int r = std::countr_zero(rays);
+			const PacketHit& hit = closestHits[r];
+			primitives_[hit.primitive].compute_interaction(packet.rays[r], hit.b0, hit.b1, hit.b2, &isects[r]);
+		}
+	}
+	return hitRays;
+}
+
+template<int N>
+bool WideBVH<N>::intersect(const Ray& ray, SurfaceInteraction* isect) const
+{
+	return traverse<false>(ray, isect);
+}
+
+template<int N>
+bool WideBVH<N>::intersect_p(const Ray& ray) const
+{
+	return traverse<true>(ray, nullptr);
+}
+
+template<int N>
+template<int K>
+uint32_t WideBVH<N>::intersect(const RayPacket<K>& packet, SurfaceInteraction* isects) const
+{
+	return traverse_packet<false, K>(packet, isects);
+}
+
+template<int N>
+template<int K>
+uint32_t WideBVH<N>::intersect_p(const RayPacket<K>& packet) const
+{
+	return traverse_packet<true, K>(packet, nullptr);
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+template uint32_t WideBVH<4>::intersect(const RayPacket8&, SurfaceInteraction*) const;
+template uint32_t WideBVH<4>::intersect(const RayPacket16&, SurfaceInteraction*) const;
+template uint32_t WideBVH<8>::intersect(const RayPacket8&, SurfaceInteraction*) const;
+template uint32_t WideBVH<8>::intersect(const RayPacket16&, SurfaceInteraction*) const;
+template uint32_t WideBVH<4>::intersect_p(const RayPacket8&) const;
+template uint32_t WideBVH<4>::intersect_p(const RayPacket16&) const;
+template uint32_t WideBVH<8>::intersect_p(const RayPacket8&) const;
+template uint32_t WideBVH<8>::intersect_p(const RayPacket16&) const;
+
+}  // namespace aito
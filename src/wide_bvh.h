@@ -0,0 +1,246 @@
+#ifndef AITO_WIDE_BVH_H
+#define AITO_WIDE_BVH_H
+
+#include "aito.h"
+
+#include "bvh.h"
+#include "ray_packet.h"
+#include "triangle_packet.h"
+
+#include <vector>
+
+
+namespace aito
+{
+
+/// <summary>
+/// Node of a BVH with up to N children. The child bounds are stored as structure of arrays,
+/// so a ray is tested against all children at once with one SIMD instruction per slab.
+/// </summary>
+template<int N>
+struct alignas(N * sizeof(float)) WideBVHNode
+{
+	static constexpr uint32_t LEAF_FLAG = 0x80000000u;
+	static constexpr uint32_t EMPTY_CHILD = 0xffffffffu;
+
+	// bounds[0] holds the minimum and bounds[1] the maximum corner of each child, per axis
+	float bounds[2][3][N];
+	// Index of the child node for interior children, LEAF_FLAG | offset of the first triangle packet for leaves,
+	// or EMPTY_CHILD for unused slots. Unused slots have inverted bounds, so they are never hit.
+	uint32_t child[N];
+	// Number of triangle packets in each leaf child
+	uint8_t n_packets[N];
+};
+#ifndef AITO_FLOAT_AS_DOUBLE
+static_assert(sizeof(WideBVHNode<4>) == 128, "WideBVHNode<4> should fill two cache lines");
+static_assert(sizeof(WideBVHNode<8>) == 256, "WideBVHNode<8> should fill four cache lines");
+#endif
+
+/// <summary>
+/// Node of a BVH with up to N children, with the child bounds quantized to 8 bits per plane relative to the bounds of the node.
+/// The quantized bounds are rounded outwards, so they always contain the exact ones: a ray may visit a few more children,
+/// but never misses one. The interior children of a node are consecutive nodes, and the triangle packets of its leaf children
+/// are consecutive packets, so the children are stored as one base index and 8 bit offsets.
+/// About 3x smaller than a WideBVHNode, for scenes where the memory of the BVH matters more than the cost of decoding the nodes.
+/// </summary>
+template<int N>
+struct alignas(8) CompressedWideBVHNode
+{
+	// The minimum corner of the node, and the power of two exponent of the size of one quantization step, per axis
+	float origin[3];
+	int8_t exponent[3];
+	// Bit i is set if child slot i is used
+	uint8_t child_mask;
+	// The index of the first interior child node, and the offset of the first triangle packet of the leaf children
+	uint32_t child_base;
+	uint32_t packet_base;
+	// Offset of each child from child_base (interior children) or packet_base (leaf children)
+	uint8_t child_offset[N];
+	// Number of triangle packets in each leaf child, 0 for interior children
+	uint8_t n_packets[N];
+	// The child bounds are origin + q * 2^exponent, per axis
+	uint8_t q_min[3][N];
+	uint8_t q_max[3][N];
+};
+static_assert(sizeof(CompressedWideBVHNode<4>) == 56, "CompressedWideBVHNode<4> should be less than a cache line");
+static_assert(sizeof(CompressedWideBVHNode<8>) == 88, "CompressedWideBVHNode<8> should be less than two cache lines");
+
+/// <summary>
+/// How a WideBVH stores its nodes. Can be chosen per scene: compressed nodes save most of the memory of the nodes,
+/// and traversal pays for it by decoding every node it visits.
+/// </summary>
+enum class BVHNodeLayout
+{
+	Full,
+	Compressed,
+};
+
+// The per ray setup of the node tests, defined with the traversal
+struct NodeRay;
+
+/// <summary>
+/// BVH with a branching factor of N (4 or 8), made by collapsing the binary SAH BVH.
+/// Traversal tests all child boxes of a node at once using SSE (BVH4) or AVX (BVH8), and visits the hit children front to back.
+/// The leaves hold N wide triangle packets, and binary subtrees with at most N triangles are merged into a single packet.
+/// </summary>
+template<int N>
+class WideBVH
+{
+public:
+	static_assert(N == 4 || N == 8, "Only 4 and 8 wide BVHs are supported");
+
+	// Subtrees that fewer rays of a packet reach are traversed ray by ray
+	static constexpr int MIN_PACKET_RAYS = 2;
+
+	/// <summary>
+	/// Builds a binary BVH over the primitives, and collapses it.
+	/// </summary>
+	WideBVH(std::vector<Triangle> primitives, int maxPrimsInNode = 4, int buildThreads = 0, BVHNodeLayout layout = BVHNodeLayout::Full);
+	/// <summary>
+	/// Collapses an already built binary BVH. The primitives are copied, so the binary BVH does not have to be kept around.
+	/// </summary>
+	explicit WideBVH(const BVHAccel& bvh, BVHNodeLayout layout = BVHNodeLayout::Full);
+
+	WideBVH(const WideBVH&) = delete;
+	WideBVH& operator=(const WideBVH&) = delete;
+
+	[[nodiscard]] Bounds3f world_bound() const { return worldBound_; }
+
+	/// <summary>
+	/// Updates the BVH after the vertices of its meshes moved, without changing the topology: the triangle packets
+	/// are refilled from the meshes, and the node bounds are recomputed bottom up, with the subtrees below the root in parallel.
+	/// The tree gets slower as the triangles move away from where it was built for, so large deformations need a new build.
+	/// </summary>
+	void refit(int threadCount = 0);
+
+	/// <summary>
+	/// Finds the closest intersection along the ray. On a hit "ray.t_max" is set to the distance of the hit and "isect" is filled in.
+	/// </summary>
+	bool intersect(const Ray& ray, SurfaceInteraction* isect) const;
+	/// <summary>
+	/// Checks if the ray hits anything before "ray.t_max". Terminates at the first hit found (any-hit query).
+	/// </summary>
+	[[nodiscard]] bool intersect_p(const Ray& ray) const;
+
+	/// <summary>
+	/// Finds the closest intersection of every active ray of the packet, like "intersect" does for a single ray.
+	/// The hit of ray i is written to isects[i].
+	/// </summary>
+	/// <returns>A bit mask of the rays that hit something. </returns>
+	template<int K>
+	uint32_t intersect(const RayPacket<K>& packet, SurfaceInteraction* isects) const;
+	/// <summary>
+	/// Checks which of the active rays of the packet hit anything before their "t_max".
+	/// </summary>
+	/// <returns>A bit mask of the rays that are blocked. </returns>
+	template<int K>
+	[[nodiscard]] uint32_t intersect_p(const RayPacket<K>& packet) const;
+
+	[[nodiscard]] inline BVHNodeLayout layout() const { return layout_; }
+	// Only one of the node arrays is used, depending on the layout
+	[[nodiscard]] inline const std::vector<WideBVHNode<N>>& nodes() const { return nodes_; }
+	[[nodiscard]] inline const std::vector<CompressedWideBVHNode<N>>& compressed_nodes() const { return compressedNodes_; }
+	[[nodiscard]] inline const std::vector<Triangle>& primitives() const { return primitives_; }
+	[[nodiscard]] inline const std::vector<TrianglePacket<N>>& packets() const { return packets_; }
+	[[nodiscard]] inline size_t node_memory_usage() const
+	{
+		return nodes_.size() * sizeof(WideBVHNode<N>) + compressedNodes_.size() * sizeof(CompressedWideBVHNode<N>);
+	}
+	[[nodiscard]] inline size_t memory_usage() const
+	{
+		return node_memory_usage() + packets_.size() * sizeof(TrianglePacket<N>) + primitives_.size() * sizeof(Triangle);
+	}
+
+private:
+	Bounds3f worldBound_{};
+	BVHNodeLayout layout_;
+	std::vector<Triangle> primitives_;
+	std::vector<WideBVHNode<N>> nodes_;
+	std::vector<CompressedWideBVHNode<N>> compressedNodes_;
+	std::vector<TrianglePacket<N>> packets_;
+
+	// The range of primitives below each binary node, only used while collapsing
+	struct SubtreeRange
+	{
+		uint32_t first;
+		uint32_t count;
+	};
+
+	void collapse(const BVHAccel& bvh);
+
+	/// <summary>
+	/// Creates the wide node for the binary node at "binaryIndex", by repeatedly replacing the child with the largest
+	/// surface area with its own children, until the node is full or only leaves are left.
+	/// </summary>
+	/// <returns>The index of the created node. </returns>
+	uint32_t collapse_node(const std::vector<LinearBVHNode>& binaryNodes, const std::vector<SubtreeRange>& subtrees, uint32_t binaryIndex);
+
+	/// <summary>
+	/// Packs the primitives of a leaf into triangle packets.
+	/// </summary>
+	/// <returns>LEAF_FLAG | the offset of the first packet. </returns>
+	uint32_t create_leaf(const SubtreeRange& range);
+
+	/// <summary>
+	/// Replaces the full nodes with compressed ones. The nodes are renumbered breadth first, so the interior children
+	/// of every node are consecutive, and the packets are reordered so the packets of the leaf children of a node are consecutive.
+	/// </summary>
+	void compress();
+	/// <summary>
+	/// Quantizes the child bounds of the node relative to their union, rounding outwards.
+	/// </summary>
+	static void quantize_bounds(const WideBVHNode<N>& node, CompressedWideBVHNode<N>* compressed);
+
+	[[nodiscard]] inline bool empty() const { return nodes_.empty() && compressedNodes_.empty(); }
+	/// <summary>
+	/// The node at "index". Compressed nodes are decoded into "decoded", so the traversal is the same for both layouts.
+	/// </summary>
+	[[nodiscard]] inline const WideBVHNode<N>& fetch_node(uint32_t index, WideBVHNode<N>* decoded) const
+	{
+		if (layout_ == BVHNodeLayout::Full)
+			return nodes_[index];
+		decode_node(compressedNodes_[index], decoded);
+		return *decoded;
+	}
+	static void decode_node(const CompressedWideBVHNode<N>& compressed, WideBVHNode<N>* node);
+
+	/// <summary>
+	/// Refits the subtree below the given child reference.
+	/// </summary>
+	/// <returns>The new bounds of the child. </returns>
+	Bounds3f refit_child(uint32_t child, uint32_t packetCount);
+	Bounds3f refit_node(uint32_t nodeIndex);
+	/// <summary>
+	/// Writes the refit child bounds into the node, in the layout of the tree.
+	/// </summary>
+	/// <returns>The bounds of the node. </returns>
+	Bounds3f store_refit_node(uint32_t nodeIndex, WideBVHNode<N>& node, const Bounds3f childBounds[N]);
+
+	template<bool AnyHit>
+	bool traverse(const Ray& ray, SurfaceInteraction* isect) const;
+	/// <summary>
+	/// Traverses the subtree below the given child reference with a single ray, and updates "closestHit" and "ray.t_max" on closer hits.
+	/// </summary>
+	template<bool AnyHit>
+	bool traverse_subtree(
+		uint32_t child, uint32_t packetCount, const Ray& ray, const NodeRay& nodeRay, const WatertightRay& triangleRay, PacketHit* closestHit) const;
+
+	/// <summary>
+	/// Traverses the tree with a whole packet. Packets whose rays do not share their direction signs are traced ray by ray,
+	/// and so are the subtrees only a few rays of the packet reach.
+	/// </summary>
+	/// <returns>A bit mask of the rays that hit something. </returns>
+	template<bool AnyHit, int K>
+	uint32_t traverse_packet(const RayPacket<K>& packet, SurfaceInteraction* isects) const;
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+extern template class WideBVH<4>;
+extern template class WideBVH<8>;
+
+}  // namespace aito
+
+
+#endif // AITO_WIDE_BVH_H